@@ -0,0 +1,62 @@
+/* Copyright (c) 2025 Michael Spears.
+* For information on usage and redistribution, and for a DISCLAIMER OF ALL
+* WARRANTIES, see the file, "LICENSE.txt," in this distribution.  */
+
+#include "m5_bitcoder.h"
+
+/*
+
+	fixed predictors and Rice parameters for the FLAC encoder and the
+	compressed sample cache
+
+*/
+
+int m5_fixed_order(const int32_t *x, int n, int maxorder)
+{
+	uint64_t sum[M5_FIXEDMAXORDER + 1] = {0, 0, 0, 0, 0};
+	int i, order;
+	if (maxorder > M5_FIXEDMAXORDER)
+		maxorder = M5_FIXEDMAXORDER;
+		// the residuals of each order, as differences of the last
+	for (i = (maxorder > 3 ? maxorder : 3); i < n; i++)
+	{
+		int64_t e0 = x[i], e1 = e0 - x[i-1],
+			e2 = e1 - ((int64_t)x[i-1] - x[i-2]),
+			e3 = e2 - ((int64_t)x[i-1] - 2 * (int64_t)x[i-2] + x[i-3]),
+			e4 = (maxorder < 4 ? 0 : e3 - ((int64_t)x[i-1] -
+				3 * (int64_t)x[i-2] + 3 * (int64_t)x[i-3] - x[i-4]));
+		sum[0] += (e0 < 0 ? -e0 : e0);
+		sum[1] += (e1 < 0 ? -e1 : e1);
+		sum[2] += (e2 < 0 ? -e2 : e2);
+		sum[3] += (e3 < 0 ? -e3 : e3);
+		sum[4] += (e4 < 0 ? -e4 : e4);
+	}
+	for (order = 0, i = 1; i <= maxorder; i++)
+		if (sum[i] < sum[order])
+			order = i;
+	return order;
+}
+
+void m5_fixed_residual(const int32_t *x, int n, int order, int32_t *res)
+{
+	int i;
+	for (i = order; i < n; i++)
+		res[i] = (int32_t)(x[i] - m5_fixed_predict(x, i, order));
+}
+
+int m5_rice_param(const int32_t *res, int start, int end, uint64_t *bits)
+{
+	uint64_t u = 0, best = (uint64_t)-1;
+	int i, k, bestk = 0;
+	for (i = start; i < end; i++)
+		u += ((uint32_t)res[i] << 1) ^ (uint32_t)(res[i] >> 31);
+		// n * (k + 1) + (sum >> k) is an upper bound
+	for (k = 0; k <= 30; k++)
+	{
+		uint64_t b = (uint64_t)(end - start) * (k + 1) + (u >> k);
+		if (b < best)
+			best = b, bestk = k;
+	}
+	*bits = best;
+	return bestk;
+}
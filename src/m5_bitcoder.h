@@ -0,0 +1,105 @@
+/* Copyright (c) 2025 Michael Spears.
+* For information on usage and redistribution, and for a DISCLAIMER OF ALL
+* WARRANTIES, see the file, "LICENSE.txt," in this distribution.  */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The lossless coding that the FLAC encoder (m5_soundfile_flac.c) and the
+// compressed sample cache (m5_samplecache.c) share: a big-endian bit
+// writer, Rice codes, and FLAC's fixed polynomial predictors of orders 0
+// to M5_FIXEDMAXORDER. The writer and the predictor are defined here so
+// that they inline into the coders' per-sample loops.
+
+#define M5_FIXEDMAXORDER 4
+
+	// big-endian bit fields; w_pos stops at w_size and sets w_full
+typedef struct _m5BitWriter
+{
+	unsigned char *w_buf;
+	size_t w_size;
+	size_t w_pos;              // bytes written
+	uint64_t w_acc;            // pending bits, the low w_nacc ones
+	int w_nacc;                // always < 8 between calls
+	int w_full;
+} t_m5BitWriter;
+
+static inline void m5_bitwriter_init(t_m5BitWriter *w, unsigned char *buf,
+	size_t size)
+{
+	w->w_buf = buf;
+	w->w_size = size;
+	w->w_pos = 0;
+	w->w_acc = 0;
+	w->w_nacc = 0;
+	w->w_full = 0;
+}
+
+	// write the low n bits of v, n <= 32
+static inline void m5_bitwriter_put(t_m5BitWriter *w, uint32_t v, int n)
+{
+	if (!n)
+		return;
+	w->w_acc = (w->w_acc << n) | (v & (uint32_t)((1ULL << n) - 1));
+	w->w_nacc += n;
+	while (w->w_nacc >= 8)
+	{
+		w->w_nacc -= 8;
+		if (w->w_pos == w->w_size)
+		{
+			w->w_full = 1;
+			return;
+		}
+		w->w_buf[w->w_pos++] = (unsigned char)(w->w_acc >> w->w_nacc);
+	}
+}
+
+	// zero pad to the next byte boundary
+static inline void m5_bitwriter_align(t_m5BitWriter *w)
+{
+	if (w->w_nacc)
+		m5_bitwriter_put(w, 0, 8 - w->w_nacc);
+}
+
+	// write r as a Rice code with parameter k, after folding its sign
+	// into the lowest bit
+static inline void m5_bitwriter_rice(t_m5BitWriter *w, int32_t r, int k)
+{
+	uint32_t u = ((uint32_t)r << 1) ^ (uint32_t)(r >> 31), q = u >> k;
+	if (q + 1 + k <= 32)
+		m5_bitwriter_put(w, (1u << k) | (u & ((1u << k) - 1)), q + 1 + k);
+	else
+	{
+		for (; q >= 32; q -= 32)
+			m5_bitwriter_put(w, 0, 32);
+		m5_bitwriter_put(w, 1, q + 1);
+		m5_bitwriter_put(w, u, k);
+	}
+}
+
+	// the fixed predictor of the given order's guess for x[i], i >= order
+static inline int64_t m5_fixed_predict(const int32_t *x, int i, int order)
+{
+	switch (order)
+	{
+		case 0: return 0;
+		case 1: return x[i-1];
+		case 2: return 2 * (int64_t)x[i-1] - x[i-2];
+		case 3: return 3 * ((int64_t)x[i-1] - x[i-2]) + x[i-3];
+		default: return 4 * ((int64_t)x[i-1] + x[i-3]) -
+			6 * (int64_t)x[i-2] - x[i-4];
+	}
+}
+
+// the order, up to maxorder, whose residual over n samples is smallest,
+// judged from the samples after the first max(maxorder, 3)
+int m5_fixed_order(const int32_t *x, int n, int maxorder);
+
+// res[order...n-1] = the residual of x under that order's predictor
+void m5_fixed_residual(const int32_t *x, int n, int order, int32_t *res);
+
+// the Rice parameter (up to 30) that codes res[start...end-1] in the
+// fewest bits, and that many bits, as estimated from the residuals' sum
+int m5_rice_param(const int32_t *res, int start, int end, uint64_t *bits);
@@ -0,0 +1,144 @@
+/* Copyright (c) 2025 Michael Spears.
+* For information on usage and redistribution, and for a DISCLAIMER OF ALL
+* WARRANTIES, see the file, "LICENSE.txt," in this distribution.  */
+
+#include <string.h>
+#include <pthread.h>
+#include "m5_checksum.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define M5_CRC32C_SSE42
+#include <nmmintrin.h>
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#define M5_CRC32C_ARM
+#include <arm_acle.h>
+#endif
+
+/*
+
+	CRC-32C for m5_writesf~ -checksum and m5_readsf~ open -verify
+
+*/
+
+#define CRC32C_POLY 0x82f63b78 /* reflected */
+
+	// built once, by whichever thread first asks for a CRC
+static uint32_t m5_crc32c_table[8][256];
+static pthread_once_t m5_crc32c_once = PTHREAD_ONCE_INIT;
+#ifdef M5_CRC32C_SSE42
+static int m5_crc32c_hassse42;
+#endif
+
+static void m5_crc32c_init(void)
+{
+	uint32_t c;
+	int i, j;
+	for (i = 0; i < 256; i++)
+	{
+		c = i;
+		for (j = 0; j < 8; j++)
+			c = (c & 1 ? (c >> 1) ^ CRC32C_POLY : c >> 1);
+		m5_crc32c_table[0][i] = c;
+	}
+	for (i = 0; i < 256; i++)
+		for (j = 1, c = m5_crc32c_table[0][i]; j < 8; j++)
+			m5_crc32c_table[j][i] = c =
+				(c >> 8) ^ m5_crc32c_table[0][c & 0xff];
+#ifdef M5_CRC32C_SSE42
+	m5_crc32c_hassse42 = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+	// slicing-by-8 over a little endian load of each 8 bytes
+static uint32_t m5_crc32c_sw(uint32_t crc, const unsigned char *p, size_t n)
+{
+	const uint32_t (*t)[256] = (const uint32_t (*)[256])m5_crc32c_table;
+	while (n >= 8)
+	{
+		uint32_t lo = crc ^ ((uint32_t)p[0] | (uint32_t)p[1] << 8 |
+				(uint32_t)p[2] << 16 | (uint32_t)p[3] << 24),
+			hi = (uint32_t)p[4] | (uint32_t)p[5] << 8 |
+				(uint32_t)p[6] << 16 | (uint32_t)p[7] << 24;
+		crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^
+			t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24] ^
+			t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^
+			t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+		p += 8;
+		n -= 8;
+	}
+	while (n--)
+		crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xff];
+	return crc;
+}
+
+#ifdef M5_CRC32C_SSE42
+
+__attribute__((target("sse4.2")))
+static uint32_t m5_crc32c_sse42(uint32_t crc, const unsigned char *p,
+	size_t n)
+{
+#ifdef __x86_64__
+	uint64_t c = crc;
+	while (n >= 8)
+	{
+		uint64_t v;
+		memcpy(&v, p, 8);
+		c = _mm_crc32_u64(c, v);
+		p += 8;
+		n -= 8;
+	}
+	crc = (uint32_t)c;
+#endif
+	while (n >= 4)
+	{
+		uint32_t v;
+		memcpy(&v, p, 4);
+		crc = _mm_crc32_u32(crc, v);
+		p += 4;
+		n -= 4;
+	}
+	while (n--)
+		crc = _mm_crc32_u8(crc, *p++);
+	return crc;
+}
+
+#endif /* M5_CRC32C_SSE42 */
+
+#ifdef M5_CRC32C_ARM
+
+static uint32_t m5_crc32c_arm(uint32_t crc, const unsigned char *p, size_t n)
+{
+	while (n >= 8)
+	{
+		uint64_t v;
+		memcpy(&v, p, 8);
+		crc = __crc32cd(crc, v);
+		p += 8;
+		n -= 8;
+	}
+	while (n--)
+		crc = __crc32cb(crc, *p++);
+	return crc;
+}
+
+#endif /* M5_CRC32C_ARM */
+
+uint32_t m5_crc32c(uint32_t crc, const void *buf, size_t size)
+{
+	const unsigned char *p = (const unsigned char *)buf;
+	crc = ~crc;
+#if defined(M5_CRC32C_ARM)
+	crc = m5_crc32c_arm(crc, p, size);
+#else
+	pthread_once(&m5_crc32c_once, m5_crc32c_init);
+#if defined(M5_CRC32C_SSE42)
+	if (m5_crc32c_hassse42)
+		crc = m5_crc32c_sse42(crc, p, size);
+	else
+#endif
+	crc = m5_crc32c_sw(crc, p, size);
+#endif
+	return ~crc;
+}
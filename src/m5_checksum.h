@@ -0,0 +1,18 @@
+/* Copyright (c) 2025 Michael Spears.
+* For information on usage and redistribution, and for a DISCLAIMER OF ALL
+* WARRANTIES, see the file, "LICENSE.txt," in this distribution.  */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// CRC-32C (Castagnoli), as used by iSCSI, ext4 and others. Uses the CPU's
+// CRC32 instructions where there are any (SSE 4.2 on x86, checked at run
+// time, and the ARMv8 CRC extension when compiled for it), otherwise a
+// slicing-by-8 table.
+//
+// Start with crc = 0 and pass the result back in to continue over more
+// data: m5_crc32c(m5_crc32c(0, a, n), b, m) == CRC of a followed by b.
+
+uint32_t m5_crc32c(uint32_t crc, const void *buf, size_t size);
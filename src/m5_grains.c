@@ -0,0 +1,801 @@
+/* Copyright (c) 2025 Michael Spears.
+* For information on usage and redistribution, and for a DISCLAIMER OF ALL
+* WARRANTIES, see the file, "LICENSE.txt," in this distribution.  */
+
+#include <m_pd.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <pthread.h>
+#include "m5_soundfile.h"
+#include "m5_grains.h"
+#include "m5_timeanchor.h"
+#include "g_canvas.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/*
+
+	granular playback of long files through a block cache
+
+*/
+
+#define GRAINSPOLL 50 /* msec between looks for the result of an "open" */
+
+#define GRAINSMAXCHANS 64
+
+#define GRAINSDEFLEAD 50 /* msec ahead a grain without "at" starts */
+
+#define GRAINSWINSIZE 2048 /* points in the window table */
+
+#define BLOCK_EMPTY 0   /* holds nothing */
+#define BLOCK_WANTED 1  /* a grain waits for it, no thread has taken it yet */
+#define BLOCK_LOADING 2 /* a thread is reading it */
+#define BLOCK_READY 3   /* in RAM */
+
+#define GRAINSMAXLENGTH ((M5_GRAINS_MAXBLOCKS - 1) * M5_GRAINS_BLOCK)
+
+	/* the Hann window, GRAINSWINSIZE points and the closing 0 */
+static t_sample m5_grains_hann[GRAINSWINSIZE + 1];
+
+typedef struct _m5GrainBlock
+{
+	long b_block;         /* block of the file it holds, or -1 */
+	int b_state;          /* BLOCK_... */
+	int b_stale;          /* LOADING for a file that "open" has replaced */
+	int b_users;          /* grains waiting for it or playing from it */
+	double b_deadline;    /* while WANTED: when its first grain starts */
+	double b_used;        /* timeline frame its last grain let go */
+	t_sample *b_data;     /* M5_GRAINS_BLOCK frames, channel after channel */
+} t_m5GrainBlock;
+
+	/** what the object shares with its I/O threads, freed by whichever
+		of them lets go last */
+typedef struct _m5GrainCache
+{
+	pthread_mutex_t c_mutex;
+	pthread_cond_t c_cond;        /* wakes the I/O threads */
+	int c_refcount;               /* the object's and each thread's */
+	int c_quit;
+	int c_nchannels;              /* the object's */
+	char c_path[MAXPDSTRING];     /* the file to read, "" for none */
+	int c_serial;                 /* bumped by each "open" */
+	int c_openserial;             /* the "open" a thread has finished */
+	int c_openerror;              /* its errno, or 0 */
+	size_t c_nframes;             /* the file's length, without an error */
+	long c_reads;                 /* blocks read, for "print" */
+	long c_readerrors;            /* of those, ones that came up short */
+	t_m5GrainBlock c_blocks[M5_GRAINS_NBLOCKS];
+} t_m5GrainCache;
+
+typedef struct _m5Grain
+{
+	double g_start;       /* timeline frame it starts at */
+	size_t g_pos;         /* file frame it starts at */
+	size_t g_length;      /* frames */
+	t_sample g_gain;
+	int g_playing;        /* its blocks were all there in time */
+	int g_nblocks;
+	t_m5GrainBlock *g_blocks[M5_GRAINS_MAXBLOCKS];
+} t_m5Grain;
+
+static t_class *m5_grains_class;
+
+typedef struct _m5Grains
+{
+	t_object x_obj;
+	t_canvas *x_canvas;
+	int x_nchannels;
+	t_sample **x_outvec;
+	t_outlet *x_infoout;
+	t_clock *x_clock;             /* polls for the result of "open" */
+	t_symbol *x_filename;
+	t_m5GrainCache *x_cache;
+	t_m5Grain *x_grains;          /* M5_GRAINS_MAX, the first x_ngrains in use */
+	int x_ngrains;
+	t_sample *x_win;              /* one grain's window for a DSP call */
+	int x_vecsize;
+	double x_lead;                /* msec */
+	t_symbol *x_timeanchorname;
+	t_m5TimeAnchor *x_timeanchor;
+	double x_localanchor;         /* logical time at creation */
+	double x_lastlogicaltime;     /* of the previous DSP call */
+	size_t x_subblocktime;        /* frames into the tick, for blocks < 64 */
+	long x_played;                /* grains played to the end */
+	long x_late;                  /* dropped: blocks not in RAM in time */
+	long x_full;                  /* dropped: no room for it or its blocks */
+} t_m5Grains;
+
+/* ----- the block cache ----- */
+
+static void m5_grains_freecache(t_m5GrainCache *c)
+{
+	int i;
+	for (i = 0; i < M5_GRAINS_NBLOCKS; i++)
+		if (c->c_blocks[i].b_data)
+			freebytes(c->c_blocks[i].b_data,
+				M5_GRAINS_BLOCK * c->c_nchannels * sizeof(t_sample));
+	pthread_cond_destroy(&c->c_cond);
+	pthread_mutex_destroy(&c->c_mutex);
+	freebytes(c, sizeof(t_m5GrainCache));
+}
+
+static t_m5GrainCache *m5_grains_newcache(int nchannels)
+{
+	t_m5GrainCache *c = (t_m5GrainCache *)getbytes(sizeof(t_m5GrainCache));
+	int i;
+	if (!c)
+		return NULL;
+	pthread_mutex_init(&c->c_mutex, 0);
+	pthread_cond_init(&c->c_cond, 0);
+	c->c_refcount = 1;
+	c->c_nchannels = nchannels;
+	c->c_openserial = -1;
+	for (i = 0; i < M5_GRAINS_NBLOCKS; i++)
+	{
+		t_m5GrainBlock *b = &c->c_blocks[i];
+		b->b_block = -1;
+		if (!(b->b_data = (t_sample *)getbytes(
+			M5_GRAINS_BLOCK * nchannels * sizeof(t_sample))))
+		{
+			m5_grains_freecache(c);
+			return NULL;
+		}
+	}
+	return c;
+}
+
+	/** drop a reference, freeing the cache with the last.  c_mutex held,
+		and released */
+static void m5_grains_releasecache(t_m5GrainCache *c)
+{
+	int last = !--c->c_refcount;
+	pthread_mutex_unlock(&c->c_mutex);
+	if (last)
+		m5_grains_freecache(c);
+}
+
+	/** a grain starting at deadline needs block: find it in the cache or
+		give it a slot, the emptiest and least recently used there is.
+		returns NULL if every slot is in use.  c_mutex held */
+static t_m5GrainBlock *m5_grains_want(t_m5GrainCache *c, long block,
+	double deadline)
+{
+	t_m5GrainBlock *b, *slot = NULL;
+	int i;
+	for (i = 0; i < M5_GRAINS_NBLOCKS; i++)
+	{
+		b = &c->c_blocks[i];
+		if (b->b_block == block && !b->b_stale)
+		{
+			if (!b->b_users || deadline < b->b_deadline)
+				b->b_deadline = deadline;
+			b->b_users++;
+			return b;
+		}
+		if (b->b_users || b->b_state == BLOCK_LOADING)
+			continue;
+		if (!slot || (slot->b_state != BLOCK_EMPTY &&
+			(b->b_state == BLOCK_EMPTY || b->b_used < slot->b_used)))
+				slot = b;
+	}
+	if (!slot)
+		return NULL;
+	slot->b_block = block;
+	slot->b_state = BLOCK_WANTED;
+	slot->b_deadline = deadline;
+	slot->b_users = 1;
+	return slot;
+}
+
+	/** a grain is done with b at timeline frame now.  c_mutex held */
+static void m5_grains_unwant(t_m5GrainBlock *b, double now)
+{
+	if (--b->b_users)
+		return;
+	b->b_used = now;
+	if (b->b_state == BLOCK_WANTED)
+	{
+		b->b_state = BLOCK_EMPTY;
+		b->b_block = -1;
+	}
+}
+
+	/** the wanted block with the earliest deadline, or NULL.  c_mutex held */
+static t_m5GrainBlock *m5_grains_nextwanted(t_m5GrainCache *c)
+{
+	t_m5GrainBlock *next = NULL;
+	int i;
+	for (i = 0; i < M5_GRAINS_NBLOCKS; i++)
+	{
+		t_m5GrainBlock *b = &c->c_blocks[i];
+		if (b->b_state == BLOCK_WANTED &&
+			(!next || b->b_deadline < next->b_deadline))
+				next = b;
+	}
+	return next;
+}
+
+/* ----- the I/O threads ----- */
+
+	/** read block of sf into data, silence past the end of the file and
+		where the read fails.  returns 0 on a failed read */
+static int m5_grains_load(t_soundfile *sf, long block, char *buf,
+	t_sample *data, int nchannels)
+{
+	t_sample *vecs[GRAINSMAXCHANS];
+	off_t start = (off_t)block * M5_GRAINS_BLOCK * sf->sf_bytesperframe;
+	size_t frames = 0, want = 0;
+	ssize_t got = 0;
+	int i;
+	if (start < sf->sf_bytelimit)
+	{
+		want = M5_GRAINS_BLOCK * sf->sf_bytesperframe;
+		if ((off_t)want > sf->sf_bytelimit - start)
+			want = sf->sf_bytelimit - start;
+		got = m5_soundfile_read(sf, sf->sf_headersize + start, buf, want);
+		if (got > 0)
+			frames = got / sf->sf_bytesperframe;
+	}
+	for (i = 0; i < nchannels; i++)
+	{
+		vecs[i] = data + i * M5_GRAINS_BLOCK;
+		memset(vecs[i] + frames, 0,
+			(M5_GRAINS_BLOCK - frames) * sizeof(t_sample));
+	}
+	m5_soundfile_xferin(sf, nchannels, vecs, (unsigned char *)buf, frames);
+	return (got >= 0 && (size_t)got == want);
+}
+
+	/** open the file at path into sf for reading blocks, with a buffer for
+		one of them.  returns 0 or an errno */
+static int m5_grains_openfile(const char *path, t_soundfile *sf,
+	char **buf, size_t *bufsize)
+{
+	int fd;
+	m5_soundfile_clear(sf);
+	sf->sf_headersize = -1;
+	errno = 0;
+	if ((fd = sys_open(path, O_RDONLY)) < 0 ||
+		m5_open_soundfile_via_fd(fd, sf, 0) < 0)
+	{
+		sf->sf_fd = -1;
+		return (errno ? errno : EIO);
+	}
+	if (!m5_soundfile_isseekable(sf))
+	{
+		m5_soundfile_close(sf);
+		return ESPIPE;
+	}
+	if (*bufsize < (size_t)(M5_GRAINS_BLOCK * sf->sf_bytesperframe))
+	{
+		if (*buf)
+			freebytes(*buf, *bufsize);
+		*bufsize = M5_GRAINS_BLOCK * sf->sf_bytesperframe;
+		if (!(*buf = (char *)getbytes(*bufsize)))
+		{
+			*bufsize = 0;
+			m5_soundfile_close(sf);
+			return ENOMEM;
+		}
+	}
+	return 0;
+}
+
+	/** each I/O thread opens the file on its own and reads the wanted
+		blocks, the earliest deadline first, with the mutex released */
+static void *m5_grains_child_main(void *z)
+{
+	t_m5GrainCache *c = (t_m5GrainCache *)z;
+	t_soundfile sf;
+	char *buf = NULL;
+	size_t bufsize = 0;
+	int serial = -1;
+	m5_soundfile_clear(&sf);
+	pthread_mutex_lock(&c->c_mutex);
+	while (!c->c_quit)
+	{
+		t_m5GrainBlock *b;
+		long block;
+		int ok;
+		if (serial != c->c_serial)
+		{
+			char path[MAXPDSTRING];
+			int err = 0;
+			serial = c->c_serial;
+			strcpy(path, c->c_path);
+			pthread_mutex_unlock(&c->c_mutex);
+			if (sf.sf_fd >= 0)
+				m5_soundfile_close(&sf);
+			if (*path)
+				err = m5_grains_openfile(path, &sf, &buf, &bufsize);
+			pthread_mutex_lock(&c->c_mutex);
+				/* the first thread done reports for all */
+			if (*path && serial == c->c_serial && c->c_openserial != serial)
+			{
+				c->c_openserial = serial;
+				c->c_openerror = err;
+				c->c_nframes = (err ? 0 :
+					sf.sf_bytelimit / sf.sf_bytesperframe);
+			}
+			continue;
+		}
+		if (sf.sf_fd < 0 || !(b = m5_grains_nextwanted(c)))
+		{
+			pthread_cond_wait(&c->c_cond, &c->c_mutex);
+			continue;
+		}
+		b->b_state = BLOCK_LOADING;
+		block = b->b_block;
+		pthread_mutex_unlock(&c->c_mutex);
+		ok = m5_grains_load(&sf, block, buf, b->b_data, c->c_nchannels);
+		pthread_mutex_lock(&c->c_mutex);
+		c->c_reads++;
+		if (!ok)
+			c->c_readerrors++;
+		if (b->b_stale)
+		{
+			b->b_stale = 0;
+			b->b_state = BLOCK_EMPTY;
+			b->b_block = -1;
+		}
+		else b->b_state = BLOCK_READY;
+	}
+	m5_grains_releasecache(c);
+	if (sf.sf_fd >= 0)
+		m5_soundfile_close(&sf);
+	if (buf)
+		freebytes(buf, bufsize);
+	return 0;
+}
+
+/* ----- the object proper ----- */
+
+	/** frames since the time anchor, at the current logical time */
+static double m5_grains_now(t_m5Grains *x)
+{
+	double d;
+	if (x->x_timeanchor)
+		return (double)m5_time_anchor_get_time_since_start(x->x_timeanchor);
+	d = ceil(m5_clock_framessince(x->x_localanchor));
+	return (d < 0. ? 0. : d);
+}
+
+	/** let go of grain i's blocks and fill its place with the last grain.
+		c_mutex held */
+static void m5_grains_drop(t_m5Grains *x, int i, double now)
+{
+	t_m5Grain *g = &x->x_grains[i];
+	int k;
+	for (k = 0; k < g->g_nblocks; k++)
+		m5_grains_unwant(g->g_blocks[k], now);
+	if (i != --x->x_ngrains)
+		*g = x->x_grains[x->x_ngrains];
+}
+
+	/** window, times gain, for the n frames of a grain of length frames
+		from its frame k on */
+static void m5_grains_window(t_sample *win, size_t k, int n, size_t length,
+	t_sample gain)
+{
+	double step = (double)GRAINSWINSIZE / length, phase = k * step;
+	int i;
+	for (i = 0; i < n; i++, phase += step)
+	{
+		int j = (int)phase;
+		t_sample frac = phase - j;
+		win[i] = gain * (m5_grains_hann[j] +
+			frac * (m5_grains_hann[j + 1] - m5_grains_hann[j]));
+	}
+}
+
+	/** out += in * win: no dependencies between iterations, so the
+		compiler can vectorize it */
+static void m5_grains_madd(t_sample *out, const t_sample *in,
+	const t_sample *win, int n)
+{
+	int i;
+	for (i = 0; i < n; i++)
+		out[i] += in[i] * win[i];
+}
+
+	/** mix the part of grain g that falls into the DSP call of n frames
+		at timeline frame now */
+static void m5_grains_mix(t_m5Grains *x, const t_m5Grain *g, double now,
+	int n)
+{
+	int off = (g->g_start > now ? (int)(g->g_start - now) : 0), done, i;
+	size_t k = (size_t)(now + off - g->g_start), first, pos;
+	int count = n - off;
+	if ((size_t)count > g->g_length - k)
+		count = g->g_length - k;
+	if (count <= 0)
+		return;
+	m5_grains_window(x->x_win, k, count, g->g_length, g->g_gain);
+	first = g->g_pos / M5_GRAINS_BLOCK;
+	for (done = 0; done < count; )
+	{
+		const t_m5GrainBlock *b;
+		size_t inblock;
+		int m;
+		pos = g->g_pos + k + done;
+		b = g->g_blocks[pos / M5_GRAINS_BLOCK - first];
+		inblock = pos % M5_GRAINS_BLOCK;
+		m = count - done;
+		if ((size_t)m > M5_GRAINS_BLOCK - inblock)
+			m = M5_GRAINS_BLOCK - inblock;
+		for (i = 0; i < x->x_nchannels; i++)
+			m5_grains_madd(x->x_outvec[i] + off + done,
+				b->b_data + i * M5_GRAINS_BLOCK + inblock, x->x_win + done, m);
+		done += m;
+	}
+}
+
+static t_int *m5_grains_perform(t_int *w)
+{
+	t_m5Grains *x = (t_m5Grains *)(w[1]);
+	int n = (int)(w[2]), i, ended = 0;
+	t_m5GrainCache *c = x->x_cache;
+	double logicaltime = m5_clock_logicaltime(), now;
+	for (i = 0; i < x->x_nchannels; i++)
+		memset(x->x_outvec[i], 0, n * sizeof(t_sample));
+	if (logicaltime == x->x_lastlogicaltime)
+		x->x_subblocktime += n;
+	else
+	{
+		x->x_lastlogicaltime = logicaltime;
+		x->x_subblocktime = 0;
+	}
+	now = m5_grains_now(x) + x->x_subblocktime;
+	if (!x->x_ngrains)
+		return (w + 3);
+
+		/* a grain due in this call plays if its blocks are all there,
+		and is dropped if they aren't.  blocks a grain plays from are
+		never touched by the threads, so mix without the mutex */
+	pthread_mutex_lock(&c->c_mutex);
+	for (i = 0; i < x->x_ngrains; )
+	{
+		t_m5Grain *g = &x->x_grains[i];
+		int k;
+		if (g->g_playing || g->g_start >= now + n)
+		{
+			i++;
+			continue;
+		}
+		for (k = 0; k < g->g_nblocks; k++)
+			if (g->g_blocks[k]->b_state != BLOCK_READY)
+				break;
+		if (k < g->g_nblocks)
+		{
+			x->x_late++;
+			m5_grains_drop(x, i, now);
+			continue;
+		}
+		g->g_playing = 1;
+		i++;
+	}
+	pthread_mutex_unlock(&c->c_mutex);
+	for (i = 0; i < x->x_ngrains; i++)
+	{
+		t_m5Grain *g = &x->x_grains[i];
+		if (!g->g_playing)
+			continue;
+		m5_grains_mix(x, g, now, n);
+		if (g->g_start + g->g_length <= now + n)
+			ended = 1;
+	}
+	if (ended)
+	{
+		pthread_mutex_lock(&c->c_mutex);
+		for (i = 0; i < x->x_ngrains; )
+		{
+			t_m5Grain *g = &x->x_grains[i];
+			if (g->g_playing && g->g_start + g->g_length <= now + n)
+			{
+				x->x_played++;
+				m5_grains_drop(x, i, now + n);
+			}
+			else i++;
+		}
+		pthread_mutex_unlock(&c->c_mutex);
+	}
+	return (w + 3);
+}
+
+static void m5_grains_time_set(t_m5Grains *x, t_symbol *s)
+{
+	t_m5TimeAnchor *a = 0;
+	x->x_timeanchorname = s;
+	if (s && *s->s_name && s != gensym("self"))
+	{
+		if (!(a = m5_time_anchor_find(s)))
+			pd_error(x, "m5_grains~: %s: no such time anchor", s->s_name);
+		else m5_time_anchor_usedindsp(a);
+	}
+	x->x_timeanchor = a;
+}
+
+static void m5_grains_dsp(t_m5Grains *x, t_signal **sp)
+{
+	int i, n = sp[0]->s_n;
+	m5_grains_time_set(x, x->x_timeanchorname);
+	for (i = 0; i < x->x_nchannels; i++)
+		x->x_outvec[i] = sp[i]->s_vec;
+	if (n > x->x_vecsize)
+	{
+		x->x_win = (t_sample *)resizebytes(x->x_win,
+			x->x_vecsize * sizeof(t_sample), n * sizeof(t_sample));
+		x->x_vecsize = n;
+	}
+	dsp_add(m5_grains_perform, 2, x, (t_int)n);
+}
+
+	/** report the "open" the threads have finished, or look again later */
+static void m5_grains_tick(t_m5Grains *x)
+{
+	t_m5GrainCache *c = x->x_cache;
+	t_m5FrameTimeCode ftc;
+	t_atom at[3];
+	int done, err = 0;
+	size_t nframes = 0;
+	pthread_mutex_lock(&c->c_mutex);
+	if ((done = (c->c_openserial == c->c_serial)))
+	{
+		err = c->c_openerror;
+		nframes = c->c_nframes;
+	}
+	pthread_mutex_unlock(&c->c_mutex);
+	if (!done)
+	{
+		clock_delay(x->x_clock, GRAINSPOLL);
+		return;
+	}
+	if (err)
+	{
+		pd_error(x, "m5_grains~: %s: %s", x->x_filename->s_name,
+			m5_soundfile_strerror(err));
+		return;
+	}
+	m5_frame_time_code_from_frames((long)nframes, &ftc);
+	SETFLOAT(&at[0], ftc.sign);
+	SETFLOAT(&at[1], ftc.epoch);
+	SETFLOAT(&at[2], ftc.frames);
+	outlet_anything(x->x_infoout, gensym("length"), 3, at);
+}
+
+	/** drop every grain.  c_mutex held */
+static void m5_grains_clear(t_m5Grains *x)
+{
+	double now = m5_grains_now(x);
+	while (x->x_ngrains)
+		m5_grains_drop(x, x->x_ngrains - 1, now);
+}
+
+	/** open <file> */
+static void m5_grains_open(t_m5Grains *x, t_symbol *file)
+{
+	t_m5GrainCache *c = x->x_cache;
+	int i;
+	x->x_filename = file;
+	pthread_mutex_lock(&c->c_mutex);
+	m5_grains_clear(x);
+	for (i = 0; i < M5_GRAINS_NBLOCKS; i++)
+	{
+		t_m5GrainBlock *b = &c->c_blocks[i];
+		if (b->b_state == BLOCK_LOADING)
+			b->b_stale = (b->b_block >= 0);
+		else
+		{
+			b->b_state = BLOCK_EMPTY;
+			b->b_block = -1;
+		}
+	}
+	canvas_makefilename(x->x_canvas, file->s_name, c->c_path, MAXPDSTRING);
+	c->c_serial++;
+	pthread_cond_broadcast(&c->c_cond);
+	pthread_mutex_unlock(&c->c_mutex);
+	clock_delay(x->x_clock, GRAINSPOLL);
+}
+
+	/** grain <FTC position> <FTC length> [<gain>] [at <FTC time>] */
+static void m5_grains_grain(t_m5Grains *x, t_symbol *s, int argc,
+	t_atom *argv)
+{
+	t_m5GrainCache *c = x->x_cache;
+	t_m5FrameTimeCode ftc;
+	t_m5Grain *g;
+	long pos, length, block, first;
+	double start;
+	t_sample gain = 1;
+	int i = 6;
+	if (argc < 6 || m5_frame_time_code_from_atoms(3, argv, &ftc) ||
+		(pos = m5_frames_from_time_code(&ftc)) < 0 ||
+		m5_frame_time_code_from_atoms(3, argv + 3, &ftc) ||
+		(length = m5_frames_from_time_code(&ftc)) <= 0)
+			goto usage;
+	if (i < argc && argv[i].a_type == A_FLOAT)
+		gain = argv[i++].a_w.w_float;
+	if (i < argc)
+	{
+		if (argc != i + 4 || argv[i].a_type != A_SYMBOL ||
+			argv[i].a_w.w_symbol != gensym("at") ||
+			m5_frame_time_code_from_atoms(3, argv + i + 1, &ftc))
+				goto usage;
+		start = m5_frames_from_time_code(&ftc);
+	}
+	else start = floor(m5_grains_now(x) + x->x_lead * sys_getsr() * 0.001);
+	if (length > GRAINSMAXLENGTH)
+	{
+		pd_error(x, "m5_grains~: grain: %ld frames is longer than %d",
+			length, GRAINSMAXLENGTH);
+		return;
+	}
+	if (x->x_ngrains == M5_GRAINS_MAX)
+	{
+		x->x_full++;
+		return;
+	}
+	g = &x->x_grains[x->x_ngrains];
+	g->g_start = start;
+	g->g_pos = pos;
+	g->g_length = length;
+	g->g_gain = gain;
+	g->g_playing = 0;
+	g->g_nblocks = 0;
+	first = pos / M5_GRAINS_BLOCK;
+	pthread_mutex_lock(&c->c_mutex);
+	for (block = first; block <= (pos + length - 1) / M5_GRAINS_BLOCK; block++)
+	{
+		if (!(g->g_blocks[g->g_nblocks] = m5_grains_want(c, block, start)))
+		{
+			while (g->g_nblocks--)
+				m5_grains_unwant(g->g_blocks[g->g_nblocks], start);
+			pthread_mutex_unlock(&c->c_mutex);
+			x->x_full++;
+			return;
+		}
+		g->g_nblocks++;
+	}
+	x->x_ngrains++;
+	pthread_cond_signal(&c->c_cond);
+	pthread_mutex_unlock(&c->c_mutex);
+	return;
+usage:
+	pd_error(x, "m5_grains~: usage: grain <FTC position> <FTC length> [<gain>] [at <FTC time>], a frame time code is three floats... 1|-1, epoch, frames.");
+}
+
+	/** stop: drop every grain */
+static void m5_grains_stop(t_m5Grains *x)
+{
+	pthread_mutex_lock(&x->x_cache->c_mutex);
+	m5_grains_clear(x);
+	pthread_mutex_unlock(&x->x_cache->c_mutex);
+}
+
+	/** lead <msec>: how far ahead a grain without "at" starts */
+static void m5_grains_lead(t_m5Grains *x, t_floatarg f)
+{
+	x->x_lead = (f < 0 ? 0 : f);
+}
+
+static void m5_grains_time(t_m5Grains *x, t_symbol *name)
+{
+	m5_grains_time_set(x, name);
+}
+
+static void m5_grains_print(t_m5Grains *x)
+{
+	t_m5GrainCache *c = x->x_cache;
+	int i, ready = 0, wanted = 0;
+	long reads, readerrors;
+	pthread_mutex_lock(&c->c_mutex);
+	for (i = 0; i < M5_GRAINS_NBLOCKS; i++)
+	{
+		if (c->c_blocks[i].b_state == BLOCK_READY)
+			ready++;
+		else if (c->c_blocks[i].b_state == BLOCK_WANTED)
+			wanted++;
+	}
+	reads = c->c_reads;
+	readerrors = c->c_readerrors;
+	pthread_mutex_unlock(&c->c_mutex);
+	post("m5_grains~: %s", (x->x_filename ? x->x_filename->s_name : "no file"));
+	post("  grains: %d scheduled or playing, %ld played, %ld late, %ld dropped (no room)",
+		x->x_ngrains, x->x_played, x->x_late, x->x_full);
+	post("  blocks: %d of %d in RAM, %d waiting, %ld read (%ld short)",
+		ready, M5_GRAINS_NBLOCKS, wanted, reads, readerrors);
+	post("  lead: %g msec", x->x_lead);
+}
+
+static void *m5_grains_new(t_floatarg fnchannels)
+{
+	t_m5Grains *x;
+	t_m5GrainCache *c;
+	int nchannels = fnchannels, i;
+	if (nchannels < 1)
+		nchannels = 1;
+	else if (nchannels > GRAINSMAXCHANS)
+		nchannels = GRAINSMAXCHANS;
+	if (!(c = m5_grains_newcache(nchannels)))
+		return 0;
+	x = (t_m5Grains *)pd_new(m5_grains_class);
+	x->x_canvas = canvas_getcurrent();
+	x->x_nchannels = nchannels;
+	x->x_outvec = (t_sample **)getbytes(nchannels * sizeof(t_sample *));
+	for (i = 0; i < nchannels; i++)
+		outlet_new(&x->x_obj, &s_signal);
+	x->x_infoout = outlet_new(&x->x_obj, &s_anything);
+	x->x_clock = clock_new(x, (t_method)m5_grains_tick);
+	x->x_filename = 0;
+	x->x_cache = c;
+	x->x_grains = (t_m5Grain *)getbytes(M5_GRAINS_MAX * sizeof(t_m5Grain));
+	x->x_ngrains = 0;
+	x->x_vecsize = 64;
+	x->x_win = (t_sample *)getbytes(x->x_vecsize * sizeof(t_sample));
+	x->x_lead = GRAINSDEFLEAD;
+	x->x_timeanchorname = 0;
+	x->x_timeanchor = 0;
+	x->x_localanchor = m5_clock_logicaltime();
+	x->x_lastlogicaltime = -1;
+	x->x_subblocktime = 0;
+	x->x_played = x->x_late = x->x_full = 0;
+	for (i = 0; i < M5_GRAINS_NTHREADS; i++)
+	{
+		pthread_t thread;
+		pthread_mutex_lock(&c->c_mutex);
+		c->c_refcount++;
+		pthread_mutex_unlock(&c->c_mutex);
+		if (pthread_create(&thread, 0, m5_grains_child_main, c))
+		{
+			pthread_mutex_lock(&c->c_mutex);
+			c->c_refcount--;
+			pthread_mutex_unlock(&c->c_mutex);
+			pd_error(x, "m5_grains~: can't start an I/O thread");
+			break;
+		}
+		pthread_detach(thread);
+	}
+	return x;
+}
+
+	/** the threads may be reading: leave the cache to the last of them */
+static void m5_grains_free(t_m5Grains *x)
+{
+	t_m5GrainCache *c = x->x_cache;
+	pthread_mutex_lock(&c->c_mutex);
+	m5_grains_clear(x);
+	c->c_quit = 1;
+	pthread_cond_broadcast(&c->c_cond);
+	m5_grains_releasecache(c);
+	clock_free(x->x_clock);
+	freebytes(x->x_grains, M5_GRAINS_MAX * sizeof(t_m5Grain));
+	freebytes(x->x_win, x->x_vecsize * sizeof(t_sample));
+	freebytes(x->x_outvec, x->x_nchannels * sizeof(t_sample *));
+}
+
+void m5_grains_setup(void)
+{
+	int i;
+	for (i = 0; i <= GRAINSWINSIZE; i++)
+		m5_grains_hann[i] = 0.5 - 0.5 * cos(2 * M_PI * i / GRAINSWINSIZE);
+	m5_grains_class = class_new(gensym("m5_grains~"),
+		(t_newmethod)m5_grains_new, (t_method)m5_grains_free,
+		sizeof(t_m5Grains), 0, A_DEFFLOAT, 0);
+	class_addmethod(m5_grains_class, (t_method)m5_grains_dsp,
+		gensym("dsp"), A_CANT, 0);
+	class_addmethod(m5_grains_class, (t_method)m5_grains_open,
+		gensym("open"), A_SYMBOL, 0);
+	class_addmethod(m5_grains_class, (t_method)m5_grains_grain,
+		gensym("grain"), A_GIMME, 0);
+	class_addmethod(m5_grains_class, (t_method)m5_grains_stop,
+		gensym("stop"), 0);
+	class_addmethod(m5_grains_class, (t_method)m5_grains_lead,
+		gensym("lead"), A_FLOAT, 0);
+	class_addmethod(m5_grains_class, (t_method)m5_grains_time,
+		gensym("time"), A_SYMBOL, 0);
+	class_addmethod(m5_grains_class, (t_method)m5_grains_print,
+		gensym("print"), 0);
+}
@@ -0,0 +1,30 @@
+/* Copyright (c) 2025 Michael Spears.
+* For information on usage and redistribution, and for a DISCLAIMER OF ALL
+* WARRANTIES, see the file, "LICENSE.txt," in this distribution.  */
+
+#pragma once
+
+#include "m_pd.h"
+
+// m5_grains~: short grains from anywhere in a long sound file, streamed
+// from disk instead of loaded into an array.
+//
+//   open <file>
+//   grain <FTC position> <FTC length> [<gain>] [at <FTC time>]
+//
+// The file is read in blocks of M5_GRAINS_BLOCK frames into a cache of
+// M5_GRAINS_NBLOCKS blocks that all of the object's grains share. A grain
+// asks for the blocks it spans when it is scheduled, and the object's I/O
+// threads read the wanted blocks in order of the time their first grain
+// starts at (its deadline). Perform mixes a grain, under a Hann window,
+// only if all its blocks are in RAM by its start time; otherwise the grain
+// is dropped and counted as late. Blocks no grain uses any more stay in the
+// cache until their slot is needed for another block, oldest first.
+
+#define M5_GRAINS_BLOCK 4096     /* frames per cache block */
+#define M5_GRAINS_NBLOCKS 256    /* blocks per object */
+#define M5_GRAINS_MAXBLOCKS 16   /* blocks one grain may span */
+#define M5_GRAINS_MAX 512        /* grains scheduled or playing at once */
+#define M5_GRAINS_NTHREADS 2     /* I/O threads per object */
+
+void m5_grains_setup(void);
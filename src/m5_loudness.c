@@ -0,0 +1,358 @@
+/* Copyright (c) 2025 Michael Spears.
+* For information on usage and redistribution, and for a DISCLAIMER OF ALL
+* WARRANTIES, see the file, "LICENSE.txt," in this distribution.  */
+
+#include <m_pd.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "m5_loudness.h"
+#include "m5_sidecar.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/*
+
+	integrated loudness, true peak and RMS of sound files
+
+*/
+
+	// true peak: 4 times oversampling with a 48 tap windowed sinc, kept
+	// as 4 phases of 12 taps each
+#define TPFACTOR 4
+#define TPPHASETAPS 12
+#define TPTAPS (TPFACTOR * TPPHASETAPS)
+
+	// gating blocks are 4 steps of 100 msec
+#define STEPSPERBLOCK 4
+
+#define ABSOLUTEGATE -70.
+#define RELATIVEGATE -10.
+
+struct _m5Loudness
+{
+	int l_nchannels;
+	double l_weight[M5_LOUDNESS_MAXCHANS];
+		// K-weighting: a high shelf, then a high pass, per channel
+	double l_b[2][3], l_a[2][3];
+	double l_z[M5_LOUDNESS_MAXCHANS][2][2];
+		// the current 100 msec step
+	size_t l_step;             // frames per step
+	size_t l_stepfill;         // frames in it so far
+	double l_stepsum[M5_LOUDNESS_MAXCHANS]; // of K-weighted squares
+		// weighted energies of the last steps and of all gating blocks
+	double l_steps[STEPSPERBLOCK];
+	long l_nsteps;
+	double *l_blocks;
+	size_t l_nblocks, l_maxblocks;
+		// true peak
+	float l_taps[TPPHASETAPS][TPFACTOR]; // tap k of each phase together
+	float *l_scratch;          // history then one run of a channel
+	float l_history[M5_LOUDNESS_MAXCHANS][TPPHASETAPS - 1];
+	double l_peak;
+		// plain RMS
+	double l_sumsq[M5_LOUDNESS_MAXCHANS];
+	double l_frames;
+};
+
+/* ----- setup ----- */
+
+	// the two K-weighting biquads of BS.1770, for any sample rate
+static void m5_loudness_kweighting(t_m5Loudness *l, double sr)
+{
+	double f0 = 1681.974450955533, g = 3.999843853973347,
+		q = 0.7071752369554196, k = tan(M_PI * f0 / sr),
+		vh = pow(10., g / 20.), vb = pow(vh, 0.4996667741545416),
+		a0 = 1. + k / q + k * k;
+	l->l_b[0][0] = (vh + vb * k / q + k * k) / a0;
+	l->l_b[0][1] = 2. * (k * k - vh) / a0;
+	l->l_b[0][2] = (vh - vb * k / q + k * k) / a0;
+	l->l_a[0][1] = 2. * (k * k - 1.) / a0;
+	l->l_a[0][2] = (1. - k / q + k * k) / a0;
+
+	f0 = 38.13547087602444;
+	q = 0.5003270373238773;
+	k = tan(M_PI * f0 / sr);
+	a0 = 1. + k / q + k * k;
+	l->l_b[1][0] = 1.;
+	l->l_b[1][1] = -2.;
+	l->l_b[1][2] = 1.;
+	l->l_a[1][1] = 2. * (k * k - 1.) / a0;
+	l->l_a[1][2] = (1. - k / q + k * k) / a0;
+}
+
+	// a Blackman windowed sinc low pass at the original Nyquist frequency
+static void m5_loudness_oversampler(t_m5Loudness *l)
+{
+	int n, p;
+	for (n = 0; n < TPTAPS; n++)
+	{
+		double t = (n - (TPTAPS - 1) / 2.) / TPFACTOR,
+			sinc = (t == 0 ? 1. : sin(M_PI * t) / (M_PI * t)),
+			w = 0.42 - 0.5 * cos(2. * M_PI * (n + 0.5) / TPTAPS) +
+				0.08 * cos(4. * M_PI * (n + 0.5) / TPTAPS);
+			// phase p of output i is sum over k of h[p + 4k] x[i - k]
+		l->l_taps[n / TPFACTOR][n % TPFACTOR] = sinc * w;
+	}
+		// normalize each phase to unity gain at DC
+	for (p = 0; p < TPFACTOR; p++)
+	{
+		double sum = 0;
+		for (n = 0; n < TPPHASETAPS; n++)
+			sum += l->l_taps[n][p];
+		for (n = 0; n < TPPHASETAPS; n++)
+			l->l_taps[n][p] /= sum;
+	}
+}
+
+t_m5Loudness *m5_loudness_new(int nchannels, double samplerate)
+{
+	t_m5Loudness *l;
+	int i;
+	if (nchannels < 1 || nchannels > M5_LOUDNESS_MAXCHANS ||
+		samplerate < 8000 || samplerate > 768000)
+			return NULL;
+	l = (t_m5Loudness *)getbytes(sizeof(t_m5Loudness));
+	l->l_nchannels = nchannels;
+	for (i = 0; i < nchannels; i++)
+		l->l_weight[i] = 1.;
+	if (nchannels == 6)
+	{
+		l->l_weight[3] = 0.;   // LFE
+		l->l_weight[4] = l->l_weight[5] = 1.41;
+	}
+	m5_loudness_kweighting(l, samplerate);
+	m5_loudness_oversampler(l);
+	l->l_step = (size_t)(samplerate / 10. + 0.5);
+	l->l_scratch = (float *)getbytes((TPPHASETAPS - 1 + l->l_step) *
+		sizeof(float));
+	return l;
+}
+
+void m5_loudness_free(t_m5Loudness *l)
+{
+	if (!l)
+		return;
+	freebytes(l->l_scratch, (TPPHASETAPS - 1 + l->l_step) * sizeof(float));
+	if (l->l_blocks)
+		freebytes(l->l_blocks, l->l_maxblocks * sizeof(double));
+	freebytes(l, sizeof(t_m5Loudness));
+}
+
+/* ----- kernels ----- */
+
+	// K-weight n samples of channel c and return the sum of their squares;
+	// a recursive filter, so one sample after another
+static double m5_loudness_filter(t_m5Loudness *l, int c, const t_sample *in,
+	size_t n)
+{
+	double b00 = l->l_b[0][0], b01 = l->l_b[0][1], b02 = l->l_b[0][2],
+		a01 = l->l_a[0][1], a02 = l->l_a[0][2],
+		a11 = l->l_a[1][1], a12 = l->l_a[1][2],
+		s00 = l->l_z[c][0][0], s01 = l->l_z[c][0][1],
+		s10 = l->l_z[c][1][0], s11 = l->l_z[c][1][1], sum = 0;
+	size_t i;
+	for (i = 0; i < n; i++)
+	{
+		double x = in[i], y;
+			// transposed direct form II, twice
+		y = b00 * x + s00;
+		s00 = b01 * x - a01 * y + s01;
+		s01 = b02 * x - a02 * y;
+		x = y;
+		y = x + s10;
+		s10 = -2. * x - a11 * y + s11;
+		s11 = x - a12 * y;
+		sum += y * y;
+	}
+		// flush denormals so a silent tail doesn't crawl
+	if (fabs(s00) < 1e-30) s00 = 0;
+	if (fabs(s01) < 1e-30) s01 = 0;
+	if (fabs(s10) < 1e-30) s10 = 0;
+	if (fabs(s11) < 1e-30) s11 = 0;
+	l->l_z[c][0][0] = s00;
+	l->l_z[c][0][1] = s01;
+	l->l_z[c][1][0] = s10;
+	l->l_z[c][1][1] = s11;
+	return sum;
+}
+
+	// sum of squares; independent lanes so the compiler can vectorize it
+static double m5_loudness_sumsq(const t_sample *in, size_t n)
+{
+	double s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+	size_t i;
+	for (i = 0; i + 4 <= n; i += 4)
+	{
+		s0 += (double)in[i] * in[i];
+		s1 += (double)in[i + 1] * in[i + 1];
+		s2 += (double)in[i + 2] * in[i + 2];
+		s3 += (double)in[i + 3] * in[i + 3];
+	}
+	for (; i < n; i++)
+		s0 += (double)in[i] * in[i];
+	return (s0 + s1) + (s2 + s3);
+}
+
+	// highest oversampled magnitude of n new samples of channel c, which
+	// follow the channel's history
+static float m5_loudness_peak(t_m5Loudness *l, int c, const t_sample *in,
+	size_t n)
+{
+	float *x = l->l_scratch, peak = 0;
+	const int h = TPPHASETAPS - 1;
+	size_t i;
+	int p, k;
+	memcpy(x, l->l_history[c], h * sizeof(float));
+	for (i = 0; i < n; i++)
+		x[h + i] = in[i];
+	for (i = 0; i < n; i++)
+	{
+		const float *xi = x + h + i;
+		float y[TPFACTOR] = {0};
+			// all phases at once: one vector multiply-add per tap
+		for (k = 0; k < TPPHASETAPS; k++)
+			for (p = 0; p < TPFACTOR; p++)
+				y[p] += l->l_taps[k][p] * xi[-k];
+		for (p = 0; p < TPFACTOR; p++)
+			if (fabsf(y[p]) > peak)
+				peak = fabsf(y[p]);
+		if (fabsf(xi[0]) > peak)
+			peak = fabsf(xi[0]);
+	}
+	memcpy(l->l_history[c], x + n, h * sizeof(float));
+	return peak;
+}
+
+/* ----- measuring ----- */
+
+	// a step is complete: store the gating block that ends with it
+static void m5_loudness_endstep(t_m5Loudness *l)
+{
+	double energy = 0;
+	int c, i;
+	for (c = 0; c < l->l_nchannels; c++)
+	{
+		energy += l->l_weight[c] * l->l_stepsum[c];
+		l->l_stepsum[c] = 0;
+	}
+	l->l_steps[l->l_nsteps++ % STEPSPERBLOCK] = energy / l->l_step;
+	l->l_stepfill = 0;
+	if (l->l_nsteps < STEPSPERBLOCK)
+		return;
+	if (l->l_nblocks == l->l_maxblocks)
+	{
+		size_t newmax = (l->l_maxblocks ? 2 * l->l_maxblocks : 1024);
+		l->l_blocks = (double *)resizebytes(l->l_blocks,
+			l->l_maxblocks * sizeof(double), newmax * sizeof(double));
+		l->l_maxblocks = newmax;
+	}
+	for (i = 0, energy = 0; i < STEPSPERBLOCK; i++)
+		energy += l->l_steps[i];
+	l->l_blocks[l->l_nblocks++] = energy / STEPSPERBLOCK;
+}
+
+void m5_loudness_process(t_m5Loudness *l, t_sample **vecs, size_t nframes)
+{
+	size_t done = 0;
+	int c;
+	while (done < nframes)
+	{
+		size_t n = l->l_step - l->l_stepfill;
+		if (n > nframes - done)
+			n = nframes - done;
+		for (c = 0; c < l->l_nchannels; c++)
+		{
+			const t_sample *in = vecs[c] + done;
+			float peak = m5_loudness_peak(l, c, in, n);
+			if (peak > l->l_peak)
+				l->l_peak = peak;
+			l->l_stepsum[c] += m5_loudness_filter(l, c, in, n);
+			l->l_sumsq[c] += m5_loudness_sumsq(in, n);
+		}
+		l->l_frames += n;
+		l->l_stepfill += n;
+		done += n;
+		if (l->l_stepfill == l->l_step)
+			m5_loudness_endstep(l);
+	}
+}
+
+static double m5_loudness_db(double power, double offset)
+{
+	return (power > 0 ? offset + 10. * log10(power) : M5_LOUDNESS_FLOOR);
+}
+
+	// mean energy of the blocks louder than gate
+static double m5_loudness_gated(const t_m5Loudness *l, double gate)
+{
+	double sum = 0;
+	size_t i, n = 0;
+	for (i = 0; i < l->l_nblocks; i++)
+		if (m5_loudness_db(l->l_blocks[i], -0.691) > gate)
+			sum += l->l_blocks[i], n++;
+	return (n ? sum / n : 0);
+}
+
+void m5_loudness_result(const t_m5Loudness *l, t_m5LoudnessResult *r)
+{
+	double relative;
+	int c;
+	relative = m5_loudness_db(m5_loudness_gated(l, ABSOLUTEGATE), -0.691) +
+		RELATIVEGATE;
+	if (relative < ABSOLUTEGATE)
+		relative = ABSOLUTEGATE;
+	r->lr_integrated = m5_loudness_db(m5_loudness_gated(l, relative), -0.691);
+	r->lr_truepeak = m5_loudness_db(l->l_peak * l->l_peak, 0);
+	r->lr_nchannels = l->l_nchannels;
+	for (c = 0; c < l->l_nchannels; c++)
+		r->lr_rms[c] = m5_loudness_db(l->l_frames > 0 ?
+			l->l_sumsq[c] / l->l_frames : 0, 0);
+	if (r->lr_integrated < M5_LOUDNESS_FLOOR)
+		r->lr_integrated = M5_LOUDNESS_FLOOR;
+}
+
+/* ----- sidecar ----- */
+
+#define SIDECAREXT "m5loud"
+#define SIDECARVERSION 1
+
+int m5_loudness_load(const char *path, const struct stat *st,
+	t_m5LoudnessResult *r)
+{
+	int c, ok = 0;
+	FILE *fp;
+	if (!(fp = m5_sidecar_open(path, SIDECAREXT, SIDECARVERSION, st)))
+		return 0;
+	if (fscanf(fp, "%lf %lf %d", &r->lr_integrated, &r->lr_truepeak,
+		&r->lr_nchannels) == 3 &&
+		r->lr_nchannels >= 1 && r->lr_nchannels <= M5_LOUDNESS_MAXCHANS)
+	{
+		for (c = 0; c < r->lr_nchannels; c++)
+			if (fscanf(fp, "%lf", &r->lr_rms[c]) != 1)
+				break;
+		ok = (c == r->lr_nchannels);
+	}
+	sys_fclose(fp);
+	return ok;
+}
+
+int m5_loudness_save(const char *path, const struct stat *st,
+	const t_m5LoudnessResult *r)
+{
+	char tmp[MAXPDSTRING];
+	int c;
+	FILE *fp;
+	if (!(fp = m5_sidecar_create(path, SIDECAREXT, SIDECARVERSION, st, tmp)))
+		return 0;
+		// integrated loudness, true peak and the RMS levels
+	fprintf(fp, "%.17g %.17g\n%d", r->lr_integrated, r->lr_truepeak,
+		r->lr_nchannels);
+	for (c = 0; c < r->lr_nchannels; c++)
+		fprintf(fp, " %.17g", r->lr_rms[c]);
+	fprintf(fp, "\n");
+	return m5_sidecar_commit(fp, path, SIDECAREXT, tmp, 1);
+}
@@ -0,0 +1,55 @@
+/* Copyright (c) 2025 Michael Spears.
+* For information on usage and redistribution, and for a DISCLAIMER OF ALL
+* WARRANTIES, see the file, "LICENSE.txt," in this distribution.  */
+
+#pragma once
+
+#include "m_pd.h"
+#include <stddef.h>
+#include <sys/stat.h>
+
+// Loudness of a whole file, for m5_readsf~ "open -loudness": integrated
+// loudness after ITU-R BS.1770-4 / EBU R 128 (K-weighting, 400 ms blocks
+// with 75% overlap, absolute and relative gates), true peak from 4 times
+// oversampling, and the plain RMS level of each channel.
+//
+// Feed a t_m5Loudness all of a file's frames in order, one run of
+// deinterleaved vectors at a time, then ask it for the result. Files
+// with 6 channels are weighted as 5.1 (L R C LFE Ls Rs), others count
+// every channel alike.
+//
+// Results can be kept in a sidecar, "<file>.m5loud" next to the file,
+// which is only used while the file's size and modification time still
+// match the ones stored in it.
+
+#define M5_LOUDNESS_MAXCHANS 64
+
+// reported in place of the level of silence
+#define M5_LOUDNESS_FLOOR -200.
+
+typedef struct _m5LoudnessResult
+{
+	double lr_integrated;                    // LUFS
+	double lr_truepeak;                      // dBTP
+	int lr_nchannels;
+	double lr_rms[M5_LOUDNESS_MAXCHANS];     // dBFS per channel
+} t_m5LoudnessResult;
+
+typedef struct _m5Loudness t_m5Loudness;
+
+// returns NULL for channel counts or sample rates it can't measure
+t_m5Loudness *m5_loudness_new(int nchannels, double samplerate);
+void m5_loudness_free(t_m5Loudness *l);
+
+// measure the next nframes frames, vecs[c] holding channel c
+void m5_loudness_process(t_m5Loudness *l, t_sample **vecs, size_t nframes);
+
+// the result for everything processed so far
+void m5_loudness_result(const t_m5Loudness *l, t_m5LoudnessResult *r);
+
+// the sidecar for the file at path with status st: load returns 0 if
+// there is none or it is stale; save returns 0 on failure, quietly
+int m5_loudness_load(const char *path, const struct stat *st,
+	t_m5LoudnessResult *r);
+int m5_loudness_save(const char *path, const struct stat *st,
+	const t_m5LoudnessResult *r);
@@ -0,0 +1,215 @@
+/* Copyright (c) 2025 Michael Spears.
+* For information on usage and redistribution, and for a DISCLAIMER OF ALL
+* WARRANTIES, see the file, "LICENSE.txt," in this distribution.  */
+
+#include <m_pd.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "m5_onsets.h"
+#include "m5_sidecar.h"
+
+/*
+
+	transient onsets of sound files
+
+*/
+
+#define MAXCHANS 64
+#define HOPMSEC 5.
+
+	// levels below this count as this, so silence has a level to rise from
+#define LEVELFLOOR -120.
+
+	// a rise is measured against the mean level of this many hops before
+#define BASEHOPS 4
+
+	// hops remembered: a candidate, the two on either side of it and the
+	// base of the first of those
+#define HISTORY 8
+
+struct _m5Onsets
+{
+	int o_nchannels;
+	size_t o_hop;                  // frames per hop
+	long o_gap;                    // hops between onsets, at least
+	t_sample o_prev[MAXCHANS];     // last sample of each channel
+	double o_acc;                  // energy of the current hop so far
+	size_t o_fill;                 // frames in the current hop so far
+	long o_nhops;                  // hops completed
+	double o_level[HISTORY];       // dB, by hop number modulo HISTORY
+	double o_rise[HISTORY];        // dB over the base
+	long o_last;                   // hop of the last onset
+	t_m5OnsetList o_list;
+};
+
+t_m5Onsets *m5_onsets_new(int nchannels, double samplerate)
+{
+	t_m5Onsets *o;
+	int i;
+	if (nchannels < 1 || nchannels > MAXCHANS || !(samplerate > 0))
+		return NULL;
+	o = (t_m5Onsets *)getbytes(sizeof(t_m5Onsets));
+	o->o_nchannels = nchannels;
+	if ((o->o_hop = (size_t)(samplerate * HOPMSEC / 1000. + 0.5)) < 1)
+		o->o_hop = 1;
+	o->o_gap = (long)ceil(M5_ONSETS_GAP / HOPMSEC);
+	for (i = 0; i < HISTORY; i++)
+		o->o_level[i] = LEVELFLOOR, o->o_rise[i] = 0;
+	o->o_last = -o->o_gap;
+	return o;
+}
+
+void m5_onsets_free(t_m5Onsets *o)
+{
+	m5_onsetlist_clear(&o->o_list);
+	freebytes(o, sizeof(t_m5Onsets));
+}
+
+static double m5_onsets_rise(const t_m5Onsets *o, long hop)
+{
+	return (hop >= 0 && hop < o->o_nhops ? o->o_rise[hop % HISTORY] : -HUGE_VAL);
+}
+
+	// decide on the hop two before the last one completed, now that its
+	// neighbours on both sides are known
+static void m5_onsets_pick(t_m5Onsets *o, long hop)
+{
+	double rise = m5_onsets_rise(o, hop);
+	long start;
+	if (hop < 0 || rise <= M5_ONSETS_RISE ||
+		o->o_level[hop % HISTORY] <= M5_ONSETS_GATE ||
+		hop - o->o_last < o->o_gap ||
+		rise <= m5_onsets_rise(o, hop - 1) ||
+		rise <= m5_onsets_rise(o, hop - 2) ||
+		rise < m5_onsets_rise(o, hop + 1) ||
+		rise < m5_onsets_rise(o, hop + 2))
+			return;
+		// an attack spread over several hops starts at the first of them
+	for (start = hop; start > hop - 2 && start - 1 > o->o_last &&
+		m5_onsets_rise(o, start - 1) > M5_ONSETS_RISE / 2; start--)
+			;
+	m5_onsetlist_add(&o->o_list, (long)(start * o->o_hop));
+	o->o_last = hop;
+}
+
+static void m5_onsets_hop(t_m5Onsets *o, double level)
+{
+	double base = 0;
+	int i;
+	for (i = 1; i <= BASEHOPS; i++)
+		base += o->o_level[(o->o_nhops - i + HISTORY) % HISTORY];
+	base /= BASEHOPS;
+	o->o_level[o->o_nhops % HISTORY] = level;
+	o->o_rise[o->o_nhops % HISTORY] = level - base;
+	o->o_nhops++;
+	m5_onsets_pick(o, o->o_nhops - 3);
+}
+
+void m5_onsets_process(t_m5Onsets *o, t_sample **vecs, size_t nframes)
+{
+	size_t done = 0, n, i;
+	int c;
+	while (done < nframes)
+	{
+		n = o->o_hop - o->o_fill;
+		if (n > nframes - done)
+			n = nframes - done;
+		for (c = 0; c < o->o_nchannels; c++)
+		{
+			const t_sample *v = vecs[c] + done;
+			t_sample prev = o->o_prev[c];
+			double acc = 0;
+			for (i = 0; i < n; i++)
+			{
+				double d = v[i] - prev;
+				acc += d * d;
+				prev = v[i];
+			}
+			o->o_prev[c] = prev;
+			o->o_acc += acc;
+		}
+		done += n;
+		if ((o->o_fill += n) == o->o_hop)
+		{
+			double level = 10. * log10(o->o_acc /
+				(o->o_hop * o->o_nchannels) + 1e-30);
+			m5_onsets_hop(o, level > LEVELFLOOR ? level : LEVELFLOOR);
+			o->o_acc = 0;
+			o->o_fill = 0;
+		}
+	}
+}
+
+void m5_onsets_result(t_m5Onsets *o, t_m5OnsetList *list)
+{
+		// the last two hops have no successors to compare with
+	m5_onsets_pick(o, o->o_nhops - 2);
+	m5_onsets_pick(o, o->o_nhops - 1);
+	*list = o->o_list;
+	memset(&o->o_list, 0, sizeof(o->o_list));
+}
+
+void m5_onsetlist_add(t_m5OnsetList *list, long frame)
+{
+	if (list->ol_n == list->ol_size)
+	{
+		size_t size = (list->ol_size ? 2 * list->ol_size : 64);
+		list->ol_frames = (long *)resizebytes(list->ol_frames,
+			list->ol_size * sizeof(long), size * sizeof(long));
+		list->ol_size = size;
+	}
+	list->ol_frames[list->ol_n++] = frame;
+}
+
+void m5_onsetlist_clear(t_m5OnsetList *list)
+{
+	if (list->ol_frames)
+		freebytes(list->ol_frames, list->ol_size * sizeof(long));
+	memset(list, 0, sizeof(*list));
+}
+
+/* ----- sidecar ----- */
+
+#define SIDECAREXT "m5onsets"
+#define SIDECARVERSION 1
+
+int m5_onsets_load(const char *path, const struct stat *st,
+	t_m5OnsetList *list)
+{
+	long frame, prev = -1;
+	unsigned long n, i;
+	FILE *fp;
+	if (!(fp = m5_sidecar_open(path, SIDECAREXT, SIDECARVERSION, st)))
+		return 0;
+	if (fscanf(fp, "%lu", &n) != 1)
+	{
+		sys_fclose(fp);
+		return 0;
+	}
+	for (i = 0; i < n && fscanf(fp, "%ld", &frame) == 1 &&
+		frame > prev; i++)
+			m5_onsetlist_add(list, prev = frame);
+	sys_fclose(fp);
+	if (list->ol_n != n)
+	{
+		m5_onsetlist_clear(list);
+		return 0;
+	}
+	return 1;
+}
+
+int m5_onsets_save(const char *path, const struct stat *st,
+	const t_m5OnsetList *list)
+{
+	char tmp[MAXPDSTRING];
+	size_t i;
+	FILE *fp;
+	if (!(fp = m5_sidecar_create(path, SIDECAREXT, SIDECARVERSION, st, tmp)))
+		return 0;
+		// the count, then one frame per line
+	fprintf(fp, "%lu\n", (unsigned long)list->ol_n);
+	for (i = 0; i < list->ol_n; i++)
+		fprintf(fp, "%ld\n", list->ol_frames[i]);
+	return m5_sidecar_commit(fp, path, SIDECAREXT, tmp, 1);
+}
@@ -0,0 +1,57 @@
+/* Copyright (c) 2025 Michael Spears.
+* For information on usage and redistribution, and for a DISCLAIMER OF ALL
+* WARRANTIES, see the file, "LICENSE.txt," in this distribution.  */
+
+#pragma once
+
+#include "m_pd.h"
+#include <stddef.h>
+#include <sys/stat.h>
+
+// Onsets of a whole file, for m5_readsf~ "open -onsets": the frames where
+// transients start, as slice points for loops.
+//
+// The detector follows the level of the file's high frequencies (the first
+// difference of each channel, all channels summed) in hops of 5 msec. A hop
+// is an onset where that level rises more than M5_ONSETS_RISE dB above the
+// hops before it, more than in its neighbours, above M5_ONSETS_GATE dB and
+// at least M5_ONSETS_GAP msec after the previous onset. Onsets are placed
+// at the start of the first hop of the rise, so a slice starts just before
+// its attack.
+//
+// Feed a t_m5Onsets all of a file's frames in order, one run of
+// deinterleaved vectors at a time, then take the list from it. Lists can
+// be kept in a sidecar, "<file>.m5onsets" (see m5_sidecar.h).
+
+#define M5_ONSETS_RISE 9.
+#define M5_ONSETS_GATE -60.
+#define M5_ONSETS_GAP 50.
+
+typedef struct _m5OnsetList
+{
+	long *ol_frames;    // ascending, from the start of the file
+	size_t ol_n;
+	size_t ol_size;     // allocated
+} t_m5OnsetList;
+
+typedef struct _m5Onsets t_m5Onsets;
+
+// returns NULL for channel counts or sample rates it can't handle
+t_m5Onsets *m5_onsets_new(int nchannels, double samplerate);
+void m5_onsets_free(t_m5Onsets *o);
+
+// scan the next nframes frames, vecs[c] holding channel c
+void m5_onsets_process(t_m5Onsets *o, t_sample **vecs, size_t nframes);
+
+// add the onsets of everything scanned to list, which must be empty
+void m5_onsets_result(t_m5Onsets *o, t_m5OnsetList *list);
+
+void m5_onsetlist_add(t_m5OnsetList *list, long frame);
+void m5_onsetlist_clear(t_m5OnsetList *list);
+
+// the sidecar for the file at path with status st: load returns 0 if
+// there is none or it is stale; save returns 0 on failure, quietly
+int m5_onsets_load(const char *path, const struct stat *st,
+	t_m5OnsetList *list);
+int m5_onsets_save(const char *path, const struct stat *st,
+	const t_m5OnsetList *list);
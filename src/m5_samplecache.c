@@ -0,0 +1,466 @@
+/* Copyright (c) 2025 Michael Spears.
+* For information on usage and redistribution, and for a DISCLAIMER OF ALL
+* WARRANTIES, see the file, "LICENSE.txt," in this distribution.  */
+
+#include <m_pd.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "m5_samplecache.h"
+#include "m5_bitcoder.h"
+#include "m5_sidecar.h"
+
+/*
+
+	losslessly compressed in-RAM sample cache for m5_readsf~
+
+*/
+
+	// the most channels a block codec handles, wider files are kept raw
+#define SAMPLEMAXCHANS 64
+
+	// residual partition size, each partition has its own Rice parameter
+#define SAMPLEPARTITION 256
+
+#define SAMPLEBLOCK_RAW   0
+#define SAMPLEBLOCK_CODED 1
+
+struct _m5SampleBank
+{
+	struct _m5SampleBank *b_next;
+		// identity
+	dev_t b_dev;
+	ino_t b_ino;
+	off_t b_size;
+	long long b_mtime;         // in nanoseconds, see m5_sidecar_mtime()
+	t_soundfile_type *b_type;
+	ssize_t b_headersize;
+	int b_nchannels;
+	int b_bytespersample;
+	int b_bigendian;
+		// data
+	size_t b_databytes;
+	long b_nblocks;
+	unsigned char **b_blocks;  // NULL where not read yet
+	size_t *b_blocksizes;
+	size_t b_used;             // bytes of blocks held
+	size_t b_raw;              // their size as samples
+	int b_refcount;
+	unsigned long b_stamp;     // LRU, last attach or detach
+};
+
+static pthread_mutex_t m5_samplecache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static t_m5SampleBank *m5_samplecache_banks = NULL;
+static size_t m5_samplecache_limit = (size_t)M5_SAMPLECACHE_DEFAULTMB << 20;
+static size_t m5_samplecache_used = 0;
+static unsigned long m5_samplecache_clock = 0;
+
+/* ----- block codec ----- */
+
+	// reads past the end see zeros
+typedef struct _m5BitReader
+{
+	const unsigned char *r_p;
+	const unsigned char *r_end;
+	uint64_t r_acc;            // next bits, left aligned
+	int r_nacc;
+} t_m5BitReader;
+
+static void m5_bitreader_fill(t_m5BitReader *r)
+{
+	while (r->r_nacc <= 56)
+	{
+		r->r_acc |= (uint64_t)(r->r_p < r->r_end ? *r->r_p++ : 0) <<
+			(56 - r->r_nacc);
+		r->r_nacc += 8;
+	}
+}
+
+static uint32_t m5_bitreader_get(t_m5BitReader *r, int n)
+{
+	uint32_t v;
+	if (!n)
+		return 0;
+	m5_bitreader_fill(r);
+	v = (uint32_t)(r->r_acc >> (64 - n));
+	r->r_acc <<= n;
+	r->r_nacc -= n;
+	return v;
+}
+
+static uint32_t m5_bitreader_unary(t_m5BitReader *r)
+{
+	uint32_t q = 0;
+	int z;
+	m5_bitreader_fill(r);
+	while (!r->r_acc)
+	{
+		if (r->r_p >= r->r_end)
+			return q; // corrupt, never written by us
+		q += r->r_nacc;
+		r->r_nacc = 0;
+		m5_bitreader_fill(r);
+	}
+	z = __builtin_clzll(r->r_acc);
+	r->r_acc <<= z;
+	r->r_acc <<= 1;
+	r->r_nacc -= z + 1;
+	return q + z;
+}
+
+static int32_t m5_sample_get(const unsigned char *p, int bytes, int big)
+{
+	if (bytes == 2)
+		return (int16_t)(big ? (p[0] << 8) | p[1] : (p[1] << 8) | p[0]);
+	return (int32_t)(big ?
+		((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) :
+		((uint32_t)p[2] << 24) | (p[1] << 16) | (p[0] << 8)) >> 8;
+}
+
+static void m5_sample_put(unsigned char *p, int32_t v, int bytes, int big)
+{
+	if (bytes == 2)
+	{
+		if (big)
+			p[0] = v >> 8, p[1] = v;
+		else p[0] = v, p[1] = v >> 8;
+	}
+	else if (big)
+		p[0] = v >> 16, p[1] = v >> 8, p[2] = v;
+	else p[0] = v, p[1] = v >> 8, p[2] = v >> 16;
+}
+
+	// code nframes interleaved frames of nch channels into out, which has
+	// room for as many bytes as the samples themselves. returns the coded
+	// size, or 0 if coding doesn't make the block smaller.
+static size_t m5_sampleblock_encode(const unsigned char *pcm, int nframes,
+	int nch, int bytes, int big, unsigned char *out, size_t outsize)
+{
+	t_m5BitWriter w;
+	int32_t x[M5_SAMPLEBLOCK], res[M5_SAMPLEBLOCK];
+	int bps = bytes * 8, bpf = nch * bytes, ch, i;
+
+	if ((bytes != 2 && bytes != 3) || nch > SAMPLEMAXCHANS || nframes < 4)
+		return 0;
+	m5_bitwriter_init(&w, out, outsize);
+	m5_bitwriter_put(&w, SAMPLEBLOCK_CODED, 8);
+	for (ch = 0; ch < nch && !w.w_full; ch++)
+	{
+		int order, start;
+		for (i = 0; i < nframes; i++)
+			x[i] = m5_sample_get(pcm + i * bpf + ch * bytes, bytes, big);
+
+			// the fixed predictor with the smallest residual, up to the
+			// order that fits in 2 bits
+		order = m5_fixed_order(x, nframes, 3);
+		m5_fixed_residual(x, nframes, order, res);
+
+		m5_bitwriter_put(&w, order, 2);
+		for (i = 0; i < order; i++)
+			m5_bitwriter_put(&w, x[i], bps);
+		for (start = order; start < nframes; )
+		{
+			int end = (start / SAMPLEPARTITION + 1) * SAMPLEPARTITION, k;
+			uint64_t bits;
+			if (end > nframes)
+				end = nframes;
+			k = m5_rice_param(res, start, end, &bits);
+			m5_bitwriter_put(&w, k, 5);
+			for (i = start; i < end && !w.w_full; i++)
+				m5_bitwriter_rice(&w, res[i], k);
+			start = end;
+		}
+	}
+	m5_bitwriter_align(&w);
+	if (w.w_full || w.w_pos >= outsize)
+		return 0;
+	return w.w_pos;
+}
+
+static void m5_sampleblock_decode(const unsigned char *in, size_t size,
+	int nframes, int nch, int bytes, int big, unsigned char *pcm)
+{
+	t_m5BitReader r = {in + 1, in + size, 0, 0};
+	int32_t x[M5_SAMPLEBLOCK];
+	int bps = bytes * 8, bpf = nch * bytes, ch, i;
+
+	if (in[0] == SAMPLEBLOCK_RAW)
+	{
+		memcpy(pcm, in + 1, size - 1);
+		return;
+	}
+	for (ch = 0; ch < nch; ch++)
+	{
+		int order = m5_bitreader_get(&r, 2), start;
+		for (i = 0; i < order; i++)
+			x[i] = (int32_t)(m5_bitreader_get(&r, bps) << (32 - bps)) >>
+				(32 - bps);
+		for (start = order; start < nframes; )
+		{
+			int end = (start / SAMPLEPARTITION + 1) * SAMPLEPARTITION,
+				k = m5_bitreader_get(&r, 5);
+			if (end > nframes)
+				end = nframes;
+			for (i = start; i < end; i++)
+			{
+				uint32_t z = (m5_bitreader_unary(&r) << k) |
+					m5_bitreader_get(&r, k);
+				int32_t e = (int32_t)(z >> 1) ^ -(int32_t)(z & 1);
+				x[i] = (int32_t)(e + m5_fixed_predict(x, i, order));
+			}
+			start = end;
+		}
+		for (i = 0; i < nframes; i++)
+			m5_sample_put(pcm + i * bpf + ch * bytes, x[i], bytes, big);
+	}
+}
+
+/* ----- banks ----- */
+
+static void m5_samplebank_free(t_m5SampleBank *b)
+{
+	long i;
+	for (i = 0; i < b->b_nblocks; i++)
+		if (b->b_blocks[i])
+			freebytes(b->b_blocks[i], b->b_blocksizes[i]);
+	freebytes(b->b_blocks, b->b_nblocks * sizeof(unsigned char *));
+	freebytes(b->b_blocksizes, b->b_nblocks * sizeof(size_t));
+	m5_samplecache_used -= b->b_used;
+	freebytes(b, sizeof(t_m5SampleBank));
+}
+
+	// drop unused banks, oldest first, until need more bytes fit.
+	// called with the mutex held. returns 1 if they fit.
+static int m5_samplecache_makeroom(size_t need)
+{
+	while (m5_samplecache_used + need > m5_samplecache_limit)
+	{
+		t_m5SampleBank **bp, **oldest = NULL, *b;
+		for (bp = &m5_samplecache_banks; *bp; bp = &(*bp)->b_next)
+			if (!(*bp)->b_refcount &&
+				(!oldest || (*bp)->b_stamp < (*oldest)->b_stamp))
+					oldest = bp;
+		if (!oldest)
+			return 0;
+		b = *oldest;
+		*oldest = b->b_next;
+		m5_samplebank_free(b);
+	}
+	return 1;
+}
+
+int m5_samplereader_attach(t_m5SampleReader *r, const t_soundfile *sf,
+	size_t databytes)
+{
+	t_m5SampleBank *b;
+	struct stat st;
+	long long mtime;
+	size_t blockbytes = (size_t)M5_SAMPLEBLOCK * sf->sf_bytesperframe;
+	char *buf;
+
+	m5_samplereader_detach(r);
+	if (sf->sf_fd < 0 || sf->sf_stream || !databytes ||
+		databytes >= (size_t)SFMAXBYTES - 1 || fstat(sf->sf_fd, &st) < 0)
+			return 0;
+	if (!(buf = (char *)getbytes(blockbytes)))
+		return 0;
+	mtime = m5_sidecar_mtime(&st);
+	pthread_mutex_lock(&m5_samplecache_mutex);
+	for (b = m5_samplecache_banks; b; b = b->b_next)
+		if (b->b_dev == st.st_dev && b->b_ino == st.st_ino &&
+			b->b_size == st.st_size && b->b_mtime == mtime &&
+			b->b_type == sf->sf_type &&
+			b->b_headersize == sf->sf_headersize &&
+			b->b_nchannels == sf->sf_nchannels &&
+			b->b_bytespersample == sf->sf_bytespersample &&
+			b->b_bigendian == sf->sf_bigendian &&
+			b->b_databytes == databytes)
+				break;
+	if (!b)
+	{
+		long nblocks = (databytes + blockbytes - 1) / blockbytes;
+		unsigned char **blocks = (unsigned char **)getbytes(nblocks *
+			sizeof(unsigned char *));
+		size_t *blocksizes = (size_t *)getbytes(nblocks * sizeof(size_t));
+		if (!blocks || !blocksizes ||
+			!(b = (t_m5SampleBank *)getbytes(sizeof(t_m5SampleBank))))
+		{
+			pthread_mutex_unlock(&m5_samplecache_mutex);
+			if (blocks)
+				freebytes(blocks, nblocks * sizeof(unsigned char *));
+			if (blocksizes)
+				freebytes(blocksizes, nblocks * sizeof(size_t));
+			freebytes(buf, blockbytes);
+			return 0;
+		}
+		b->b_dev = st.st_dev;
+		b->b_ino = st.st_ino;
+		b->b_size = st.st_size;
+		b->b_mtime = mtime;
+		b->b_type = sf->sf_type;
+		b->b_headersize = sf->sf_headersize;
+		b->b_nchannels = sf->sf_nchannels;
+		b->b_bytespersample = sf->sf_bytespersample;
+		b->b_bigendian = sf->sf_bigendian;
+		b->b_databytes = databytes;
+		b->b_nblocks = nblocks;
+		b->b_blocks = blocks;
+		b->b_blocksizes = blocksizes;
+		b->b_next = m5_samplecache_banks;
+		m5_samplecache_banks = b;
+	}
+	b->b_refcount++;
+	b->b_stamp = ++m5_samplecache_clock;
+	pthread_mutex_unlock(&m5_samplecache_mutex);
+
+	r->r_bank = b;
+	r->r_bufsize = blockbytes;
+	r->r_buf = buf;
+	r->r_block = -1;
+	r->r_bytes = 0;
+	return 1;
+}
+
+void m5_samplereader_detach(t_m5SampleReader *r)
+{
+	if (!r->r_bank)
+		return;
+	pthread_mutex_lock(&m5_samplecache_mutex);
+	r->r_bank->b_refcount--;
+	r->r_bank->b_stamp = ++m5_samplecache_clock;
+	pthread_mutex_unlock(&m5_samplecache_mutex);
+	freebytes(r->r_buf, r->r_bufsize);
+	r->r_bank = NULL;
+	r->r_buf = NULL;
+	r->r_bufsize = 0;
+	r->r_block = -1;
+	r->r_bytes = 0;
+}
+
+	// keep the block just read from the file in r_buf, if there's room
+static void m5_samplereader_store(t_m5SampleReader *r, long block)
+{
+	t_m5SampleBank *b = r->r_bank;
+	int nframes = r->r_bytes / (b->b_nchannels * b->b_bytespersample);
+	unsigned char *code = (unsigned char *)getbytes(r->r_bytes + 1), *keep;
+	size_t size;
+	if (!code)
+		return;
+	size = m5_sampleblock_encode((unsigned char *)r->r_buf, nframes,
+		b->b_nchannels, b->b_bytespersample, b->b_bigendian, code,
+		r->r_bytes + 1);
+	if (!size)
+	{
+		code[0] = SAMPLEBLOCK_RAW;
+		memcpy(code + 1, r->r_buf, r->r_bytes);
+		size = r->r_bytes + 1;
+	}
+	if ((keep = (unsigned char *)getbytes(size)))
+		memcpy(keep, code, size);
+	freebytes(code, r->r_bytes + 1);
+	if (!keep)
+		return;
+
+	pthread_mutex_lock(&m5_samplecache_mutex);
+	if (!b->b_blocks[block] && m5_samplecache_makeroom(size))
+	{
+		b->b_blocks[block] = keep;
+		b->b_blocksizes[block] = size;
+		b->b_used += size;
+		b->b_raw += r->r_bytes;
+		m5_samplecache_used += size;
+		keep = NULL;
+	}
+	pthread_mutex_unlock(&m5_samplecache_mutex);
+	if (keep)
+		freebytes(keep, size);
+}
+
+	// get a block into r_buf, from RAM or from the file
+static int m5_samplereader_load(t_m5SampleReader *r, t_soundfile *sf,
+	long block)
+{
+	t_m5SampleBank *b = r->r_bank;
+	size_t len = b->b_databytes - (size_t)block * r->r_bufsize;
+	unsigned char *data;
+	size_t size;
+	ssize_t got;
+
+	if (len > r->r_bufsize)
+		len = r->r_bufsize;
+		// a stored block never changes or goes away while we're attached
+	pthread_mutex_lock(&m5_samplecache_mutex);
+	data = b->b_blocks[block];
+	size = b->b_blocksizes[block];
+	pthread_mutex_unlock(&m5_samplecache_mutex);
+	if (data)
+	{
+		m5_sampleblock_decode(data, size, len / (b->b_nchannels *
+			b->b_bytespersample), b->b_nchannels, b->b_bytespersample,
+			b->b_bigendian, (unsigned char *)r->r_buf);
+		r->r_block = block;
+		r->r_bytes = len;
+		return 0;
+	}
+	got = m5_soundfile_read(sf, b->b_headersize + (off_t)block * r->r_bufsize,
+		r->r_buf, len);
+	if (got < 0)
+	{
+		r->r_block = -1;
+		return -1;
+	}
+	r->r_block = block;
+	r->r_bytes = got;
+	if ((size_t)got == len)
+		m5_samplereader_store(r, block);
+	return 0;
+}
+
+ssize_t m5_samplereader_read(t_m5SampleReader *r, t_soundfile *sf,
+	off_t offset, void *dst, size_t size)
+{
+	t_m5SampleBank *b = r->r_bank;
+	char *out = (char *)dst;
+	size_t done = 0;
+
+	if (!b || offset < b->b_headersize)
+		return m5_soundfile_read(sf, offset, dst, size);
+	while (done < size)
+	{
+		size_t rel = offset + done - b->b_headersize, within, n;
+		long block = rel / r->r_bufsize;
+		if (rel >= b->b_databytes)
+			break;
+		if (block != r->r_block && m5_samplereader_load(r, sf, block) < 0)
+			return (done ? (ssize_t)done : -1);
+		within = rel % r->r_bufsize;
+		if (within >= r->r_bytes)
+			break;
+		n = r->r_bytes - within;
+		if (n > size - done)
+			n = size - done;
+		memcpy(out + done, r->r_buf + within, n);
+		done += n;
+	}
+	return done;
+}
+
+void m5_samplecache_setlimit(size_t bytes)
+{
+	pthread_mutex_lock(&m5_samplecache_mutex);
+	m5_samplecache_limit = bytes;
+	m5_samplecache_makeroom(0);
+	pthread_mutex_unlock(&m5_samplecache_mutex);
+}
+
+void m5_samplecache_usage(size_t *used, size_t *raw)
+{
+	t_m5SampleBank *b;
+	pthread_mutex_lock(&m5_samplecache_mutex);
+	*used = m5_samplecache_used;
+	*raw = 0;
+	for (b = m5_samplecache_banks; b; b = b->b_next)
+		*raw += b->b_raw;
+	pthread_mutex_unlock(&m5_samplecache_mutex);
+}
@@ -0,0 +1,59 @@
+/* Copyright (c) 2025 Michael Spears.
+* For information on usage and redistribution, and for a DISCLAIMER OF ALL
+* WARRANTIES, see the file, "LICENSE.txt," in this distribution.  */
+
+#pragma once
+
+#include "m5_soundfile.h"
+
+// Process-wide in-RAM copy of sound files' data for m5_readsf~
+// ("open -ram"), held losslessly compressed so that more material fits
+// than as raw samples.
+//
+// A file's sound data is cut into blocks of M5_SAMPLEBLOCK frames, in the
+// file's own sample format. Integer samples (2 and 3 bytes) are stored
+// with a fixed predictor per channel and a Rice coded residual; anything
+// that doesn't shrink, float samples included, is stored as it is.
+// Blocks are filled the first time they are read from disk and decoded
+// again on every read after that, in the reader's I/O thread.
+//
+// Files are identified by device, inode, size, modification time (to the
+// nanosecond where the platform keeps it) and sample format, so a
+// rewritten file is never served from stale blocks.
+// When the cache is full, files that no reader is attached to are
+// dropped, least recently used first; if that isn't enough, new blocks
+// are simply read from disk without being kept.
+
+#define M5_SAMPLEBLOCK 4096
+
+#define M5_SAMPLECACHE_DEFAULTMB 256
+
+typedef struct _m5SampleBank t_m5SampleBank;
+
+// One reader's view of a bank, with the block it decoded last.
+typedef struct _m5SampleReader
+{
+	t_m5SampleBank *r_bank;  // NULL: not attached
+	char *r_buf;             // one decoded block
+	size_t r_bufsize;
+	long r_block;            // block in r_buf, or -1
+	size_t r_bytes;          // valid bytes in r_buf
+} t_m5SampleReader;
+
+// attach to the bank for the open file sf, whose sound data is databytes
+// long after sf_headersize. returns 0 for files that can't be cached
+// (streams, unknown lengths).
+int m5_samplereader_attach(t_m5SampleReader *r, const t_soundfile *sf,
+	size_t databytes);
+void m5_samplereader_detach(t_m5SampleReader *r);
+
+// as m5_soundfile_read(), serving blocks from RAM and keeping the ones it
+// had to read from the file
+ssize_t m5_samplereader_read(t_m5SampleReader *r, t_soundfile *sf,
+	off_t offset, void *dst, size_t size);
+
+// set the most RAM all banks together may hold
+void m5_samplecache_setlimit(size_t bytes);
+
+// RAM held and the raw size of what it holds, for reports
+void m5_samplecache_usage(size_t *used, size_t *raw);
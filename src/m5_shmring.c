@@ -0,0 +1,161 @@
+/* Copyright (c) 2025 Michael Spears.
+* For information on usage and redistribution, and for a DISCLAIMER OF ALL
+* WARRANTIES, see the file, "LICENSE.txt," in this distribution.  */
+
+#include <m_pd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include "m5_shmring.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/*
+
+	shared-memory ring input for m5_readsf~
+
+*/
+
+#ifndef _WIN32
+
+t_m5ShmRing *m5_shmring_open(const char *name)
+{
+	t_m5ShmRing *r;
+	t_m5ShmRingHeader *h;
+	struct stat st;
+	char path[MAXPDSTRING];
+	void *map;
+	int fd;
+
+	// POSIX shm names start with a single slash
+	if (snprintf(path, MAXPDSTRING, "%s%s", (*name == '/' ? "" : "/"),
+		name) >= MAXPDSTRING)
+	{
+		errno = ENAMETOOLONG;
+		return NULL;
+	}
+	if ((fd = shm_open(path, O_RDONLY, 0)) < 0)
+		return NULL;
+	if (fstat(fd, &st) < 0)
+	{
+		close(fd);
+		return NULL;
+	}
+	if ((size_t)st.st_size < sizeof(t_m5ShmRingHeader))
+	{
+		close(fd);
+		errno = EINVAL;
+		return NULL;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return NULL;
+
+	// validate the layout before trusting any of it
+	h = (t_m5ShmRingHeader *)map;
+	if (h->r_magic != M5_SHMRING_MAGIC || h->r_version != M5_SHMRING_VERSION ||
+		h->r_format != M5_SHMRING_FLOAT32 || h->r_nchannels < 1 ||
+		h->r_capacity < 4 || h->r_capacity > ((size_t)st.st_size -
+			sizeof(t_m5ShmRingHeader)) / (h->r_nchannels * sizeof(float)))
+	{
+		munmap(map, st.st_size);
+		errno = EINVAL;
+		return NULL;
+	}
+	r = (t_m5ShmRing *)getbytes(sizeof(t_m5ShmRing));
+	r->r_header = h;
+	r->r_data = (float *)(h + 1);
+	r->r_mapsize = st.st_size;
+	snprintf(r->r_name, MAXPDSTRING, "%s", path);
+	return r;
+}
+
+void m5_shmring_close(t_m5ShmRing *r)
+{
+	if (!r)
+		return;
+	munmap(r->r_header, r->r_mapsize);
+	freebytes(r, sizeof(t_m5ShmRing));
+}
+
+#else /* _WIN32 */
+
+t_m5ShmRing *m5_shmring_open(const char *name)
+{
+	errno = ENOSYS;
+	return NULL;
+}
+
+void m5_shmring_close(t_m5ShmRing *r)
+{
+}
+
+#endif /* _WIN32 */
+
+double m5_shmring_starttime(const t_m5ShmRing *r)
+{
+	return ((volatile t_m5ShmRingHeader *)r->r_header)->r_starttime;
+}
+
+	// oldest stream frame that can still be trusted when the producer
+	// has published 'written' frames
+static int64_t m5_shmring_oldest(const t_m5ShmRing *r, uint64_t written)
+{
+	return (int64_t)written - (int64_t)(r->r_header->r_capacity -
+		r->r_header->r_capacity / 4);
+}
+
+size_t m5_shmring_read(t_m5ShmRing *r, int64_t frame, int nvecs,
+	t_sample **vecs, size_t offset, size_t nframes)
+{
+	const t_m5ShmRingHeader *h = r->r_header;
+	uint64_t capacity = h->r_capacity, written;
+	int nchannels = h->r_nchannels, ncopy = (nvecs < nchannels ? nvecs : nchannels);
+	int64_t first, last, oldest, f;
+	size_t i;
+	int c;
+
+	written = __atomic_load_n(&h->r_writeframe, __ATOMIC_ACQUIRE);
+	first = frame;
+	last = frame + (int64_t)nframes;
+	oldest = m5_shmring_oldest(r, written);
+	if (first < oldest) first = oldest;
+	if (first < 0) first = 0;
+	if (last > (int64_t)written) last = written;
+
+	for (f = frame; f < frame + (int64_t)nframes; f++)
+	{
+		i = offset + (f - frame);
+		if (f >= first && f < last)
+		{
+			const float *src = r->r_data + (f % capacity) * nchannels;
+			for (c = 0; c < ncopy; c++)
+				vecs[c][i] = src[c];
+		}
+		else for (c = 0; c < ncopy; c++)
+			vecs[c][i] = 0;
+		for (c = ncopy; c < nvecs; c++)
+			vecs[c][i] = 0;
+	}
+	if (first >= last)
+		return 0;
+
+	// the producer may have lapped us while copying; drop what it reached
+	written = __atomic_load_n(&h->r_writeframe, __ATOMIC_ACQUIRE);
+	oldest = m5_shmring_oldest(r, written);
+	for (f = first; f < oldest && f < last; f++)
+	{
+		i = offset + (f - frame);
+		for (c = 0; c < ncopy; c++)
+			vecs[c][i] = 0;
+	}
+	if (first < oldest)
+		first = (oldest < last ? oldest : last);
+	return last - first;
+}
@@ -0,0 +1,62 @@
+/* Copyright (c) 2025 Michael Spears.
+* For information on usage and redistribution, and for a DISCLAIMER OF ALL
+* WARRANTIES, see the file, "LICENSE.txt," in this distribution.  */
+
+#pragma once
+
+#include "m_pd.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Shared-memory ring that an external producer fills with interleaved
+// frames for m5_readsf~ ("open -shm name"). The POSIX shared memory
+// object holds one t_m5ShmRingHeader followed by r_capacity frames of
+// r_nchannels native-endian 32-bit floats.
+//
+// Stream frame n lives at ring frame (n % r_capacity). The producer
+// writes the frames first, then stores the new total in r_writeframe
+// with release ordering. It must not write more than a quarter of the
+// ring between two stores; the reader only trusts the newest 3/4.
+//
+// r_starttime is an optional FTC stamp, in frames on the reader's time
+// anchor: stream frame 0 belongs at that time. Set it < 0 if unused.
+
+#define M5_SHMRING_MAGIC 0x4e52354d /* "M5RN" */
+#define M5_SHMRING_VERSION 1
+#define M5_SHMRING_FLOAT32 1
+
+typedef struct _m5ShmRingHeader
+{
+	uint32_t r_magic;
+	uint32_t r_version;
+	uint32_t r_format;
+	uint32_t r_nchannels;
+	uint32_t r_samplerate;
+	uint32_t r_pad;
+	uint64_t r_capacity;
+	uint64_t r_writeframe;
+	double r_starttime;
+	char r_reserved[16];
+} t_m5ShmRingHeader;
+
+// A mapped ring, owned by the reader.
+typedef struct _m5ShmRing
+{
+	t_m5ShmRingHeader *r_header;
+	float *r_data;
+	size_t r_mapsize;
+	char r_name[MAXPDSTRING];
+} t_m5ShmRing;
+
+// map a ring by name, returns NULL and sets errno on failure
+t_m5ShmRing *m5_shmring_open(const char *name);
+void m5_shmring_close(t_m5ShmRing *r);
+
+// producer's start stamp, or < 0 if not set
+double m5_shmring_starttime(const t_m5ShmRing *r);
+
+// copy stream frames [frame, frame + nframes) into vecs at offset,
+// writing silence where the producer is behind or has overwritten them.
+// returns the number of frames that were available.
+size_t m5_shmring_read(t_m5ShmRing *r, int64_t frame, int nvecs,
+	t_sample **vecs, size_t offset, size_t nframes);
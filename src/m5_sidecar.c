@@ -0,0 +1,88 @@
+/* Copyright (c) 2025 Michael Spears.
+* For information on usage and redistribution, and for a DISCLAIMER OF ALL
+* WARRANTIES, see the file, "LICENSE.txt," in this distribution.  */
+
+#include <m_pd.h>
+#include <stdio.h>
+#include <string.h>
+#include "m5_sidecar.h"
+
+/*
+
+	analysis results kept next to sound files
+
+*/
+
+long long m5_sidecar_mtime(const struct stat *st)
+{
+#if defined(__APPLE__)
+	return (long long)st->st_mtimespec.tv_sec * 1000000000LL +
+		st->st_mtimespec.tv_nsec;
+#elif defined(_WIN32)
+	return (long long)st->st_mtime * 1000000000LL;
+#else
+	return (long long)st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec;
+#endif
+}
+
+static int m5_sidecar_path(char *buf, const char *path, const char *ext)
+{
+	return (snprintf(buf, MAXPDSTRING, "%s.%s", path, ext) < MAXPDSTRING);
+}
+
+FILE *m5_sidecar_open(const char *path, const char *ext, int version,
+	const struct stat *st)
+{
+	char name[MAXPDSTRING], magic[16];
+	unsigned long long ino;
+	long long size, mtime;
+	int v;
+	FILE *fp;
+	if (!m5_sidecar_path(name, path, ext) || !(fp = sys_fopen(name, "r")))
+		return NULL;
+	if (fscanf(fp, "%15s %d %llu %lld %lld", magic, &v, &ino, &size,
+		&mtime) == 5 && !strcmp(magic, ext) && v == version &&
+		ino == (unsigned long long)st->st_ino &&
+		size == (long long)st->st_size && mtime == m5_sidecar_mtime(st))
+			return fp;
+	sys_fclose(fp);
+	return NULL;
+}
+
+FILE *m5_sidecar_create(const char *path, const char *ext, int version,
+	const struct stat *st, char *tmp)
+{
+	char name[MAXPDSTRING];
+	FILE *fp;
+	if (!m5_sidecar_path(name, path, ext) ||
+		snprintf(tmp, MAXPDSTRING, "%s~", name) >= MAXPDSTRING ||
+		!(fp = sys_fopen(tmp, "w")))
+			return NULL;
+	if (fprintf(fp, "%s %d %llu %lld %lld\n", ext, version,
+		(unsigned long long)st->st_ino, (long long)st->st_size,
+		m5_sidecar_mtime(st)) < 0)
+	{
+		sys_fclose(fp);
+		remove(tmp);
+		return NULL;
+	}
+	return fp;
+}
+
+int m5_sidecar_commit(FILE *fp, const char *path, const char *ext,
+	const char *tmp, int ok)
+{
+	char name[MAXPDSTRING];
+	ok = (!ferror(fp) && ok);
+	ok = (sys_fclose(fp) == 0 && ok);
+	ok = (ok && m5_sidecar_path(name, path, ext));
+		// rename() won't replace an existing file everywhere
+	if (ok && rename(tmp, name) < 0)
+	{
+		remove(name);
+		ok = (rename(tmp, name) == 0);
+	}
+	if (!ok)
+		remove(tmp);
+	return ok;
+}
@@ -0,0 +1,36 @@
+/* Copyright (c) 2025 Michael Spears.
+* For information on usage and redistribution, and for a DISCLAIMER OF ALL
+* WARRANTIES, see the file, "LICENSE.txt," in this distribution.  */
+
+#pragma once
+
+#include "m_pd.h"
+#include <stdio.h>
+#include <sys/stat.h>
+
+// Sidecars: small text files next to a sound file, "<file>.<ext>", that
+// keep what a background analysis found so the next open needn't redo it.
+// Each starts with a key, "<ext> <version> <inode> <size> <mtime>", the
+// mtime in nanoseconds, and is only used while the sound file's inode,
+// size and modification time still match, so a file renamed over the old
+// one or rewritten within the same second isn't taken for it.
+// A new one is written under a temporary name and then renamed over the
+// old one, so readers never see half a file.
+
+// the modification time in st, in nanoseconds where the platform keeps them
+long long m5_sidecar_mtime(const struct stat *st);
+
+// open the sidecar of the file at path with status st, positioned after
+// its key; NULL if there is none or it is stale. close with sys_fclose().
+FILE *m5_sidecar_open(const char *path, const char *ext, int version,
+	const struct stat *st);
+
+// start a new sidecar with its key written; tmp (MAXPDSTRING) receives
+// the temporary name for m5_sidecar_commit(). NULL on failure.
+FILE *m5_sidecar_create(const char *path, const char *ext, int version,
+	const struct stat *st, char *tmp);
+
+// close fp and, if ok and everything was written, put it in place.
+// returns 0 on failure, having removed the temporary file.
+int m5_sidecar_commit(FILE *fp, const char *path, const char *ext,
+	const char *tmp, int ok);
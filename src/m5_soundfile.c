@@ -16,6 +16,16 @@ objects use Posix-like threads. */
 #include "m5_soundfile.h"
 #include "m5_timeanchor.h"
 #include "m5_timeanchor.h"
+#include "m5_shmring.h"
+#include "m5_samplecache.h"
+#include "m5_checksum.h"
+#include "m5_worker.h"
+#include "m5_loudness.h"
+#include "m5_onsets.h"
+#include "m5_sidecar.h"
+#include "m5_soundfile_edit.h"
+#include "m5_soundfile_convert.h"
+#include "m5_grains.h"
 #include "g_canvas.h"
 #include "s_stuff.h"
 #include <float.h>
@@ -23,10 +33,14 @@ objects use Posix-like threads. */
 #include <math.h>
 #ifdef _WIN32
 #include <io.h>
+#include <windows.h>
+#else
+#include <sys/mman.h>
 #endif
 #include <fcntl.h>
 #include <stdio.h>
 #include <pthread.h>
+#include <sys/stat.h>
 
 #include <m_pd.h>
 
@@ -36,6 +50,8 @@ objects use Posix-like threads. */
 
 #define MAXSFCHANS 64
 
+#define MAXLOOKAHEAD 16384 /* frames readsf~ -lookahead may run ahead */
+
 /* GLIBC large file support */
 #ifdef _LARGEFILE64_SOURCE
 #define open open64
@@ -95,6 +111,128 @@ int m5_soundfile_needsbyteswap(const t_soundfile *sf)
 	return sf->sf_bigendian != m5_sys_isbigendian();
 }
 
+int m5_soundfile_isseekable(const t_soundfile *sf)
+{
+	return !sf->sf_stream;
+}
+
+	/** set up stream history for a non-seekable fd, returns 1 on success */
+static int m5_soundfile_stream_new(t_soundfile *sf)
+{
+	t_soundfile_stream *ss = (t_soundfile_stream *)getbytes(sizeof(*ss));
+	if (!ss)
+		return 0;
+	if (!(ss->ss_buf = getbytes(SFSTREAMHISTORY)))
+	{
+		freebytes(ss, sizeof(*ss));
+		return 0;
+	}
+	ss->ss_size = SFSTREAMHISTORY;
+	ss->ss_start = ss->ss_end = 0;
+	ss->ss_eof = 0;
+	sf->sf_stream = ss;
+	return 1;
+}
+
+static void m5_soundfile_stream_free(t_soundfile *sf)
+{
+	t_soundfile_stream *ss = sf->sf_stream;
+	if (!ss)
+		return;
+	freebytes(ss->ss_buf, ss->ss_size);
+	freebytes(ss, sizeof(*ss));
+	sf->sf_stream = NULL;
+}
+
+	/** serve a read from the stream history, reading forward from the fd
+		until the requested range has arrived or the stream ends */
+static ssize_t m5_soundfile_stream_read(t_soundfile *sf, off_t offset,
+	char *dst, size_t size)
+{
+	t_soundfile_stream *ss = sf->sf_stream;
+	size_t copied = 0;
+	if (size > ss->ss_size)
+		size = ss->ss_size;
+	while (ss->ss_end < offset + (off_t)size && !ss->ss_eof)
+	{
+		size_t pos = ss->ss_end % ss->ss_size, want = ss->ss_size - pos;
+		ssize_t got;
+			/* don't push the requested offset out of the history */
+		if (offset > ss->ss_start &&
+			(off_t)want > offset - ss->ss_start + (off_t)ss->ss_size -
+				(ss->ss_end - ss->ss_start))
+					want = offset - ss->ss_start + ss->ss_size -
+						(ss->ss_end - ss->ss_start);
+		got = read(sf->sf_fd, ss->ss_buf + pos, want);
+		if (got < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (got == 0)
+		{
+			ss->ss_eof = 1;
+			break;
+		}
+		ss->ss_end += got;
+		if (ss->ss_end - ss->ss_start > (off_t)ss->ss_size)
+			ss->ss_start = ss->ss_end - ss->ss_size;
+	}
+	if (offset < ss->ss_start)
+	{
+		errno = ESPIPE;
+		return -1;
+	}
+	while (offset < ss->ss_end && copied < size)
+	{
+		size_t pos = offset % ss->ss_size, n = ss->ss_size - pos;
+		if (n > size - copied)
+			n = size - copied;
+		if ((off_t)n > ss->ss_end - offset)
+			n = ss->ss_end - offset;
+		memcpy(dst + copied, ss->ss_buf + pos, n);
+		copied += n;
+		offset += n;
+	}
+	return copied;
+}
+
+ssize_t m5_soundfile_readraw(t_soundfile *sf, off_t offset, void *dst,
+	size_t size)
+{
+	if (sf->sf_stream)
+		return m5_soundfile_stream_read(sf, offset, (char *)dst, size);
+	return m5_fd_read(sf->sf_fd, offset, dst, size);
+}
+
+ssize_t m5_soundfile_read(t_soundfile *sf, off_t offset, void *dst,
+	size_t size)
+{
+	if (sf->sf_decoder)
+		return sf->sf_type->t_decodefn(sf, offset, dst, size);
+	return m5_soundfile_readraw(sf, offset, dst, size);
+}
+
+ssize_t m5_soundfile_write(t_soundfile *sf, const void *src, size_t size)
+{
+	if (sf->sf_encoder)
+		return sf->sf_type->t_encodefn(sf, src, size);
+	return write(sf->sf_fd, src, size);
+}
+
+void m5_soundfile_close(t_soundfile *sf)
+{
+	if (sf->sf_decoder)
+		sf->sf_type->t_freedecoderfn(sf);
+	if (sf->sf_encoder)
+		sf->sf_type->t_freeencoderfn(sf);
+	if (sf->sf_fd >= 0)
+		sys_close(sf->sf_fd);
+	sf->sf_fd = -1;
+	m5_soundfile_stream_free(sf);
+}
+
 const char* m5_soundfile_strerror(int errnum)
 {
 	switch (errnum)
@@ -141,7 +279,7 @@ static void m5_object_sferror(const void *x, const char *header,
 /* ----- soundfile type ----- */
 
 // #define SFMAXTYPES 4
-#define SFMAXTYPES 1
+#define SFMAXTYPES 2
 
 /* should these globals be PERTHREAD? */
 
@@ -160,6 +298,7 @@ static char m5_sf_typeargs[MAXPDSTRING] = {0};
 
 	/* built-in type implementations */
 void m5_soundfile_wave_setup(void);
+void m5_soundfile_flac_setup(void);
 // void soundfile_aiff_setup(void);
 // void soundfile_caf_setup(void);
 // void soundfile_next_setup(void);
@@ -168,6 +307,7 @@ void m5_soundfile_wave_setup(void);
 void m5_soundfile_type_setup(void)
 {
 	m5_soundfile_wave_setup(); /* default first */
+	m5_soundfile_flac_setup();
 	// soundfile_aiff_setup();
 	// soundfile_caf_setup();
 	// soundfile_next_setup();
@@ -202,8 +342,7 @@ static t_soundfile_type **m5_soundfile_nexttype(t_soundfile_type **t)
 	return (t == &m5_sf_types[m5_sf_numtypes-1] ? NULL : ++t);
 }
 
-	/** find type by name, returns NULL if not found */
-static t_soundfile_type *m5_soundfile_findtype(const char *name)
+t_soundfile_type *m5_soundfile_findtype(const char *name)
 {
 	t_soundfile_type **t = m5_soundfile_firsttype();
 	while (t)
@@ -215,6 +354,18 @@ static t_soundfile_type *m5_soundfile_findtype(const char *name)
 	return (t ? *t : NULL);
 }
 
+t_soundfile_type *m5_soundfile_typeforfile(const char *filename)
+{
+	t_soundfile_type **t = m5_soundfile_firsttype();
+	while (t)
+	{
+		if ((*t)->t_hasextensionfn(filename, MAXPDSTRING))
+			break;
+		t = m5_soundfile_nexttype(t);
+	}
+	return (t ? *t : NULL);
+}
+
 /* ----- ASCII ----- */
 
 	/** compound ascii read/write args  */
@@ -359,21 +510,33 @@ int m5_open_soundfile_via_fd(int fd, t_soundfile *sf, size_t skipframes)
 {
 	off_t offset;
 	errno = 0;
+	sf->sf_stream = NULL;
+	sf->sf_decoder = NULL;
+		/* pipes and FIFOs can't seek, so read them through a history */
+	if (lseek(fd, 0, SEEK_CUR) < 0 && errno == ESPIPE)
+	{
+		if (!m5_soundfile_stream_new(sf))
+			goto badheader;
+		errno = 0;
+	}
+	sf->sf_fd = fd;
 	if (sf->sf_headersize >= 0) /* header detection overridden */
 	{
-			/* interpret data size from file size */
-		ssize_t bytelimit = lseek(fd, 0, SEEK_END);
+			/* interpret data size from file size, a stream's size is
+			unknown until it ends */
+		ssize_t bytelimit = (sf->sf_stream ? SFMAXBYTES - 1 :
+			lseek(fd, 0, SEEK_END));
 		if (bytelimit < 0)
 			goto badheader;
 		if (bytelimit > SFMAXBYTES || bytelimit < 0)
 			bytelimit = SFMAXBYTES;
 		sf->sf_bytelimit = bytelimit;
-		sf->sf_fd = fd;
 	}
 	else
 	{
 		char buf[SFHDRBUFSIZE];
-		ssize_t bytesread = read(fd, buf, m5_sf_minheadersize);
+		ssize_t bytesread = m5_soundfile_read(sf, 0, buf,
+			m5_sf_minheadersize);
 
 		if (!sf->sf_type)
 		{
@@ -401,18 +564,18 @@ int m5_open_soundfile_via_fd(int fd, t_soundfile *sf, size_t skipframes)
 				goto badheader;
 			}
 		}
-		sf->sf_fd = fd;
 
 			/* rewind and read header */
-		if (lseek(sf->sf_fd, 0, SEEK_SET) < 0)
+		if (!sf->sf_stream && lseek(sf->sf_fd, 0, SEEK_SET) < 0)
 			goto badheader;
 		if (!sf->sf_type->t_readheaderfn(sf))
 			goto badheader;
 	}
 
-		/* seek past header and any sample frames to skip */
+		/* seek past header and any sample frames to skip, streams are
+		always read by offset so there is nothing to seek */
 	offset = sf->sf_headersize + (skipframes * sf->sf_bytesperframe);
-	if (lseek(sf->sf_fd, offset, 0) < offset)
+	if (!sf->sf_stream && lseek(sf->sf_fd, offset, 0) < offset)
 		goto badheader;
 	sf->sf_bytelimit -= skipframes * sf->sf_bytesperframe;
 	if (sf->sf_bytelimit < 0)
@@ -426,6 +589,9 @@ badheader:
 		print out the error... */
 	if (!errno)
 		errno = SOUNDFILE_ERRMALFORMED;
+	if (sf->sf_decoder)
+		sf->sf_type->t_freedecoderfn(sf);
+	m5_soundfile_stream_free(sf);
 	sf->sf_fd = -1;
 	if (fd >= 0)
 		sys_close(fd);
@@ -464,7 +630,7 @@ int m5_open_soundfile_via_canvas(t_canvas *canvas, const char *filename,
 	return sf_fd;
 }
 
-static int m5_find_threshold(int nchannels, int nframes, t_sample **vecs, t_sample threshold)
+static int m5_find_threshold(int nchannels, int onset, int nframes, t_sample **vecs, t_sample threshold)
 {
 	// MWS: very simple threshold test
 	
@@ -472,7 +638,7 @@ static int m5_find_threshold(int nchannels, int nframes, t_sample **vecs, t_samp
 	t_sample *fp;
 	for (i = 0; i < nchannels; i++)
 	{
-		for (j = 0, fp = vecs[i]; j < nframes; j++, fp++)
+		for (j = 0, fp = vecs[i] + onset; j < nframes; j++, fp++)
 		{
 			if (fabs(*fp) >= threshold ) {
 				return j;
@@ -581,10 +747,40 @@ static void m5_soundfile_xferin_sample(const t_soundfile *sf, int nvecs,
 	}
 		/* zero out other outputs */
 	for (i = sf->sf_nchannels; i < nvecs; i++)
-		for (j = nframes, fp = vecs[i]; j--;)
+		for (j = nframes, fp = vecs[i] + framesread; j--;)
+			*fp++ = 0;
+}
+
+	/** 32-bit float files in our own byte order need no conversion: copy
+		each channel straight out of the interleaved frames */
+static void m5_soundfile_xferin_float(const t_soundfile *sf, int nvecs,
+	t_sample **vecs, size_t framesread, unsigned char *buf, size_t nframes)
+{
+	int nchannels = (sf->sf_nchannels < nvecs ? sf->sf_nchannels : nvecs), i;
+	size_t j;
+	unsigned char *sp2;
+	t_sample *fp;
+	float f;
+	for (i = 0; i < nchannels; i++)
+		for (j = 0, sp2 = buf + i * 4, fp = vecs[i] + framesread;
+			j < nframes; j++, sp2 += sf->sf_bytesperframe)
+		{
+			memcpy(&f, sp2, 4);
+			*fp++ = f;
+		}
+	for (i = sf->sf_nchannels; i < nvecs; i++)
+		for (j = nframes, fp = vecs[i] + framesread; j--;)
 			*fp++ = 0;
 }
 
+void m5_soundfile_xferin(const t_soundfile *sf, int nvecs, t_sample **vecs,
+	unsigned char *buf, size_t nframes)
+{
+	if (sf->sf_bytespersample == 4 && !m5_soundfile_needsbyteswap(sf))
+		m5_soundfile_xferin_float(sf, nvecs, vecs, 0, buf, nframes);
+	else m5_soundfile_xferin_sample(sf, nvecs, vecs, 0, buf, nframes);
+}
+
 static void m5_soundfile_xferin_words(const t_soundfile *sf, int nvecs,
 	t_word **vecs, size_t framesread, unsigned char *buf, size_t nframes)
 {
@@ -715,6 +911,8 @@ typedef struct _soundfiler_writeargs
 	size_t wa_onsetframes;            /* sample frame onset when writing */
 	int wa_normalize;                 /* normalize samples? */
 	int wa_ascii;                     /* write ascii? */
+	int wa_checksum;                  /* store a CRC-32C of the data? */
+	int wa_mmap;                      /* write through a mapping? */
 } t_soundfiler_writeargs;
 
 
@@ -731,7 +929,7 @@ static int m5_soundfiler_parsewriteargs(void *obj, int *p_argc, t_atom **p_argv,
 	t_atom *argv = *p_argv;
 	int samplerate = -1, bytespersample = 2, bigendian = 0, endianness = -1;
 	size_t nframes = SFMAXFRAMES, onsetframes = 0;
-	int normalize = 0, ascii = 0;
+	int normalize = 0, ascii = 0, checksum = 0, mapped = 0;
 	t_symbol *filesym;
 	t_soundfile_type *type = NULL;
 
@@ -790,6 +988,16 @@ static int m5_soundfiler_parsewriteargs(void *obj, int *p_argc, t_atom **p_argv,
 			ascii = 1;
 			argc -= 1; argv += 1;
 		}
+		else if (!strcmp(flag, "checksum"))
+		{
+			checksum = 1;
+			argc -= 1; argv += 1;
+		}
+		else if (!strcmp(flag, "mmap"))
+		{
+			mapped = 1;
+			argc -= 1; argv += 1;
+		}
 		else if (!strcmp(flag, "nextstep"))
 		{
 				/* handle old "-nextstep" alias */
@@ -810,22 +1018,11 @@ static int m5_soundfiler_parsewriteargs(void *obj, int *p_argc, t_atom **p_argv,
 	filesym = argv->a_w.w_symbol;
 
 		/* deduce from filename extension? */
-	if (!type)
+	if (!type && !(type = m5_soundfile_typeforfile(filesym->s_name)))
 	{
-		t_soundfile_type **t = m5_soundfile_firsttype();
-		while (t)
-		{
-			if ((*t)->t_hasextensionfn(filesym->s_name, MAXPDSTRING))
-				break;
-			t = m5_soundfile_nexttype(t);
-		}
-		if (!t)
-		{
-			if (!ascii)
-				ascii = m5_ascii_hasextension(filesym->s_name, MAXPDSTRING);
-			t = m5_soundfile_firsttype(); /* default if unknown */
-		}
-		type = *t;
+		if (!ascii)
+			ascii = m5_ascii_hasextension(filesym->s_name, MAXPDSTRING);
+		type = *m5_soundfile_firsttype(); /* default if unknown */
 	}
 
 		/* check requested endianness */
@@ -849,10 +1046,13 @@ static int m5_soundfiler_parsewriteargs(void *obj, int *p_argc, t_atom **p_argv,
 	wa->wa_onsetframes = onsetframes;
 	wa->wa_normalize = normalize;
 	wa->wa_ascii = ascii;
+	wa->wa_checksum = checksum;
+	wa->wa_mmap = mapped;
 	return 0;
 }
 
-	/** sets sf fd & headerisze on success and returns fd or -1 on failure */
+	/** sets sf fd & headerisze on success and returns fd or -1 on failure.
+		with no canvas the filename is taken as the path as it stands */
 static int m5_create_soundfile(t_canvas *canvas, const char *filename,
 	t_soundfile *sf, size_t nframes)
 {
@@ -866,8 +1066,11 @@ static int m5_create_soundfile(t_canvas *canvas, const char *filename,
 		if (!sf->sf_type->t_addextensionfn(filenamebuf, MAXPDSTRING-10))
 			return -1;
 	filenamebuf[MAXPDSTRING-10] = 0; /* FIXME: what is the 10 for? */
-	canvas_makefilename(canvas, filenamebuf, pathbuf, MAXPDSTRING);
-	if ((fd = sys_open(pathbuf, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0)
+	if (canvas)
+		canvas_makefilename(canvas, filenamebuf, pathbuf, MAXPDSTRING);
+	else strcpy(pathbuf, filenamebuf); /* a path already */
+		/* readable too, as writesf~ -mmap maps it for writing */
+	if ((fd = sys_open(pathbuf, O_RDWR | O_CREAT | O_TRUNC, 0666)) < 0)
 		return -1;
 	sf->sf_fd = fd;
 
@@ -897,6 +1100,25 @@ static void m5_soundfile_finishwrite(void *obj, const char *filename,
 	m5_object_sferror(obj, "[soundfiler] write", filename, errno, sf);
 }
 
+	/** store the CRC-32C of the frameswritten frames just finished by
+		m5_soundfile_finishwrite() */
+static void m5_soundfile_finishchecksum(void *obj, const char *filename,
+	t_soundfile *sf, size_t frameswritten, uint32_t crc)
+{
+	t_soundfile_checksum ck;
+	if (!sf->sf_type->t_writechecksumfn)
+	{
+		pd_error(obj, "[writesf~] %s: %s files can't hold a checksum",
+			filename, sf->sf_type->t_name);
+		return;
+	}
+	ck.sc_crc32c = crc;
+	ck.sc_databytes = (uint64_t)frameswritten * sf->sf_bytesperframe;
+	ck.sc_bigendian = sf->sf_bigendian;
+	if (!sf->sf_type->t_writechecksumfn(sf, &ck))
+		m5_object_sferror(obj, "[writesf~] checksum", filename, errno, sf);
+}
+
 static void m5_soundfile_xferout_sample(const t_soundfile *sf,
 	t_sample **vecs, unsigned char *buf, size_t nframes, size_t onsetframes,
 	t_sample normalfactor)
@@ -1033,6 +1255,33 @@ static void m5_soundfile_xferout_sample(const t_soundfile *sf,
 	}
 }
 
+	/** 32-bit float files in our own byte order, see xferin_float */
+static void m5_soundfile_xferout_float(const t_soundfile *sf,
+	t_sample **vecs, unsigned char *buf, size_t nframes, size_t onsetframes,
+	t_sample normalfactor)
+{
+	int i;
+	size_t j;
+	unsigned char *sp2;
+	t_sample *fp;
+	float f;
+	for (i = 0; i < sf->sf_nchannels; i++)
+		for (j = 0, sp2 = buf + i * 4, fp = vecs[i] + onsetframes;
+			j < nframes; j++, sp2 += sf->sf_bytesperframe)
+		{
+			f = *fp++ * normalfactor;
+			memcpy(sp2, &f, 4);
+		}
+}
+
+void m5_soundfile_xferout(const t_soundfile *sf, t_sample **vecs,
+	unsigned char *buf, size_t nframes)
+{
+	if (sf->sf_bytespersample == 4 && !m5_soundfile_needsbyteswap(sf))
+		m5_soundfile_xferout_float(sf, vecs, buf, nframes, 0, 1);
+	else m5_soundfile_xferout_sample(sf, vecs, buf, nframes, 0, 1);
+}
+
 static void m5_soundfile_xferout_words(const t_soundfile *sf, t_word **vecs,
 	unsigned char *buf, size_t nframes, size_t onsetframes,
 	t_sample normalfactor)
@@ -1193,6 +1442,14 @@ areas.
 #define MINBUFSIZE (4 * READSIZE)
 #define MAXBUFSIZE 16777216     /* arbitrary; just don't want to hang malloc */
 
+#define WATCHDEFAULT 1000.      /* msec a disk access may take unreported */
+#define WATCHPOLL 50            /* msec between looks at the access in flight */
+#define IORETRIES 3             /* tries to reopen a file after failed reads */
+#define IORETRYWAIT 100.        /* msec before the first, more before each next */
+
+#define MAXREGIONS 64           /* entries of "regions" */
+#define REGIONHEADMS 300.       /* msec of each region kept in RAM */
+
 	/* read/write thread request type */
 typedef enum _soundfile_request
 {
@@ -1230,6 +1487,35 @@ typedef enum _m5_loop_mode
 
 #define FRAMES_NOT_UPDATED SIZE_MAX
 
+	/* sample conversion routines, picked once per file */
+typedef void (*t_m5XferIn)(const t_soundfile *sf, int nvecs,
+	t_sample **vecs, size_t framesread, unsigned char *buf, size_t nframes);
+typedef void (*t_m5XferOut)(const t_soundfile *sf, t_sample **vecs,
+	unsigned char *buf, size_t nframes, size_t onsetframes,
+	t_sample normalfactor);
+
+	/* Immutable snapshot of a file's sample format and the conversion
+	routines chosen for it. Whoever learns the format (the child on open
+	for readsf~, the open method for writesf~) publishes it into
+	x_m5FormatPending with the mutex held. Perform, which holds the mutex
+	for the fifo anyway, swaps it in and chains the one it replaces on
+	x_m5FormatRetired, so that it never frees one itself; the child frees
+	them when it next goes idle. */
+typedef struct _m5SoundFormat
+{
+	t_soundfile f_sf;      /* format fields only, never the fd */
+	t_m5XferIn f_xferin;
+	t_m5XferOut f_xferout;
+	struct _m5SoundFormat *f_next; /* on x_m5FormatRetired */
+} t_m5SoundFormat;
+
+	/* let "-m" objects use a single multichannel signal where Pd can */
+#ifdef CLASS_MULTICHANNEL
+#define M5_SF_CLASSFLAGS CLASS_MULTICHANNEL
+#else
+#define M5_SF_CLASSFLAGS 0
+#endif
+
 typedef enum _m5_sync_mode
 
 {
@@ -1239,6 +1525,13 @@ typedef enum _m5_sync_mode
 
 static t_class *m5_readsf_class;
 
+	/* an entry of "regions", in frames after the onset */
+typedef struct _m5Region
+{
+	size_t r_start;
+	size_t r_length;
+} t_m5Region;
+
 // 'm5_ prefixed' fields are new additions to readsf
 typedef struct _readsf
 {
@@ -1248,7 +1541,7 @@ typedef struct _readsf
 	char *x_buf;                      /**< soundfile buffer */
 	int x_bufsize;                    /**< buffer size in bytes */
 	int x_noutlets;                   /**< number of audio outlets */
-	t_sample *(x_outvec[MAXSFCHANS]); /**< audio vectors */
+	t_sample *(x_outvec[2 * MAXSFCHANS]); /**< audio vectors, then lookahead */
 	int x_vecsize;                    /**< vector size for transfers */
 	
 	t_outlet *x_m5listOut;			  /** number of frames in file (FTC) */
@@ -1263,6 +1556,7 @@ typedef struct _readsf
 	const char *x_filename;   /**< file to open (permanently allocated) */
 	int x_fileerror;          /**< slot for "errno" return */
 	t_soundfile x_sf;         /**< soundfile fd, type, and format info */
+	t_soundfile x_m5LastOpen; /**< readsf~ only: x_sf as "open" asked for it */
 	size_t x_onsetframes;     /**< number of sample frames to skip */
 	int x_fifosize;           /**< buffer size appropriately rounded down */
 	int x_fifohead;           /**< index of next byte to get from file */
@@ -1272,9 +1566,10 @@ typedef struct _readsf
 	int x_sigperiod;          /**< number of ticks per signal */
 	size_t x_frameswritten;   /**< writesf~ only; frames written */
 	t_float x_f;              /**< writesf~ only; scalar for signal inlet */
-	pthread_mutex_t x_mutex;
-	pthread_cond_t x_requestcondition;
-	pthread_cond_t x_answercondition;
+	pthread_mutex_t *x_mutex;             /**< these three live in x_m5Link */
+	pthread_cond_t *x_requestcondition;
+	pthread_cond_t *x_answercondition;
+	struct _m5SfLink *x_m5Link;           /**< what the child thread holds on to */
 	pthread_t x_childthread;
 	t_namelist *x_namelist;
 	
@@ -1289,6 +1584,8 @@ typedef struct _readsf
 
 	double x_m5HeadTimeRequest;
 	double x_m5TailTime;
+	char x_m5Refilling; /* the fifo was emptied for x_m5HeadTimeRequest and none of that has come yet */
+	double x_m5RefillLead; /* frames ahead of its block the fill was asked for, < 0 once it has played */
 	
 	/* m5_ftc_anchor referenced by ID */
 	/* used for common t=0 time */	
@@ -1305,163 +1602,1683 @@ typedef struct _readsf
 	
 	double x_m5PlayStartTime; /* frame to start reading / writing */
 	double x_m5PlayEndTime; /*frame to stop reading / writing */
+	char x_m5EndFromLoop; /* end time was resolved from END_AT_LOOP */
+	char x_m5StreamEnded; /* child found the end of a streamed file */
 	int x_m5PerformedFifoSize; /* store how many frames have been buffered by writesf so far */
 	
 	t_sample x_m5PlayStartThreshold; /* input signal threshold to detect */
 	
+	t_m5ShmRing *x_m5Shm; /* readsf~ only: shared-memory ring source, or NULL */
+	char x_m5Ram; /* readsf~ only: "open -ram", keep the file in the sample cache */
+	char x_m5Checksum; /* writesf~ only: "open -checksum", store a CRC-32C on close */
+	char x_m5Mmap; /* writesf~ only: "open -mmap", write through a mapping */
+	int x_m5TakeEnd; /* writesf~ only: where the data of a take left to the child by "open" ends, or -1 */
+	int x_m5TakeStart; /* writesf~ only: where the next take's data starts, while x_m5TakeEnd >= 0 */
+	struct _m5Job *x_m5Takes; /* writesf~ only: takes being finished, oldest first */
+	t_clock *x_m5TakeClock; /* writesf~ only: reports x_m5Takes as they finish */
+	struct _m5Live *x_m5LiveTake; /* writesf~ only: the take being recorded, as readers see it, or NULL */
+	char x_m5Live; /* readsf~ only: 2 while the file is being recorded by a writesf~ here, 1 once that ended */
+	struct _m5Job *x_m5Verify; /* readsf~ only: "open -verify" job, or NULL */
+	t_clock *x_m5VerifyClock; /* readsf~ only: polls x_m5Verify */
+	struct _m5Job *x_m5Loudness; /* readsf~ only: "open -loudness" job, or NULL */
+	t_clock *x_m5LoudnessClock; /* readsf~ only: polls x_m5Loudness */
+	struct _m5Job *x_m5Onsets; /* readsf~ only: "open -onsets" job, or NULL */
+	t_clock *x_m5OnsetsClock; /* readsf~ only: polls x_m5Onsets */
+	t_m5OnsetList x_m5OnsetList; /* readsf~ only: found, from the open's onset */
+	
+	/* readsf~ only: "regions" and "play" */
+	t_m5Region x_m5Regions[MAXREGIONS];
+	int x_m5NRegions;
+	int x_m5RegionSerial; /* bumped by "regions", the child then loads their heads */
+	int x_m5RegionsResident; /* heads the child holds in RAM, for "print" */
+	double x_m5CueTime; /* timeline frame "play ... at" starts x_m5Cue at, < 0 when none */
+	t_m5Region x_m5Cue;
+	int x_m5CueSerial; /* bumped by each cue */
+	
+	/* readsf~ only: how late the last "start" sounded, in frames */
+	double x_m5StartDue; /* when its first frame was due, < 0 until known */
+	char x_m5StartPending; /* none of its frames has played yet */
+	double x_m5StartLatency; /* first frame played minus x_m5StartDue */
+	double x_m5StartLatencyMax; /* worst so far */
+	t_clock *x_m5LatencyClock; /* reports x_m5StartLatency */
+	
+#ifdef M5_VIRTUAL_CLOCK
+	/* readsf~ in test builds only: conditions to time a start under, see
+	test/m5_startbench.c */
+	char x_m5Cold; /* "open -cold": skip the parked file and page cache */
+	double x_m5IoDelay; /* "iodelay": msec the child stalls per disk access */
+#endif
+	double x_m5IoSince; /* sys_getrealtime() as the child's disk access began, < 0 when none is in flight */
+	double x_m5Watchdog; /* "watchdog": msec an access may take before it's reported, 0 = off */
+	char x_m5Stalled; /* 1: a stall was reported, 2: sound came back, to report */
+	double x_m5StallSince; /* x_m5IoSince of the access that stalled */
+	size_t x_m5StallFrame; /* timeline frame playback stood at when reported */
+	size_t x_m5ResumeFrame; /* and the first one played once it returned */
+	size_t x_m5StallSilence; /* frames of silence played meanwhile */
+	int x_m5Stalls; /* stalls reported, for "print" */
+	int x_m5Reopens; /* times the child reopened the file after a failed read */
+	int x_m5ReopensSeen; /* of those, already reported */
+	t_clock *x_m5WatchClock; /* polls x_m5IoSince while a file plays */
+	
+	t_m5SoundFormat *x_m5Format; /* perform's format, owned by perform */
+	t_m5SoundFormat *x_m5FormatPending; /* newly published, not yet in use */
+	t_m5SoundFormat *x_m5FormatRetired; /* replaced, waiting for the child */
+	
+	char x_m5Multi; /* -m: one multichannel outlet (readsf~) or inlet (writesf~) */
+	int x_m5Lookahead; /* readsf~ -lookahead: frames the tap outlets run ahead */
+	t_sample *x_m5ZeroVec; /* writesf~ -m: stands in for missing input channels */
+	int x_m5ZeroVecSize;
+	
+	int x_m5Hop; /* frames the timeline moves per DSP call */
+	double x_m5LastLogicalTime; /* logical time of the previous DSP call */
+	size_t x_m5SubBlockTime; /* frames into the current tick, for blocks < 64 */
+	
+	/* what m5_soundfile_monitor reports, see m5_sf_register() */
+	struct _readsf *x_m5Next; /* next object in m5_sf_registry */
+	int x_m5Id; /* numbered in order of creation */
+	double x_m5Created; /* sys_getrealtime() at creation */
+	long x_m5Underruns; /* DSP calls the fifo couldn't keep up with */
+	double x_m5IoBytes; /* moved between the fifo and the file by the child */
+	double x_m5DspTime; /* seconds in perform while any monitor exists */
+	
 #ifdef PDINSTANCE
 	t_pdinstance *x_pd_this;  /**< pointer to the owner pd instance */
 #endif
 } t_readsf;
 
-/* ----- the child thread which performs file I/O ----- */
+	/** what the child thread shares with the object, allocated apart from
+		it so that it can outlive it: when the object is freed its state is
+		moved into l_ghost and the child tears it down in its own time, see
+		m5_sf_handoff() */
+typedef struct _m5SfLink
+{
+	pthread_mutex_t l_mutex;
+	pthread_cond_t l_requestcondition;
+	pthread_cond_t l_answercondition;
+	int l_refcount;     /* the object's, its live take's and readers' */
+	t_readsf *l_x;      /* the object, l_ghost once it has gone, NULL once reaped */
+	t_readsf l_ghost;
+} t_m5SfLink;
 
-	/** thread state debug prints to stderr */
-//#define DEBUG_SOUNDFILE_THREADS
+/* ----- format descriptors shared by readsf~ and writesf~ ----- */
 
-#if 1
-#define sfread_cond_wait pthread_cond_wait
-#define sfread_cond_signal pthread_cond_signal
-#else
-#include <sys/time.h>    /* debugging version... */
-#include <sys/types.h>
-static void m5_readsf_fakewait(pthread_mutex_t *b)
+static t_m5SoundFormat *m5_soundformat_new(const t_soundfile *sf)
 {
-	struct timeval timeout;
-	timeout.tv_sec = 0;
-	timeout.tv_usec = 1000000;
-	pthread_mutex_unlock(b);
-	select(0, 0, 0, 0, &timeout);
-	pthread_mutex_lock(b);
+	t_m5SoundFormat *f = (t_m5SoundFormat *)getbytes(sizeof(t_m5SoundFormat));
+	if (!f)
+		return NULL;
+	m5_soundfile_copy(&f->f_sf, sf);
+	f->f_sf.sf_fd = -1;
+	f->f_sf.sf_stream = NULL;
+	f->f_sf.sf_decoder = NULL;
+	f->f_sf.sf_encoder = NULL;
+	f->f_next = NULL;
+	if (sf->sf_bytespersample == 4 && !m5_soundfile_needsbyteswap(sf))
+	{
+		f->f_xferin = m5_soundfile_xferin_float;
+		f->f_xferout = m5_soundfile_xferout_float;
+	}
+	else
+	{
+		f->f_xferin = m5_soundfile_xferin_sample;
+		f->f_xferout = m5_soundfile_xferout_sample;
+	}
+	return f;
 }
 
-#define sfread_cond_wait(a,b) readsf_fakewait(b)
-#define sfread_cond_signal(a)
-#endif
+	/** free a chain of formats */
+static void m5_soundformat_free(t_m5SoundFormat *f)
+{
+	while (f)
+	{
+		t_m5SoundFormat *next = f->f_next;
+		freebytes(f, sizeof(t_m5SoundFormat));
+		f = next;
+	}
+}
 
-static void *m5_readsf_child_main(void *zz)
+	/** make a format available to perform. Called with the mutex held,
+		from any thread but perform's. */
+static void m5_sf_publishformat(t_readsf *x, const t_soundfile *sf)
 {
-	t_readsf *x = zz;
-	t_soundfile sf = {0};
-	ssize_t m5_original_bytelimit = 0;
-	size_t m5_seek_max = 0;
-	off_t m5_initial_offset = 0;
-	
-	m5_soundfile_clear(&sf);
-#ifdef PDINSTANCE
-	pd_this = x->x_pd_this;
-#endif
-#ifdef DEBUG_SOUNDFILE_THREADS
-	fprintf(stderr, "readsf~: 1\n");
-#endif
-	pthread_mutex_lock(&x->x_mutex);
-	while (1)
+	t_m5SoundFormat *f = m5_soundformat_new(sf);
+	if (!f)
+		return;
+	m5_soundformat_free(x->x_m5FormatPending); /* never picked up */
+	x->x_m5FormatPending = f;
+}
+
+	/** perform's view of the format, called with the mutex held: picks up
+		a newly published one, and leaves the one it replaces for the child
+		to free */
+static const t_m5SoundFormat *m5_sf_currentformat(t_readsf *x)
+{
+	t_m5SoundFormat *f = x->x_m5FormatPending;
+	if (f)
 	{
-		int fifohead;
-		char *buf;
-#ifdef DEBUG_SOUNDFILE_THREADS
-		fprintf(stderr, "readsf~: 0\n");
-#endif
-		if (x->x_requestcode == REQUEST_NOTHING)
+		x->x_m5FormatPending = NULL;
+		if (x->x_m5Format)
 		{
-#ifdef DEBUG_SOUNDFILE_THREADS
-			fprintf(stderr, "readsf~: wait 2\n");
-#endif
-			sfread_cond_signal(&x->x_answercondition);
-			sfread_cond_wait(&x->x_requestcondition, &x->x_mutex);
-#ifdef DEBUG_SOUNDFILE_THREADS
-			fprintf(stderr, "readsf~: 3\n");
-#endif
+			x->x_m5Format->f_next = x->x_m5FormatRetired;
+			x->x_m5FormatRetired = x->x_m5Format;
 		}
-		else if (x->x_requestcode == REQUEST_OPEN)
-		{
-			ssize_t bytesread;
-			size_t wantbytes;		
-			off_t nextSeek = 0; 	
+		x->x_m5Format = f;
+	}
+	return x->x_m5Format;
+}
 
-				/* copy file stuff out of the data structure so we can
-				relinquish the mutex while we're in open_soundfile_via_path() */
-			size_t onsetframes = x->x_onsetframes;
-			// size_t loop_length_bytes = 0;
-			const char *filename = x->x_filename;
-			const char *dirname = canvas_getdir(x->x_canvas)->s_name;
+	/** free the retired formats, outside of perform with the mutex held */
+static void m5_sf_reclaimformat(t_readsf *x)
+{
+	m5_soundformat_free(x->x_m5FormatRetired);
+	x->x_m5FormatRetired = NULL;
+}
 
-#ifdef DEBUG_SOUNDFILE_THREADS
-			fprintf(stderr, "readsf~: 4\n");
-#endif
-				/* alter the request code so that an ensuing "open" will get
-				noticed. */
-			x->x_requestcode = REQUEST_BUSY;
-			x->x_fileerror = 0;
+	/** drop every format, when the object goes away */
+static void m5_sf_freeformats(t_readsf *x)
+{
+	m5_sf_reclaimformat(x);
+	m5_soundformat_free(x->x_m5FormatPending);
+	m5_soundformat_free(x->x_m5Format);
+	x->x_m5Format = x->x_m5FormatPending = NULL;
+}
 
-				/* if there's already a file open, close it */
-			if (sf.sf_fd >= 0)
-			{
-				pthread_mutex_unlock(&x->x_mutex);
-				sys_close(sf.sf_fd);
-				sf.sf_fd = -1;
-				pthread_mutex_lock(&x->x_mutex);
-				x->x_sf.sf_fd = -1;
-				if (x->x_requestcode != REQUEST_BUSY)
-					goto lost;
-			}
-				/* cache sf *after* closing as x->sf's type
-					may have changed in readsf_open() */
-			m5_soundfile_copy(&sf, &x->x_sf);
-				/* open the soundfile with the mutex unlocked */
-			pthread_mutex_unlock(&x->x_mutex);
-			m5_open_soundfile_via_namelist(dirname, filename, x->x_namelist,
-				&sf, onsetframes);
-			pthread_mutex_lock(&x->x_mutex);
-			
-			// get maximum size of loop, in bytes, that contains all sound data in file after 
-			// 'onset' frames 
-			m5_original_bytelimit = sf.sf_bytelimit;
-			
-			// lowest offset in file, after 'onset' frames
-			m5_initial_offset = sf.sf_headersize + (onsetframes * sf.sf_bytesperframe);
-			
-			// highest offset in file
-			m5_seek_max = m5_original_bytelimit + m5_initial_offset;
-		
+/* ----- open file cache for readsf~ ----- */
+
+/* Files that readsf~ closes are parked here, still open and with their
+header parsed, so that reopening them ("restart", or "open" of the same
+file) skips the path search and header parse. Each entry also keeps the
+first bytes of the loop as they were last read, so a retrigger can fill
+its fifo from RAM. The cache is process-wide and holds at most
+SFCACHESIZE files; the least recently parked one is closed to make room.
+Entries are dropped if the path they were found at now leads to another
+file, or the file's size or modification time has changed.
+Streams are never cached.  A file opened with "-ram" also keeps a reader
+on the compressed sample cache (m5_samplecache.h) in its head, which then
+serves all of its reads. */
+
+#define SFCACHESIZE 16
+#define SFCACHEHEADBYTES (4 * READSIZE)
+
+	/* bytes at the loop start, as last read from the file */
+typedef struct _m5SfHead
+{
+	char *h_buf;        /* SFCACHEHEADBYTES, or NULL */
+	size_t h_bytes;     /* valid bytes in h_buf */
+	off_t h_offset;     /* file offset of h_buf[0] */
+	t_m5SampleReader h_ram; /* attached for "-ram", serves every read */
+} t_m5SfHead;
+
+	/* what was asked for: the same file opened the same way */
+typedef struct _m5SfCacheKey
+{
+	char k_name[MAXPDSTRING]; /* canvas directory and file name */
+	size_t k_onsetframes;
+	t_soundfile k_request;    /* header overrides given to "open" */
+	char k_path[MAXPDSTRING]; /* where it was found; not matched */
+} t_m5SfCacheKey;
 
-#ifdef DEBUG_SOUNDFILE_THREADS
-			fprintf(stderr, "readsf~: 5\n");
-#endif
-			if (sf.sf_fd < 0)
-			{
-				x->x_fileerror = errno;
-				x->x_eof = 1;
-#ifdef DEBUG_SOUNDFILE_THREADS
-				fprintf(stderr, "readsf~: open failed %s %s\n",
-					filename, dirname);
-#endif
-				goto lost;
-			}
-				/* copy back into the instance structure. */
-			m5_soundfile_copy(&x->x_sf, &sf);
-				/* check if another request has been made; if so, field it */
-			if (x->x_requestcode != REQUEST_BUSY)
-				goto lost;
-#ifdef DEBUG_SOUNDFILE_THREADS
-			fprintf(stderr, "readsf~: 6\n");
-#endif
-			x->x_fifohead = 0;
-					/* set fifosize from bufsize.  fifosize must be a
-					multiple of the number of bytes eaten for each DSP
-					tick.  We pessimistically assume MAXVECSIZE samples
-					per tick since that could change.  There could be a
-					problem here if the vector size increases while a
-					soundfile is being played...  */
-			x->x_fifosize = x->x_bufsize - (x->x_bufsize %
-				(sf.sf_bytesperframe * MAXVECSIZE));
-					/* arrange for the "request" condition to be signaled 16
-					times per buffer */
-#ifdef DEBUG_SOUNDFILE_THREADS
+typedef struct _m5SfCacheEntry
+{
+	int e_full;               /* slot holds a parked file */
+	t_m5SfCacheKey e_key;
+	t_soundfile e_sf;         /* the open file */
+	t_m5SfHead e_head;
+	struct stat e_stat;
+	unsigned long e_parked;   /* LRU stamp */
+} t_m5SfCacheEntry;
+
+static t_m5SfCacheEntry m5_sfcache[SFCACHESIZE];
+static unsigned long m5_sfcache_clock;
+static pthread_mutex_t m5_sfcache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void m5_sfcache_makekey(t_m5SfCacheKey *k, const char *dirname,
+	const char *filename, size_t onsetframes, const t_soundfile *request)
+{
+	snprintf(k->k_name, MAXPDSTRING, "%s/%s", dirname, filename);
+	k->k_path[0] = 0;
+	k->k_onsetframes = onsetframes;
+	m5_soundfile_copy(&k->k_request, request);
+}
+
+static int m5_sfcache_match(const t_m5SfCacheKey *a, const t_m5SfCacheKey *b)
+{
+	return (a->k_onsetframes == b->k_onsetframes &&
+		a->k_request.sf_type == b->k_request.sf_type &&
+		a->k_request.sf_headersize == b->k_request.sf_headersize &&
+		(a->k_request.sf_headersize < 0 ||
+			(a->k_request.sf_nchannels == b->k_request.sf_nchannels &&
+			a->k_request.sf_bytespersample == b->k_request.sf_bytespersample &&
+			a->k_request.sf_bigendian == b->k_request.sf_bigendian)) &&
+		!strcmp(a->k_name, b->k_name));
+}
+
+static void m5_sfhead_free(t_m5SfHead *h)
+{
+	if (h->h_buf)
+		freebytes(h->h_buf, SFCACHEHEADBYTES);
+	h->h_buf = NULL;
+	h->h_bytes = 0;
+	m5_samplereader_detach(&h->h_ram);
+}
+
+	/** open a soundfile as m5_open_soundfile_via_namelist() does, putting
+		the path it was found at in the key for the cache to check */
+static int m5_sfcache_open(t_m5SfCacheKey *k, const char *dirname,
+	const char *filename, t_soundfile *sf, size_t skipframes)
+{
+	char dir[MAXPDSTRING], *name;
+	int fd = open_via_path(dirname, filename, "", dir, &name, MAXPDSTRING, 1);
+	k->k_path[0] = 0;
+	if (fd < 0)
+		return -1;
+		/* one too long to check again is never reused */
+	if (snprintf(k->k_path, MAXPDSTRING, "%s/%s", dir, name) >= MAXPDSTRING)
+		k->k_path[0] = 0;
+	return m5_open_soundfile_via_fd(fd, sf, skipframes);
+}
+
+	/** whether the path still leads to the file that was parked, unchanged:
+		a file renamed over it has another inode, one rewritten in place
+		another size or modification time. Called without
+		m5_sfcache_mutex: stat() may hang on a network mount that
+		dropped out, and must only hold up the thread asking */
+static int m5_sfcache_fresh(const char *path, const struct stat *parked)
+{
+	struct stat st;
+	return (path[0] && stat(path, &st) == 0 &&
+		st.st_dev == parked->st_dev && st.st_ino == parked->st_ino &&
+		st.st_size == parked->st_size &&
+		m5_sidecar_mtime(&st) == m5_sidecar_mtime(parked));
+}
+
+	/** take a parked file matching the key, filling in sf and head, and
+		the key's path. returns 0 if there is none and the file must be
+		opened */
+static int m5_sfcache_take(t_m5SfCacheKey *k, t_soundfile *sf,
+	t_m5SfHead *head)
+{
+	t_m5SfCacheEntry *e = m5_sfcache;
+	t_soundfile stale;
+	char path[MAXPDSTRING];
+	struct stat parked;
+	unsigned long stamp;
+	int i, fresh, hit = 0;
+	m5_soundfile_clear(&stale);
+	pthread_mutex_lock(&m5_sfcache_mutex);
+	for (i = 0; i < SFCACHESIZE; i++, e++)
+		if (e->e_full && m5_sfcache_match(k, &e->e_key))
+			break;
+	if (i == SFCACHESIZE)
+	{
+		pthread_mutex_unlock(&m5_sfcache_mutex);
+		return 0;
+	}
+		/* look at the file with the cache unlocked, then make sure the
+		entry is still the one we looked at: its stamp is new each time
+		a file is parked */
+	strcpy(path, e->e_key.k_path);
+	parked = e->e_stat;
+	stamp = e->e_parked;
+	pthread_mutex_unlock(&m5_sfcache_mutex);
+	fresh = m5_sfcache_fresh(path, &parked);
+	pthread_mutex_lock(&m5_sfcache_mutex);
+	if (e->e_full && e->e_parked == stamp)
+	{
+			/* drop it if the file was replaced or rewritten since it
+			was parked */
+		if (!fresh)
+		{
+			m5_soundfile_copy(&stale, &e->e_sf);
+			m5_sfhead_free(&e->e_head);
+		}
+		else
+		{
+			m5_soundfile_copy(sf, &e->e_sf);
+			strcpy(k->k_path, e->e_key.k_path);
+			*head = e->e_head;
+			e->e_head.h_buf = NULL;
+			e->e_head.h_bytes = 0;
+			e->e_head.h_ram.r_bank = NULL;
+			hit = 1;
+		}
+		e->e_full = 0;
+	}
+	pthread_mutex_unlock(&m5_sfcache_mutex);
+	m5_soundfile_close(&stale);
+	return hit;
+}
+
+	/** done with a file: park it in the cache if keep is set and it can be
+		reopened from there, otherwise close it. either way sf and head are
+		released. */
+static void m5_sfcache_release(const t_m5SfCacheKey *k, t_soundfile *sf,
+	t_m5SfHead *head, int keep)
+{
+	t_m5SfCacheEntry *e, *slot = NULL;
+	t_soundfile evicted;
+	t_m5SfHead evictedhead = {0};
+	struct stat st;
+	int i;
+	m5_soundfile_clear(&evicted);
+	if (!keep || sf->sf_fd < 0 || sf->sf_stream || fstat(sf->sf_fd, &st) < 0)
+	{
+		m5_soundfile_close(sf);
+		m5_sfhead_free(head);
+		return;
+	}
+	pthread_mutex_lock(&m5_sfcache_mutex);
+	for (i = 0, e = m5_sfcache; i < SFCACHESIZE; i++, e++)
+	{
+		if (!e->e_full)
+		{
+			slot = e;
+			break;
+		}
+		if (!slot || e->e_parked < slot->e_parked)
+			slot = e;
+	}
+	if (slot->e_full)
+	{
+		m5_soundfile_copy(&evicted, &slot->e_sf);
+		evictedhead = slot->e_head;
+	}
+	slot->e_full = 1;
+	slot->e_key = *k;
+	m5_soundfile_copy(&slot->e_sf, sf);
+	slot->e_head = *head;
+	slot->e_stat = st;
+	slot->e_parked = ++m5_sfcache_clock;
+	pthread_mutex_unlock(&m5_sfcache_mutex);
+	m5_soundfile_close(&evicted);
+	m5_sfhead_free(&evictedhead);
+	sf->sf_fd = -1;
+	sf->sf_decoder = NULL;
+	head->h_buf = NULL;
+	head->h_bytes = 0;
+	head->h_ram.r_bank = NULL;
+}
+
+	/** read from the file, or from the head buffer if the read starts
+		there.  a read at the loop start (isloopstart) refreshes the buffer */
+static ssize_t m5_sfhead_read(t_m5SfHead *h, t_soundfile *sf, off_t offset,
+	char *dst, size_t size, int isloopstart)
+{
+	ssize_t bytesread;
+	size_t n;
+	if (h->h_ram.r_bank)
+		return m5_samplereader_read(&h->h_ram, sf, offset, dst, size);
+	if (h->h_buf && h->h_bytes && offset == h->h_offset)
+	{
+		n = (size < h->h_bytes ? size : h->h_bytes);
+		memcpy(dst, h->h_buf, n);
+		if (n == size)
+			return n;
+		bytesread = m5_soundfile_read(sf, offset + n, dst + n, size - n);
+		return (bytesread < 0 ? (ssize_t)n : (ssize_t)n + bytesread);
+	}
+	bytesread = m5_soundfile_read(sf, offset, dst, size);
+	if (isloopstart && bytesread > 0 && m5_soundfile_isseekable(sf))
+	{
+		if (!h->h_buf)
+			h->h_buf = (char *)getbytes(SFCACHEHEADBYTES);
+		if (h->h_buf)
+		{
+			n = ((size_t)bytesread < SFCACHEHEADBYTES ?
+				(size_t)bytesread : SFCACHEHEADBYTES);
+			memcpy(h->h_buf, dst, n);
+			h->h_bytes = n;
+			h->h_offset = offset;
+		}
+	}
+	return bytesread;
+}
+
+/* ----- creation arguments shared by readsf~ and writesf~ ----- */
+
+	/** parse [-m] [-lookahead frames] [nchannels] [bufsize], returns 0 on
+		a bad flag. -m asks for a single multichannel signal, which needs
+		Pd 0.54 or later. -lookahead is only taken if lookahead isn't NULL. */
+static int m5_sf_parsenew(const char *header, int argc, t_atom *argv,
+	int *multi, int *nchannels, int *bufsize, int *lookahead)
+{
+	*multi = 0;
+	if (lookahead)
+		*lookahead = 0;
+	while (argc > 0 && argv->a_type == A_SYMBOL &&
+		*argv->a_w.w_symbol->s_name == '-')
+	{
+		if (!strcmp(argv->a_w.w_symbol->s_name, "-m"))
+		{
+#ifdef CLASS_MULTICHANNEL
+			*multi = 1;
+#else
+			pd_error(0, "%s: -m needs Pd 0.54 or later, ignored", header);
+#endif
+		}
+		else if (lookahead &&
+			!strcmp(argv->a_w.w_symbol->s_name, "-lookahead"))
+		{
+			*lookahead = atom_getfloatarg(1, argc, argv);
+			if (*lookahead < 1 || *lookahead > MAXLOOKAHEAD)
+			{
+				pd_error(0, "%s: -lookahead must be 1 to %d frames", header,
+					MAXLOOKAHEAD);
+				return 0;
+			}
+			argc--; argv++;
+		}
+		else
+		{
+			pd_error(0, "%s: unknown flag '%s'", header,
+				argv->a_w.w_symbol->s_name);
+			return 0;
+		}
+		argc--; argv++;
+	}
+	*nchannels = atom_getfloatarg(0, argc, argv);
+	*bufsize = atom_getfloatarg(1, argc, argv);
+	return 1;
+}
+
+/* ----- fifo sizing and timing shared by readsf~ and writesf~ ----- */
+
+	/** frames the timeline moves per DSP call: the whole vector, or one
+		hop of it when running inside an overlapping block~ */
+static int m5_sf_gethop(const t_signal *sp)
+{
+	int overlap, hop;
+#if PD_MINOR_VERSION >= 54
+	overlap = sp->s_overlap;
+#else
+	overlap = (int)(sp->s_sr / sys_getsr() + 0.5);
+#endif
+	if (overlap < 1)
+		overlap = 1;
+	hop = sp->s_n / overlap;
+	return (hop < 1 ? 1 : hop);
+}
+
+	/** number of DSP calls between wakeups of the child thread, so that it
+		is signaled about 16 times per buffer whatever the block size */
+static int m5_sf_sigperiod(const t_readsf *x, int bytesperframe)
+{
+	int period;
+	if (bytesperframe < 1 || x->x_m5Hop < 1)
+		return 1;
+	period = x->x_fifosize / (16 * bytesperframe * x->x_m5Hop);
+	return (period < 1 ? 1 : period);
+}
+
+	/** bytes the child moves per read or write: at least READSIZE, at least
+		two vectors so large blocks aren't fed in slivers, but never so much
+		that it can't fit in a quarter of the fifo. Whole frames only. */
+static size_t m5_sf_iosize(const t_readsf *x, int bytesperframe)
+{
+	size_t size = 2 * (size_t)x->x_vecsize * bytesperframe;
+	if (size < READSIZE)
+		size = READSIZE;
+	if (size > (size_t)x->x_fifosize / 4)
+		size = x->x_fifosize / 4;
+	size -= size % bytesperframe;
+	return (size < (size_t)bytesperframe ? (size_t)bytesperframe : size);
+}
+
+	/** bytes the buffer must hold for the fifo to keep up with this block
+		size: a quarter of it, the most the child moves at once, has to
+		cover a vector and the lookahead */
+static size_t m5_sf_fifoneed(const t_readsf *x, int bytesperframe)
+{
+	return 4 * (size_t)bytesperframe *
+		((size_t)x->x_vecsize + (size_t)x->x_m5Lookahead);
+}
+
+	/** swap in a zeroed buffer of 'need' bytes if the current one is
+		smaller. The caller makes sure the child can't be touching the
+		fifo. Returns 0, keeping the old buffer, if 'need' is over
+		MAXBUFSIZE or there's no memory for it. */
+static int m5_sf_growbuffer(t_readsf *x, size_t need)
+{
+	char *buf;
+	if (need <= (size_t)x->x_bufsize)
+		return 1;
+	if (need > MAXBUFSIZE || !(buf = (char *)getbytes(need)))
+		return 0;
+	freebytes(x->x_buf, x->x_bufsize);
+	x->x_buf = buf;
+	x->x_bufsize = (int)need;
+	return 1;
+}
+
+	/** make sure the fifo can feed the block size. Called from the dsp
+		method with the mutex held. The buffer the user asked for is kept
+		unless it is really too small; it is grown here while the child is
+		idle, or else at the next open, so in the meantime we only complain
+		if the fifo of the file already open can't hold the vectors. */
+static void m5_sf_fitbuffer(t_readsf *x, int nchannels, const char *header)
+{
+		/* with no file open yet, assume the widest sample, 8 bytes */
+	int bpf = (x->x_sf.sf_bytesperframe > 0 ?
+		x->x_sf.sf_bytesperframe : 8 * nchannels);
+	size_t need = m5_sf_fifoneed(x, bpf);
+	if (need <= (size_t)x->x_bufsize)
+		return;
+	if (x->x_state == STATE_IDLE && x->x_requestcode == REQUEST_NOTHING)
+	{
+		if (!m5_sf_growbuffer(x, need))
+			pd_error(x, "%s: buffer too small for block size %d", header,
+				x->x_vecsize);
+	}
+	else if (x->x_fifosize > 0 && (size_t)x->x_fifosize <
+		2 * (size_t)bpf * ((size_t)x->x_vecsize + (size_t)x->x_m5Lookahead))
+		pd_error(x, "%s: buffer too small for block size %d until the next open",
+			header, x->x_vecsize);
+}
+
+	/** bytes between the fifo tail and head */
+static ssize_t m5_readsf_fifoavailable(const t_readsf *x)
+{
+	ssize_t n = x->x_fifohead - x->x_fifotail;
+	return (n < 0 ? n + x->x_fifosize : n);
+}
+
+	/** copy frames out of the fifo starting at byte 'pos', splitting the
+		transfer where the fifo wraps */
+static void m5_readsf_xferin_fifo(t_readsf *x, const t_m5SoundFormat *fmt,
+	t_sample **vecs, size_t framesread, int pos, size_t nframes)
+{
+	size_t first;
+	pos %= x->x_fifosize;
+	first = (x->x_fifosize - pos) / fmt->f_sf.sf_bytesperframe;
+	if (first > nframes)
+		first = nframes;
+	fmt->f_xferin(&fmt->f_sf, x->x_noutlets, vecs, framesread,
+		(unsigned char *)(x->x_buf + pos), first);
+	if (nframes > first)
+		fmt->f_xferin(&fmt->f_sf, x->x_noutlets, vecs, framesread + first,
+			(unsigned char *)x->x_buf, nframes - first);
+}
+
+	/** copy frames into the fifo starting at byte 'pos', splitting the
+		transfer where the fifo wraps */
+static void m5_writesf_xferout_fifo(t_readsf *x, const t_m5SoundFormat *fmt,
+	t_sample **vecs, size_t onsetframes, int pos, size_t nframes)
+{
+	size_t first;
+	pos %= x->x_fifosize;
+	first = (x->x_fifosize - pos) / fmt->f_sf.sf_bytesperframe;
+	if (first > nframes)
+		first = nframes;
+	fmt->f_xferout(&fmt->f_sf, vecs, (unsigned char *)(x->x_buf + pos),
+		first, onsetframes, 1.);
+	if (nframes > first)
+		fmt->f_xferout(&fmt->f_sf, vecs, (unsigned char *)x->x_buf,
+			nframes - first, onsetframes + first, 1.);
+}
+
+/* ----- the objects m5_soundfile_monitor reports on ----- */
+
+/* Every readsf~ and writesf~ is listed in m5_sf_registry from creation to
+free, oldest first, for m5_soundfile_monitor below.  Only the main thread
+adds, removes and walks it, but Pd instances may each have their own, hence
+the mutex.  The time spent in perform is only measured while a monitor
+exists, so that 300 streams don't read the clock twice per block for
+nothing. */
+
+static t_readsf *m5_sf_registry;
+static pthread_mutex_t m5_sf_registrymutex = PTHREAD_MUTEX_INITIALIZER;
+static int m5_sf_nextid;
+static int m5_sf_monitors; /* m5_soundfile_monitor objects */
+
+static void m5_sf_register(t_readsf *x)
+{
+	t_readsf **p;
+	x->x_m5Next = NULL;
+	x->x_m5Created = sys_getrealtime();
+	x->x_m5Underruns = 0;
+	x->x_m5IoBytes = x->x_m5DspTime = 0;
+	pthread_mutex_lock(&m5_sf_registrymutex);
+	x->x_m5Id = ++m5_sf_nextid;
+	for (p = &m5_sf_registry; *p; p = &(*p)->x_m5Next)
+		;
+	*p = x;
+	pthread_mutex_unlock(&m5_sf_registrymutex);
+}
+
+static void m5_sf_unregister(t_readsf *x)
+{
+	t_readsf **p;
+	pthread_mutex_lock(&m5_sf_registrymutex);
+	for (p = &m5_sf_registry; *p; p = &(*p)->x_m5Next)
+		if (*p == x)
+	{
+		*p = x->x_m5Next;
+		break;
+	}
+	pthread_mutex_unlock(&m5_sf_registrymutex);
+}
+
+	/** dsp_add(m5_sf_timedperform, 2, perform, x): run perform on x and,
+		while a monitor is listening, add up the time it took */
+static t_int *m5_sf_timedperform(t_int *w)
+{
+	t_perfroutine perform = (t_perfroutine)(w[1]);
+	t_readsf *x = (t_readsf *)(w[2]);
+	double then;
+	if (!m5_sf_monitors)
+		return perform(w + 1);
+	then = sys_getrealtime();
+	w = perform(w + 1);
+	x->x_m5DspTime += sys_getrealtime() - then;
+	return w;
+}
+
+/* ----- background file jobs ----- */
+
+/* Some work on a whole file is too slow for the I/O thread to do in line.
+"open -verify" checks the file against the CRC-32C that writesf~ -checksum
+stored in it, "open -loudness" measures its loudness and "open -onsets"
+finds its transients.  Each is a job:
+the I/O thread opens the file a second time, right after its own open, and
+hands that descriptor to a background worker (m5_worker.h), which reads all
+of the sound data, so playback never waits for it.  The main thread polls
+for the result with a clock and reports it on the info outlet.  Another
+"open" or freeing the object cancels a job that is still running. */
+
+#define JOB_PENDING -2
+#define JOB_NONE -1   /* nothing to do, e.g. no checksum stored */
+#define JOB_FAILED 0
+#define JOB_OK 1
+
+#define JOBREADSIZE (16 * READSIZE) /* bytes read at a time */
+#define JOBFRAMES 8192 /* frames decoded at a time */
+#define JOBPOLL 100 /* msec between looks at the result */
+
+typedef struct _m5Job
+{
+	t_soundfile j_sf;     /* the job's own descriptor */
+	char j_path[MAXPDSTRING]; /* where it was found */
+	t_m5WorkerFn j_run;   /* what the worker does with it */
+	int j_refcount;       /* readsf~ and, once started, the job */
+	int j_started;        /* taken by the I/O thread, under x_mutex */
+	int j_cancel;         /* readsf~ no longer wants the result */
+	int j_result;         /* JOB_PENDING until the job is done */
+	const char *j_why;    /* for JOB_FAILED */
+	void *j_data;         /* what it found, for the kind of job */
+	size_t j_datasize;
+	t_m5WorkerFn j_freedata; /* frees what j_data points to, or NULL */
+	struct _m5Job *j_next; /* writesf~: the next take it finishes */
+} t_m5Job;
+
+	/* guards refcounts, cancel flags and results of all jobs */
+static pthread_mutex_t m5_job_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static t_m5Job *m5_job_new(const t_soundfile *sf, t_m5WorkerFn run,
+	size_t datasize, t_m5WorkerFn freedata)
+{
+	t_m5Job *j = (t_m5Job *)getbytes(sizeof(t_m5Job));
+	m5_soundfile_copy(&j->j_sf, sf);
+	j->j_sf.sf_fd = -1;
+	j->j_sf.sf_stream = NULL;
+	j->j_sf.sf_decoder = NULL;
+	j->j_sf.sf_encoder = NULL;
+	j->j_run = run;
+	j->j_refcount = 1;
+	j->j_result = JOB_PENDING;
+	if ((j->j_datasize = datasize))
+		j->j_data = getbytes(datasize);
+	j->j_freedata = freedata;
+	return j;
+}
+
+static void m5_job_release(t_m5Job *j)
+{
+	int last;
+	pthread_mutex_lock(&m5_job_mutex);
+	last = !--j->j_refcount;
+	pthread_mutex_unlock(&m5_job_mutex);
+	if (!last)
+		return;
+	m5_soundfile_close(&j->j_sf);
+	if (j->j_data)
+	{
+		if (j->j_freedata)
+			j->j_freedata(j->j_data);
+		freebytes(j->j_data, j->j_datasize);
+	}
+	freebytes(j, sizeof(t_m5Job));
+}
+
+	/** post the result and drop the job's reference */
+static void m5_job_finish(t_m5Job *j, int result, const char *why)
+{
+	pthread_mutex_lock(&m5_job_mutex);
+	j->j_result = result;
+	j->j_why = why;
+	pthread_mutex_unlock(&m5_job_mutex);
+	m5_job_release(j);
+}
+
+static int m5_job_cancelled(t_m5Job *j)
+{
+	int cancel;
+	pthread_mutex_lock(&m5_job_mutex);
+	cancel = j->j_cancel;
+	pthread_mutex_unlock(&m5_job_mutex);
+	return cancel;
+}
+
+	/** called by the I/O thread with x_mutex held: take a new job, if
+		any, for the open it's about to do; "restart" doesn't redo it */
+static t_m5Job *m5_job_take(t_m5Job *j)
+{
+	if (!j || j->j_started)
+		return NULL;
+	j->j_started = 1;
+	pthread_mutex_lock(&m5_job_mutex);
+	j->j_refcount++;
+	pthread_mutex_unlock(&m5_job_mutex);
+	return j;
+}
+
+	/** called by the I/O thread, unlocked, after it opened the file sf:
+		open it again for the job and queue it */
+static void m5_job_start(t_m5Job *j, const t_soundfile *sf,
+	const char *dirname, const char *filename)
+{
+	char dir[MAXPDSTRING], *name;
+	int fd;
+	if (!j)
+		return;
+	if (sf->sf_fd < 0)
+	{
+		m5_job_finish(j, JOB_FAILED, "file couldn't be opened");
+		return;
+	}
+	if (!m5_soundfile_isseekable(sf))
+	{
+		m5_job_finish(j, JOB_FAILED, "streams can't be read twice");
+		return;
+	}
+		/* as m5_open_soundfile_via_namelist(), keeping the path */
+	if ((fd = open_via_path(dirname, filename, "", dir, &name,
+		MAXPDSTRING, 1)) < 0 || m5_open_soundfile_via_fd(fd, &j->j_sf, 0) < 0)
+	{
+		m5_job_finish(j, JOB_FAILED, "file couldn't be opened");
+		return;
+	}
+		/* the sidecar is named after the path, which must fit */
+	if (snprintf(j->j_path, MAXPDSTRING, "%s/%s", dir, name) >= MAXPDSTRING)
+	{
+		m5_job_finish(j, JOB_FAILED, "path too long");
+		return;
+	}
+	if (!m5_worker_submit(j->j_run, j))
+		m5_job_finish(j, JOB_FAILED, "no thread to run it on");
+}
+
+typedef void (*t_m5JobScanFn)(void *state, t_sample **vecs, size_t nframes);
+
+	/** decode all of the job's sound data for fn, JOBFRAMES deinterleaved
+		frames at a time; returns 0 if it was cut short or cancelled */
+static int m5_job_scan(t_m5Job *j, t_m5JobScanFn fn, void *state)
+{
+	t_soundfile *sf = &j->j_sf;
+	t_sample *vecs[MAXSFCHANS];
+	t_m5SoundFormat *fmt = m5_soundformat_new(sf);
+	size_t chunk = JOBFRAMES * sf->sf_bytesperframe;
+	char *buf = (char *)getbytes(chunk);
+	off_t done = 0;
+	int i;
+	for (i = 0; i < sf->sf_nchannels; i++)
+		vecs[i] = (t_sample *)getbytes(JOBFRAMES * sizeof(t_sample));
+	while (done < sf->sf_bytelimit && !m5_job_cancelled(j))
+	{
+		size_t want = (sf->sf_bytelimit - done < (off_t)chunk ?
+			(size_t)(sf->sf_bytelimit - done) : chunk);
+		ssize_t got = m5_soundfile_read(sf, sf->sf_headersize + done,
+			buf, want);
+		if (got < sf->sf_bytesperframe)
+			break;
+		got -= got % sf->sf_bytesperframe;
+		fmt->f_xferin(&fmt->f_sf, sf->sf_nchannels, vecs, 0,
+			(unsigned char *)buf, got / sf->sf_bytesperframe);
+		fn(state, vecs, got / sf->sf_bytesperframe);
+		done += got;
+	}
+	for (i = 0; i < sf->sf_nchannels; i++)
+		freebytes(vecs[i], JOBFRAMES * sizeof(t_sample));
+	freebytes(buf, chunk);
+	m5_soundformat_free(fmt);
+	return (done >= sf->sf_bytelimit);
+}
+
+/* ----- "-verify" ----- */
+
+	/* reverse the bytes of each whole sample in buf */
+static void m5_verify_swap(char *buf, size_t size, int bytespersample)
+{
+	char *sp, *end = buf + size - size % bytespersample;
+	int i;
+	for (sp = buf; sp < end; sp += bytespersample)
+		for (i = 0; i < bytespersample / 2; i++)
+		{
+			char c = sp[i];
+			sp[i] = sp[bytespersample - 1 - i];
+			sp[bytespersample - 1 - i] = c;
+		}
+}
+
+	/** worker job: checksum all of the sound data and compare */
+static void m5_verify_run(void *z)
+{
+	t_m5Job *j = (t_m5Job *)z;
+	t_soundfile *sf = &j->j_sf;
+	t_soundfile_checksum ck;
+	size_t chunk = JOBREADSIZE - JOBREADSIZE % sf->sf_bytesperframe;
+	uint64_t done = 0;
+	uint32_t crc = 0;
+	int swap;
+	char *buf;
+
+		/* a truncated PCM file has lost a trailing checksum as well */
+	if (!sf->sf_decoder && lseek(sf->sf_fd, 0, SEEK_END) <
+		(off_t)(sf->sf_headersize + sf->sf_bytelimit))
+	{
+		m5_job_finish(j, JOB_FAILED, "file is shorter than its header says");
+		return;
+	}
+	if (!sf->sf_type || !sf->sf_type->t_readchecksumfn ||
+		!sf->sf_type->t_readchecksumfn(sf, &ck))
+	{
+		m5_job_finish(j, JOB_NONE, 0);
+		return;
+	}
+	if ((uint64_t)sf->sf_bytelimit < ck.sc_databytes)
+	{
+		m5_job_finish(j, JOB_FAILED, "file is shorter than when written");
+		return;
+	}
+		/* decoded data may come out in the other endianness */
+	swap = (ck.sc_bigendian != sf->sf_bigendian);
+	buf = (char *)getbytes(chunk);
+	while (done < ck.sc_databytes && !m5_job_cancelled(j))
+	{
+		size_t want = (ck.sc_databytes - done < chunk ?
+			(size_t)(ck.sc_databytes - done) : chunk);
+		ssize_t got = m5_soundfile_read(sf, sf->sf_headersize + done,
+			buf, want);
+		if (got <= 0)
+			break;
+		if (swap)
+			m5_verify_swap(buf, got, sf->sf_bytespersample);
+		crc = m5_crc32c(crc, buf, got);
+		done += got;
+	}
+	freebytes(buf, chunk);
+	if (done < ck.sc_databytes)
+		m5_job_finish(j, JOB_FAILED, "sound data couldn't be read");
+	else if (crc != ck.sc_crc32c)
+		m5_job_finish(j, JOB_FAILED, "checksum mismatch");
+	else m5_job_finish(j, JOB_OK, 0);
+}
+
+/* ----- "-loudness" ----- */
+
+	/** worker job: measure the file, or take the measurement from its
+		sidecar if it's still current, into j_data */
+static void m5_loudness_run(void *z)
+{
+	t_m5Job *j = (t_m5Job *)z;
+	t_soundfile *sf = &j->j_sf;
+	t_m5LoudnessResult *r = (t_m5LoudnessResult *)j->j_data;
+	t_m5Loudness *l;
+	struct stat st;
+	int complete;
+
+	if (fstat(sf->sf_fd, &st) < 0)
+	{
+		m5_job_finish(j, JOB_FAILED, "file couldn't be read");
+		return;
+	}
+	if (m5_loudness_load(j->j_path, &st, r))
+	{
+		m5_job_finish(j, JOB_OK, 0);
+		return;
+	}
+	if (!(l = m5_loudness_new(sf->sf_nchannels, sf->sf_samplerate)))
+	{
+		m5_job_finish(j, JOB_FAILED, "can't measure this channel count or sample rate");
+		return;
+	}
+	complete = m5_job_scan(j, (t_m5JobScanFn)m5_loudness_process, l);
+	m5_loudness_result(l, r);
+	m5_loudness_free(l);
+	if (!complete)
+		m5_job_finish(j, JOB_FAILED, "sound data couldn't be read");
+	else
+	{
+			/* a sidecar that can't be written just costs a rescan */
+		m5_loudness_save(j->j_path, &st, r);
+		m5_job_finish(j, JOB_OK, 0);
+	}
+}
+
+/* ----- "-onsets" ----- */
+
+static void m5_onsets_freelist(void *z)
+{
+	m5_onsetlist_clear((t_m5OnsetList *)z);
+}
+
+	/** worker job: find the file's onsets, or take them from its sidecar
+		if it's still current, into j_data */
+static void m5_onsets_run(void *z)
+{
+	t_m5Job *j = (t_m5Job *)z;
+	t_soundfile *sf = &j->j_sf;
+	t_m5OnsetList *list = (t_m5OnsetList *)j->j_data;
+	t_m5Onsets *o;
+	struct stat st;
+	int complete;
+
+	if (fstat(sf->sf_fd, &st) < 0)
+	{
+		m5_job_finish(j, JOB_FAILED, "file couldn't be read");
+		return;
+	}
+	if (m5_onsets_load(j->j_path, &st, list))
+	{
+		m5_job_finish(j, JOB_OK, 0);
+		return;
+	}
+	if (!(o = m5_onsets_new(sf->sf_nchannels, sf->sf_samplerate)))
+	{
+		m5_job_finish(j, JOB_FAILED, "can't scan this channel count or sample rate");
+		return;
+	}
+	complete = m5_job_scan(j, (t_m5JobScanFn)m5_onsets_process, o);
+	m5_onsets_result(o, list);
+	m5_onsets_free(o);
+	if (!complete)
+		m5_job_finish(j, JOB_FAILED, "sound data couldn't be read");
+	else
+	{
+		m5_onsets_save(j->j_path, &st, list);
+		m5_job_finish(j, JOB_OK, 0);
+	}
+}
+
+/* ----- region heads for "play" ----- */
+
+/* The child keeps the first REGIONHEADMS of every entry of "regions" in
+RAM, loaded one at a time whenever its fifo is full, and serves reads that
+start there from memory.  A region cued with "play ... at" then fills the
+fifo from its time on without a trip to the disk, so the switch is
+gapless even when it comes just a few blocks ahead.  The heads belong to
+the child alone and are dropped with its file. */
+
+typedef struct _m5RegionHead
+{
+	off_t h_offset;     /* file offset of the region's first frame */
+	size_t h_want;      /* bytes to keep */
+	char *h_buf;        /* NULL until loaded */
+	size_t h_bytes;     /* valid bytes in h_buf */
+	int h_loaded;
+} t_m5RegionHead;
+
+typedef struct _m5RegionHeads
+{
+	int rh_serial;      /* x_m5RegionSerial they were made for, or -1 */
+	int rh_n;
+	t_m5RegionHead rh_vec[MAXREGIONS];
+} t_m5RegionHeads;
+
+static void m5_regionheads_clear(t_m5RegionHeads *rh)
+{
+	int i;
+	for (i = 0; i < rh->rh_n; i++)
+		if (rh->rh_vec[i].h_buf)
+			freebytes(rh->rh_vec[i].h_buf, rh->rh_vec[i].h_want);
+	rh->rh_n = 0;
+	rh->rh_serial = -1;
+}
+
+	/** with x_mutex held: start over if "regions" changed.  only seekable
+		files that end before seekmax get heads */
+static void m5_regionheads_sync(t_m5RegionHeads *rh, const t_readsf *x,
+	const t_soundfile *sf, off_t offset, off_t seekmax, int eligible)
+{
+	size_t maxframes = (size_t)(REGIONHEADMS * sf->sf_samplerate / 1000.);
+	int i;
+	if (rh->rh_serial == x->x_m5RegionSerial)
+		return;
+	m5_regionheads_clear(rh);
+	rh->rh_serial = x->x_m5RegionSerial;
+	if (!eligible || !m5_soundfile_isseekable(sf))
+		return;
+	for (i = 0; i < x->x_m5NRegions; i++)
+	{
+		const t_m5Region *r = &x->x_m5Regions[i];
+		t_m5RegionHead *h = &rh->rh_vec[rh->rh_n++];
+		size_t frames = (r->r_length < maxframes ? r->r_length : maxframes);
+		h->h_offset = offset + (off_t)(r->r_start * sf->sf_bytesperframe);
+		h->h_want = frames * sf->sf_bytesperframe;
+		if (h->h_offset + (off_t)h->h_want > seekmax)
+			h->h_want = (h->h_offset < seekmax ? seekmax - h->h_offset : 0);
+		h->h_buf = NULL;
+		h->h_bytes = 0;
+		h->h_loaded = !h->h_want;
+	}
+}
+
+static t_m5RegionHead *m5_regionheads_missing(t_m5RegionHeads *rh)
+{
+	int i;
+	for (i = 0; i < rh->rh_n; i++)
+		if (!rh->rh_vec[i].h_loaded)
+			return &rh->rh_vec[i];
+	return NULL;
+}
+
+	/** with x_mutex released: read a head from the file */
+static void m5_regionhead_load(t_m5RegionHead *h, t_m5SfHead *head,
+	t_soundfile *sf)
+{
+	ssize_t n;
+	h->h_loaded = 1;
+	if (!(h->h_buf = (char *)getbytes(h->h_want)))
+		return;
+	n = m5_sfhead_read(head, sf, h->h_offset, h->h_buf, h->h_want, 0);
+	h->h_bytes = (n > 0 ? n : 0);
+}
+
+static int m5_regionheads_resident(const t_m5RegionHeads *rh)
+{
+	int i, n = 0;
+	for (i = 0; i < rh->rh_n; i++)
+		n += (rh->rh_vec[i].h_bytes > 0);
+	return n;
+}
+
+	/** copy what a head holds from offset on, at most size bytes.
+		returns 0 if no head holds offset */
+static size_t m5_regionheads_read(const t_m5RegionHeads *rh, off_t offset,
+	char *dst, size_t size)
+{
+	int i;
+	for (i = 0; i < rh->rh_n; i++)
+	{
+		const t_m5RegionHead *h = &rh->rh_vec[i];
+		if (offset >= h->h_offset && offset < h->h_offset + (off_t)h->h_bytes)
+		{
+			size_t n = h->h_offset + h->h_bytes - offset;
+			if (n > size)
+				n = size;
+			memcpy(dst, h->h_buf + (offset - h->h_offset), n);
+			return n;
+		}
+	}
+	return 0;
+}
+
+/* ----- the child thread which performs file I/O ----- */
+
+	/** thread state debug prints to stderr */
+//#define DEBUG_SOUNDFILE_THREADS
+
+#if 1
+#define sfread_cond_wait pthread_cond_wait
+#define sfread_cond_signal pthread_cond_signal
+#else
+#include <sys/time.h>    /* debugging version... */
+#include <sys/types.h>
+static void m5_readsf_fakewait(pthread_mutex_t *b)
+{
+	struct timeval timeout;
+	timeout.tv_sec = 0;
+	timeout.tv_usec = 1000000;
+	pthread_mutex_unlock(b);
+	select(0, 0, 0, 0, &timeout);
+	pthread_mutex_lock(b);
+}
+
+#define sfread_cond_wait(a,b) readsf_fakewait(b)
+#define sfread_cond_signal(a)
+#endif
+
+	/** stall the I/O thread: between attempts to reopen a file, and in
+		test builds before every disk access, standing in for slow
+		storage */
+static void m5_sf_iodelay(double ms)
+{
+	if (ms <= 0)
+		return;
+#ifdef _WIN32
+	Sleep((DWORD)ms);
+#else
+	usleep((useconds_t)(ms * 1000.));
+#endif
+}
+
+#ifdef M5_VIRTUAL_CLOCK
+#define M5_SF_IODELAY(x) ((x)->x_m5IoDelay)
+#else
+#define M5_SF_IODELAY(x) 0.
+#endif
+
+/* Freeing an object never waits for its child thread, which may be stuck
+in a read, write or close on slow or hung storage: the free method copies
+the object's state into the child's link and tells it to quit, and the
+child, once it gets there, closes its file and frees the rest itself.
+Until then it finds the state through the link after every wait for the
+mutex, and touches none of it while it doesn't hold that. */
+
+static t_m5SfLink *m5_sf_newlink(void)
+{
+	t_m5SfLink *link = (t_m5SfLink *)getbytes(sizeof(t_m5SfLink));
+	if (!link)
+		return NULL;
+	pthread_mutex_init(&link->l_mutex, 0);
+	pthread_cond_init(&link->l_requestcondition, 0);
+	pthread_cond_init(&link->l_answercondition, 0);
+	link->l_refcount = 1;
+	return link;
+}
+
+static void m5_sf_retainlink(t_m5SfLink *link)
+{
+	__atomic_add_fetch(&link->l_refcount, 1, __ATOMIC_RELAXED);
+}
+
+static void m5_sf_releaselink(t_m5SfLink *link)
+{
+	if (__atomic_sub_fetch(&link->l_refcount, 1, __ATOMIC_ACQ_REL))
+		return;
+	pthread_cond_destroy(&link->l_requestcondition);
+	pthread_cond_destroy(&link->l_answercondition);
+	pthread_mutex_destroy(&link->l_mutex);
+	freebytes(link, sizeof(t_m5SfLink));
+}
+
+static void m5_sf_attachlink(t_readsf *x, t_m5SfLink *link)
+{
+	link->l_x = x;
+	x->x_m5Link = link;
+	x->x_mutex = &link->l_mutex;
+	x->x_requestcondition = &link->l_requestcondition;
+	x->x_answercondition = &link->l_answercondition;
+}
+
+	/** child side: lock, and find the state again */
+static t_readsf *m5_sf_childlock(t_m5SfLink *link)
+{
+	pthread_mutex_lock(&link->l_mutex);
+	return link->l_x;
+}
+
+	/** child side: wait for a request, and find the state again */
+static t_readsf *m5_sf_childwait(t_m5SfLink *link)
+{
+	sfread_cond_wait(&link->l_requestcondition, &link->l_mutex);
+	return link->l_x;
+}
+
+	/** called by the free methods once everything only the object itself
+		uses is gone: leave the rest to the child and return at once */
+static void m5_sf_handoff(t_readsf *x)
+{
+	t_m5SfLink *link = x->x_m5Link;
+	pthread_mutex_lock(&link->l_mutex);
+	x->x_requestcode = REQUEST_QUIT;
+	link->l_ghost = *x;
+	link->l_x = &link->l_ghost;
+	sfread_cond_signal(&link->l_requestcondition);
+	pthread_mutex_unlock(&link->l_mutex);
+	pthread_detach(x->x_childthread);
+}
+
+	/** the child's last act after "quit", with the mutex held: free the
+		fifo, the formats and any takes still queued for their report */
+static void m5_sf_reap(t_m5SfLink *link)
+{
+	t_readsf *x = link->l_x;
+	freebytes(x->x_buf, x->x_bufsize);
+	m5_sf_freeformats(x);
+	while (x->x_m5Takes)
+	{
+		t_m5Job *j = x->x_m5Takes;
+		x->x_m5Takes = j->j_next;
+		m5_job_release(j);
+	}
+	link->l_x = NULL;
+	pthread_mutex_unlock(&link->l_mutex);
+	m5_sf_releaselink(link);
+}
+
+/* ----- reading takes while they are recorded ----- */
+
+/* A writesf~ take in an uncompressed format is listed here, by device and
+inode, from the moment its file is created until its header is final.  A
+readsf~ that opens a listed file follows its growing end instead of the
+length in the header: what is on disk it reads from its own descriptor,
+the rest, still in the writer's fifo, it copies from there under the
+writer's mutex.  The writer's link is kept alive by a reference for as
+long as anyone may look into it.  Lock order is writer, then the list;
+readers never hold the list while they lock a writer. */
+
+typedef struct _m5Live
+{
+	dev_t l_dev;
+	ino_t l_ino;
+	ssize_t l_headersize;
+	int l_bytesperframe;
+	t_m5SfLink *l_link;     /* the writer while it records, or NULL */
+	size_t l_frames;        /* the take's length once l_link is NULL */
+	int l_refcount;         /* the list's and each reader's */
+	struct _m5Live *l_next;
+} t_m5Live;
+
+static t_m5Live *m5_live_list;
+static pthread_mutex_t m5_live_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int m5_writesf_datalimit(const t_readsf *x);
+
+	/** writer side, x_mutex held: list the take just created in sf */
+static t_m5Live *m5_live_new(t_m5SfLink *link, const t_soundfile *sf)
+{
+	t_m5Live *l;
+	struct stat st;
+	if (sf->sf_type->t_encodefn || fstat(sf->sf_fd, &st) < 0 ||
+		!(l = (t_m5Live *)getbytes(sizeof(t_m5Live))))
+			return NULL;
+	l->l_dev = st.st_dev;
+	l->l_ino = st.st_ino;
+	l->l_headersize = sf->sf_headersize;
+	l->l_bytesperframe = sf->sf_bytesperframe;
+	l->l_link = link;
+	l->l_frames = 0;
+	l->l_refcount = 1;
+	m5_sf_retainlink(link);
+	pthread_mutex_lock(&m5_live_mutex);
+	l->l_next = m5_live_list;
+	m5_live_list = l;
+	pthread_mutex_unlock(&m5_live_mutex);
+	return l;
+}
+
+static void m5_live_release(t_m5Live *l)
+{
+	int last;
+	if (!l)
+		return;
+	pthread_mutex_lock(&m5_live_mutex);
+	last = !--l->l_refcount;
+	pthread_mutex_unlock(&m5_live_mutex);
+	if (last)
+		freebytes(l, sizeof(t_m5Live));
+}
+
+	/** writer side, x_mutex held: the take stops growing at frames */
+static void m5_live_end(t_readsf *x, size_t frames)
+{
+	t_m5Live *l = x->x_m5LiveTake;
+	t_m5SfLink *link;
+	if (!l)
+		return;
+	x->x_m5LiveTake = NULL;
+	pthread_mutex_lock(&m5_live_mutex);
+	link = l->l_link;
+	l->l_frames = frames;
+	l->l_link = NULL;
+	pthread_mutex_unlock(&m5_live_mutex);
+		/* the object still holds its own reference */
+	m5_sf_releaselink(link);
+}
+
+	/** the take's header is final: new readers can trust it again */
+static void m5_live_unlist(t_m5Live *l)
+{
+	t_m5Live **lp;
+	if (!l)
+		return;
+	pthread_mutex_lock(&m5_live_mutex);
+	for (lp = &m5_live_list; *lp; lp = &(*lp)->l_next)
+	{
+		if (*lp == l)
+		{
+			*lp = l->l_next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&m5_live_mutex);
+	m5_live_release(l);
+}
+
+	/** reader side: the take recorded into the open file sf, if any */
+static t_m5Live *m5_live_find(const t_soundfile *sf)
+{
+	t_m5Live *l;
+	struct stat st;
+	if (sf->sf_fd < 0 || sf->sf_stream || fstat(sf->sf_fd, &st) < 0)
+		return NULL;
+	pthread_mutex_lock(&m5_live_mutex);
+	for (l = m5_live_list; l; l = l->l_next)
+	{
+		if (l->l_dev == st.st_dev && l->l_ino == st.st_ino &&
+			l->l_headersize == sf->sf_headersize &&
+			l->l_bytesperframe == sf->sf_bytesperframe)
+		{
+			l->l_refcount++;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&m5_live_mutex);
+	return l;
+}
+
+	/** lock the writer of a take still recording, or return NULL */
+static t_readsf *m5_live_lockwriter(t_m5Live *l, t_m5SfLink **linkp)
+{
+	t_m5SfLink *link;
+	pthread_mutex_lock(&m5_live_mutex);
+	if ((link = l->l_link))
+		m5_sf_retainlink(link);
+	pthread_mutex_unlock(&m5_live_mutex);
+	if (!link)
+		return NULL;
+	pthread_mutex_lock(&link->l_mutex);
+	if (link->l_x && link->l_x->x_m5LiveTake == l)
+	{
+		*linkp = link;
+		return link->l_x;
+	}
+	pthread_mutex_unlock(&link->l_mutex);
+	m5_sf_releaselink(link);
+	return NULL;
+}
+
+static void m5_live_unlockwriter(t_m5SfLink *link)
+{
+	pthread_mutex_unlock(&link->l_mutex);
+	m5_sf_releaselink(link);
+}
+
+	/** bytes of the take's data waiting in the writer's fifo */
+static size_t m5_live_pending(const t_readsf *w)
+{
+	return (m5_writesf_datalimit(w) - w->x_fifotail + w->x_fifosize) %
+		w->x_fifosize;
+}
+
+	/** the take's data bytes after onsetframes, as far as it has been
+		recorded; growing is set while it records */
+static ssize_t m5_live_bytelimit(t_m5Live *l, size_t onsetframes,
+	int *growing)
+{
+	t_m5SfLink *link;
+	t_readsf *w = m5_live_lockwriter(l, &link);
+	size_t frames;
+	if (w)
+	{
+		frames = w->x_frameswritten + m5_live_pending(w) / l->l_bytesperframe;
+		m5_live_unlockwriter(link);
+		*growing = 1;
+	}
+	else
+	{
+		pthread_mutex_lock(&m5_live_mutex);
+		frames = l->l_frames;
+		pthread_mutex_unlock(&m5_live_mutex);
+		*growing = 0;
+	}
+	return (frames > onsetframes ?
+		(ssize_t)(frames - onsetframes) * l->l_bytesperframe : 0);
+}
+
+	/** as m5_soundfile_read(), taking what isn't on disk yet from the
+		writer's fifo.  may return less than size where the two meet */
+static ssize_t m5_live_read(t_m5Live *l, t_soundfile *sf, off_t offset,
+	char *dst, size_t size)
+{
+	t_m5SfLink *link;
+	t_readsf *w = m5_live_lockwriter(l, &link);
+	off_t ondisk;
+	if (!w)
+		return m5_soundfile_read(sf, offset, dst, size);
+	ondisk = l->l_headersize + (off_t)(w->x_frameswritten * l->l_bytesperframe);
+	if (offset >= ondisk)
+	{
+		size_t pending = m5_live_pending(w), start = offset - ondisk, n = 0;
+		if (start < pending)
+		{
+			int from = (w->x_fifotail + start) % w->x_fifosize;
+			size_t first;
+			n = (size < pending - start ? size : pending - start);
+			first = (n < (size_t)(w->x_fifosize - from) ? n :
+				(size_t)(w->x_fifosize - from));
+			memcpy(dst, w->x_buf + from, first);
+			memcpy(dst + first, w->x_buf, n - first);
+		}
+		m5_live_unlockwriter(link);
+		return n;
+	}
+	m5_live_unlockwriter(link);
+	if ((off_t)size > ondisk - offset)
+		size = ondisk - offset;
+	return m5_soundfile_read(sf, offset, dst, size);
+}
+
+static void *m5_readsf_child_main(void *zz)
+{
+	t_readsf *x = zz;
+	t_m5SfLink *link = x->x_m5Link;
+	t_soundfile sf = {0};
+	t_m5SfCacheKey key; /* how the open file was asked for */
+	t_m5SfHead head = {0};
+	t_m5Live *live = NULL; /* the take sf is being recorded as, or NULL */
+	t_m5RegionHeads regionheads; /* for sf */
+	int cueserial = -1; /* x_m5CueSerial of the cue the fifo has reached */
+	ssize_t m5_original_bytelimit = 0;
+	size_t m5_seek_max = 0;
+	off_t m5_initial_offset = 0;
+	
+	m5_soundfile_clear(&sf);
+	regionheads.rh_n = 0;
+	regionheads.rh_serial = -1;
+#ifdef PDINSTANCE
+	pd_this = x->x_pd_this;
+#endif
+#ifdef DEBUG_SOUNDFILE_THREADS
+	fprintf(stderr, "readsf~: 1\n");
+#endif
+	x = m5_sf_childlock(link);
+	while (1)
+	{
+		int fifohead;
+		char *buf;
+#ifdef DEBUG_SOUNDFILE_THREADS
+		fprintf(stderr, "readsf~: 0\n");
+#endif
+		if (x->x_requestcode == REQUEST_NOTHING)
+		{
+#ifdef DEBUG_SOUNDFILE_THREADS
+			fprintf(stderr, "readsf~: wait 2\n");
+#endif
+			m5_sf_reclaimformat(x);
+			sfread_cond_signal(x->x_answercondition);
+			x = m5_sf_childwait(link);
+#ifdef DEBUG_SOUNDFILE_THREADS
+			fprintf(stderr, "readsf~: 3\n");
+#endif
+		}
+		else if (x->x_requestcode == REQUEST_OPEN)
+		{
+			ssize_t bytesread;
+			size_t wantbytes, need;
+			off_t nextSeek = 0; 	
+
+				/* copy file stuff out of the data structure so we can
+				relinquish the mutex while we're in open_soundfile_via_path() */
+			size_t onsetframes = x->x_onsetframes;
+			// size_t loop_length_bytes = 0;
+			const char *filename = x->x_filename;
+			const char *dirname = canvas_getdir(x->x_canvas)->s_name;
+			int ram = x->x_m5Ram;
+			double iodelay = M5_SF_IODELAY(x);
+			int retries = 0; /* reopens since the last good read */
+			int growing = 0; /* live, and still being recorded */
+			t_m5Job *verify, *loudness, *onsets;
+#ifdef M5_VIRTUAL_CLOCK
+			int cold = x->x_m5Cold;
+#endif
+
+#ifdef DEBUG_SOUNDFILE_THREADS
+			fprintf(stderr, "readsf~: 4\n");
+#endif
+				/* alter the request code so that an ensuing "open" will get
+				noticed. */
+			x->x_requestcode = REQUEST_BUSY;
+			x->x_fileerror = 0;
+#ifdef M5_VIRTUAL_CLOCK
+			x->x_m5Cold = 0;
+#endif
+
+				/* if there's already a file open, park it */
+			if (sf.sf_fd >= 0)
+			{
+				pthread_mutex_unlock(x->x_mutex);
+				m5_sfcache_release(&key, &sf, &head, !live);
+				m5_live_release(live);
+				live = NULL;
+				m5_regionheads_clear(&regionheads);
+				x = m5_sf_childlock(link);
+				x->x_m5RegionsResident = 0;
+				x->x_sf.sf_fd = -1;
+				x->x_sf.sf_stream = NULL;
+				x->x_sf.sf_decoder = NULL;
+				if (x->x_requestcode != REQUEST_BUSY)
+					goto lost;
+			}
+				/* cache sf *after* closing as x->sf's type
+					may have changed in readsf_open() */
+			m5_soundfile_copy(&sf, &x->x_sf);
+			x->x_m5StreamEnded = 0;
+			m5_sfcache_makekey(&key, dirname, filename, onsetframes, &sf);
+			verify = m5_job_take(x->x_m5Verify);
+			loudness = m5_job_take(x->x_m5Loudness);
+			onsets = m5_job_take(x->x_m5Onsets);
+				/* open the soundfile with the mutex unlocked, unless it
+				was parked in the cache */
+			x->x_m5IoSince = sys_getrealtime();
+			pthread_mutex_unlock(x->x_mutex);
+#ifdef M5_VIRTUAL_CLOCK
+				/* "-cold": close a parked copy and open from scratch, with
+				what "open" asked for rather than the header it had parsed */
+			if (cold && m5_sfcache_take(&key, &sf, &head))
+			{
+				m5_sfcache_release(&key, &sf, &head, 0);
+				m5_soundfile_copy(&sf, &key.k_request);
+			}
+			if (cold || !m5_sfcache_take(&key, &sf, &head))
+#else
+			if (!m5_sfcache_take(&key, &sf, &head))
+#endif
+			{
+				m5_sf_iodelay(iodelay);
+				m5_sfcache_open(&key, dirname, filename, &sf, onsetframes);
+#if defined(M5_VIRTUAL_CLOCK) && defined(POSIX_FADV_DONTNEED)
+					/* and have the kernel forget the file's pages */
+				if (cold && sf.sf_fd >= 0)
+					posix_fadvise(sf.sf_fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+			}
+				/* a take still being recorded here is followed as it
+				grows, and never kept in RAM */
+			if ((live = m5_live_find(&sf)))
+				sf.sf_bytelimit = m5_live_bytelimit(live, onsetframes,
+					&growing);
+			else if (ram && sf.sf_fd >= 0 && !head.h_ram.r_bank)
+				m5_samplereader_attach(&head.h_ram, &sf, sf.sf_bytelimit +
+					onsetframes * sf.sf_bytesperframe);
+			m5_job_start(verify, &sf, dirname, filename);
+			m5_job_start(loudness, &sf, dirname, filename);
+			m5_job_start(onsets, &sf, dirname, filename);
+			x = m5_sf_childlock(link);
+			x->x_m5IoSince = -1;
+			x->x_m5Live = (live ? 1 + growing : 0);
+			
+			// get maximum size of loop, in bytes, that contains all sound data in file after 
+			// 'onset' frames 
+			m5_original_bytelimit = sf.sf_bytelimit;
+			
+			// lowest offset in file, after 'onset' frames
+			m5_initial_offset = sf.sf_headersize + (onsetframes * sf.sf_bytesperframe);
+			
+			// highest offset in file
+			m5_seek_max = m5_original_bytelimit + m5_initial_offset;
+		
+
+#ifdef DEBUG_SOUNDFILE_THREADS
+			fprintf(stderr, "readsf~: 5\n");
+#endif
+			if (sf.sf_fd < 0)
+			{
+				x->x_fileerror = errno;
+				x->x_eof = 1;
+#ifdef DEBUG_SOUNDFILE_THREADS
+				fprintf(stderr, "readsf~: open failed %s %s\n",
+					filename, dirname);
+#endif
+				goto lost;
+			}
+				/* copy back into the instance structure. */
+			m5_soundfile_copy(&x->x_sf, &sf);
+			m5_sf_publishformat(x, &sf);
+				/* check if another request has been made; if so, field it */
+			if (x->x_requestcode != REQUEST_BUSY)
+				goto lost;
+#ifdef DEBUG_SOUNDFILE_THREADS
+			fprintf(stderr, "readsf~: 6\n");
+#endif
+			x->x_fifohead = 0;
+				/* a block size set while the last file played may need a
+				bigger buffer. Nothing is in the fifo yet, so swap it now,
+				allocating with the mutex released; if there's no memory,
+				keep the old one (the dsp method has said it's too small) */
+			need = m5_sf_fifoneed(x, sf.sf_bytesperframe);
+			if (need > (size_t)x->x_bufsize && need <= MAXBUFSIZE)
+			{
+				char *grown;
+				pthread_mutex_unlock(x->x_mutex);
+				grown = (char *)getbytes(need);
+				x = m5_sf_childlock(link);
+				if (x->x_requestcode != REQUEST_BUSY)
+				{
+					if (grown)
+						freebytes(grown, need);
+					goto lost;
+				}
+				if (grown)
+				{
+					freebytes(x->x_buf, x->x_bufsize);
+					x->x_buf = grown;
+					x->x_bufsize = (int)need;
+				}
+			}
+					/* set fifosize from bufsize.  fifosize only needs to be
+					a multiple of the frame size: the perform routine splits
+					its transfers where the fifo wraps, so any vector size
+					(and any hop under block~ overlap) works. */
+			x->x_fifosize = x->x_bufsize - (x->x_bufsize %
+				sf.sf_bytesperframe);
+					/* arrange for the "request" condition to be signaled 16
+					times per buffer */
+#ifdef DEBUG_SOUNDFILE_THREADS
 			fprintf(stderr, "readsf~: fifosize %d\n", x->x_fifosize);
 #endif
-			x->x_sigcountdown = x->x_sigperiod = (x->x_fifosize /
-				(16 * sf.sf_bytesperframe * x->x_vecsize));
+			x->x_sigcountdown = x->x_sigperiod =
+				m5_sf_sigperiod(x, sf.sf_bytesperframe);
 				/* in a loop, wait for the fifo to get hungry and feed it */
 			
 			// int seekstartflag = 0;
@@ -1471,17 +3288,49 @@ static void *m5_readsf_child_main(void *zz)
 				// 
 				
 				int fifosize = x->x_fifosize;
+				size_t readsize = m5_sf_iosize(x, sf.sf_bytesperframe);
 #ifdef DEBUG_SOUNDFILE_THREADS
 				fprintf(stderr, "readsf~: 77\n");
 #endif
 				// actual loop length, always +ve
 				size_t loop_length_bytes = 0;
+				int wasgrowing = growing;
+				
+				// the loop to fill the fifo with. A region cued by "play ... at" takes
+				// over where the fifo reaches its time: reads stop short of that, and
+				// once there, nextSeek is found again in the region
+				size_t looplength = x->x_m5LoopLength, loopstart = x->x_m5LoopStart;
+				double playstart = x->x_m5PlayStartTime, seektime = x->x_m5HeadTimeRequest;
+				int reseek = (x->x_fifohead == 0 && x->x_fifotail == 0);
+				size_t cuelimit = SIZE_MAX;
+				m5_regionheads_sync(&regionheads, x, &sf, m5_initial_offset,
+					m5_seek_max, !live);
+				if (x->x_m5CueTime >= 0)
+				{
+					double headtime = x->x_m5TailTime +
+						m5_readsf_fifoavailable(x) / sf.sf_bytesperframe;
+					if (headtime >= x->x_m5CueTime)
+					{
+						looplength = x->x_m5Cue.r_length;
+						loopstart = x->x_m5Cue.r_start;
+						playstart = x->x_m5CueTime;
+						if (cueserial != x->x_m5CueSerial)
+						{
+							cueserial = x->x_m5CueSerial;
+							reseek = 1;
+							seektime = headtime;
+						}
+					}
+					else cuelimit = (size_t)(x->x_m5CueTime - headtime) *
+						sf.sf_bytesperframe;
+				}
 				
 				// determine actual loop length... either use available loop length in file, or pre-defined
-				if (x->x_m5LoopLength == LOOP_SELF) {
-					loop_length_bytes = m5_original_bytelimit;
+				// a take still being recorded has no end to wrap at yet
+				if (looplength == LOOP_SELF) {
+					loop_length_bytes = (growing ? SFMAXBYTES / 2 : m5_original_bytelimit);
 				} else {
-					loop_length_bytes = sf.sf_bytesperframe * x->x_m5LoopLength;
+					loop_length_bytes = sf.sf_bytesperframe * looplength;
 				}
 				
 				// cannot have 0 loop length!
@@ -1494,20 +3343,20 @@ static void *m5_readsf_child_main(void *zz)
 				
 				// user-defined start time for loop file, in bytes 
 				// added to 'onset'
-				size_t loop_start_bytes = sf.sf_bytesperframe * x->x_m5LoopStart;
+				size_t loop_start_bytes = sf.sf_bytesperframe * loopstart;
 
 				// Usually 'nextseek' is auto-incremented as we read along the file.
 				// When head and tail are equal, there is a request for a fresh buffer, 
 				// so synchronize nextseek with newly requested time
 				ssize_t byte_time = 0;
-				if (x->x_fifohead == 0 && x->x_fifotail == 0) 
+				if (reseek) 
 				{
 					// get the time requested to start playing the loop
-					double pst = x->x_m5PlayStartTime;
+					double pst = playstart;
 					if (pst < 0) pst = 0;
 					
 					// current frame time at 'head', in bytes, relative to time anchor
-					byte_time = ((ssize_t)x->x_m5HeadTimeRequest - (ssize_t)pst) * (ssize_t)sf.sf_bytesperframe;
+					byte_time = ((ssize_t)seektime - (ssize_t)pst) * (ssize_t)sf.sf_bytesperframe;
 					if (byte_time >= 0)
 					{
 						// calculate time within current audio loop
@@ -1525,9 +3374,10 @@ static void *m5_readsf_child_main(void *zz)
 					
 				}				
 
-				// nudge it around if on exactly the end of the loop
+				// nudge it around if on exactly the end of the loop, or past it
+				// when a take being recorded ended short of where we got to
 				
-				if (nextSeek == loop_length_bytes + m5_initial_offset + loop_start_bytes) {
+				if (nextSeek >= (off_t)(loop_length_bytes + m5_initial_offset + loop_start_bytes)) {
 					nextSeek = m5_initial_offset + loop_start_bytes;
 				}
 				
@@ -1543,12 +3393,12 @@ static void *m5_readsf_child_main(void *zz)
 						"tail" is zero; this would fill the buffer completely
 						which isn't allowed because you can't tell a completely
 						full buffer from an empty one. */
-					if (x->x_fifotail || (fifosize - x->x_fifohead > READSIZE))
+					if (x->x_fifotail || ((size_t)(fifosize - x->x_fifohead) > readsize))
 					{
 						wantbytes = fifosize - x->x_fifohead;
-						// only read up to READSIZE
-						if (wantbytes > READSIZE)
-							wantbytes = READSIZE;
+						// only read up to readsize
+						if (wantbytes > readsize)
+							wantbytes = readsize;
 						
 						// only read up to end of audio loop
 						if (wantbytes > loop_byte_limit)
@@ -1562,14 +3412,16 @@ static void *m5_readsf_child_main(void *zz)
 					}
 					else
 					{
+						if (m5_regionheads_missing(&regionheads))
+							goto loadhead;
 #ifdef DEBUG_SOUNDFILE_THREADS
 						fprintf(stderr, "readsf~: wait 7a...\n");
 #endif
-						sfread_cond_signal(&x->x_answercondition);
+						sfread_cond_signal(x->x_answercondition);
 #ifdef DEBUG_SOUNDFILE_THREADS
 						fprintf(stderr, "readsf~: signaled...\n");
 #endif
-						sfread_cond_wait(&x->x_requestcondition, &x->x_mutex);
+						x = m5_sf_childwait(link);
 #ifdef DEBUG_SOUNDFILE_THREADS
 						fprintf(stderr, "readsf~: 7a ... done\n");
 #endif
@@ -1578,27 +3430,31 @@ static void *m5_readsf_child_main(void *zz)
 				}
 				else
 				{
-						/* otherwise check if there are at least READSIZE
+						/* otherwise check if there are at least readsize
 						bytes to read.  If not, wait and loop back. */
 					wantbytes =  x->x_fifotail - x->x_fifohead - 1;
-					if (wantbytes < READSIZE)
+					if (wantbytes < readsize)
 					{					
+						if (m5_regionheads_missing(&regionheads))
+							goto loadhead;
 #ifdef DEBUG_SOUNDFILE_THREADS
 						fprintf(stderr, "readsf~: wait 7...\n");
 #endif
-						sfread_cond_signal(&x->x_answercondition);
-						sfread_cond_wait(&x->x_requestcondition, &x->x_mutex);
+						sfread_cond_signal(x->x_answercondition);
+						x = m5_sf_childwait(link);
 #ifdef DEBUG_SOUNDFILE_THREADS
 						fprintf(stderr, "readsf~: 7 ... done\n");
 #endif
 						continue;
 					}
-					else wantbytes = READSIZE;
+					else wantbytes = readsize;
 					if (wantbytes > loop_byte_limit)
 					{
 						wantbytes = loop_byte_limit;
 					}
 				}
+				if (wantbytes > cuelimit)
+					wantbytes = cuelimit;
 #ifdef DEBUG_SOUNDFILE_THREADS
 				fprintf(stderr, "readsf~: 8\n");
 #endif
@@ -1606,19 +3462,20 @@ static void *m5_readsf_child_main(void *zz)
 				fifohead = x->x_fifohead;
 				
 				
-				off_t bytesSought = 0;
 				int last_fifohead = x->x_fifohead;
 				double last_headTimeRequest = x->x_m5HeadTimeRequest;
-				pthread_mutex_unlock(&x->x_mutex);
+				int last_cueserial = x->x_m5CueSerial;
+				int selfloop = (looplength == LOOP_SELF);
+				iodelay = M5_SF_IODELAY(x);
+				x->x_m5IoSince = sys_getrealtime();
+				pthread_mutex_unlock(x->x_mutex);
 				
-				// if nextSeek is within actual file
-				if (nextSeek < (off_t)m5_seek_max) 
+				// a take being recorded ends wherever its writer is now
+				if (growing)
 				{
-					bytesSought = lseek(sf.sf_fd, nextSeek, SEEK_SET);
-				}
-				else 
-				{
-					bytesSought = nextSeek;
+					m5_original_bytelimit = m5_live_bytelimit(live,
+						onsetframes, &growing);
+					m5_seek_max = m5_original_bytelimit + m5_initial_offset;
 				}
 				
 				// don't read past end of the file
@@ -1632,14 +3489,57 @@ static void *m5_readsf_child_main(void *zz)
 					actual_bytes_to_want = 0;
 				}	
 
-				// zeroes to fill out FIFO if our audio loop extends past end of file
+				// zeroes to fill out FIFO if our audio loop extends past end of file,
+				// which a take still being recorded hasn't got yet
 				ssize_t wantzeroes = wantbytes - actual_bytes_to_want;
+				if (wasgrowing)
+					wantzeroes = 0;
 #ifdef DEBUG_READ_LOOP
 				fprintf(stderr, "loop: %ld, %ld %ld %ld %ld %ld %ld %ld %ld\n", byte_time, loop_length_bytes, nextSeek, wantbytes, actual_bytes_to_want, wantzeroes, m5_seek_max, loop_byte_limit, m5_initial_offset);
 #endif
 
 				
-				bytesread = read(sf.sf_fd, buf + fifohead, actual_bytes_to_want);
+				bytesread = 0;
+				if (actual_bytes_to_want > 0 &&
+					(bytesread = m5_regionheads_read(&regionheads, nextSeek,
+						buf + fifohead, actual_bytes_to_want)))
+				{
+						/* a region's head in RAM: take what it has, and the
+						rest from the file next time round */
+					if (bytesread < actual_bytes_to_want)
+					{
+						actual_bytes_to_want = bytesread;
+						wantzeroes = 0;
+					}
+				}
+				else if (actual_bytes_to_want > 0)
+				{
+					m5_sf_iodelay(iodelay);
+					if (live)
+						bytesread = m5_live_read(live, &sf, nextSeek,
+							buf + fifohead, actual_bytes_to_want);
+					else bytesread = m5_sfhead_read(&head, &sf, nextSeek,
+						buf + fifohead, actual_bytes_to_want, nextSeek ==
+							m5_initial_offset + (off_t)loop_start_bytes);
+				}
+				
+				// a stream ran out before its header said so (or never said):
+				// now we know the real length, pad with silence from here
+				int streamended = 0;
+				if (!m5_soundfile_isseekable(&sf) && bytesread >= 0 &&
+					bytesread < actual_bytes_to_want && sf.sf_stream->ss_eof)
+				{
+					streamended = 1;
+						/* where the data ended, decoded or not */
+					m5_seek_max = nextSeek + bytesread;
+					m5_original_bytelimit = m5_seek_max - m5_initial_offset;
+					if (m5_original_bytelimit < 0)
+						m5_original_bytelimit = 0;
+					wantzeroes += actual_bytes_to_want - bytesread;
+						// a self-length loop wraps at the real end instead
+					if (selfloop)
+						wantzeroes = 0;
+				}
 				
 				ssize_t i = 0;
 				
@@ -1649,18 +3549,88 @@ static void *m5_readsf_child_main(void *zz)
 					*b++ = 0;
 				
 				
-				pthread_mutex_lock(&x->x_mutex);
+				x = m5_sf_childlock(link);
+				x->x_m5IoSince = -1;
+				if (bytesread > 0)
+					x->x_m5IoBytes += bytesread;
 				if (x->x_requestcode != REQUEST_BUSY)
 					break;
-				if (bytesread < 0 || bytesSought != nextSeek)
+				if (live)
+				{
+					x->x_sf.sf_bytelimit = sf.sf_bytelimit = m5_original_bytelimit;
+						/* the take is done: now it has a real length */
+					if (x->x_m5Live == 2 && !growing)
+					{
+						x->x_m5Live = 1;
+						x->x_m5StreamEnded = 1;
+					}
+						/* caught up with the writer: wait for more */
+					if (wasgrowing && bytesread == 0)
+					{
+						sfread_cond_signal(x->x_answercondition);
+						x = m5_sf_childwait(link);
+						continue;
+					}
+				}
+				if (streamended)
+				{
+					x->x_sf.sf_bytelimit = sf.sf_bytelimit = m5_original_bytelimit;
+					x->x_m5StreamEnded = 1;
+					if (m5_original_bytelimit == 0)
+					{
+						x->x_eof = 1;
+						x->x_fileerror = SOUNDFILE_M5_ERREMPTY;
+						goto lost;
+					}
+				}
+				if (bytesread < 0)
 				{
 #ifdef DEBUG_SOUNDFILE_THREADS
 					fprintf(stderr, "readsf~: fileerror %d\n", errno);
 #endif
-					x->x_fileerror = errno;
+					int err = errno;
+						/* the file may have gone away under us, as on a
+						network mount that dropped out: open it afresh and
+						read there again, a few times, in case it's back */
+					if (retries < IORETRIES && m5_soundfile_isseekable(&sf))
+					{
+						int bytesperframe = sf.sf_bytesperframe;
+						x->x_m5Reopens++;
+						x->x_m5IoSince = sys_getrealtime();
+						pthread_mutex_unlock(x->x_mutex);
+						m5_sfcache_release(&key, &sf, &head, 0);
+						while (sf.sf_fd < 0 && retries < IORETRIES)
+						{
+							retries++;
+							m5_sf_iodelay(IORETRYWAIT * retries);
+							m5_soundfile_copy(&sf, &key.k_request);
+							m5_sfcache_open(&key, dirname, filename, &sf,
+								onsetframes);
+							err = errno;
+						}
+						if (ram && !live && sf.sf_fd >= 0)
+							m5_samplereader_attach(&head.h_ram, &sf,
+								sf.sf_bytelimit +
+									onsetframes * sf.sf_bytesperframe);
+						x = m5_sf_childlock(link);
+						x->x_m5IoSince = -1;
+						x->x_sf.sf_fd = sf.sf_fd;
+						x->x_sf.sf_stream = sf.sf_stream;
+						x->x_sf.sf_decoder = sf.sf_decoder;
+						if (sf.sf_fd >= 0 && sf.sf_bytesperframe == bytesperframe)
+							continue;
+						if (sf.sf_fd < 0)
+						{
+							x->x_fileerror = err;
+							x->x_eof = 1;
+							goto lost;
+						}
+						err = SOUNDFILE_ERRSAMPLEFMT;
+					}
+					x->x_fileerror = err;
 					break;
 				}
-				else if (bytesread == 0 && actual_bytes_to_want > 0)
+				else if (bytesread == 0 && actual_bytes_to_want > 0 && !streamended)
 				{
 					// couldn't read from file for some reason
 					goto lost;
@@ -1669,13 +3639,16 @@ static void *m5_readsf_child_main(void *zz)
 				{
 					// Make sure fifohead wasn't reset by parent process during read, then auto-increment
 					// otherwise nextSeek will be updated above based on playStartTime and current time
-					if (x->x_fifohead == last_fifohead && x->x_m5HeadTimeRequest == last_headTimeRequest) {
+					retries = 0;
+					if (x->x_fifohead == last_fifohead && x->x_m5HeadTimeRequest == last_headTimeRequest &&
+						x->x_m5CueSerial == last_cueserial) {
 						x->x_fifohead += bytesread + wantzeroes;
 						if (x->x_fifohead == fifosize)
 							x->x_fifohead = 0;
 						nextSeek += bytesread + wantzeroes;
 						// If the math works out, we should always end up at exactly the end of the loop when we get to the end
-						if (nextSeek == m5_initial_offset + (off_t)loop_length_bytes + (off_t)loop_start_bytes)		
+						if (nextSeek == m5_initial_offset + (off_t)loop_length_bytes + (off_t)loop_start_bytes
+							|| (streamended && looplength == LOOP_SELF))
 						{
 							nextSeek = m5_initial_offset + (off_t)loop_start_bytes;
 						}
@@ -1686,7 +3659,21 @@ static void *m5_readsf_child_main(void *zz)
 					x->x_fifohead, x->x_fifotail);
 #endif
 					/* signal parent in case it's waiting for data */
-				sfread_cond_signal(&x->x_answercondition);
+				sfread_cond_signal(x->x_answercondition);
+				continue;
+
+			loadhead:
+					/* the fifo is full: meanwhile load a region's head */
+				{
+					t_m5RegionHead *h = m5_regionheads_missing(&regionheads);
+					x->x_m5IoSince = sys_getrealtime();
+					pthread_mutex_unlock(x->x_mutex);
+					m5_sf_iodelay(iodelay);
+					m5_regionhead_load(h, &head, &sf);
+					x = m5_sf_childlock(link);
+					x->x_m5IoSince = -1;
+					x->x_m5RegionsResident = m5_regionheads_resident(&regionheads);
+				}
 			}
 
 		lost:
@@ -1699,45 +3686,62 @@ static void *m5_readsf_child_main(void *zz)
 					/* only set EOF if there is no pending "open" request!
 					Otherwise, we might accidentally set EOF after it has been
 					unset in readsf_open() and the stream would fail silently. */
+				int keep = !x->x_fileerror && !live;
 				if (x->x_requestcode != REQUEST_OPEN)
 					x->x_eof = 1;
 				x->x_sf.sf_fd = -1;
-					/* use cached sf */
-				pthread_mutex_unlock(&x->x_mutex);
-				sys_close(sf.sf_fd);
-				sf.sf_fd = -1;
-				pthread_mutex_lock(&x->x_mutex);
+				x->x_sf.sf_stream = NULL;
+				x->x_sf.sf_decoder = NULL;
+					/* use cached sf, park it unless it failed */
+				pthread_mutex_unlock(x->x_mutex);
+				m5_sfcache_release(&key, &sf, &head, keep);
+				x = m5_sf_childlock(link);
 			}
-			sfread_cond_signal(&x->x_answercondition);
+			m5_live_release(live);
+			live = NULL;
+			m5_regionheads_clear(&regionheads);
+			x->x_m5RegionsResident = 0;
+			sfread_cond_signal(x->x_answercondition);
 		}
 		else if (x->x_requestcode == REQUEST_CLOSE)
 		{
 			if (sf.sf_fd >= 0)
 			{
 				x->x_sf.sf_fd = -1;
+				x->x_sf.sf_stream = NULL;
+				x->x_sf.sf_decoder = NULL;
 					/* use cached sf */
-				pthread_mutex_unlock(&x->x_mutex);
-				sys_close(sf.sf_fd);
-				sf.sf_fd = -1;
-				pthread_mutex_lock(&x->x_mutex);
+				pthread_mutex_unlock(x->x_mutex);
+				m5_sfcache_release(&key, &sf, &head, !live);
+				x = m5_sf_childlock(link);
 			}
+			m5_live_release(live);
+			live = NULL;
+			m5_regionheads_clear(&regionheads);
+			x->x_m5RegionsResident = 0;
 			if (x->x_requestcode == REQUEST_CLOSE)
 				x->x_requestcode = REQUEST_NOTHING;
-			sfread_cond_signal(&x->x_answercondition);
+			sfread_cond_signal(x->x_answercondition);
 		}
 		else if (x->x_requestcode == REQUEST_QUIT)
 		{
 			if (sf.sf_fd >= 0)
 			{
 				x->x_sf.sf_fd = -1;
+				x->x_sf.sf_stream = NULL;
+				x->x_sf.sf_decoder = NULL;
 					/* use cached sf */
-				pthread_mutex_unlock(&x->x_mutex);
-				sys_close(sf.sf_fd);
-				sf.sf_fd = -1;
-				pthread_mutex_lock(&x->x_mutex);
+				pthread_mutex_unlock(x->x_mutex);
+				m5_sfcache_release(&key, &sf, &head, !live);
+				x = m5_sf_childlock(link);
 			}
+			m5_live_release(live);
+			live = NULL;
+			m5_regionheads_clear(&regionheads);
+			x->x_m5RegionsResident = 0;
+			m5_sfhead_free(&head);
 			x->x_requestcode = REQUEST_NOTHING;
-			sfread_cond_signal(&x->x_answercondition);
+			sfread_cond_signal(x->x_answercondition);
 			break;
 		}
 		else
@@ -1750,7 +3754,7 @@ static void *m5_readsf_child_main(void *zz)
 #ifdef DEBUG_SOUNDFILE_THREADS
 	fprintf(stderr, "readsf~: thread exit\n");
 #endif
-	pthread_mutex_unlock(&x->x_mutex);
+	m5_sf_reap(link);
 	return 0;
 }
 
@@ -1759,12 +3763,210 @@ static void *m5_readsf_child_main(void *zz)
 static void m5_readsf_tick(t_readsf *x);
 static void m5_readsf_frame_out_tick(t_readsf *x);
 
-static void *m5_readsf_new(t_floatarg fnchannels, t_floatarg fbufsize)
+	/** report how late the last start sounded */
+static void m5_readsf_latency_tick(t_readsf *x)
+{
+	t_atom at;
+	SETFLOAT(&at, x->x_m5StartLatency);
+	outlet_anything(x->x_m5listOut, gensym("latency"), 1, &at);
+}
+
+	/** the watchdog, every WATCHPOLL msec while a file plays: report a
+		disk access that has taken longer than "watchdog" msec as "stall"
+		with the frame playback stood at, and "resume" with the first one
+		played after it returned. Meanwhile perform plays silence, and
+		lines up with the timeline again as data comes back. */
+static void m5_readsf_watch_tick(t_readsf *x)
+{
+	t_m5FrameTimeCode ftc;
+	int report = 0, reopens, more;
+	size_t frame = 0, silence = 0;
+	double since;
+	pthread_mutex_lock(x->x_mutex);
+	since = x->x_m5IoSince;
+	if (x->x_m5Stalled == 1 && since != x->x_m5StallSince &&
+		x->x_state != STATE_STREAM)
+	{
+			/* returned while nothing plays */
+		x->x_m5Stalled = 2;
+		x->x_m5ResumeFrame = (size_t)x->x_m5TailTime;
+	}
+	if (!x->x_m5Stalled && x->x_m5Watchdog > 0 && since >= 0 &&
+		(sys_getrealtime() - since) * 1000. > x->x_m5Watchdog)
+	{
+		x->x_m5Stalled = 1;
+		x->x_m5StallSince = since;
+		x->x_m5StallFrame = frame = (size_t)x->x_m5TailTime;
+		x->x_m5StallSilence = 0;
+		x->x_m5Stalls++;
+		report = 1;
+	}
+	else if (x->x_m5Stalled == 2)
+	{
+		x->x_m5Stalled = 0;
+		frame = x->x_m5ResumeFrame;
+		silence = x->x_m5StallSilence;
+		report = 2;
+	}
+	reopens = x->x_m5Reopens - x->x_m5ReopensSeen;
+	x->x_m5ReopensSeen = x->x_m5Reopens;
+	more = (x->x_m5Watchdog > 0 &&
+		(x->x_state != STATE_IDLE || x->x_m5Stalled));
+	pthread_mutex_unlock(x->x_mutex);
+	if (more)
+		clock_delay(x->x_m5WatchClock, WATCHPOLL);
+	if (reopens)
+		pd_error(x, "[readsf~] %s: read failed, reopening the file",
+			x->x_filename);
+	if (report == 1)
+	{
+		pd_error(x, "[readsf~] %s: disk access stalled for over %g msec",
+			x->x_filename, x->x_m5Watchdog);
+		m5_frame_time_code_from_frames(frame, &ftc);
+		m5_frame_time_code_out_prepend_symbol(gensym("stall"), &ftc,
+			x->x_m5listOut);
+	}
+	else if (report == 2)
+	{
+		post("[readsf~] %s: sound back after %ld frames of silence",
+			x->x_filename, (long)silence);
+		m5_frame_time_code_from_frames(frame, &ftc);
+		m5_frame_time_code_out_prepend_symbol(gensym("resume"), &ftc,
+			x->x_m5listOut);
+	}
+}
+
+	/** cancel and forget a job, if any */
+static void m5_readsf_dropjob(t_readsf *x, t_m5Job **jp, t_clock *poll)
+{
+	t_m5Job *j;
+	pthread_mutex_lock(x->x_mutex);
+	j = *jp;
+	*jp = NULL;
+	pthread_mutex_unlock(x->x_mutex);
+	clock_unset(poll);
+	if (!j)
+		return;
+	pthread_mutex_lock(&m5_job_mutex);
+	j->j_cancel = 1;
+	pthread_mutex_unlock(&m5_job_mutex);
+	m5_job_release(j);
+}
+
+	/** a job's result, or JOB_PENDING after polling again */
+static int m5_readsf_jobresult(t_m5Job *j, t_clock *poll, const char **why)
+{
+	int result;
+	pthread_mutex_lock(&m5_job_mutex);
+	result = j->j_result;
+	*why = j->j_why;
+	pthread_mutex_unlock(&m5_job_mutex);
+	if (result == JOB_PENDING)
+		clock_delay(poll, JOBPOLL);
+	return result;
+}
+
+	/** report the verification once it's done */
+static void m5_readsf_verify_tick(t_readsf *x)
+{
+	const char *why;
+	int result;
+	t_atom at;
+	if (!x->x_m5Verify || (result = m5_readsf_jobresult(x->x_m5Verify,
+		x->x_m5VerifyClock, &why)) == JOB_PENDING)
+			return;
+	if (result == JOB_OK)
+		post("[readsf~] %s: checksum ok", x->x_filename);
+	else if (result == JOB_NONE)
+		post("[readsf~] %s: no checksum to verify", x->x_filename);
+	else pd_error(x, "[readsf~] %s: %s", x->x_filename, why);
+	m5_readsf_dropjob(x, &x->x_m5Verify, x->x_m5VerifyClock);
+	SETFLOAT(&at, result);
+	outlet_anything(x->x_m5listOut, gensym("verify"), 1, &at);
+}
+
+	/** report the loudness once it's measured:
+		loudness <LUFS> <dBTP> <dBFS RMS of each channel...> */
+static void m5_readsf_loudness_tick(t_readsf *x)
+{
+	t_atom at[3 + M5_LOUDNESS_MAXCHANS];
+	const t_m5LoudnessResult *r;
+	const char *why;
+	int result, i;
+	if (!x->x_m5Loudness || (result = m5_readsf_jobresult(x->x_m5Loudness,
+		x->x_m5LoudnessClock, &why)) == JOB_PENDING)
+			return;
+	if (result != JOB_OK)
+	{
+		pd_error(x, "[readsf~] %s: loudness: %s", x->x_filename, why);
+		m5_readsf_dropjob(x, &x->x_m5Loudness, x->x_m5LoudnessClock);
+		return;
+	}
+	r = (const t_m5LoudnessResult *)x->x_m5Loudness->j_data;
+	SETFLOAT(&at[0], r->lr_integrated);
+	SETFLOAT(&at[1], r->lr_truepeak);
+	for (i = 0; i < r->lr_nchannels; i++)
+		SETFLOAT(&at[2 + i], r->lr_rms[i]);
+	m5_readsf_dropjob(x, &x->x_m5Loudness, x->x_m5LoudnessClock);
+	outlet_anything(x->x_m5listOut, gensym("loudness"), 2 + i, at);
+}
+
+	/** keep the onsets once they're found, counted from the open's onset
+		like "loopstart", and report how many there are: onsets <n> */
+static void m5_readsf_onsets_tick(t_readsf *x)
+{
+	t_m5OnsetList *found;
+	const char *why;
+	int result;
+	size_t i;
+	t_atom at;
+	if (!x->x_m5Onsets || (result = m5_readsf_jobresult(x->x_m5Onsets,
+		x->x_m5OnsetsClock, &why)) == JOB_PENDING)
+			return;
+	if (result != JOB_OK)
+	{
+		pd_error(x, "[readsf~] %s: onsets: %s", x->x_filename, why);
+		m5_readsf_dropjob(x, &x->x_m5Onsets, x->x_m5OnsetsClock);
+		return;
+	}
+	found = (t_m5OnsetList *)x->x_m5Onsets->j_data;
+	m5_onsetlist_clear(&x->x_m5OnsetList);
+	for (i = 0; i < found->ol_n; i++)
+		if (found->ol_frames[i] >= (long)x->x_onsetframes)
+			m5_onsetlist_add(&x->x_m5OnsetList,
+				found->ol_frames[i] - (long)x->x_onsetframes);
+	m5_readsf_dropjob(x, &x->x_m5Onsets, x->x_m5OnsetsClock);
+	SETFLOAT(&at, x->x_m5OnsetList.ol_n);
+	outlet_anything(x->x_m5listOut, gensym("onsets"), 1, &at);
+}
+
+	/** onset <index>: output onset <FTC> for the index'th onset (from 0)
+		that "open -onsets" found, ready for "loopstart" */
+static void m5_readsf_onset(t_readsf *x, t_floatarg f)
+{
+	t_m5FrameTimeCode ftc;
+	if (f < 0 || f >= x->x_m5OnsetList.ol_n)
+	{
+		pd_error(x, "[readsf~] onset: %g out of range (%d onsets)", f,
+			(int)x->x_m5OnsetList.ol_n);
+		return;
+	}
+	m5_frame_time_code_from_frames(x->x_m5OnsetList.ol_frames[(size_t)f],
+		&ftc);
+	m5_frame_time_code_out_prepend_symbol(gensym("onset"), &ftc,
+		x->x_m5listOut);
+}
+
+static void *m5_readsf_new(t_symbol *s, int argc, t_atom *argv)
 {
 	t_readsf *x;
-	int nchannels = fnchannels, bufsize = fbufsize, i;
+	int nchannels, bufsize, multi, lookahead, i;
 	char *buf;
+	t_m5SfLink *link;
 
+	if (!m5_sf_parsenew("[readsf~]", argc, argv, &multi, &nchannels,
+		&bufsize, &lookahead))
+		return 0;
 	if (nchannels < 1)
 		nchannels = 1;
 	else if (nchannels > MAXSFCHANS)
@@ -1776,25 +3978,58 @@ static void *m5_readsf_new(t_floatarg fnchannels, t_floatarg fbufsize)
 		bufsize = MAXBUFSIZE;
 	buf = getbytes(bufsize);
 	if (!buf) return 0;
+	if (!(link = m5_sf_newlink()))
+	{
+		freebytes(buf, bufsize);
+		return 0;
+	}
 
 	x = (t_readsf *)pd_new(m5_readsf_class);
 
-	for (i = 0; i < nchannels; i++)
+	x->x_m5Multi = multi;
+	x->x_m5Lookahead = lookahead;
+		/* the lookahead tap repeats the channel outlets */
+	for (i = 0; i < (multi ? 1 : nchannels) * (lookahead ? 2 : 1); i++)
 		outlet_new(&x->x_obj, gensym("signal"));
 	x->x_noutlets = nchannels;
 	
 	x->x_bangout = outlet_new(&x->x_obj, &s_bang);
 	x->x_m5listOut = outlet_new(&x->x_obj, &s_anything);
 	
-	pthread_mutex_init(&x->x_mutex, 0);
-	pthread_cond_init(&x->x_requestcondition, 0);
-	pthread_cond_init(&x->x_answercondition, 0);
-	x->x_vecsize = MAXVECSIZE;
+	m5_sf_attachlink(x, link);
+	x->x_vecsize = x->x_m5Hop = MAXVECSIZE;
+	x->x_m5LastLogicalTime = -1;
+	x->x_m5SubBlockTime = 0;
 	x->x_state = STATE_IDLE;
 	x->x_clock = clock_new(x, (t_method)m5_readsf_tick);
 	x->x_m5FramesOutClock = clock_new(x, (t_method)m5_readsf_frame_out_tick);
+	x->x_m5VerifyClock = clock_new(x, (t_method)m5_readsf_verify_tick);
+	x->x_m5LoudnessClock = clock_new(x, (t_method)m5_readsf_loudness_tick);
+	x->x_m5OnsetsClock = clock_new(x, (t_method)m5_readsf_onsets_tick);
+	x->x_m5LatencyClock = clock_new(x, (t_method)m5_readsf_latency_tick);
+	x->x_m5WatchClock = clock_new(x, (t_method)m5_readsf_watch_tick);
+	x->x_m5Shm = NULL;
+	x->x_m5Ram = 0;
+	x->x_m5Verify = x->x_m5Loudness = x->x_m5Onsets = NULL;
+	memset(&x->x_m5OnsetList, 0, sizeof(x->x_m5OnsetList));
+	x->x_m5StartPending = 0;
+	x->x_m5StartDue = -1;
+	x->x_m5StartLatency = x->x_m5StartLatencyMax = 0;
+#ifdef M5_VIRTUAL_CLOCK
+	x->x_m5Cold = 0;
+	x->x_m5IoDelay = 0;
+#endif
+	x->x_m5IoSince = -1;
+	x->x_m5Watchdog = WATCHDEFAULT;
+	x->x_m5Stalled = 0;
+	x->x_m5Stalls = x->x_m5Reopens = x->x_m5ReopensSeen = 0;
+	x->x_m5NRegions = x->x_m5RegionSerial = x->x_m5RegionsResident = 0;
+	x->x_m5CueTime = -1;
+	x->x_m5CueSerial = 0;
+	x->x_m5Format = x->x_m5FormatPending = x->x_m5FormatRetired = NULL;
 	x->x_canvas = canvas_getcurrent();
 	m5_soundfile_clear(&x->x_sf);
+	m5_soundfile_clear(&x->x_m5LastOpen);
 	x->x_sf.sf_bytespersample = 2;
 	x->x_sf.sf_nchannels = 1;
 	x->x_sf.sf_bytesperframe = 2;
@@ -1811,6 +4046,8 @@ static void *m5_readsf_new(t_floatarg fnchannels, t_floatarg fbufsize)
 	
 	x->x_m5HeadTimeRequest = 0;
 	x->x_m5TailTime = 0;
+	x->x_m5Refilling = 0;
+	x->x_m5RefillLead = -1;
 	x->x_m5TimeAnchorName = 0;
 	x->x_m5TimeAnchor = 0;
 	x->x_m5LocalTimeAnchor = 0;
@@ -1823,6 +4060,7 @@ static void *m5_readsf_new(t_floatarg fnchannels, t_floatarg fbufsize)
 #ifdef PDINSTANCE
 	x->x_pd_this = pd_this;
 #endif
+	m5_sf_register(x);
 	pthread_create(&x->x_childthread, 0, m5_readsf_child_main, x);
 	return x;
 }
@@ -1840,18 +4078,262 @@ static void m5_readsf_frame_out_tick(t_readsf *x)
 	m5_frame_time_code_out(&ftc, x->x_m5listOut);
 }
 
+	/** the child hit the end of a streamed file, or of a take recorded
+		here: report the real length and move an end time that was derived
+		from the old one.  while the take grows, just follow it.  mutex held */
+static void m5_readsf_streamended(t_readsf *x)
+{
+	if (x->x_m5Live == 2 && x->x_m5SoundFileFramesAvailableFromOnset &&
+		x->x_sf.sf_bytesperframe > 0)
+			x->x_m5SoundFileFramesAvailableFromOnset =
+				x->x_sf.sf_bytelimit / x->x_sf.sf_bytesperframe;
+	if (!x->x_m5StreamEnded)
+		return;
+	x->x_m5StreamEnded = 0;
+	if (x->x_sf.sf_bytesperframe > 0)
+		x->x_m5SoundFileFramesAvailableFromOnset =
+			x->x_sf.sf_bytelimit / x->x_sf.sf_bytesperframe;
+	if (x->x_m5EndFromLoop)
+		x->x_m5PlayEndTime = END_AT_LOOP;
+	clock_delay(x->x_m5FramesOutClock, 0);
+}
+
+	/** a region cued by "play ... at" becomes the loop once playback has
+		reached its time; the fifo holds its frames from there on already.
+		until then an end at the loop waits for the region's.  mutex held */
+static void m5_readsf_cue(t_readsf *x, size_t blockStartTime)
+{
+	if (x->x_m5CueTime < 0)
+		return;
+	if ((double)blockStartTime >= x->x_m5CueTime)
+	{
+		x->x_m5LoopStart = x->x_m5Cue.r_start;
+		x->x_m5LoopLength = x->x_m5Cue.r_length;
+		x->x_m5PlayStartTime = x->x_m5CueTime;
+		x->x_m5CueTime = -1;
+		if (x->x_m5EndFromLoop)
+			x->x_m5PlayEndTime = END_AT_LOOP;
+	}
+	else if (x->x_m5PlayEndTime == END_AT_LOOP || x->x_m5EndFromLoop)
+	{
+		x->x_m5PlayEndTime = END_NEVER;
+		x->x_m5EndFromLoop = 1;
+	}
+}
+
+	/** called first thing in every DSP call. Blocks smaller than the
+		scheduler tick run several times at the same logical time, so count
+		the hops already taken within this tick. */
+static void m5_sf_subblock(t_readsf *x)
+{
+	double now = m5_clock_logicaltime();
+	if (now == x->x_m5LastLogicalTime)
+		x->x_m5SubBlockTime += x->x_m5Hop;
+	else
+	{
+		x->x_m5LastLogicalTime = now;
+		x->x_m5SubBlockTime = 0;
+	}
+}
+
+	/** frame count since the time anchor at the start of this block. In a
+		reblocked subpatch that is the parent's tick plus a hop for each
+		earlier call in it; the delay block~ itself adds isn't known here
+		and isn't compensated (see README) */
+static size_t m5_readsf_blocktime(t_readsf *x)
+{
+	size_t blockStartTime;
+	if (x->x_m5TimeAnchor) 
+	{
+		// shared time anchor
+		blockStartTime = m5_time_anchor_get_time_since_start(x->x_m5TimeAnchor);
+	} 
+	else 
+	{
+		// local clock for this object
+		double d = ceil(m5_clock_framessince(x->x_m5LocalTimeAnchor));
+		if (d < 0.) { d = 0.;}
+		blockStartTime = (size_t)d;
+	}
+	return blockStartTime + x->x_m5SubBlockTime;
+}
+
+	/** perform routine for a shared-memory ring source. There is no fifo
+		or child thread: the ring is read directly against the block time,
+		with silence wherever the producer hasn't got to (or has already
+		overwritten) the frames we need. */
+	/** the frames [*lo, *hi) of the lookahead outlets, which play from
+		x_m5Lookahead frames after blockStartTime, that lie between the start
+		and end times */
+static void m5_readsf_lookrange(const t_readsf *x, double blockStartTime,
+	size_t *lo, size_t *hi)
+{
+	double from = blockStartTime + x->x_m5Lookahead, n = x->x_vecsize,
+		a = x->x_m5PlayStartTime - from, b = x->x_m5PlayEndTime - from;
+	*lo = (a <= 0 ? 0 : (a >= n ? n : (size_t)a));
+	*hi = (b <= 0 ? 0 : (b >= n ? n : (size_t)b));
+	if (*hi < *lo)
+		*hi = *lo;
+}
+
+	/** silence the lookahead outlets outside [lo, hi) */
+static void m5_readsf_lookzero(t_readsf *x, size_t lo, size_t hi)
+{
+	t_sample **vecs = x->x_outvec + x->x_noutlets;
+	size_t j;
+	int i;
+	for (i = 0; i < x->x_noutlets; i++)
+	{
+		for (j = 0; j < lo; j++)
+			vecs[i][j] = 0;
+		for (j = hi; j < (size_t)x->x_vecsize; j++)
+			vecs[i][j] = 0;
+	}
+}
+
+	/** fill the lookahead outlets from the fifo, which holds the frames
+		for the times after the tail in order. called with the mutex held,
+		before the tail moves on */
+static void m5_readsf_lookahead(t_readsf *x, const t_m5SoundFormat *fmt,
+	double blockStartTime)
+{
+	int bpf = fmt->f_sf.sf_bytesperframe,
+		avail = (int)(m5_readsf_fifoavailable(x) / bpf);
+	size_t lo, hi;
+	m5_readsf_lookrange(x, blockStartTime, &lo, &hi);
+		/* what the child hasn't read yet stays silent; lo and hi are
+		   within the vector, so they fit the fifo's int indices */
+	if (x->x_m5Lookahead + (int)hi > avail)
+		hi = (avail > x->x_m5Lookahead + (int)lo ?
+			(size_t)(avail - x->x_m5Lookahead) : lo);
+	m5_readsf_lookzero(x, lo, hi);
+	if (hi > lo)
+		m5_readsf_xferin_fifo(x, fmt, x->x_outvec + x->x_noutlets, lo,
+			x->x_fifotail + (x->x_m5Lookahead + (int)lo) * bpf, hi - lo);
+}
+
+static t_int *m5_readsf_shm_perform(t_readsf *x, t_int *w)
+{
+	int vecsize = x->x_vecsize, noutlets = x->x_noutlets, i, ended = 0;
+	size_t j, zerosize = 0, xfersize = vecsize;
+	double blockStartTime;
+	t_sample *fp;
+
+	if (x->x_state != STATE_STREAM)
+	{
+		for (i = 0; i < noutlets * (x->x_m5Lookahead ? 2 : 1); i++)
+			for (j = vecsize, fp = x->x_outvec[i]; j--;)
+				*fp++ = 0;
+		return w + 2;
+	}
+	blockStartTime = (double)m5_readsf_blocktime(x);
+
+		// without a start time, use the producer's stamp if it has one
+	if (x->x_m5PlayStartTime == START_NOW)
+	{
+		double stamp = floor(m5_shmring_starttime(x->x_m5Shm));
+		x->x_m5PlayStartTime = (stamp >= 0 ? stamp : blockStartTime);
+	}
+		// a ring has no loop to end at, so play until told otherwise
+	if (x->x_m5PlayEndTime == END_AT_LOOP)
+		x->x_m5PlayEndTime = END_NEVER;
+
+	if (blockStartTime + vecsize > x->x_m5PlayEndTime)
+	{
+		ended = 1;
+		xfersize = (blockStartTime >= x->x_m5PlayEndTime ? 0 :
+			(size_t)(x->x_m5PlayEndTime - blockStartTime));
+	}
+	if (blockStartTime < x->x_m5PlayStartTime)
+	{
+		zerosize = (x->x_m5PlayStartTime - blockStartTime > vecsize ?
+			(size_t)vecsize : (size_t)(x->x_m5PlayStartTime - blockStartTime));
+	}
+	if (zerosize > xfersize)
+		zerosize = xfersize;
+	for (i = 0; i < noutlets; i++)
+		for (j = zerosize, fp = x->x_outvec[i]; j--;)
+			*fp++ = 0;
+	if (xfersize > zerosize)
+		m5_shmring_read(x->x_m5Shm, (int64_t)(blockStartTime + zerosize -
+			x->x_m5PlayStartTime) + (int64_t)x->x_onsetframes,
+				noutlets, x->x_outvec, zerosize, xfersize - zerosize);
+	for (i = 0; i < noutlets; i++)
+		for (j = vecsize - xfersize, fp = x->x_outvec[i] + xfersize; j--;)
+			*fp++ = 0;
+	if (x->x_m5Lookahead)
+	{
+			/* the ring silences what the producer hasn't written yet */
+		size_t lo, hi;
+		m5_readsf_lookrange(x, blockStartTime, &lo, &hi);
+		m5_readsf_lookzero(x, lo, hi);
+		if (hi > lo)
+			m5_shmring_read(x->x_m5Shm, (int64_t)(blockStartTime +
+				x->x_m5Lookahead + lo - x->x_m5PlayStartTime) +
+					(int64_t)x->x_onsetframes, noutlets,
+						x->x_outvec + noutlets, lo, hi - lo);
+	}
+	if (ended)
+	{
+		x->x_state = STATE_IDLE;
+		clock_delay(x->x_clock, 0);
+	}
+	return w + 2;
+}
+
+	/** called with the time of the first frame that plays after a "start":
+		compare it with when that start was due */
+static void m5_readsf_started(t_readsf *x, size_t firstframe)
+{
+	if (!x->x_m5StartPending || x->x_m5StartDue < 0)
+		return;
+	x->x_m5StartPending = 0;
+	x->x_m5StartLatency = (double)firstframe - x->x_m5StartDue;
+	if (x->x_m5StartLatency > x->x_m5StartLatencyMax)
+		x->x_m5StartLatencyMax = x->x_m5StartLatency;
+	clock_delay(x->x_m5LatencyClock, 0);
+}
+
+	/** the fifo has data for this block: if a stalled disk access has
+		returned since, note where sound came back */
+static void m5_readsf_resumed(t_readsf *x, size_t blockframe)
+{
+	if (x->x_m5Stalled != 1 || x->x_m5IoSince == x->x_m5StallSince)
+		return;
+	x->x_m5Stalled = 2;
+	x->x_m5ResumeFrame = blockframe;
+	clock_delay(x->x_m5WatchClock, 0);
+}
+
+	/** empty the fifo and have the child fill it afresh with the frames
+		from "lead" after the block at blockStartTime on */
+static void m5_readsf_refill(t_readsf *x, size_t blockStartTime, double lead)
+{
+	x->x_fifohead = x->x_fifotail = x->x_eof = 0;
+	x->x_m5HeadTimeRequest = x->x_m5TailTime = (double)blockStartTime + lead;
+	x->x_m5Refilling = 1;
+	x->x_m5RefillLead = lead;
+}
+
 static t_int *m5_readsf_perform(t_int *w)
 {
 	t_readsf *x = (t_readsf *)(w[1]);
-	int vecsize = x->x_vecsize, noutlets = x->x_noutlets, i;
+		/* silence covers the lookahead outlets too */
+	int vecsize = x->x_vecsize,
+		noutlets = x->x_noutlets * (x->x_m5Lookahead ? 2 : 1), i;
 	size_t j;
 	t_sample *fp;
+	
+	m5_sf_subblock(x);
+	if (x->x_m5Shm)
+		return m5_readsf_shm_perform(x, w);
 		
 	if (x->x_state == STATE_STREAM)
 	{
-		int wantbytes;
-		t_soundfile sf = {0};
-		pthread_mutex_lock(&x->x_mutex);
+		int wantbytes, refilling = 0;
+		const t_m5SoundFormat *fmt;
+		pthread_mutex_lock(x->x_mutex);
+		m5_readsf_streamended(x);
 		
 		// Don't play anything until file has been opened and number of frames in file reported
 		if (x->x_m5SoundFileFramesAvailableFromOnset == 0)  {
@@ -1873,7 +4355,7 @@ static t_int *m5_readsf_perform(t_int *w)
 					clock_delay(x->x_m5FramesOutClock, 0);
 					clock_delay(x->x_clock, 0);	
 				}
-				pthread_mutex_unlock(&x->x_mutex);
+				pthread_mutex_unlock(x->x_mutex);
 				for (i = 0; i < noutlets; i++){
 					for (j = vecsize, fp = x->x_outvec[i]; j--;){
 						*fp++ = 0;
@@ -1887,29 +4369,27 @@ static t_int *m5_readsf_perform(t_int *w)
 
 		}
 		
-		/* copy with mutex locked! */
-		
-		m5_soundfile_copy(&sf, &x->x_sf);
-		
-		size_t blockStartTime = 0; // frame count since time anchor
-		if (x->x_m5TimeAnchor) 
-		{
-			// shared time anchor
-			blockStartTime = m5_time_anchor_get_time_since_start(x->x_m5TimeAnchor);
-		} 
-		else 
+			/* the format is immutable, so there's nothing to copy */
+		if (!(fmt = m5_sf_currentformat(x)))
 		{
-			// local clock for this object
-			double d = ceil(clock_gettimesincewithunits(x->x_m5LocalTimeAnchor, 1, 1));
-			if (d < 0.) { d = 0.;}
-			blockStartTime = (size_t)d;
+			pthread_mutex_unlock(x->x_mutex);
+			for (i = 0; i < noutlets; i++)
+				for (j = vecsize, fp = x->x_outvec[i]; j--;)
+					*fp++ = 0;
+			return w + 2;
 		}
+		
+		size_t blockStartTime = m5_readsf_blocktime(x); // frame count since time anchor
 				
 		// request to start relative to next immediate block
 		if (x->x_m5PlayStartTime == START_NOW)  
 		{
 			x->x_m5PlayStartTime = (double)blockStartTime;
 		}
+			/* a start in the past is due as soon as we heard of it */
+		if (x->x_m5StartPending && x->x_m5StartDue < 0)
+			x->x_m5StartDue = (x->x_m5PlayStartTime > blockStartTime ?
+				x->x_m5PlayStartTime : (double)blockStartTime);
 		
 		
 		
@@ -1918,61 +4398,80 @@ static t_int *m5_readsf_perform(t_int *w)
 		// if (x->x_m5LoopLengthRequest || ((size_t)x->x_m5TailTime != (size_t)blockStartTime)) {		
 		if (x->x_m5LoopLengthRequest) {		
 			x->x_m5LoopLengthRequest = 0;
-			x->x_fifohead = x->x_fifotail = x->x_eof = 0;
+			m5_readsf_refill(x, blockStartTime, 0);
 		}
+			/* the child has brought the first of a fresh fill, or gave up */
+		if (x->x_m5Refilling && (x->x_eof || x->x_fifohead != x->x_fifotail))
+			x->x_m5Refilling = 0;
 		
 		// if the tail
 		// somehow is not lined up with the current needed frame clock, check to see if we can fast-forward
-		// otherwise reset the fifo like with x_m5LoopLengthRequest
-		if ((size_t)x->x_m5TailTime != (size_t)blockStartTime) {
+		// otherwise reset the fifo like with x_m5LoopLengthRequest.
+		// Not once the child has stopped reading: nothing would fill it
+		if ((size_t)x->x_m5TailTime != (size_t)blockStartTime && !x->x_eof) {
 			ssize_t time_out = (ssize_t)blockStartTime - (ssize_t)x->x_m5TailTime;
-			if (time_out < 0) {
-				x->x_fifohead = x->x_fifotail = x->x_eof = 0;
-			}
-			size_t forward_limit = 0;
-			if (x->x_fifohead < x->x_fifotail) {
-				forward_limit = x->x_fifosize;
-			} else {
-				forward_limit = x->x_fifohead;
-			}
-			if ((time_out + x->x_fifotail < forward_limit)) {
-				x->x_fifotail += time_out;
+			// bytes the tail can skip without passing the head
+			ssize_t forward_bytes = time_out * (ssize_t)fmt->f_sf.sf_bytesperframe;
+			if (time_out > 0 && forward_bytes < m5_readsf_fifoavailable(x)) {
+				x->x_fifotail = (x->x_fifotail + forward_bytes) % x->x_fifosize;
 				x->x_m5TailTime = blockStartTime;
+			} else if (x->x_m5Refilling || (time_out < 0 &&
+				-time_out <= x->x_m5RefillLead)) {
+					/* still waiting on a fill, or it's ahead of us: asking
+					again would throw away a read that takes longer than a
+					block, and it would never land */
+				refilling = 1;
 			} else {
-				x->x_fifohead = x->x_fifotail = x->x_eof = 0;
+					/* a fill that came too late to catch up with asks for
+					the next one ahead of time, by twice what it took */
+				m5_readsf_refill(x, blockStartTime,
+					(x->x_m5RefillLead >= 0 && time_out > 0 ?
+						2 * (x->x_m5RefillLead + time_out) : 0));
+				refilling = 1;
 			}
 
 		}
 		
 		// tail and head wound up in the same place, so update start time
-		if (x->x_fifohead == x->x_fifotail)
+		else if (x->x_fifohead == x->x_fifotail && !x->x_eof &&
+			!x->x_m5Refilling)
 		{
 			// tell the child where we need to start reading based on frame clock
-			x->x_m5HeadTimeRequest = blockStartTime;
-			x->x_m5TailTime = blockStartTime;
+			m5_readsf_refill(x, blockStartTime, 0);
+			refilling = 1;
 		}
 		
-		wantbytes = vecsize * sf.sf_bytesperframe;
-		
+		wantbytes = vecsize * fmt->f_sf.sf_bytesperframe;
+			/* wait for the lookahead too, unless the fifo can't hold it */
+		if (x->x_m5Lookahead && (vecsize + x->x_m5Lookahead) *
+			fmt->f_sf.sf_bytesperframe < x->x_fifosize / 2)
+				wantbytes += x->x_m5Lookahead * fmt->f_sf.sf_bytesperframe;
 		
 		// if fifo is not ready, play silence and return
-		if (!x->x_eof && x->x_fifohead >= x->x_fifotail &&
-		x->x_fifohead < x->x_fifotail + wantbytes-1) 
+		if (refilling || (!x->x_eof && m5_readsf_fifoavailable(x) < wantbytes))
 		{
-			sfread_cond_signal(&x->x_requestcondition);
-			pthread_mutex_unlock(&x->x_mutex);
+				/* once it has sounded, silence here is a gap; before, the
+				first fill may take as long as playing a whole fifo */
+			if (!x->x_m5StartPending || (double)blockStartTime >
+				x->x_m5StartDue + x->x_fifosize / fmt->f_sf.sf_bytesperframe)
+					x->x_m5Underruns++;
+			if (x->x_m5Stalled == 1)
+				x->x_m5StallSilence += x->x_m5Hop;
+			sfread_cond_signal(x->x_requestcondition);
+			pthread_mutex_unlock(x->x_mutex);
 			for (i = 0; i < noutlets; i++){
 				for (j = vecsize, fp = x->x_outvec[i]; j--;){
 					*fp++ = 0;
 				}
 			}
-			
-			
-			
+
+
+
 			return w+2;
 		}
-		
-// 		// fill fifo (and wait for file to finish opening, if needed)	
+		x->x_m5RefillLead = -1;
+
+// 		// fill fifo (and wait for file to finish opening, if needed)
 // 		while (!x->x_eof && x->x_fifohead >= x->x_fifotail &&
 // 				x->x_fifohead < x->x_fifotail + wantbytes-1)
 // 		{
@@ -1980,12 +4479,12 @@ static t_int *m5_readsf_perform(t_int *w)
 // #ifdef DEBUG_SOUNDFILE_THREADS
 // 			fprintf(stderr, "readsf~: wait...\n");
 // #endif
-// 			sfread_cond_signal(&x->x_requestcondition);
-// 			sfread_cond_wait(&x->x_answercondition, &x->x_mutex);
+// 			sfread_cond_signal(x->x_requestcondition);
+// 			sfread_cond_wait(x->x_answercondition, x->x_mutex);
 // 				/* resync local variables -- bug fix thanks to Shahrokh */
 // 			vecsize = x->x_vecsize;
 // 			m5_soundfile_copy(&sf, &x->x_sf);
-// 			wantbytes = vecsize * sf.sf_bytesperframe;
+// 			wantbytes = vecsize * fmt->f_sf.sf_bytesperframe;
 // 		
 // #ifdef DEBUG_SOUNDFILE_THREADS
 // 			fprintf(stderr, "readsf~: ... done\n");
@@ -1997,7 +4496,7 @@ static t_int *m5_readsf_perform(t_int *w)
 			x->x_state = STATE_IDLE;
 			clock_delay(x->x_clock, 0);	
 			/* send bang and zero out the (rest of the) output */
-			pthread_mutex_unlock(&x->x_mutex);
+			pthread_mutex_unlock(x->x_mutex);
 				
 					
 			for (i = 0; i < noutlets; i++)
@@ -2006,6 +4505,17 @@ static t_int *m5_readsf_perform(t_int *w)
 			return w + 2;
 		}
 		
+		m5_readsf_cue(x, blockStartTime);
+		
+		// A take still being recorded has no end yet: play on until it has,
+		// m5_readsf_streamended() asks for the end of the loop again then
+		if (x->x_m5PlayEndTime == END_AT_LOOP && x->x_m5Live == 2 &&
+			x->x_m5LoopLength == LOOP_SELF)
+		{
+			x->x_m5PlayEndTime = END_NEVER;
+			x->x_m5EndFromLoop = 1;
+		}
+		
 		// There was a request to set the end time to the end of the current loop.
 		// We need to calculate x_m5PlayEndTime here in case loop length depends on # of frames in opened soundfile
 		if (x->x_m5PlayEndTime == END_AT_LOOP) 
@@ -2027,18 +4537,20 @@ static t_int *m5_readsf_perform(t_int *w)
 				}
 				x->x_m5PlayEndTime = x->x_m5PlayStartTime + loop_length * loop_count;
 			}
+			x->x_m5EndFromLoop = 1;
 		}
 		
 		x->x_state = STATE_STREAM;
+		m5_readsf_resumed(x, blockStartTime);
 		
-		if (blockStartTime + vecsize >(size_t) x->x_m5PlayEndTime)
+		if ((double)(blockStartTime + vecsize) > x->x_m5PlayEndTime)
 		{
 			// the current block passes by the requested end time
 			// finish the partial buffer and set the rest to silence
 
 			size_t xfersize;
 		
-			if (blockStartTime >= (size_t)x->x_m5PlayEndTime)
+			if ((double)blockStartTime >= x->x_m5PlayEndTime)
 			{
 				xfersize = 0;
 			} else {
@@ -2048,16 +4560,19 @@ static t_int *m5_readsf_perform(t_int *w)
 			
 			if (xfersize)
 			{
-				m5_soundfile_xferin_sample(&sf, noutlets, x->x_outvec, 0,
-					(unsigned char *)(x->x_buf + x->x_fifotail), xfersize);
+				m5_readsf_xferin_fifo(x, fmt, x->x_outvec, 0, x->x_fifotail,
+					xfersize);
+				m5_readsf_started(x, blockStartTime);
 				vecsize -= xfersize;
 			}
+			if (x->x_m5Lookahead)
+				m5_readsf_lookahead(x, fmt, blockStartTime);
 			
 			x->x_state = STATE_IDLE;
 			x->x_requestcode = REQUEST_CLOSE;
 			clock_delay(x->x_clock, 0);	
 			/* send bang and zero out the (rest of the) output */
-			pthread_mutex_unlock(&x->x_mutex);
+			pthread_mutex_unlock(x->x_mutex);
 				
 					
 			for (i = 0; i < noutlets; i++)
@@ -2065,7 +4580,7 @@ static t_int *m5_readsf_perform(t_int *w)
 					*fp++ = 0;
 			return w + 2;
 		}
-		else if (blockStartTime < (size_t)x->x_m5PlayStartTime) 
+		else if ((double)blockStartTime < x->x_m5PlayStartTime) 
 		{
 			// start time may occur within this block (or later). 
 			// fill with partial silence in the meantime before the start time
@@ -2076,54 +4591,55 @@ static t_int *m5_readsf_perform(t_int *w)
 			if (zerosize > (size_t)vecsize) {
 				zerosize = vecsize;
 			}
-			pthread_mutex_unlock(&x->x_mutex);
+			pthread_mutex_unlock(x->x_mutex);
 			for (i = 0; i < noutlets; i++)
 				for (j = zerosize, fp = x->x_outvec[i]; j--;)
 					*fp++ = 0;
-			pthread_mutex_lock(&x->x_mutex);
+			pthread_mutex_lock(x->x_mutex);
 			/* resync local variables */
 			vecsize = x->x_vecsize;
-			m5_soundfile_copy(&sf, &x->x_sf);
 			
 			
 			int xfersize = vecsize - zerosize;
 			
+			// the frame at the start time is zerosize frames past the tail
 			if (xfersize)
 			{
-				m5_soundfile_xferin_sample(&sf, noutlets, x->x_outvec, zerosize,
-				(unsigned char *)(x->x_buf + x->x_fifotail), xfersize);
+				m5_readsf_xferin_fifo(x, fmt, x->x_outvec, zerosize,
+					x->x_fifotail + zerosize * fmt->f_sf.sf_bytesperframe, xfersize);
+				m5_readsf_started(x, blockStartTime + zerosize);
 			}
-			x->x_fifotail += vecsize * sf.sf_bytesperframe;
-
-			x->x_m5TailTime += vecsize;
 		} else {
 			// Regular playback, stream entire buffer.
 			// Note if audio loop extends past end of actual soundfile, the
 			// child process handles inserting silence into the buffer
-			m5_soundfile_xferin_sample(&sf, noutlets, x->x_outvec, 0,
-				(unsigned char *)(x->x_buf + x->x_fifotail), vecsize);
-			
-			x->x_fifotail += vecsize * sf.sf_bytesperframe;
-			x->x_m5TailTime += vecsize;
+			m5_readsf_xferin_fifo(x, fmt, x->x_outvec, 0, x->x_fifotail,
+				vecsize);
+			m5_readsf_started(x, blockStartTime);
 		}
-
-
+		if (x->x_m5Lookahead)
+			m5_readsf_lookahead(x, fmt, blockStartTime);
 		
-		if (x->x_fifotail >= x->x_fifosize) {
-			x->x_fifotail = 0;			
-		}
+		// the next DSP call starts one hop later; that's the whole vector
+		// unless we're in an overlapping block~
+		x->x_fifotail = (x->x_fifotail + x->x_m5Hop * fmt->f_sf.sf_bytesperframe) %
+			x->x_fifosize;
+		x->x_m5TailTime += x->x_m5Hop;
 			
-		if ((--x->x_sigcountdown) <= 0)
+			/* a take being recorded only gets a little ahead of us at a
+			time, so have the child look for more on every call */
+		if ((--x->x_sigcountdown) <= 0 || x->x_m5Live == 2)
 		{
-			sfread_cond_signal(&x->x_requestcondition);
+			sfread_cond_signal(x->x_requestcondition);
 			x->x_sigcountdown = x->x_sigperiod;
 		}
-		pthread_mutex_unlock(&x->x_mutex);
+		pthread_mutex_unlock(x->x_mutex);
 	}
 	else
 	{
-		if (x->x_state == STATE_STARTUP) {
-			pthread_mutex_lock(&x->x_mutex);
+		if (x->x_state == STATE_STARTUP || x->x_state == STATE_STARTUP_2) {
+			pthread_mutex_lock(x->x_mutex);
+			m5_readsf_streamended(x);
 			// get file length and send it to the outlet once if ready
 			if (x->x_m5SoundFileFramesAvailableFromOnset == 0) {
 				if (x->x_sf.sf_bytesperframe > 0 && x->x_sf.sf_bytelimit != SFMAXBYTES) {
@@ -2145,7 +4661,7 @@ static t_int *m5_readsf_perform(t_int *w)
 				clock_delay(x->x_clock, 0);	
 			}
 			
-			pthread_mutex_unlock(&x->x_mutex);
+			pthread_mutex_unlock(x->x_mutex);
 		}
 
 		for (i = 0; i < noutlets; i++)
@@ -2170,16 +4686,18 @@ static void m5_readsf_start(t_readsf *x, t_symbol *s, int argc, t_atom *argv)
 	// no args - start now or as soon as file opened
 	if (argc == 0) 
 	{
-		pthread_mutex_lock(&x->x_mutex);
+		pthread_mutex_lock(x->x_mutex);
 		x->x_m5LoopLengthRequest = 1;
 		x->x_state = STATE_STREAM;
 		x->x_m5PlayStartTime = START_NOW;
+		x->x_m5StartPending = 1;
+		x->x_m5StartDue = -1;
 		
 		// get a new t=0 reference time for case when a shared FTC anchor is not used
-		x->x_m5LocalTimeAnchor = clock_getlogicaltime();
+		x->x_m5LocalTimeAnchor = m5_clock_logicaltime();
 		
-		sfread_cond_signal(&x->x_requestcondition);
-		pthread_mutex_unlock(&x->x_mutex);
+		sfread_cond_signal(x->x_requestcondition);
+		pthread_mutex_unlock(x->x_mutex);
 		return;
 	}
 	// read FTC from parameters and make that the start time
@@ -2192,15 +4710,17 @@ static void m5_readsf_start(t_readsf *x, t_symbol *s, int argc, t_atom *argv)
 		pd_error (x,"m5_readsf~: start time must be >= 0 frames.");
 		return;
 	}
-	pthread_mutex_lock(&x->x_mutex);
+	pthread_mutex_lock(x->x_mutex);
 	x->x_m5LoopLengthRequest = 1;
 	x->x_state = STATE_STREAM;
 	x->x_m5PlayStartTime = (double)ll;
+	x->x_m5StartPending = 1;
+	x->x_m5StartDue = -1;
 	
-	x->x_m5LocalTimeAnchor = clock_getlogicaltime();
+	x->x_m5LocalTimeAnchor = m5_clock_logicaltime();
 	
-	sfread_cond_signal(&x->x_requestcondition);
-	pthread_mutex_unlock(&x->x_mutex);
+	sfread_cond_signal(x->x_requestcondition);
+	pthread_mutex_unlock(x->x_mutex);
 }
 
 
@@ -2215,34 +4735,36 @@ static void m5_readsf_stop(t_readsf *x, t_symbol *s, int argc, t_atom *argv)
 	
 	// stop on next block, as usual for readsf
 	if (argc == 0) {
-		pthread_mutex_lock(&x->x_mutex);
+		pthread_mutex_lock(x->x_mutex);
 		x->x_state = STATE_IDLE;
 		x->x_requestcode = REQUEST_CLOSE;
-		sfread_cond_signal(&x->x_requestcondition);
-		pthread_mutex_unlock(&x->x_mutex);
+		sfread_cond_signal(x->x_requestcondition);
+		pthread_mutex_unlock(x->x_mutex);
 		return;
 	}
 	
 	// stop asap
 	if (atom_getsymbolarg(0, argc, argv) == gensym("now")) {
-		pthread_mutex_lock(&x->x_mutex);
+		pthread_mutex_lock(x->x_mutex);
 		x->x_m5PlayEndTime = END_NOW;
-		sfread_cond_signal(&x->x_requestcondition);
-		pthread_mutex_unlock(&x->x_mutex);
+		x->x_m5EndFromLoop = 0;
+		sfread_cond_signal(x->x_requestcondition);
+		pthread_mutex_unlock(x->x_mutex);
 		return;
 	// stop at 'end' of current audio loop	
 	} else if (atom_getsymbolarg(0, argc, argv) == gensym("end")) {
-		pthread_mutex_lock(&x->x_mutex);
+		pthread_mutex_lock(x->x_mutex);
 		x->x_m5PlayEndTime = END_AT_LOOP;
-		sfread_cond_signal(&x->x_requestcondition);
-		pthread_mutex_unlock(&x->x_mutex);
+		sfread_cond_signal(x->x_requestcondition);
+		pthread_mutex_unlock(x->x_mutex);
 		return;
 	// keep looping forever (can follow-up with a another 'stop' later to actually stop)
 	} else if (atom_getsymbolarg(0, argc, argv) == gensym("never")) {
-		pthread_mutex_lock(&x->x_mutex);
+		pthread_mutex_lock(x->x_mutex);
 		x->x_m5PlayEndTime = END_NEVER;
-		sfread_cond_signal(&x->x_requestcondition);
-		pthread_mutex_unlock(&x->x_mutex);
+		x->x_m5EndFromLoop = 0;
+		sfread_cond_signal(x->x_requestcondition);
+		pthread_mutex_unlock(x->x_mutex);
 		return;
 	}
 	// stop at specific FTC
@@ -2255,10 +4777,11 @@ static void m5_readsf_stop(t_readsf *x, t_symbol *s, int argc, t_atom *argv)
 		pd_error (x,"m5_readsf~: end time must be >= 0 frames.");
 		return;
 	}
-	pthread_mutex_lock(&x->x_mutex);
+	pthread_mutex_lock(x->x_mutex);
 	x->x_m5PlayEndTime = (double)ll;
-	sfread_cond_signal(&x->x_requestcondition);
-	pthread_mutex_unlock(&x->x_mutex);
+	x->x_m5EndFromLoop = 0;
+	sfread_cond_signal(x->x_requestcondition);
+	pthread_mutex_unlock(x->x_mutex);
 
 }
 
@@ -2277,11 +4800,11 @@ static void m5_readsf_loop_start (t_readsf *x, t_symbol *s, int argc, t_atom *ar
 		pd_error (x,"m5_readsf~: Loop start must be >= 0 frames.");
 		return;
 	}
-	pthread_mutex_lock(&x->x_mutex);
+	pthread_mutex_lock(x->x_mutex);
 	x->x_m5LoopLengthRequest = 1;
 	x->x_m5LoopStart = ll;	
-	sfread_cond_signal(&x->x_requestcondition);
-	pthread_mutex_unlock(&x->x_mutex);
+	sfread_cond_signal(x->x_requestcondition);
+	pthread_mutex_unlock(x->x_mutex);
 	
 	
 }
@@ -2291,11 +4814,11 @@ static void m5_readsf_loop_length(t_readsf *x, t_symbol *s, int argc, t_atom *ar
 {
 	t_m5FrameTimeCode ftc;
 	if (atom_getsymbolarg(0, argc, argv) == gensym("self")) {
-		pthread_mutex_lock(&x->x_mutex);
+		pthread_mutex_lock(x->x_mutex);
 		x->x_m5LoopLengthRequest = 1;
 		x->x_m5LoopLength = LOOP_SELF;
-		sfread_cond_signal(&x->x_requestcondition);
-		pthread_mutex_unlock(&x->x_mutex);
+		sfread_cond_signal(x->x_requestcondition);
+		pthread_mutex_unlock(x->x_mutex);
 		return;
 	}
 	if (m5_frame_time_code_from_atoms(argc, argv, &ftc)) {
@@ -2307,11 +4830,125 @@ static void m5_readsf_loop_length(t_readsf *x, t_symbol *s, int argc, t_atom *ar
 		pd_error (x,"m5_readsf~: Loop length must be > 0 frames.");
 		return;
 	}
-	pthread_mutex_lock(&x->x_mutex);
-	x->x_m5LoopLengthRequest = 1;
-	x->x_m5LoopLength = ll;	
-	sfread_cond_signal(&x->x_requestcondition);
-	pthread_mutex_unlock(&x->x_mutex);
+	pthread_mutex_lock(x->x_mutex);
+	x->x_m5LoopLengthRequest = 1;
+	x->x_m5LoopLength = ll;	
+	sfread_cond_signal(x->x_requestcondition);
+	pthread_mutex_unlock(x->x_mutex);
+}
+
+	/** regions <FTC start> <FTC length> ...: the table "play" picks from,
+		in frames after the open's onset like "loopstart".  no arguments
+		clear it */
+static void m5_readsf_regions(t_readsf *x, t_symbol *s, int argc, t_atom *argv)
+{
+	t_m5Region regions[MAXREGIONS];
+	t_m5FrameTimeCode ftc;
+	int n = argc / 6, i;
+	long ll;
+	if (argc % 6 || n > MAXREGIONS)
+	{
+		pd_error(x, "m5_readsf~: regions takes up to %d pairs of start and length frame time codes.", MAXREGIONS);
+		return;
+	}
+	for (i = 0; i < n; i++)
+	{
+		if (m5_frame_time_code_from_atoms(3, argv + 6 * i, &ftc)) {
+			pd_error (x,"m5_readsf~: A frame time code must be three floats... 1|-1, epoch, frames.");
+			return;
+		}
+		if ((ll = m5_frames_from_time_code(&ftc)) < 0) {
+			pd_error (x,"m5_readsf~: region %d: start must be >= 0 frames.", i);
+			return;
+		}
+		regions[i].r_start = ll;
+		if (m5_frame_time_code_from_atoms(3, argv + 6 * i + 3, &ftc)) {
+			pd_error (x,"m5_readsf~: A frame time code must be three floats... 1|-1, epoch, frames.");
+			return;
+		}
+		if ((ll = m5_frames_from_time_code(&ftc)) <= 0) {
+			pd_error (x,"m5_readsf~: region %d: length must be > 0 frames.", i);
+			return;
+		}
+		regions[i].r_length = ll;
+	}
+	pthread_mutex_lock(x->x_mutex);
+	memcpy(x->x_m5Regions, regions, n * sizeof(t_m5Region));
+	x->x_m5NRegions = n;
+	x->x_m5RegionSerial++;
+	sfread_cond_signal(x->x_requestcondition);
+	pthread_mutex_unlock(x->x_mutex);
+}
+
+	/** play <index> [at <FTC>]: loop a region from "regions" from its
+		start, now or at the given time.  a time ahead of what plays now
+		is cued: the fifo switches to the region there, without a refill */
+static void m5_readsf_play(t_readsf *x, t_symbol *s, int argc, t_atom *argv)
+{
+	t_m5FrameTimeCode ftc;
+	t_m5Region r;
+	int i = (int)atom_getfloatarg(0, argc, argv);
+	long at = -1;
+	if (!argc || argv[0].a_type != A_FLOAT || i < 0 || i >= x->x_m5NRegions)
+	{
+		pd_error(x, "[readsf~] play: no region %d (%d regions)", i,
+			x->x_m5NRegions);
+		return;
+	}
+	if (argc > 1)
+	{
+		if (atom_getsymbolarg(1, argc, argv) != gensym("at") ||
+			m5_frame_time_code_from_atoms(argc - 2, argv + 2, &ftc)) {
+			pd_error (x,"m5_readsf~: play <region> at <FTC>: A frame time code must be three floats... 1|-1, epoch, frames.");
+			return;
+		}
+		if ((at = m5_frames_from_time_code(&ftc)) < 0) {
+			pd_error (x,"m5_readsf~: play time must be >= 0 frames.");
+			return;
+		}
+	}
+	if (x->x_state == STATE_IDLE) 
+	{
+		pd_error(x, "[readsf~]: play requested with no prior 'open'");
+		return;
+	}
+	r = x->x_m5Regions[i];
+	pthread_mutex_lock(x->x_mutex);
+	if (x->x_state == STATE_STREAM && at >= 0 && at >= x->x_m5TailTime)
+	{
+		int bpf = x->x_sf.sf_bytesperframe;
+		x->x_m5Cue = r;
+		x->x_m5CueTime = (double)at;
+		x->x_m5CueSerial++;
+			/* drop what the fifo holds from then on */
+		if (x->x_fifosize && bpf > 0 && (at - x->x_m5TailTime) * bpf <
+			m5_readsf_fifoavailable(x))
+		{
+			x->x_fifohead = (x->x_fifotail +
+				(int)(at - x->x_m5TailTime) * bpf) % x->x_fifosize;
+			x->x_eof = 0;
+		}
+	}
+	else
+	{
+			/* too late to cue: switch now and refill, like "loopstart" */
+		x->x_m5CueTime = -1;
+		x->x_m5LoopStart = r.r_start;
+		x->x_m5LoopLength = r.r_length;
+		x->x_m5LoopLengthRequest = 1;
+		x->x_m5PlayStartTime = (at < 0 ? START_NOW : (double)at);
+		if (x->x_m5EndFromLoop)
+			x->x_m5PlayEndTime = END_AT_LOOP;
+		if (x->x_state != STATE_STREAM)
+		{
+			x->x_state = STATE_STREAM;
+			x->x_m5StartPending = 1;
+			x->x_m5StartDue = -1;
+			x->x_m5LocalTimeAnchor = m5_clock_logicaltime();
+		}
+	}
+	sfread_cond_signal(x->x_requestcondition);
+	pthread_mutex_unlock(x->x_mutex);
 }
 
 // set ID for FTC anchor (shared time reference for t=0)
@@ -2360,6 +4997,70 @@ static int m5_readsf_one_iter(const char *path, t_readsf *x)
 	return 1;
 }
 
+	/** ask the child to open x_filename as described by x_sf and reset
+		playback, called with the mutex locked */
+static void m5_readsf_arm(t_readsf *x)
+{
+	x->x_requestcode = REQUEST_OPEN;
+	x->x_fifotail = 0;
+	x->x_fifohead = 0;
+	x->x_eof = 0;
+	x->x_m5SoundFileFramesAvailableFromOnset = 0;
+	x->x_fileerror = 0;
+	x->x_m5HeadTimeRequest = x->x_m5TailTime = 0;
+	x->x_m5Refilling = 0;
+	x->x_m5RefillLead = -1;
+	x->x_m5PlayStartTime = START_NOW;
+	x->x_m5PlayEndTime = END_AT_LOOP;
+	x->x_m5EndFromLoop = 0;
+	x->x_m5StreamEnded = 0;
+	x->x_m5Live = 0;
+	x->x_m5CueTime = -1;
+	x->x_m5StartPending = 0;
+	x->x_state = STATE_STARTUP;
+	x->x_m5Stalled = 0;
+	if (x->x_m5Watchdog > 0)
+		clock_delay(x->x_m5WatchClock, WATCHPOLL);
+}
+
+	/** open a shared-memory ring instead of a file: the ring is mapped
+		right here (no disk access) and any open file is closed */
+static void m5_readsf_open_shm(t_readsf *x, t_symbol *name, t_float onsetframes)
+{
+	t_m5ShmRing *r = m5_shmring_open(name->s_name);
+	if (!r)
+	{
+		pd_error(x, "[readsf~] open -shm %s: %s", name->s_name,
+			(errno == EINVAL ? "not an m5 ring" : strerror(errno)));
+		return;
+	}
+	if ((int)r->r_header->r_nchannels != x->x_noutlets)
+		post("[readsf~] %s: %d channels in ring, %d outlets", name->s_name,
+			(int)r->r_header->r_nchannels, x->x_noutlets);
+	if (r->r_header->r_samplerate && r->r_header->r_samplerate != sys_getsr())
+		post("[readsf~] %s: ring sample rate %d differs from Pd's",
+			name->s_name, (int)r->r_header->r_samplerate);
+
+	pthread_mutex_lock(x->x_mutex);
+	x->x_requestcode = REQUEST_CLOSE;
+	x->x_filename = name->s_name;
+	x->x_m5Shm = r;
+	x->x_onsetframes = (onsetframes > 0 ? onsetframes : 0);
+	x->x_eof = 0;
+	x->x_fileerror = 0;
+	x->x_m5SoundFileFramesAvailableFromOnset = r->r_header->r_capacity;
+	x->x_m5PlayStartTime = START_NOW;
+	x->x_m5PlayEndTime = END_AT_LOOP;
+	x->x_m5EndFromLoop = 0;
+	x->x_m5StreamEnded = 0;
+	x->x_m5Live = 0;
+	x->x_state = STATE_STARTUP_2;
+	sfread_cond_signal(x->x_requestcondition);
+	pthread_mutex_unlock(x->x_mutex);
+		/* report the ring length in place of the file length */
+	clock_delay(x->x_m5FramesOutClock, 0);
+}
+
 	/** open method.  Called as:
 		open [flags] filename [onsetframes headersize channels bytes endianness]
 		(if headersize is zero, header is taken to be automatically detected;
@@ -2370,13 +5071,31 @@ static void m5_readsf_open(t_readsf *x, t_symbol *s, int argc, t_atom *argv)
 	t_symbol *filesym, *endian;
 	t_float onsetframes, headersize, nchannels, bytespersample;
 	t_soundfile_type *type = NULL;
+	int shm = 0, ram = 0, verify = 0, loudness = 0, onsets = 0;
+#ifdef M5_VIRTUAL_CLOCK
+	int cold = 0;
+#endif
 
 	while (argc > 0 && argv->a_type == A_SYMBOL &&
 		*argv->a_w.w_symbol->s_name == '-')
 	{
 			/* check for type by name */
 		const char *flag = argv->a_w.w_symbol->s_name + 1;
-		if (!(type = m5_soundfile_findtype(flag)))
+		if (!strcmp(flag, "shm"))
+			shm = 1;
+		else if (!strcmp(flag, "ram"))
+			ram = 1;
+		else if (!strcmp(flag, "verify"))
+			verify = 1;
+		else if (!strcmp(flag, "loudness"))
+			loudness = 1;
+		else if (!strcmp(flag, "onsets"))
+			onsets = 1;
+#ifdef M5_VIRTUAL_CLOCK
+		else if (!strcmp(flag, "cold"))
+			cold = 1;
+#endif
+		else if (!(type = m5_soundfile_findtype(flag)))
 			goto usage; /* unknown flag */
 		argc -= 1; argv += 1;
 	}
@@ -2389,7 +5108,21 @@ static void m5_readsf_open(t_readsf *x, t_symbol *s, int argc, t_atom *argv)
 	if (!*filesym->s_name)
 		return; /* no filename */
 
-	pthread_mutex_lock(&x->x_mutex);
+		/* a new file makes earlier jobs moot */
+	m5_readsf_dropjob(x, &x->x_m5Verify, x->x_m5VerifyClock);
+	m5_readsf_dropjob(x, &x->x_m5Loudness, x->x_m5LoudnessClock);
+	m5_readsf_dropjob(x, &x->x_m5Onsets, x->x_m5OnsetsClock);
+	m5_onsetlist_clear(&x->x_m5OnsetList);
+		/* drop any ring from a previous "open -shm" */
+	if (x->x_m5Shm)
+		m5_shmring_close(x->x_m5Shm), x->x_m5Shm = NULL;
+	if (shm)
+	{
+		m5_readsf_open_shm(x, filesym, onsetframes);
+		return;
+	}
+
+	pthread_mutex_lock(x->x_mutex);
 	if (x->x_namelist)
 		namelist_free(x->x_namelist), x->x_namelist = 0;
 		/* see open_soundfile_via_namelist() */
@@ -2407,10 +5140,11 @@ static void m5_readsf_open(t_readsf *x, t_symbol *s, int argc, t_atom *argv)
 			close(fd);
 	}
 	m5_soundfile_clear(&x->x_sf);
-	x->x_requestcode = REQUEST_OPEN;
 	x->x_filename = filesym->s_name;
-	x->x_fifotail = 0;
-	x->x_fifohead = 0;
+	x->x_m5Ram = ram;
+#ifdef M5_VIRTUAL_CLOCK
+	x->x_m5Cold = cold;
+#endif
 	// x->x_m5FramesPlayed = 0;
 	if (*endian->s_name == 'b')
 		 x->x_sf.sf_bigendian = 1;
@@ -2433,34 +5167,97 @@ static void m5_readsf_open(t_readsf *x, t_symbol *s, int argc, t_atom *argv)
 	}
 	else
 		x->x_sf.sf_type = type;
-	x->x_eof = 0;
-	x->x_m5SoundFileFramesAvailableFromOnset = 0;
-	x->x_fileerror = 0;
-	x->x_m5HeadTimeRequest = x->x_m5TailTime = 0;
-	x->x_m5PlayStartTime = START_NOW;
-	x->x_m5PlayEndTime = END_AT_LOOP;
-	x->x_state = STATE_STARTUP;
+		/* remember the request for "restart" */
+	m5_soundfile_copy(&x->x_m5LastOpen, &x->x_sf);
+	if (verify)
+	{
+		x->x_m5Verify = m5_job_new(&x->x_sf, m5_verify_run, 0, 0);
+		clock_delay(x->x_m5VerifyClock, JOBPOLL);
+	}
+	if (loudness)
+	{
+		x->x_m5Loudness = m5_job_new(&x->x_sf, m5_loudness_run,
+			sizeof(t_m5LoudnessResult), 0);
+		clock_delay(x->x_m5LoudnessClock, JOBPOLL);
+	}
+	if (onsets)
+	{
+		x->x_m5Onsets = m5_job_new(&x->x_sf, m5_onsets_run,
+			sizeof(t_m5OnsetList), m5_onsets_freelist);
+		clock_delay(x->x_m5OnsetsClock, JOBPOLL);
+	}
+	m5_readsf_arm(x);
 	
-	sfread_cond_signal(&x->x_requestcondition);
-	pthread_mutex_unlock(&x->x_mutex);
+	sfread_cond_signal(x->x_requestcondition);
+	pthread_mutex_unlock(x->x_mutex);
 	return;
 usage:
 	pd_error(x, "[readsf~]: usage; open [flags] filename [onset] [headersize]...");
 	pd_error(0, "[nchannels] [bytespersample] [endian (b or l)]");
-	post("flags: %s",m5_sf_typeargs);
+	post("flags: %s -shm -ram -verify -loudness -onsets",
+		m5_sf_typeargs);
+}
+
+	/** restart [FTC]: reopen the last file the way "open" did and start it,
+		as "start" would.  The child finds the file in the cache, so this
+		costs neither a path search nor a header parse. */
+static void m5_readsf_restart(t_readsf *x, t_symbol *s, int argc, t_atom *argv)
+{
+	if (!x->x_filename || x->x_m5Shm || !x->x_m5LastOpen.sf_nchannels)
+	{
+		pd_error(x, "[readsf~]: restart requested with no prior 'open'");
+		return;
+	}
+	pthread_mutex_lock(x->x_mutex);
+	m5_soundfile_copy(&x->x_sf, &x->x_m5LastOpen);
+	m5_readsf_arm(x);
+	sfread_cond_signal(x->x_requestcondition);
+	pthread_mutex_unlock(x->x_mutex);
+	m5_readsf_start(x, s, argc, argv);
 }
 
 static void m5_readsf_dsp(t_readsf *x, t_signal **sp)
 {
 	m5_readsf_time_set(x, x->x_m5TimeAnchorName);
 	int i, noutlets = x->x_noutlets;
-	pthread_mutex_lock(&x->x_mutex);
+	pthread_mutex_lock(x->x_mutex);
 	x->x_vecsize = sp[0]->s_n;
-	x->x_sigperiod = x->x_fifosize / (x->x_sf.sf_bytesperframe * x->x_vecsize);
-	for (i = 0; i < noutlets; i++)
+	x->x_m5Hop = m5_sf_gethop(sp[0]);
+	m5_sf_fitbuffer(x, noutlets, "[readsf~]");
+	x->x_sigperiod = m5_sf_sigperiod(x, x->x_sf.sf_bytesperframe);
+#ifdef CLASS_MULTICHANNEL
+	if (x->x_m5Multi)
+	{
+			/* channels sit one after another in a single signal */
+		signal_setmultiout(&sp[0], noutlets);
+		for (i = 0; i < noutlets; i++)
+			x->x_outvec[i] = sp[0]->s_vec + i * x->x_vecsize;
+		if (x->x_m5Lookahead)
+		{
+			signal_setmultiout(&sp[1], noutlets);
+			for (i = 0; i < noutlets; i++)
+				x->x_outvec[noutlets + i] = sp[1]->s_vec + i * x->x_vecsize;
+		}
+	}
+	else for (i = 0; i < noutlets * (x->x_m5Lookahead ? 2 : 1); i++)
+	{
+		signal_setmultiout(&sp[i], 1);
+		x->x_outvec[i] = sp[i]->s_vec;
+	}
+#else
+	for (i = 0; i < noutlets * (x->x_m5Lookahead ? 2 : 1); i++)
 		x->x_outvec[i] = sp[i]->s_vec;
-	pthread_mutex_unlock(&x->x_mutex);
-	dsp_add(m5_readsf_perform, 1, x);	
+#endif
+	pthread_mutex_unlock(x->x_mutex);
+	dsp_add(m5_sf_timedperform, 2, m5_readsf_perform, x);
+}
+
+static void m5_readsf_ramcache_print(void)
+{
+	size_t used, raw;
+	m5_samplecache_usage(&used, &raw);
+	post("ram cache %.1f MB holding %.1f MB of samples",
+		used / 1048576., raw / 1048576.);
 }
 
 static void m5_readsf_print(t_readsf *x)
@@ -2472,40 +5269,95 @@ static void m5_readsf_print(t_readsf *x)
 	post("fd %d", x->x_sf.sf_fd);
 	post("eof %d", x->x_eof);
 	post("total frames %d", x->x_m5SoundFileFramesAvailableFromOnset);
-	
+	post("start latency %g frames, worst %g", x->x_m5StartLatency,
+		x->x_m5StartLatencyMax);
+#ifdef M5_VIRTUAL_CLOCK
+	if (x->x_m5IoDelay > 0)
+		post("io delay %g msec", x->x_m5IoDelay);
+#endif
+	if (x->x_m5Watchdog > 0)
+		post("watchdog %g msec, %d stalls, %d reopens", x->x_m5Watchdog,
+			x->x_m5Stalls, x->x_m5Reopens);
+	else post("watchdog off");
+	if (x->x_m5Lookahead)
+		post("lookahead %d frames", x->x_m5Lookahead);
+	if (x->x_m5OnsetList.ol_n)
+		post("%d onsets", (int)x->x_m5OnsetList.ol_n);
+	if (x->x_m5NRegions)
+		post("%d regions, %d heads in RAM", x->x_m5NRegions,
+			x->x_m5RegionsResident);
+	if (x->x_m5Shm)
+		post("shm %s, %d frames written", x->x_m5Shm->r_name,
+			(int)x->x_m5Shm->r_header->r_writeframe);
+	m5_readsf_ramcache_print();
 }
 
-	/** request QUIT and wait for acknowledge */
-static void m5_readsf_free(t_readsf *x)
+	/** ramcache <megabytes>: size of the compressed sample cache shared by
+		all readsf~ objects for files opened with "-ram" */
+static void m5_readsf_ramcache(t_readsf *x, t_floatarg megabytes)
 {
-	void *threadrtn;
-	pthread_mutex_lock(&x->x_mutex);
-	x->x_requestcode = REQUEST_QUIT;
-	sfread_cond_signal(&x->x_requestcondition);
-	while (x->x_requestcode != REQUEST_NOTHING)
+	if (megabytes < 0)
 	{
-		sfread_cond_signal(&x->x_requestcondition);
-		sfread_cond_wait(&x->x_answercondition, &x->x_mutex);
+		pd_error(x, "[readsf~] ramcache: size must be >= 0 megabytes");
+		return;
 	}
-	pthread_mutex_unlock(&x->x_mutex);
-	if (pthread_join(x->x_childthread, &threadrtn))
-		pd_error(x, "[readsf~] free: join failed");
+	m5_samplecache_setlimit((size_t)(megabytes * 1048576.));
+	m5_readsf_ramcache_print();
+}
 
-	pthread_cond_destroy(&x->x_requestcondition);
-	pthread_cond_destroy(&x->x_answercondition);
-	pthread_mutex_destroy(&x->x_mutex);
-	freebytes(x->x_buf, x->x_bufsize);
+#ifdef M5_VIRTUAL_CLOCK
+	/** iodelay <msec>, test builds only: stall every open and read from
+		disk that long, to time cues against slow storage */
+static void m5_readsf_iodelay(t_readsf *x, t_floatarg ms)
+{
+	pthread_mutex_lock(x->x_mutex);
+	x->x_m5IoDelay = (ms > 0 ? ms : 0);
+	pthread_mutex_unlock(x->x_mutex);
+}
+#endif
+
+	/** watchdog <msec>: report disk accesses that take longer, 0 for
+		never */
+static void m5_readsf_watchdog(t_readsf *x, t_floatarg ms)
+{
+	pthread_mutex_lock(x->x_mutex);
+	x->x_m5Watchdog = (ms > 0 ? ms : 0);
+	if (!x->x_m5Watchdog)
+		x->x_m5Stalled = 0;
+	pthread_mutex_unlock(x->x_mutex);
+	if (x->x_m5Watchdog > 0)
+		clock_delay(x->x_m5WatchClock, WATCHPOLL);
+	else clock_unset(x->x_m5WatchClock);
+}
+
+	/** drop what only the object uses and leave the rest to the child,
+		without waiting for it */
+static void m5_readsf_free(t_readsf *x)
+{
+	m5_readsf_dropjob(x, &x->x_m5Verify, x->x_m5VerifyClock);
+	m5_readsf_dropjob(x, &x->x_m5Loudness, x->x_m5LoudnessClock);
+	m5_readsf_dropjob(x, &x->x_m5Onsets, x->x_m5OnsetsClock);
+	m5_onsetlist_clear(&x->x_m5OnsetList);
 	clock_free(x->x_clock);
 	clock_free(x->x_m5FramesOutClock);
+	clock_free(x->x_m5VerifyClock);
+	clock_free(x->x_m5LoudnessClock);
+	clock_free(x->x_m5OnsetsClock);
+	clock_free(x->x_m5LatencyClock);
+	clock_free(x->x_m5WatchClock);
+	m5_shmring_close(x->x_m5Shm);
+	m5_sf_unregister(x);
+	m5_sf_handoff(x);
 }
 
 static void m5_readsf_setup(void)
 {
 	m5_readsf_class = class_new(gensym("m5_readsf~"),
 		(t_newmethod)m5_readsf_new, (t_method)m5_readsf_free,
-		sizeof(t_readsf), 0, A_DEFFLOAT, A_DEFFLOAT, 0);
+		sizeof(t_readsf), M5_SF_CLASSFLAGS, A_GIMME, 0);
 	class_addfloat(m5_readsf_class, (t_method)m5_readsf_float);
 	class_addmethod(m5_readsf_class, (t_method)m5_readsf_start, gensym("start"), A_GIMME, 0);
+	class_addmethod(m5_readsf_class, (t_method)m5_readsf_restart, gensym("restart"), A_GIMME, 0);
 	// class_addmethod(m5_readsf_class, (t_method)m5_readsf_start_arm, gensym("start_arm"), 0);
 	// class_addmethod(m5_readsf_class, (t_method)m5_readsf_start_sync_now, gensym("start_sync_now"), 0);
 	class_addmethod(m5_readsf_class, (t_method)m5_readsf_stop, gensym("stop"), A_GIMME, 0);
@@ -2514,12 +5366,24 @@ static void m5_readsf_setup(void)
 	class_addmethod(m5_readsf_class, (t_method)m5_readsf_open,
 		gensym("open"), A_GIMME, 0);
 	class_addmethod(m5_readsf_class, (t_method)m5_readsf_print, gensym("print"), 0);
+	class_addmethod(m5_readsf_class, (t_method)m5_readsf_ramcache,
+		gensym("ramcache"), A_FLOAT, 0);
+#ifdef M5_VIRTUAL_CLOCK
+	class_addmethod(m5_readsf_class, (t_method)m5_readsf_iodelay,
+		gensym("iodelay"), A_FLOAT, 0);
+#endif
+	class_addmethod(m5_readsf_class, (t_method)m5_readsf_watchdog,
+		gensym("watchdog"), A_FLOAT, 0);
+	class_addmethod(m5_readsf_class, (t_method)m5_readsf_onset,
+		gensym("onset"), A_FLOAT, 0);
 	
 	// class_addmethod(m5_readsf_class, (t_method)m5_readsf_loop_off, gensym("loopoff"), 0);
 	// class_addmethod(m5_readsf_class, (t_method)m5_readsf_loop_on, gensym("loopon"), 0);
 	class_addmethod(m5_readsf_class, (t_method)m5_readsf_time, gensym("time"), A_SYMBOL, 0);
 	class_addmethod(m5_readsf_class, (t_method)m5_readsf_loop_length, gensym("looplength"), A_GIMME, 0);
 	class_addmethod(m5_readsf_class, (t_method)m5_readsf_loop_start, gensym("loopstart"), A_GIMME, 0);
+	class_addmethod(m5_readsf_class, (t_method)m5_readsf_regions, gensym("regions"), A_GIMME, 0);
+	class_addmethod(m5_readsf_class, (t_method)m5_readsf_play, gensym("play"), A_GIMME, 0);
 		
 }
 
@@ -2529,12 +5393,233 @@ static t_class *m5_writesf_class;
 
 typedef t_readsf t_writesf; /* just re-use the structure */
 
+/* ----- finishing takes ----- */
+
+/* When a take stops, the child hands the file, with all of its data
+written, to a background worker (m5_worker.h) as a job that updates the
+header, stores the checksum and closes it, and goes back to waiting.  An
+"open" that comes while the last take's data is still being written
+doesn't wait for it either: the data stays in the fifo up to
+x_m5TakeEnd, the new take's goes in after it from x_m5TakeStart, and the
+child writes out the one and hands it over before it opens the other.
+Each take's length goes out the frames outlet once its file is
+complete. */
+
+typedef struct _m5Take
+{
+	size_t t_frames;      /* frames written */
+	uint32_t t_crc;       /* their CRC-32C, for t_checksum */
+	int t_checksum;
+	int t_error;          /* errno of a write that failed, or 0 */
+	t_m5Live *t_live;     /* listed until the header is final, or NULL */
+} t_m5Take;
+
+	/** worker job: finish and close the take's file */
+static void m5_writesf_finish_run(void *z)
+{
+	t_m5Job *j = (t_m5Job *)z;
+	t_m5Take *t = (t_m5Take *)j->j_data;
+	t_soundfile *sf = &j->j_sf;
+	m5_soundfile_finishwrite(0, j->j_path, sf, SFMAXFRAMES, t->t_frames);
+	if (t->t_checksum && !t->t_error)
+		m5_soundfile_finishchecksum(0, j->j_path, sf, t->t_frames, t->t_crc);
+	m5_soundfile_close(sf);
+	m5_live_unlist(t->t_live);
+	if (t->t_error)
+		m5_job_finish(j, JOB_FAILED, strerror(t->t_error));
+	else m5_job_finish(j, JOB_OK, 0);
+}
+
+	/** called by the child with x_mutex held: hand the file sf, whose take
+		is all written, to a worker and queue it for the report */
+static void m5_writesf_handover(t_writesf *x, t_soundfile *sf,
+	const char *filename, size_t frameswritten, int checksum, uint32_t crc,
+	int error)
+{
+	t_m5Job *j = m5_job_new(sf, m5_writesf_finish_run, sizeof(t_m5Take), 0),
+		**jp;
+	t_m5Take *t = (t_m5Take *)j->j_data;
+	m5_soundfile_copy(&j->j_sf, sf);
+	snprintf(j->j_path, MAXPDSTRING, "%s", filename);
+	t->t_frames = frameswritten;
+	t->t_checksum = checksum;
+	t->t_crc = crc;
+	t->t_error = error;
+	t->t_live = x->x_m5LiveTake;
+	m5_live_end(x, frameswritten);
+	sf->sf_fd = -1;
+	sf->sf_encoder = NULL;
+	x->x_sf.sf_fd = -1;
+	x->x_sf.sf_encoder = NULL;
+	for (jp = &x->x_m5Takes; *jp; jp = &(*jp)->j_next)
+		;
+	*jp = j;
+	j->j_refcount++; /* the worker's */
+	if (!m5_worker_submit(m5_writesf_finish_run, j))
+		m5_writesf_finish_run(j);
+}
+
+	/** where the child's writing has to stop: the end of the take it
+		has open, if a new "open" fixed that already, else the fifo head */
+static int m5_writesf_datalimit(const t_writesf *x)
+{
+	return (x->x_m5TakeEnd >= 0 ? x->x_m5TakeEnd : x->x_fifohead);
+}
+
+	/** where the recording take's data starts, which perform moves: the
+		fifo tail, or after the last take while the child writes that out */
+static int *m5_writesf_taketail(t_writesf *x)
+{
+	return (x->x_m5TakeEnd >= 0 ? &x->x_m5TakeStart : &x->x_fifotail);
+}
+
+	/** whether the child has to write out all of its take's data */
+static int m5_writesf_draining(const t_writesf *x)
+{
+	return (x->x_requestcode == REQUEST_CLOSE || x->x_m5TakeEnd >= 0);
+}
+
+/* ----- "-mmap" ----- */
+
+/* With "open -mmap" the child doesn't write() the fifo's data but copies
+it into the file through a shared mapping, one extent at a time, and the
+kernel writes the pages back when it sees fit.  Each extent is
+preallocated before it is mapped, so that a full disk makes the
+preallocation fail instead of raising SIGBUS in a store, and the kernel
+is asked to start writing back (msync() with MS_ASYNC) every
+M5_MMAP_SYNC bytes.  When the take stops the file is cut back to the end
+of its data, where the header update and a checksum chunk expect it.
+Compressed types, and files or file systems that can't be preallocated
+or mapped, go on with plain writes from where the mapping left off. */
+
+#define M5_MMAP_EXTENT (8 * 1024 * 1024) /* bytes mapped at a time */
+#define M5_MMAP_SYNC (1024 * 1024)       /* bytes between msync() calls */
+
+typedef struct _m5MapOut
+{
+	char *mo_map;       /* the mapped extent, or NULL */
+	off_t mo_mapstart;  /* its offset, a multiple of M5_MMAP_EXTENT */
+	off_t mo_alloc;     /* the file's preallocated size */
+	off_t mo_pos;       /* where the next byte of data goes */
+	off_t mo_synced;    /* written back as far as asked for */
+	int mo_on;          /* 0: plain writes */
+} t_m5MapOut;
+
+	/** start writing the take just created in sf through a mapping,
+		returns 0 if it has to be written plainly */
+static int m5_mmap_begin(t_m5MapOut *mo, const t_soundfile *sf)
+{
+	mo->mo_map = NULL;
+	mo->mo_on = 0;
+#ifndef _WIN32
+	if (sf->sf_encoder || sf->sf_headersize < 0)
+		return 0;
+	mo->mo_mapstart = 0;
+	mo->mo_alloc = mo->mo_pos = mo->mo_synced = sf->sf_headersize;
+	mo->mo_on = 1;
+#endif
+	return mo->mo_on;
+}
+
+#ifndef _WIN32
+
+	/** ask for writeback of the mapped data up to mo_pos, and unmap the
+		extent as well if unmap is set */
+static void m5_mmap_sync(t_m5MapOut *mo, int unmap)
+{
+	off_t from = mo->mo_synced - mo->mo_synced % M5_MMAP_SYNC;
+	if (!mo->mo_map)
+		return;
+	if (from < mo->mo_mapstart)
+		from = mo->mo_mapstart;
+	if (mo->mo_pos > from)
+		msync(mo->mo_map + (from - mo->mo_mapstart),
+			mo->mo_pos - from, MS_ASYNC);
+	mo->mo_synced = mo->mo_pos;
+	if (unmap)
+	{
+		munmap(mo->mo_map, M5_MMAP_EXTENT);
+		mo->mo_map = NULL;
+	}
+}
+
+#endif /* _WIN32 */
+
+	/** the take stopped, or can't be mapped any more: unmap it and cut
+		the file back to the end of the data, which plain writes go on
+		from */
+static void m5_mmap_end(t_m5MapOut *mo, t_soundfile *sf)
+{
+	if (!mo->mo_on)
+		return;
+	mo->mo_on = 0;
+#ifndef _WIN32
+	m5_mmap_sync(mo, 1);
+		/* the header is updated in place either way, so a file that
+		can't be cut back only keeps some zeros after its data */
+	if (ftruncate(sf->sf_fd, mo->mo_pos) < 0)
+		{}
+	lseek(sf->sf_fd, mo->mo_pos, SEEK_SET);
+#endif
+}
+
+	/** as m5_soundfile_write(), through the mapping while there is one */
+static ssize_t m5_mmap_write(t_m5MapOut *mo, t_soundfile *sf,
+	const char *src, size_t size)
+{
+	size_t done = 0;
+	ssize_t plain;
+#ifndef _WIN32
+	while (mo->mo_on && done < size)
+	{
+		off_t end = mo->mo_mapstart + M5_MMAP_EXTENT;
+		size_t n;
+		if (!mo->mo_map || mo->mo_pos >= end)
+		{
+			void *map;
+			m5_mmap_sync(mo, 1);
+			mo->mo_mapstart = mo->mo_pos - mo->mo_pos % M5_MMAP_EXTENT;
+			end = mo->mo_mapstart + M5_MMAP_EXTENT;
+			if ((mo->mo_alloc < end && posix_fallocate(sf->sf_fd,
+					mo->mo_alloc, end - mo->mo_alloc)) ||
+				(map = mmap(NULL, M5_MMAP_EXTENT, PROT_READ | PROT_WRITE,
+					MAP_SHARED, sf->sf_fd, mo->mo_mapstart)) == MAP_FAILED)
+			{
+				m5_mmap_end(mo, sf);
+				break;
+			}
+			if (mo->mo_alloc < end)
+				mo->mo_alloc = end;
+			mo->mo_map = (char *)map;
+		}
+		n = end - mo->mo_pos;
+		if (n > size - done)
+			n = size - done;
+		memcpy(mo->mo_map + (mo->mo_pos - mo->mo_mapstart), src + done, n);
+		mo->mo_pos += n;
+		done += n;
+		if (mo->mo_pos - mo->mo_synced >= M5_MMAP_SYNC)
+			m5_mmap_sync(mo, 0);
+	}
+#endif
+	if (done == size)
+		return done;
+	if ((plain = m5_soundfile_write(sf, src + done, size - done)) < 0)
+		return (done ? (ssize_t)done : -1);
+	return done + plain;
+}
+
 /* ----- the child thread which performs file I/O ----- */
 
 static void *m5_writesf_child_main(void *zz)
 {
 	t_writesf *x = zz;
+	t_m5SfLink *link = x->x_m5Link;
 	t_soundfile sf = {0};
+	uint32_t crc = 0; /* CRC-32C of the data written so far, for -checksum */
+	int checksum = 0;
+	const char *takename = 0; /* the file sf, once open */
+	t_m5MapOut mo = {0}; /* sf's mapping, for -mmap */
 	m5_soundfile_clear(&sf);
 #ifdef PDINSTANCE
 	pd_this = x->x_pd_this;
@@ -2542,7 +5627,7 @@ static void *m5_writesf_child_main(void *zz)
 #ifdef DEBUG_SOUNDFILE_THREADS
 	fprintf(stderr, "writesf~: 1\n");
 #endif
-	pthread_mutex_lock(&x->x_mutex);
+	x = m5_sf_childlock(link);
 	while (1)
 	{
 #ifdef DEBUG_SOUNDFILE_THREADS
@@ -2553,8 +5638,9 @@ static void *m5_writesf_child_main(void *zz)
 #ifdef DEBUG_SOUNDFILE_THREADS
 			fprintf(stderr, "writesf~: wait 2\n");
 #endif
-			sfread_cond_signal(&x->x_answercondition);
-			sfread_cond_wait(&x->x_requestcondition, &x->x_mutex);
+			m5_sf_reclaimformat(x);
+			sfread_cond_signal(x->x_answercondition);
+			x = m5_sf_childwait(link);
 #ifdef DEBUG_SOUNDFILE_THREADS
 			fprintf(stderr, "writesf~: 3\n");
 #endif
@@ -2565,10 +5651,11 @@ static void *m5_writesf_child_main(void *zz)
 			size_t writebytes;
 
 				/* copy file stuff out of the data structure so we can
-				relinquish the mutex while we're in open_soundfile_via_path() */
+				relinquish the mutex while we're in open_soundfile_via_path().
+				the canvas may be gone by the time the file is open. */
 			const char *filename = x->x_filename;
-			t_canvas *canvas = x->x_canvas;
-			m5_soundfile_copy(&sf, &x->x_sf);
+			char path[MAXPDSTRING];
+			canvas_makefilename(x->x_canvas, filename, path, MAXPDSTRING);
 
 				/* alter the request code so that an ensuing "open" will get
 				noticed. */
@@ -2576,36 +5663,30 @@ static void *m5_writesf_child_main(void *zz)
 			fprintf(stderr, "writesf~: 4\n");
 #endif
 			x->x_requestcode = REQUEST_BUSY;
-			x->x_fileerror = 0;
 
-				/* if there's already a file open, close it.  This
-				should never happen since writesf_open() calls stop if
-				needed and then waits until we're idle. */
+				/* a file still open here is the last take, which "open"
+				left to us and which is written out by now: finish it in
+				the background, and start the new take's data */
 			if (sf.sf_fd >= 0)
 			{
-				size_t frameswritten = x->x_frameswritten;
-
-				pthread_mutex_unlock(&x->x_mutex);
-				m5_soundfile_finishwrite(x, filename, &sf,
-					SFMAXFRAMES, frameswritten);
-				sys_close(sf.sf_fd);
-				sf.sf_fd = -1;
-				pthread_mutex_lock(&x->x_mutex);
-				x->x_sf.sf_fd = -1;
-#ifdef DEBUG_SOUNDFILE_THREADS
-				fprintf(stderr, "writesf~: bug? ditched %ld\n", frameswritten);
-#endif
-				if (x->x_requestcode != REQUEST_BUSY)
-					continue;
+				m5_mmap_end(&mo, &sf);
+				m5_writesf_handover(x, &sf, takename, x->x_frameswritten,
+					checksum, crc, 0);
+			}
+			if (x->x_m5TakeEnd >= 0)
+			{
+				x->x_fifotail = x->x_m5TakeStart;
+				x->x_m5TakeEnd = -1;
 			}
+			x->x_fileerror = 0;
 				/* cache sf *after* closing as x->sf's type
 					may have changed in writesf_open() */
 			m5_soundfile_copy(&sf, &x->x_sf);
 
 				/* open the soundfile with the mutex unlocked */
-			pthread_mutex_unlock(&x->x_mutex);
-			m5_create_soundfile(canvas, filename, &sf, 0);
-			pthread_mutex_lock(&x->x_mutex);
+			pthread_mutex_unlock(x->x_mutex);
+			m5_create_soundfile(0, path, &sf, 0);
+			x = m5_sf_childlock(link);
 
 #ifdef DEBUG_SOUNDFILE_THREADS
 			fprintf(stderr, "writesf~: 5\n");
@@ -2621,52 +5702,58 @@ static void *m5_writesf_child_main(void *zz)
 #endif
 				goto bail;
 			}
+			checksum = x->x_m5Checksum;
+			crc = 0;
+			takename = filename;
+			if (x->x_m5Mmap)
+				m5_mmap_begin(&mo, &sf);
+				/* copy back into the instance structure. */
+			m5_soundfile_copy(&x->x_sf, &sf);
+			x->x_frameswritten = 0;
+				/* readers may follow it from here */
+			x->x_m5LiveTake = m5_live_new(link, &sf);
 				/* check if another request has been made; if so, field it */
 			if (x->x_requestcode != REQUEST_BUSY)
 				continue;
 #ifdef DEBUG_SOUNDFILE_THREADS
 			fprintf(stderr, "writesf~: 6\n");
 #endif
-				/* copy back into the instance structure. */
-			m5_soundfile_copy(&x->x_sf, &sf);
-			x->x_fifotail = 0;
-			x->x_frameswritten = 0;
 				/* in a loop, wait for the fifo to have data and write it
 					to disk */
 			while (x->x_requestcode == REQUEST_BUSY ||
-				(x->x_requestcode == REQUEST_CLOSE &&
-					x->x_fifohead != x->x_fifotail))
+				(m5_writesf_draining(x) &&
+					m5_writesf_datalimit(x) != x->x_fifotail))
 			{
 				int fifosize = x->x_fifosize, fifotail;
+				int limit = m5_writesf_datalimit(x);
+				size_t writesize = m5_sf_iosize(x, sf.sf_bytesperframe);
 				char *buf = x->x_buf;
 #ifdef DEBUG_SOUNDFILE_THREADS
 				fprintf(stderr, "writesf~: 77\n");
 #endif
 					/* if the head is < the tail, we can immediately write
 					from tail to end of fifo to disk; otherwise we hold off
-					writing until there are at least WRITESIZE bytes in the
-					buffer */
-				if (x->x_fifohead < x->x_fifotail ||
-					x->x_fifohead >= x->x_fifotail + WRITESIZE
-					|| (x->x_requestcode == REQUEST_CLOSE &&
-						x->x_fifohead != x->x_fifotail))
+					writing until there are at least writesize bytes in the
+					buffer.  the head is the take's end if that's known. */
+				if (limit < x->x_fifotail ||
+					limit >= x->x_fifotail + (int)writesize
+					|| (m5_writesf_draining(x) && limit != x->x_fifotail))
 				{
-					writebytes = (x->x_fifohead < x->x_fifotail ?
-						fifosize : x->x_fifohead) - x->x_fifotail;
-					if (writebytes > READSIZE)
-						writebytes = READSIZE;
+					writebytes = (limit < x->x_fifotail ?
+						fifosize : limit) - x->x_fifotail;
+					if (writebytes > writesize)
+						writebytes = writesize;
 				}
 				else
 				{
 #ifdef DEBUG_SOUNDFILE_THREADS
 					fprintf(stderr, "writesf~: wait 7a...\n");
 #endif
-					sfread_cond_signal(&x->x_answercondition);
+					sfread_cond_signal(x->x_answercondition);
 #ifdef DEBUG_SOUNDFILE_THREADS
 					fprintf(stderr, "writesf~: signaled...\n");
 #endif
-					sfread_cond_wait(&x->x_requestcondition,
-						&x->x_mutex);
+					x = m5_sf_childwait(link);
 #ifdef DEBUG_SOUNDFILE_THREADS
 					fprintf(stderr, "writesf~: 7a ... done\n");
 #endif
@@ -2676,12 +5763,14 @@ static void *m5_writesf_child_main(void *zz)
 				fprintf(stderr, "writesf~: 8\n");
 #endif
 				fifotail = x->x_fifotail;
-				m5_soundfile_copy(&sf, &x->x_sf);
-				pthread_mutex_unlock(&x->x_mutex);
-				byteswritten = write(sf.sf_fd, buf + fifotail, writebytes);
-				pthread_mutex_lock(&x->x_mutex);
+				pthread_mutex_unlock(x->x_mutex);
+				byteswritten = m5_mmap_write(&mo, &sf, buf + fifotail,
+					writebytes);
+				if (checksum && byteswritten > 0)
+					crc = m5_crc32c(crc, buf + fifotail, byteswritten);
+				x = m5_sf_childlock(link);
 				if (x->x_requestcode != REQUEST_BUSY &&
-					x->x_requestcode != REQUEST_CLOSE)
+					!m5_writesf_draining(x))
 						break;
 				if (byteswritten < 0 || (size_t)byteswritten < writebytes)
 				{
@@ -2705,51 +5794,88 @@ static void *m5_writesf_child_main(void *zz)
 						x->x_fifotail = 0;
 				}
 				x->x_frameswritten += byteswritten / sf.sf_bytesperframe;
+				x->x_m5IoBytes += byteswritten;
 #ifdef DEBUG_SOUNDFILE_THREADS
 				fprintf(stderr, "writesf~: after head %d tail %d written %ld\n",
 					x->x_fifohead, x->x_fifotail, x->x_frameswritten);
 #endif
 					/* signal parent in case it's waiting for data */
-				sfread_cond_signal(&x->x_answercondition);
+				sfread_cond_signal(x->x_answercondition);
 				continue;
 
 			 bail:
+					 /* a take "open" left to us: drop the rest of it,
+					 finish what's there and go on with the new one */
+				 if (x->x_m5TakeEnd >= 0)
+				 {
+					 x->x_fifotail = x->x_m5TakeEnd;
+					 m5_mmap_end(&mo, &sf);
+					 if (sf.sf_fd >= 0)
+						 m5_writesf_handover(x, &sf, takename,
+							 x->x_frameswritten, checksum, crc,
+							 (x->x_fileerror ? x->x_fileerror : EIO));
+					 x->x_fileerror = 0;
+					 sfread_cond_signal(x->x_answercondition);
+					 continue;
+				 }
 				 if (x->x_requestcode == REQUEST_BUSY)
 					 x->x_requestcode = REQUEST_NOTHING;
 					 /* hit an error; close file if necessary,
 					 set EOF and signal once more */
 				 if (sf.sf_fd >= 0)
 				 {
-					 pthread_mutex_unlock(&x->x_mutex);
-					 sys_close(sf.sf_fd);
-					 sf.sf_fd = -1;
-					 pthread_mutex_lock(&x->x_mutex);
+					 t_m5Live *live = x->x_m5LiveTake;
+					 m5_live_end(x, x->x_frameswritten);
+					 pthread_mutex_unlock(x->x_mutex);
+					 m5_mmap_end(&mo, &sf);
+					 m5_soundfile_close(&sf);
+					 m5_live_unlist(live);
+					 x = m5_sf_childlock(link);
 					 x->x_eof = 1;
 					 x->x_sf.sf_fd = -1;
+					 x->x_sf.sf_encoder = NULL;
 				 }
-				 sfread_cond_signal(&x->x_answercondition);
+				 sfread_cond_signal(x->x_answercondition);
 			}
 		}
 		else if (x->x_requestcode == REQUEST_CLOSE ||
 			x->x_requestcode == REQUEST_QUIT)
 		{
 			int quit = (x->x_requestcode == REQUEST_QUIT);
-			if (sf.sf_fd >= 0)
+			size_t frameswritten = x->x_frameswritten;
+				/* the object is going away: finish the file here */
+			if (sf.sf_fd >= 0 && quit)
 			{
-				const char *filename = x->x_filename;
-				size_t frameswritten = x->x_frameswritten;
-				m5_soundfile_copy(&sf, &x->x_sf);
-				pthread_mutex_unlock(&x->x_mutex);
-				m5_soundfile_finishwrite(x, filename, &sf,
+				t_m5Live *live = x->x_m5LiveTake;
+				m5_live_end(x, frameswritten);
+				pthread_mutex_unlock(x->x_mutex);
+				m5_mmap_end(&mo, &sf);
+				m5_soundfile_finishwrite(0, takename, &sf,
 					SFMAXFRAMES, frameswritten);
-				sys_close(sf.sf_fd);
-				sf.sf_fd = -1;
-				pthread_mutex_lock(&x->x_mutex);
+				if (checksum)
+					m5_soundfile_finishchecksum(0, takename, &sf,
+						frameswritten, crc);
+				m5_soundfile_close(&sf);
+				m5_live_unlist(live);
+				x = m5_sf_childlock(link);
 				x->x_sf.sf_fd = -1;
+				x->x_sf.sf_encoder = NULL;
+			}
+			else if (sf.sf_fd >= 0)
+			{
+				m5_mmap_end(&mo, &sf);
+				m5_writesf_handover(x, &sf, takename, frameswritten,
+					checksum, crc, 0);
+			}
+				/* a take opened after it never got its file */
+			if (x->x_m5TakeEnd >= 0)
+			{
+				x->x_fifotail = x->x_fifohead;
+				x->x_m5TakeEnd = -1;
 			}
 			x->x_requestcode = REQUEST_NOTHING;
 			x->x_m5FramesWrittenReport = x->x_frameswritten;
-			sfread_cond_signal(&x->x_answercondition);
+			sfread_cond_signal(x->x_answercondition);
 			if (quit)
 				break;
 		}
@@ -2763,7 +5889,7 @@ static void *m5_writesf_child_main(void *zz)
 #ifdef DEBUG_SOUNDFILE_THREADS
 	fprintf(stderr, "writesf~: thread exit\n");
 #endif
-	pthread_mutex_unlock(&x->x_mutex);
+	m5_sf_reap(link);
 	return 0;
 }
 
@@ -2777,6 +5903,38 @@ static void m5_writesf_frame_out_tick(t_writesf *x)
 	m5_frame_time_code_out(&ftc, x->x_m5listOut);
 }
 
+	/** report the takes whose files are finished, in order, and look
+		again later while there are more */
+static void m5_writesf_take_tick(t_writesf *x)
+{
+	t_m5Job *done = NULL, **dp = &done, *j;
+	int more;
+	pthread_mutex_lock(x->x_mutex);
+	pthread_mutex_lock(&m5_job_mutex);
+	while ((j = x->x_m5Takes) && j->j_result != JOB_PENDING)
+	{
+		x->x_m5Takes = j->j_next;
+		j->j_next = NULL;
+		*dp = j;
+		dp = &j->j_next;
+	}
+	pthread_mutex_unlock(&m5_job_mutex);
+	more = (x->x_m5Takes || x->x_m5TakeEnd >= 0);
+	pthread_mutex_unlock(x->x_mutex);
+	if (more)
+		clock_delay(x->x_m5TakeClock, JOBPOLL);
+	while ((j = done))
+	{
+		done = j->j_next;
+		if (j->j_result != JOB_OK)
+			pd_error(x, "[writesf~] %s: %s", j->j_path, j->j_why);
+		x->x_m5SoundFileFramesAvailableFromOnset =
+			((t_m5Take *)j->j_data)->t_frames;
+		m5_job_release(j);
+		m5_writesf_frame_out_tick(x);
+	}
+}
+
 static void m5_writesf_start_time_tick(t_writesf *x)
 {
 	t_m5FrameTimeCode ftc;
@@ -2784,12 +5942,16 @@ static void m5_writesf_start_time_tick(t_writesf *x)
 	m5_frame_time_code_out(&ftc, x->x_m5startListOut);
 }
 
-static void *m5_writesf_new(t_floatarg fnchannels, t_floatarg fbufsize)
+static void *m5_writesf_new(t_symbol *s, int argc, t_atom *argv)
 {
 	t_writesf *x;
-	int nchannels = fnchannels, bufsize = fbufsize, i;
+	int nchannels, bufsize, multi, i;
 	char *buf;
+	t_m5SfLink *link;
 
+	if (!m5_sf_parsenew("[writesf~]", argc, argv, &multi, &nchannels,
+		&bufsize, NULL))
+		return 0;
 	if (nchannels < 1)
 		nchannels = 1;
 	else if (nchannels > MAXSFCHANS)
@@ -2801,17 +5963,33 @@ static void *m5_writesf_new(t_floatarg fnchannels, t_floatarg fbufsize)
 		bufsize = MAXBUFSIZE;
 	buf = getbytes(bufsize);
 	if (!buf) return 0;
+	if (!(link = m5_sf_newlink()))
+	{
+		freebytes(buf, bufsize);
+		return 0;
+	}
 
 	x = (t_writesf *)pd_new(m5_writesf_class);
 
-	for (i = 1; i < nchannels; i++)
+	x->x_m5Multi = multi;
+	x->x_m5Lookahead = 0;
+	x->x_m5ZeroVec = 0;
+	x->x_m5ZeroVecSize = 0;
+	x->x_m5Checksum = 0;
+	x->x_m5Mmap = 0;
+	x->x_m5TakeEnd = -1;
+	x->x_m5TakeStart = 0;
+	x->x_m5Takes = NULL;
+	x->x_m5LiveTake = NULL;
+	x->x_m5Format = x->x_m5FormatPending = x->x_m5FormatRetired = NULL;
+	for (i = 1; i < (multi ? 1 : nchannels); i++)
 		inlet_new(&x->x_obj,  &x->x_obj.ob_pd, &s_signal, &s_signal);
 
 	x->x_f = 0;
-	pthread_mutex_init(&x->x_mutex, 0);
-	pthread_cond_init(&x->x_requestcondition, 0);
-	pthread_cond_init(&x->x_answercondition, 0);
-	x->x_vecsize = MAXVECSIZE;
+	m5_sf_attachlink(x, link);
+	x->x_vecsize = x->x_m5Hop = MAXVECSIZE;
+	x->x_m5LastLogicalTime = -1;
+	x->x_m5SubBlockTime = 0;
 	x->x_insamplerate = 0;
 	x->x_state = STATE_IDLE;
 	x->x_canvas = canvas_getcurrent();
@@ -2830,6 +6008,8 @@ static void *m5_writesf_new(t_floatarg fnchannels, t_floatarg fbufsize)
 	
 	x->x_m5HeadTimeRequest = 0;
 	x->x_m5TailTime = 0;
+	x->x_m5Refilling = 0;
+	x->x_m5RefillLead = -1;
 	x->x_m5TimeAnchorName = 0;
 	x->x_m5TimeAnchor = 0;
 	x->x_m5LocalTimeAnchor = 0;
@@ -2840,6 +6020,7 @@ static void *m5_writesf_new(t_floatarg fnchannels, t_floatarg fbufsize)
 	
 	x->x_m5FramesOutClock = clock_new(x, (t_method)m5_writesf_frame_out_tick);
 	x->x_m5StartTimeOutClock = clock_new(x, (t_method)m5_writesf_start_time_tick);
+	x->x_m5TakeClock = clock_new(x, (t_method)m5_writesf_take_tick);
 	
 	x->x_m5startListOut = outlet_new(&x->x_obj, &s_anything);
 	x->x_m5listOut = outlet_new(&x->x_obj, &s_anything);
@@ -2847,6 +6028,7 @@ static void *m5_writesf_new(t_floatarg fnchannels, t_floatarg fbufsize)
 #ifdef PDINSTANCE
 	x->x_pd_this = pd_this;
 #endif
+	m5_sf_register(x);
 	pthread_create(&x->x_childthread, 0, m5_writesf_child_main, x);
 	return x;
 }
@@ -2854,35 +6036,31 @@ static void *m5_writesf_new(t_floatarg fnchannels, t_floatarg fbufsize)
 static t_int *m5_writesf_perform(t_int *w)
 {
 	t_writesf *x = (t_writesf *)(w[1]);
+	m5_sf_subblock(x);
 	if (x->x_state == STATE_STREAM || x->x_state == STATE_STREAM_JUST_STARTING)
 	{
 		size_t roominfifo;
 		size_t wantbytes;
-		int vecsize = x->x_vecsize;
+		// record one hop per call: the whole vector, except in an
+		// overlapping block~ where only its last hop is new, the rest
+		// having been recorded by earlier calls
+		int vecsize = x->x_m5Hop, hopstart = x->x_vecsize - x->x_m5Hop;
 		
 		// tail push is used to copy incoming bytes to FIFO , but prevent
 		// child process from writing them, in case we want to retroactively
 		// start recording 'in the past'
 		int tailpush = 0;
 
-		t_soundfile sf = {0};
-		pthread_mutex_lock(&x->x_mutex);
-			/* copy with mutex locked! */
-		m5_soundfile_copy(&sf, &x->x_sf);
-		
-		size_t blockStartTime = 0; // frame count since time anchor
-		if (x->x_m5TimeAnchor) 
-		{
-			// shared time anchor
-			blockStartTime = m5_time_anchor_get_time_since_start(x->x_m5TimeAnchor);
-		} 
-		else 
+		const t_m5SoundFormat *fmt;
+		pthread_mutex_lock(x->x_mutex);
+			/* the format is immutable, so there's nothing to copy */
+		if (!(fmt = m5_sf_currentformat(x)))
 		{
-			// local clock for this object
-			double d =  ceil(clock_gettimesincewithunits(x->x_m5LocalTimeAnchor, 1, 1));
-			if (d < 0.){d = 0.;}
-			blockStartTime = (size_t)d;
+			pthread_mutex_unlock(x->x_mutex);
+			return w + 2;
 		}
+		
+		size_t blockStartTime = m5_readsf_blocktime(x); // frame count since time anchor
 		if (x->x_m5PlayStartTime == START_NOW)  
 		{
 			x->x_m5PlayStartTime = blockStartTime;
@@ -2894,12 +6072,17 @@ static t_int *m5_writesf_perform(t_int *w)
 			// do threshold detect if necessary
 			t_sample the_threshold = x->x_m5PlayStartThreshold;
 			
-			pthread_mutex_unlock(&x->x_mutex);
+			pthread_mutex_unlock(x->x_mutex);
 			int started = NOT_FOUND;
-			started = m5_find_threshold(sf.sf_nchannels, vecsize,  x->x_outvec, the_threshold);
-			pthread_mutex_lock(&x->x_mutex);
+			started = m5_find_threshold(fmt->f_sf.sf_nchannels, hopstart, vecsize,  x->x_outvec, the_threshold);
+			pthread_mutex_lock(x->x_mutex);
 			
-			m5_soundfile_copy(&sf, &x->x_sf);			
+			/* the format is immutable, no need to copy it */
+			if (!(fmt = m5_sf_currentformat(x)))
+			{
+				pthread_mutex_unlock(x->x_mutex);
+				return w + 2;
+			}
 			if (started != NOT_FOUND) 
 			{
 				// get the start time, can subtract some extra frames here if needed to record the threshold onset
@@ -2911,7 +6094,7 @@ static t_int *m5_writesf_perform(t_int *w)
 		char is_finished = 0;
 		int vecstart = 0;
 		int overdue = 0;
-		if (blockStartTime + (size_t)vecsize > (size_t)x->x_m5PlayEndTime)
+		if ((double)(blockStartTime + vecsize) > x->x_m5PlayEndTime)
 		{
 			is_finished = 1;
 			ssize_t xfersize = (ssize_t)x->x_m5PlayEndTime - (ssize_t)blockStartTime;
@@ -2923,14 +6106,14 @@ static t_int *m5_writesf_perform(t_int *w)
 			
 		} 
 		// note: always true if x_m5PlayStartTime = START_AT_THRESHOLD
-		else if (blockStartTime <= (size_t)x->x_m5PlayStartTime)
+		else if ((double)blockStartTime <= x->x_m5PlayStartTime)
 		{
 			if (blockStartTime + (size_t)vecsize > x->x_m5PlayStartTime)
 			{	
 				// partial vector, scheduled to start recording during this block			
 				vecstart = (size_t)x->x_m5PlayStartTime - blockStartTime;
-				// realign the tail and head so that the head ends up one full vecsize from the beginning
-				x->x_fifotail = x->x_fifohead = vecstart * sf.sf_bytesperframe;
+				// drop anything pushed so far; recording starts at vecstart
+				*m5_writesf_taketail(x) = x->x_fifohead;
 				vecsize -= vecstart;
 				
 				x->x_m5WriteStartTimeReport = x->x_m5PlayStartTime;
@@ -2946,12 +6129,12 @@ static t_int *m5_writesf_perform(t_int *w)
 			// write start time is in the past but we haven't started recording yet
 			
 			// get how many bytes before now that we need to actually keep
-			int overdueBytes = overdue * sf.sf_bytesperframe;
+			int overdueBytes = overdue * fmt->f_sf.sf_bytesperframe;
 			
 			// can't go back further than the buffer can store
 			if (overdueBytes >= x->x_fifosize) {
 				// one frame less than fifosize so head and tail don't exactly line up again (which would prevent child process from writing)
-				overdueBytes = x->x_fifosize - (1 * sf.sf_bytesperframe); 				
+				overdueBytes = x->x_fifosize - (1 * fmt->f_sf.sf_bytesperframe); 				
 			}
 			
 			// can't go back further than we've actually received
@@ -2963,29 +6146,32 @@ static t_int *m5_writesf_perform(t_int *w)
 			
 			// move the tail back to a position away from head,
 			// child process will start moving bytes from FIFO to disk
-			x->x_fifotail -= overdueBytes;
-			if (x->x_fifotail < 0)
+			int *taketail = m5_writesf_taketail(x);
+			*taketail -= overdueBytes;
+			if (*taketail < 0)
 			{
-				x->x_fifotail = x->x_fifosize + x->x_fifotail;
+				*taketail = x->x_fifosize + *taketail;
 			}
-			int actualFrames = overdueBytes /  sf.sf_bytesperframe;
+			int actualFrames = overdueBytes /  fmt->f_sf.sf_bytesperframe;
 			int difff = overdue - actualFrames;
 			// will output the time we actually started saving frames
 			x->x_m5WriteStartTimeReport = x->x_m5PlayStartTime + difff;
 			
 		}
-		wantbytes = vecsize * sf.sf_bytesperframe;
+		wantbytes = vecsize * fmt->f_sf.sf_bytesperframe;
 		roominfifo = x->x_fifotail - x->x_fifohead;
 		if (roominfifo <= 0)
 			roominfifo += x->x_fifosize;
+		if (!x->x_eof && roominfifo < wantbytes + 1)
+			x->x_m5Underruns++;
 		while (!x->x_eof && roominfifo < wantbytes + 1)
 		{
 			fprintf(stderr, "writesf waiting for disk write..\n");
 			fprintf(stderr, "(head %d, tail %d, room %d, want %ld)\n",
 				(int)x->x_fifohead, (int)x->x_fifotail,
 				(int)roominfifo, (long)wantbytes);
-			sfread_cond_signal(&x->x_requestcondition);
-			sfread_cond_wait(&x->x_answercondition, &x->x_mutex);
+			sfread_cond_signal(x->x_requestcondition);
+			sfread_cond_wait(x->x_answercondition, x->x_mutex);
 			fprintf(stderr, "... done waiting.\n");
 			roominfifo = x->x_fifotail - x->x_fifohead;
 			if (roominfifo <= 0)
@@ -2997,27 +6183,24 @@ static t_int *m5_writesf_perform(t_int *w)
 				m5_object_sferror(x, "[writesf~]", x->x_filename,
 					x->x_fileerror, &x->x_sf);
 			x->x_state = STATE_IDLE;
-			sfread_cond_signal(&x->x_requestcondition);
-			pthread_mutex_unlock(&x->x_mutex);
+			sfread_cond_signal(x->x_requestcondition);
+			pthread_mutex_unlock(x->x_mutex);
 			return w + 2;
 		}
 
 		
-		m5_soundfile_xferout_sample(&sf, x->x_outvec,
-			(unsigned char *)(x->x_buf + x->x_fifohead), vecsize, 0, 1.);
+		m5_writesf_xferout_fifo(x, fmt, x->x_outvec, hopstart + vecstart,
+			x->x_fifohead, vecsize);
 		
 		// there are bytes in fifo that actually came from the inlet	
 		x->x_m5PerformedFifoSize += wantbytes;
 		if (x->x_m5PerformedFifoSize > x->x_fifosize)
 			x->x_m5PerformedFifoSize = x->x_fifosize;
 		
-		x->x_fifohead += wantbytes;
-
-		if (x->x_fifohead >= x->x_fifosize)
-			x->x_fifohead = 0;
+		x->x_fifohead = (x->x_fifohead + wantbytes) % x->x_fifosize;
 		
 		if (tailpush)
-			x->x_fifotail = x->x_fifohead;
+			*m5_writesf_taketail(x) = x->x_fifohead;
 		
 		else if (x->x_state == STATE_STREAM_JUST_STARTING && vecsize > 0) {
 			x->x_state = STATE_STREAM;
@@ -3027,29 +6210,30 @@ static t_int *m5_writesf_perform(t_int *w)
 		{
 			x->x_state = STATE_IDLE_2;
 			x->x_requestcode = REQUEST_CLOSE;
-			sfread_cond_signal(&x->x_requestcondition);	
+			sfread_cond_signal(x->x_requestcondition);	
 		}
 		else if ((--x->x_sigcountdown) <= 0)
 		{
 #ifdef DEBUG_SOUNDFILE_THREADS
 			fprintf(stderr, "writesf~: signal 1\n");
 #endif
-			sfread_cond_signal(&x->x_requestcondition);
+			sfread_cond_signal(x->x_requestcondition);
 			x->x_sigcountdown = x->x_sigperiod;
 		}
-		pthread_mutex_unlock(&x->x_mutex);
+		pthread_mutex_unlock(x->x_mutex);
 	}
 	else if (x->x_state == STATE_IDLE_2)
 	{
-		pthread_mutex_lock(&x->x_mutex);
+		pthread_mutex_lock(x->x_mutex);
 		if (x->x_m5FramesWrittenReport != FRAMES_NOT_UPDATED) 
 		{
-			x->x_m5SoundFileFramesAvailableFromOnset = x->x_m5FramesWrittenReport;
+			// the child handed the file over; its length goes out
+			// once it's finished
 			x->x_m5FramesWrittenReport = 0;
-			clock_delay(x->x_m5FramesOutClock, 0);
+			clock_delay(x->x_m5TakeClock, 0);
 			x->x_state = STATE_IDLE;
 		}
-		pthread_mutex_unlock(&x->x_mutex);
+		pthread_mutex_unlock(x->x_mutex);
 	}
 	return w + 2;
 }
@@ -3066,22 +6250,22 @@ static void m5_writesf_start(t_writesf *x, t_symbol *s, int argc, t_atom *argv)
 	}
 	if (argc == 0)
 	{
-		pthread_mutex_lock(&x->x_mutex);		
+		pthread_mutex_lock(x->x_mutex);		
 		x->x_state = STATE_STREAM_JUST_STARTING;
 		x->x_m5PlayStartTime = START_NOW;
-		x->x_m5LocalTimeAnchor = clock_getlogicaltime();
-		sfread_cond_signal(&x->x_requestcondition);
-		pthread_mutex_unlock(&x->x_mutex);
+		x->x_m5LocalTimeAnchor = m5_clock_logicaltime();
+		sfread_cond_signal(x->x_requestcondition);
+		pthread_mutex_unlock(x->x_mutex);
 		return;
 	} else if (argc == 1)
 	{
 		x->x_m5PlayStartThreshold = atom_getfloatarg(0, argc, argv);
-		pthread_mutex_lock(&x->x_mutex);	
+		pthread_mutex_lock(x->x_mutex);	
 		x->x_state = STATE_STREAM_JUST_STARTING;
 		x->x_m5PlayStartTime = START_AT_THRESHOLD;
-		x->x_m5LocalTimeAnchor = clock_getlogicaltime();
-		sfread_cond_signal(&x->x_requestcondition);
-		pthread_mutex_unlock(&x->x_mutex);
+		x->x_m5LocalTimeAnchor = m5_clock_logicaltime();
+		sfread_cond_signal(x->x_requestcondition);
+		pthread_mutex_unlock(x->x_mutex);
 		return;
 	}
 	if (m5_frame_time_code_from_atoms(argc, argv, &ftc)) {
@@ -3093,12 +6277,12 @@ static void m5_writesf_start(t_writesf *x, t_symbol *s, int argc, t_atom *argv)
 		pd_error (x,"m5_writesf~: start time must be >= 0 frames.");
 		return;
 	}
-	pthread_mutex_lock(&x->x_mutex);	
+	pthread_mutex_lock(x->x_mutex);	
 	x->x_state = STATE_STREAM_JUST_STARTING;
 	x->x_m5PlayStartTime = (double)ll;
-	x->x_m5LocalTimeAnchor = clock_getlogicaltime();
-	sfread_cond_signal(&x->x_requestcondition);
-	pthread_mutex_unlock(&x->x_mutex);
+	x->x_m5LocalTimeAnchor = m5_clock_logicaltime();
+	sfread_cond_signal(x->x_requestcondition);
+	pthread_mutex_unlock(x->x_mutex);
 	
 
 }
@@ -3113,11 +6297,11 @@ static void m5_writesf_stop(t_writesf *x, t_symbol *s, int argc, t_atom *argv)
 		return;
 	}
 	if (argc == 0) {
-		pthread_mutex_lock(&x->x_mutex);
+		pthread_mutex_lock(x->x_mutex);
 		x->x_state = STATE_IDLE_2;
 		x->x_requestcode = REQUEST_CLOSE;
-		sfread_cond_signal(&x->x_requestcondition);
-		pthread_mutex_unlock(&x->x_mutex);
+		sfread_cond_signal(x->x_requestcondition);
+		pthread_mutex_unlock(x->x_mutex);
 		return;
 	}
 	if (m5_frame_time_code_from_atoms(argc, argv, &ftc)) {
@@ -3129,10 +6313,10 @@ static void m5_writesf_stop(t_writesf *x, t_symbol *s, int argc, t_atom *argv)
 		pd_error (x,"m5_writesf~: end time must be >= 0 frames.");
 		return;
 	}
-	pthread_mutex_lock(&x->x_mutex);
+	pthread_mutex_lock(x->x_mutex);
 	x->x_m5PlayEndTime = (double)ll;
-	sfread_cond_signal(&x->x_requestcondition);
-	pthread_mutex_unlock(&x->x_mutex);
+	sfread_cond_signal(x->x_requestcondition);
+	pthread_mutex_unlock(x->x_mutex);
 }
 
 static void m5_writesf_time_set(t_writesf *x, t_symbol *s)
@@ -3170,24 +6354,45 @@ static void m5_writesf_time(t_writesf *x, t_symbol *name)
 static void m5_writesf_open(t_writesf *x, t_symbol *s, int argc, t_atom *argv)
 {
 	t_soundfiler_writeargs wa = {0};
+	int bytespersample, leave;
 	if (x->x_state != STATE_IDLE)
 		m5_writesf_stop(x, 0, 0, 0);
 	if (m5_soundfiler_parsewriteargs(x, &argc, &argv, &wa) || wa.wa_ascii)
 	{
 		pd_error(x, "[writesf~]: usage; open [flags] filename...");
-		post("flags: -bytes <n> %s -big -little -rate <n>", m5_sf_typeargs);
+		post("flags: -bytes <n> %s -big -little -rate <n> -checksum -mmap",
+			m5_sf_typeargs);
 		return;
 	}
 	if (wa.wa_normalize || wa.wa_onsetframes || (wa.wa_nframes != SFMAXFRAMES))
 		pd_error(x, "[writesf~] open: normalize/onset/nframes argument ignored");
 	if (argc)
 		pd_error(x, "[writesf~] open: extra argument(s) ignored");
-	pthread_mutex_lock(&x->x_mutex);
-		/* make sure that the child thread has finished writing */
-	while (x->x_requestcode != REQUEST_NOTHING)
+	bytespersample = (wa.wa_bytespersample > 2 ? wa.wa_bytespersample : 2);
+	pthread_mutex_lock(x->x_mutex);
+		/* if the child is still writing the last take, leave that to it
+		and put this one after it in the fifo (see "finishing takes").
+		the fifo's layout depends on the frame size, so for another
+		sample size, wait until the child has finished writing. */
+	leave = (x->x_requestcode != REQUEST_NOTHING &&
+		bytespersample == x->x_sf.sf_bytespersample);
+	while (!leave && x->x_requestcode != REQUEST_NOTHING)
+	{
+		sfread_cond_signal(x->x_requestcondition);
+		sfread_cond_wait(x->x_answercondition, x->x_mutex);
+	}
+	if (leave)
+	{
+		if (x->x_m5TakeEnd < 0)
+			x->x_m5TakeEnd = x->x_fifohead;
+		x->x_m5TakeStart = x->x_fifohead;
+		clock_delay(x->x_m5TakeClock, JOBPOLL);
+	}
+	else
 	{
-		sfread_cond_signal(&x->x_requestcondition);
-		sfread_cond_wait(&x->x_answercondition, &x->x_mutex);
+		x->x_fifotail = 0;
+		x->x_fifohead = 0;
+		x->x_frameswritten = 0;
 	}
 	x->x_filename = wa.wa_filesym->s_name;
 	x->x_sf.sf_type = wa.wa_type;
@@ -3196,14 +6401,26 @@ static void m5_writesf_open(t_writesf *x, t_symbol *s, int argc, t_atom *argv)
 	else if (x->x_insamplerate > 0)
 		x->x_sf.sf_samplerate = x->x_insamplerate;
 	else x->x_sf.sf_samplerate = sys_getsr();
-	x->x_sf.sf_bytespersample =
-		(wa.wa_bytespersample > 2 ? wa.wa_bytespersample : 2);
+	x->x_sf.sf_bytespersample = bytespersample;
 	x->x_sf.sf_bigendian = wa.wa_bigendian;
 	x->x_sf.sf_bytesperframe = x->x_sf.sf_nchannels * x->x_sf.sf_bytespersample;
-	x->x_frameswritten = 0;
+		/* the child is idle and the fifo empty, so the buffer can grow for
+		a block size it was too small for */
+	if (!leave && !m5_sf_growbuffer(x,
+		m5_sf_fifoneed(x, x->x_sf.sf_bytesperframe)))
+		pd_error(x, "[writesf~]: buffer too small for block size %d",
+			x->x_vecsize);
+	x->x_m5Checksum = wa.wa_checksum;
+	x->x_m5Mmap = wa.wa_mmap;
+#ifdef _WIN32
+	if (wa.wa_mmap)
+		post("[writesf~] -mmap: not supported here, writing plainly");
+#else
+	if (wa.wa_mmap && wa.wa_type->t_encodefn)
+		post("[writesf~] -mmap: %s files are written plainly",
+			wa.wa_type->t_name);
+#endif
 	x->x_requestcode = REQUEST_OPEN;
-	x->x_fifotail = 0;
-	x->x_fifohead = 0;
 	x->x_eof = 0;
 	x->x_fileerror = 0;
 	x->x_state = STATE_STARTUP;
@@ -3215,31 +6432,52 @@ static void m5_writesf_open(t_writesf *x, t_symbol *s, int argc, t_atom *argv)
 	x->x_m5PerformedFifoSize = 0;
 	
 		/* set fifosize from bufsize.  fifosize must be a
-		multiple of the number of bytes eaten for each DSP
-		tick.  */
+		multiple of the frame size; transfers are split where
+		the fifo wraps. */
 	x->x_fifosize = x->x_bufsize - (x->x_bufsize %
-		(x->x_sf.sf_bytesperframe * MAXVECSIZE));
+		x->x_sf.sf_bytesperframe);
 		/* arrange for the "request" condition to be signaled 16
 			times per buffer */
-	x->x_sigcountdown = x->x_sigperiod = (x->x_fifosize /
-			(16 * (x->x_sf.sf_bytesperframe * x->x_vecsize)));
-	sfread_cond_signal(&x->x_requestcondition);
-	pthread_mutex_unlock(&x->x_mutex);
+	x->x_sigcountdown = x->x_sigperiod =
+		m5_sf_sigperiod(x, x->x_sf.sf_bytesperframe);
+	m5_sf_publishformat(x, &x->x_sf);
+	sfread_cond_signal(x->x_requestcondition);
+	pthread_mutex_unlock(x->x_mutex);
 }
 
 static void m5_writesf_dsp(t_writesf *x, t_signal **sp)
 {
 	m5_writesf_time_set(x, x->x_m5TimeAnchorName);
 	int i, ninlets = x->x_sf.sf_nchannels;
-	pthread_mutex_lock(&x->x_mutex);
+	pthread_mutex_lock(x->x_mutex);
 	x->x_vecsize = sp[0]->s_n;
-	x->x_sigperiod = (x->x_fifosize /
-			(16 * x->x_sf.sf_bytesperframe * x->x_vecsize));
+	x->x_m5Hop = m5_sf_gethop(sp[0]);
+	m5_sf_fitbuffer(x, ninlets, "[writesf~]");
+	x->x_sigperiod = m5_sf_sigperiod(x, x->x_sf.sf_bytesperframe);
+#ifdef CLASS_MULTICHANNEL
+	if (x->x_m5Multi)
+	{
+			/* channels the input doesn't have are recorded as silence */
+		if (x->x_m5ZeroVecSize < x->x_vecsize)
+		{
+			x->x_m5ZeroVec = (t_sample *)resizebytes(x->x_m5ZeroVec,
+				x->x_m5ZeroVecSize * sizeof(t_sample),
+				x->x_vecsize * sizeof(t_sample));
+			x->x_m5ZeroVecSize = x->x_vecsize;
+		}
+		memset(x->x_m5ZeroVec, 0, x->x_vecsize * sizeof(t_sample));
+		for (i = 0; i < ninlets; i++)
+			x->x_outvec[i] = (i < sp[0]->s_nchans ?
+				sp[0]->s_vec + i * x->x_vecsize : x->x_m5ZeroVec);
+	}
+	else
+#endif
 	for (i = 0; i < ninlets; i++)
 		x->x_outvec[i] = sp[i]->s_vec;
-	x->x_insamplerate = sp[0]->s_sr;
-	pthread_mutex_unlock(&x->x_mutex);
-	dsp_add(m5_writesf_perform, 1, x);
+		/* one hop of each block is recorded, so that's the file's rate */
+	x->x_insamplerate = sp[0]->s_sr * x->x_m5Hop / x->x_vecsize;
+	pthread_mutex_unlock(x->x_mutex);
+	dsp_add(m5_sf_timedperform, 2, m5_writesf_perform, x);
 }
 
 static void m5_writesf_print(t_writesf *x)
@@ -3250,50 +6488,33 @@ static void m5_writesf_print(t_writesf *x)
 	post("fifo size %d", x->x_fifosize);
 	post("fd %d", x->x_sf.sf_fd);
 	post("eof %d", x->x_eof);
-	post ("start time %d", (size_t)x->x_m5PlayStartTime);
-	post ("end time %d", (size_t)x->x_m5PlayEndTime);
-	post ("length %d", (size_t)x->x_m5PlayEndTime - (size_t)x->x_m5PlayStartTime);
+	post ("start time %g", x->x_m5PlayStartTime);
+	post ("end time %g", x->x_m5PlayEndTime);
+	post ("length %g", x->x_m5PlayEndTime - x->x_m5PlayStartTime);
 }
 
-	/** request QUIT and wait for acknowledge */
+	/** drop what only the object uses and leave the rest to the child,
+		without waiting for it: an open take is finished in the background */
 static void m5_writesf_free(t_writesf *x)
 {
-	void *threadrtn;
-	pthread_mutex_lock(&x->x_mutex);
-	x->x_requestcode = REQUEST_QUIT;
 #ifdef DEBUG_SOUNDFILE_THREADS
 	fprintf(stderr, "writesf~: stopping thread...\n");
 #endif
-	sfread_cond_signal(&x->x_requestcondition);
-	while (x->x_requestcode != REQUEST_NOTHING)
-	{
-#ifdef DEBUG_SOUNDFILE_THREADS
-		fprintf(stderr, "writesf~: signaling...\n");
-#endif
-		sfread_cond_signal(&x->x_requestcondition);
-		sfread_cond_wait(&x->x_answercondition, &x->x_mutex);
-	}
-	pthread_mutex_unlock(&x->x_mutex);
-	if (pthread_join(x->x_childthread, &threadrtn))
-		pd_error(x, "[writesf~] free: join failed");
-#ifdef DEBUG_SOUNDFILE_THREADS
-	fprintf(stderr, "writesf~: ... done\n");
-#endif
-
-	pthread_cond_destroy(&x->x_requestcondition);
-	pthread_cond_destroy(&x->x_answercondition);
-	pthread_mutex_destroy(&x->x_mutex);
-	freebytes(x->x_buf, x->x_bufsize);
 	// clock_free(x->x_clock);
 	clock_free(x->x_m5FramesOutClock);
 	clock_free(x->x_m5StartTimeOutClock);
+	clock_free(x->x_m5TakeClock);
+	if (x->x_m5ZeroVec)
+		freebytes(x->x_m5ZeroVec, x->x_m5ZeroVecSize * sizeof(t_sample));
+	m5_sf_unregister(x);
+	m5_sf_handoff(x);
 }
 
 static void m5_writesf_setup(void)
 {
 	m5_writesf_class = class_new(gensym("m5_writesf~"),
 		(t_newmethod)m5_writesf_new, (t_method)m5_writesf_free,
-		sizeof(t_writesf), 0, A_DEFFLOAT, A_DEFFLOAT, 0);
+		sizeof(t_writesf), M5_SF_CLASSFLAGS, A_GIMME, 0);
 	class_addmethod(m5_writesf_class, (t_method)m5_writesf_start, gensym("start"), A_GIMME, 0);
 	class_addmethod(m5_writesf_class, (t_method)m5_writesf_stop, gensym("stop"), A_GIMME, 0);
 	class_addmethod(m5_writesf_class, (t_method)m5_writesf_dsp,
@@ -3305,6 +6526,191 @@ static void m5_writesf_setup(void)
 	CLASS_MAINSIGNALIN(m5_writesf_class, t_writesf, x_f);
 }
 
+/* ------------------------- m5_soundfile_monitor ------------------------- */
+
+/* One view of every readsf~ and writesf~ in the process: on "bang" it sends
+
+	stream <id> <class> <state> <file> <fill> <underruns> <new> <MB/s> <dsp>
+
+for each of them, oldest first, and then
+
+	total <objects> <streaming> <underruns> <new> <MB/s> <dsp>
+
+"fill" is the percentage of the fifo holding data (sound yet to be played,
+or recorded sound yet to be written), "underruns" the DSP calls the fifo
+couldn't keep up with and "new" how many of those came since the previous
+"bang".  "MB/s" is what the file thread moved and "dsp" the percentage of
+one core spent in perform, both since the previous "bang". */
+
+static t_class *m5_soundfile_monitor_class;
+
+typedef struct _m5MonitorSample
+{
+	int s_id;
+	t_symbol *s_class;
+	t_symbol *s_state;
+	t_symbol *s_file;
+	t_float s_fill;
+	char s_streaming;
+	long s_underruns;
+	double s_iobytes;
+	double s_dsptime;
+	double s_created;
+} t_m5MonitorSample;
+
+typedef struct _m5soundfile_monitor
+{
+	t_object x_obj;
+	t_outlet *x_out;
+	t_m5MonitorSample *x_last; /* the previous bang's samples, by id */
+	int x_nlast;
+	double x_lasttime; /* sys_getrealtime() at the previous bang */
+} t_m5soundfile_monitor;
+
+static t_symbol *m5_sf_statename(const t_readsf *x)
+{
+	int writer = (pd_class(&x->x_obj.ob_pd) == m5_writesf_class);
+	switch (x->x_state)
+	{
+	case STATE_STARTUP:
+		return gensym(writer ? "ready" : "opening");
+	case STATE_STARTUP_2:
+		return gensym("ready");
+	case STATE_STREAM:
+	case STATE_STREAM_JUST_STARTING:
+		if (writer)
+			return gensym("recording");
+		if (x->x_m5Stalled == 1)
+			return gensym("stalled");
+		return gensym(x->x_m5StartPending ? "starting" : "playing");
+	default:
+		return gensym("idle");
+	}
+}
+
+	/** fill s from x, under its lock */
+static void m5_sf_monitorsample(t_readsf *x, t_m5MonitorSample *s)
+{
+	int writer = (pd_class(&x->x_obj.ob_pd) == m5_writesf_class);
+	ssize_t pending;
+	pthread_mutex_lock(x->x_mutex);
+	s->s_id = x->x_m5Id;
+	s->s_class = gensym(writer ? "m5_writesf~" : "m5_readsf~");
+	s->s_state = m5_sf_statename(x);
+	s->s_file = gensym(x->x_filename ? x->x_filename : "-");
+	s->s_streaming = (x->x_state == STATE_STREAM ||
+		x->x_state == STATE_STREAM_JUST_STARTING);
+		/* either way, what lies between the tail and the head */
+	pending = m5_readsf_fifoavailable(x);
+	s->s_fill = (x->x_fifosize > 0 ? 100. * pending / x->x_fifosize : 0);
+	s->s_underruns = x->x_m5Underruns;
+	s->s_iobytes = x->x_m5IoBytes;
+	s->s_dsptime = x->x_m5DspTime;
+	s->s_created = x->x_m5Created;
+	pthread_mutex_unlock(x->x_mutex);
+}
+
+static void m5_soundfile_monitor_bang(t_m5soundfile_monitor *x)
+{
+	t_m5MonitorSample *now;
+	t_readsf *y;
+	t_atom at[9];
+	double time = sys_getrealtime(), elapsed, totalbytes = 0, totaldsp = 0;
+	long totalunderruns = 0, totalnew = 0;
+	int n = 0, i, j = 0, streaming = 0;
+
+		/* sample everything first: whatever the outlet sets off may
+		create or free objects */
+	pthread_mutex_lock(&m5_sf_registrymutex);
+	for (y = m5_sf_registry; y; y = y->x_m5Next)
+		n++;
+	now = (t_m5MonitorSample *)getbytes((n ? n : 1) *
+		sizeof(t_m5MonitorSample));
+	for (y = m5_sf_registry, i = 0; y; y = y->x_m5Next, i++)
+		m5_sf_monitorsample(y, &now[i]);
+	pthread_mutex_unlock(&m5_sf_registrymutex);
+
+	elapsed = time - x->x_lasttime;
+	for (i = 0; i < n; i++)
+	{
+		t_m5MonitorSample *s = &now[i], prev = {0};
+		double since = elapsed;
+			/* both lists are in order of creation */
+		while (j < x->x_nlast && x->x_last[j].s_id < s->s_id)
+			j++;
+		if (j < x->x_nlast && x->x_last[j].s_id == s->s_id)
+			prev = x->x_last[j];
+		else if (s->s_created > x->x_lasttime)
+			since = time - s->s_created;
+		if (since <= 0)
+			since = 1e-9;
+		SETFLOAT(&at[0], s->s_id);
+		SETSYMBOL(&at[1], s->s_class);
+		SETSYMBOL(&at[2], s->s_state);
+		SETSYMBOL(&at[3], s->s_file);
+		SETFLOAT(&at[4], s->s_fill);
+		SETFLOAT(&at[5], s->s_underruns);
+		SETFLOAT(&at[6], s->s_underruns - prev.s_underruns);
+		SETFLOAT(&at[7], (s->s_iobytes - prev.s_iobytes) / since / 1e6);
+		SETFLOAT(&at[8], 100. * (s->s_dsptime - prev.s_dsptime) / since);
+		outlet_anything(x->x_out, gensym("stream"), 9, at);
+		totalunderruns += s->s_underruns;
+		totalnew += s->s_underruns - prev.s_underruns;
+		totalbytes += s->s_iobytes - prev.s_iobytes;
+		totaldsp += s->s_dsptime - prev.s_dsptime;
+		streaming += s->s_streaming;
+	}
+	if (elapsed <= 0)
+		elapsed = 1e-9;
+	SETFLOAT(&at[0], n);
+	SETFLOAT(&at[1], streaming);
+	SETFLOAT(&at[2], totalunderruns);
+	SETFLOAT(&at[3], totalnew);
+	SETFLOAT(&at[4], totalbytes / elapsed / 1e6);
+	SETFLOAT(&at[5], 100. * totaldsp / elapsed);
+
+	if (x->x_last)
+		freebytes(x->x_last, (x->x_nlast ? x->x_nlast : 1) *
+			sizeof(t_m5MonitorSample));
+	x->x_last = now;
+	x->x_nlast = n;
+	x->x_lasttime = time;
+	outlet_anything(x->x_out, gensym("total"), 6, at);
+}
+
+static void *m5_soundfile_monitor_new(void)
+{
+	t_m5soundfile_monitor *x =
+		(t_m5soundfile_monitor *)pd_new(m5_soundfile_monitor_class);
+	x->x_last = NULL;
+	x->x_nlast = 0;
+	x->x_lasttime = sys_getrealtime();
+	x->x_out = outlet_new(&x->x_obj, &s_anything);
+	pthread_mutex_lock(&m5_sf_registrymutex);
+	m5_sf_monitors++;
+	pthread_mutex_unlock(&m5_sf_registrymutex);
+	return x;
+}
+
+static void m5_soundfile_monitor_free(t_m5soundfile_monitor *x)
+{
+	pthread_mutex_lock(&m5_sf_registrymutex);
+	m5_sf_monitors--;
+	pthread_mutex_unlock(&m5_sf_registrymutex);
+	if (x->x_last)
+		freebytes(x->x_last, (x->x_nlast ? x->x_nlast : 1) *
+			sizeof(t_m5MonitorSample));
+}
+
+static void m5_soundfile_monitor_setup(void)
+{
+	m5_soundfile_monitor_class = class_new(gensym("m5_soundfile_monitor"),
+		(t_newmethod)m5_soundfile_monitor_new,
+		(t_method)m5_soundfile_monitor_free,
+		sizeof(t_m5soundfile_monitor), 0, 0);
+	class_addbang(m5_soundfile_monitor_class, (t_method)m5_soundfile_monitor_bang);
+}
+
 /* ------------------------- global setup routine ------------------------ */
 
 void m5_soundfile_setup(void)
@@ -3313,6 +6719,10 @@ void m5_soundfile_setup(void)
 	// soundfiler_setup();
 	m5_readsf_setup();
 	m5_writesf_setup();
+	m5_soundfile_monitor_setup();
+	m5_soundfile_edit_setup();
+	m5_soundfile_convert_setup();
+	m5_grains_setup();
 	
 	m5_time_anchor_setup();
 	m5_ftc_add_setup();
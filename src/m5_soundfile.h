@@ -52,11 +52,26 @@ typedef SSIZE_T ssize_t;
 #define SFMAXFRAMES SIZE_MAX  /**< default max sample frames, unsigned */
 #define SFMAXBYTES  SSIZE_MAX /**< default max sample bytes, signed */
 
+    /** history kept for sequential-only sources (pipes, FIFOs, stdin),
+        seeks further back than this fail */
+#define SFSTREAMHISTORY (16 * 1024 * 1024)
+
     /** sound file read/write debug posts */
 //#define DEBUG_SOUNDFILE
 
 /* ----- soundfile ----- */
 
+    /** in-RAM history for a non-seekable file descriptor: a ring buffer
+        holding the most recent bytes read, addressed by stream offset */
+typedef struct _soundfile_stream
+{
+    char *ss_buf;          /**< ring buffer                               */
+    size_t ss_size;        /**< ring buffer size in bytes                 */
+    off_t ss_start;        /**< stream offset of the oldest byte kept     */
+    off_t ss_end;          /**< stream offset after the newest byte read  */
+    int ss_eof;            /**< 1 once the writing end has been closed    */
+} t_soundfile_stream;
+
     /** soundfile file descriptor, backend type, and format info
         note: headersize and bytelimit are signed as they are used for < 0
               comparisons, hopefully ssize_t is large enough
@@ -73,6 +88,9 @@ typedef struct _soundfile
     int sf_bigendian;      /**< sample endianness, 1 : big or 0 : little  */
     int sf_bytesperframe;  /**< number of bytes per sample frame          */
     ssize_t sf_bytelimit;  /**< number of sound data bytes to read/write  */
+    t_soundfile_stream *sf_stream; /**< history if fd can't seek, or NULL */
+    void *sf_decoder;      /**< compressed types: decoder state, or NULL  */
+    void *sf_encoder;      /**< compressed types: encoder state, or NULL  */
 } t_soundfile;
 
     /** clear soundfile struct to defaults, does not close or free */
@@ -84,6 +102,51 @@ void m5_soundfile_copy(t_soundfile *dst, const t_soundfile *src);
     /** returns 1 if bytes need to be swapped due to endianness, otherwise 0 */
 int m5_soundfile_needsbyteswap(const t_soundfile *sf);
 
+    /** returns 1 if the file can seek, 0 for pipes and other streams */
+int m5_soundfile_isseekable(const t_soundfile *sf);
+
+    /** read size bytes at offset into dst, from the file or, for a
+        non-seekable stream, from its history buffer (reading ahead as
+        needed), returns bytes read, which is only short at the end of
+        the file, or -1 on failure (errno ESPIPE if the offset has already
+        left the history buffer) */
+ssize_t m5_soundfile_read(t_soundfile *sf, off_t offset, void *dst,
+    size_t size);
+
+    /** as m5_soundfile_read() but always reads the file's own bytes, never
+        decoded ones: for type implementations reading their headers and
+        compressed data */
+ssize_t m5_soundfile_readraw(t_soundfile *sf, off_t offset, void *dst,
+    size_t size);
+
+    /** write size bytes of sound data at the current file position, or
+        hand them to the encoder of a compressed type, returns bytes
+        written or -1 on failure */
+ssize_t m5_soundfile_write(t_soundfile *sf, const void *src, size_t size);
+
+    /** close the file descriptor, free any decoder, encoder and stream
+        history */
+void m5_soundfile_close(t_soundfile *sf);
+
+    /** read the header of the file open on fd into sf (sf_headersize < 0
+        to detect it) and seek past skipframes, returns fd or -1 on error,
+        closing fd
+        this may be called in a background thread */
+int m5_open_soundfile_via_fd(int fd, t_soundfile *sf, size_t skipframes);
+
+    /** convert nframes frames of sample data read from sf in buf into one
+        vector per channel, at most nvecs of them, zeroing vectors past the
+        file's channels
+        this may be called in a background thread */
+void m5_soundfile_xferin(const t_soundfile *sf, int nvecs, t_sample **vecs,
+    unsigned char *buf, size_t nframes);
+
+    /** convert nframes frames of one vector per channel of sf into sample
+        data for sf in buf, the inverse of m5_soundfile_xferin()
+        this may be called in a background thread */
+void m5_soundfile_xferout(const t_soundfile *sf, t_sample **vecs,
+    unsigned char *buf, size_t nframes);
+
     /** generic soundfile errors */
 typedef enum _soundfile_errno
 {
@@ -134,6 +197,51 @@ typedef int (*t_soundfile_addextensionfn)(char *filename, size_t size);
         returns 1 for big endian, 0 for little endian */
 typedef int (*t_soundfile_endiannessfn)(int endianness, int bytespersample);
 
+    /** compressed types only: the header reader sets sf_decoder, and the
+        sound data is then presented as native-endian PCM in sf_bytesperframe
+        frames starting at offset sf_headersize. m5_soundfile_read() calls
+        this to decode size bytes at offset into dst; returns bytes decoded,
+        short only at the end of the data, or -1 on error
+        this is called in a background thread */
+typedef ssize_t (*t_soundfile_decodefn)(t_soundfile *sf, off_t offset,
+    void *dst, size_t size);
+
+    /** compressed types only: free sf_decoder and set it to NULL */
+typedef void (*t_soundfile_freedecoderfn)(t_soundfile *sf);
+
+    /** compressed types only: the header writer sets sf_encoder, and
+        m5_soundfile_write() calls this with size bytes of PCM in the format
+        given by sf, always whole frames; the type compresses and writes
+        them in its own time and the update header function finishes the
+        file. returns size or -1 on error
+        this is called in a background thread */
+typedef ssize_t (*t_soundfile_encodefn)(t_soundfile *sf, const void *src,
+    size_t size);
+
+    /** compressed types only: abandon and free sf_encoder, set it to NULL */
+typedef void (*t_soundfile_freeencoderfn)(t_soundfile *sf);
+
+    /** integrity checksum of a file's sound data, as the writer handed it
+        to m5_soundfile_write() */
+typedef struct _soundfile_checksum
+{
+    uint32_t sc_crc32c;    /**< CRC-32C of the sound data bytes           */
+    uint64_t sc_databytes; /**< number of sound data bytes covered        */
+    int sc_bigendian;      /**< sample endianness the CRC was taken over  */
+} t_soundfile_checksum;
+
+    /** store a checksum in a file that has been finished by the update
+        header function, returns 1 on success or 0 on error
+        this is called in a background thread */
+typedef int (*t_soundfile_writechecksumfn)(t_soundfile *sf,
+    const t_soundfile_checksum *ck);
+
+    /** find a stored checksum in an open file, returns 1 if there is one,
+        otherwise 0
+        this is called in a background thread */
+typedef int (*t_soundfile_readchecksumfn)(t_soundfile *sf,
+    t_soundfile_checksum *ck);
+
     /* type implementation for a single file format */
 typedef struct _soundfile_type
 {
@@ -146,12 +254,24 @@ typedef struct _soundfile_type
     t_soundfile_hasextensionfn t_hasextensionfn; /**< must be non-NULL      */
     t_soundfile_addextensionfn t_addextensionfn; /**< must be non-NULL      */
     t_soundfile_endiannessfn t_endiannessfn;     /**< must be non-NULL      */
+    t_soundfile_decodefn t_decodefn;             /**< NULL for PCM types    */
+    t_soundfile_freedecoderfn t_freedecoderfn;   /**< NULL for PCM types    */
+    t_soundfile_encodefn t_encodefn;             /**< NULL for PCM types    */
+    t_soundfile_freeencoderfn t_freeencoderfn;   /**< NULL for PCM types    */
+    t_soundfile_writechecksumfn t_writechecksumfn; /**< NULL: unsupported */
+    t_soundfile_readchecksumfn t_readchecksumfn;   /**< NULL: unsupported */
 } t_soundfile_type;
 
     /** add a new type implementation
         returns 1 on success or 0 if max types has been reached */
 int m5_soundfile_addtype(const t_soundfile_type *t);
 
+    /** find type by name, returns NULL if not found */
+t_soundfile_type *m5_soundfile_findtype(const char *name);
+
+    /** find the type whose extension filename has, returns NULL if none */
+t_soundfile_type *m5_soundfile_typeforfile(const char *filename);
+
 /* ----- read/write helpers ----- */
 
     /** seek to offset in file fd and read size bytes into dst,
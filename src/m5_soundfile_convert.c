@@ -0,0 +1,789 @@
+/* Copyright (c) 2025 Michael Spears.
+* For information on usage and redistribution, and for a DISCLAIMER OF ALL
+* WARRANTIES, see the file, "LICENSE.txt," in this distribution.  */
+
+#include <m_pd.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "m5_soundfile.h"
+#include "m5_soundfile_convert.h"
+#include "m5_timeanchor.h"
+#include "g_canvas.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/*
+
+	converting sound files on a pool of background threads
+
+*/
+
+#define CONVERT_PENDING -1
+#define CONVERT_FAILED 0
+#define CONVERT_OK 1
+
+#define CONVERTPOLL 100 /* msec between looks at the results */
+
+#define CONVERTMAXBYTES 0xfffffff0 /* sound data a .wav header can count */
+
+	/* resampling: a windowed sinc kernel tabulated at CONVERTPHASES steps
+	   per input frame, CONVERTHALF zero crossings either side of its centre
+	   and cut off at CONVERTROLLOFF of the lower Nyquist frequency */
+#define CONVERTPHASES 256
+#define CONVERTHALF 16
+#define CONVERTMAXHALF 512
+#define CONVERTROLLOFF 0.95
+
+#define CONVERTMAXCHANS 64 /* as many as writesf~ takes */
+
+#define CONVERTPREPARE -1 /* job segment: open the files and plan the work */
+
+typedef struct _m5Convert
+{
+	t_symbol *c_name;          /* <out> as given, for reports */
+	char c_inpath[MAXPDSTRING];
+	char c_outpath[MAXPDSTRING];
+	char c_tmppath[MAXPDSTRING];
+	t_soundfile_type *c_type;  /* of the output */
+	int c_bytespersample;      /* of the output, 0: the input's */
+	int c_samplerate;          /* of the output, 0: the input's */
+	int c_endianness;          /* asked for, -1: the type's choice */
+	t_soundfile c_in;          /* format of the input, closed */
+	t_soundfile c_out;         /* the output, open until it is finished */
+	size_t c_inframes;
+	size_t c_outframes;        /* 0 until the input has been opened */
+	float *c_kernel;           /* resampling table, or NULL */
+	int c_half;                /* its half width in input frames */
+	int c_nsegments;
+	int c_running;             /* segments still converting */
+	size_t c_written;          /* frames converted so far */
+	int c_refcount;            /* the object's and one per queued job */
+	int c_cancel;              /* the object is gone */
+	int c_result;              /* CONVERT_PENDING until it is finished */
+	const char *c_why;         /* the first failure, stops the segments */
+	int c_errno;               /* or 0 */
+	int c_percent;             /* last reported, main thread only */
+	struct _m5Convert *c_next;
+} t_m5Convert;
+
+typedef struct _m5ConvertJob
+{
+	t_m5Convert *j_convert;
+	int j_segment;             /* or CONVERTPREPARE */
+	struct _m5ConvertJob *j_next;
+} t_m5ConvertJob;
+
+typedef struct _m5SoundfileConvert
+{
+	t_object x_obj;
+	t_canvas *x_canvas;
+	t_outlet *x_out;
+	t_clock *x_clock;          /* polls x_converts */
+	t_m5Convert *x_converts;   /* submitted, oldest first */
+} t_m5SoundfileConvert;
+
+static t_class *m5_soundfile_convert_class;
+
+	/* guards refcounts, progress, cancel flags and results of all
+	   conversions */
+static pthread_mutex_t m5_convert_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void m5_convert_release(t_m5Convert *c)
+{
+	int last;
+	pthread_mutex_lock(&m5_convert_mutex);
+	last = !--c->c_refcount;
+	pthread_mutex_unlock(&m5_convert_mutex);
+	if (!last)
+		return;
+	if (c->c_kernel)
+		freebytes(c->c_kernel, (CONVERTPHASES + 1) * 2 * c->c_half *
+			sizeof(float));
+	freebytes(c, sizeof(t_m5Convert));
+}
+
+	/** returns 1 once the object is gone or a segment has failed */
+static int m5_convert_stopped(t_m5Convert *c)
+{
+	int stop;
+	pthread_mutex_lock(&m5_convert_mutex);
+	stop = (c->c_cancel || c->c_why);
+	pthread_mutex_unlock(&m5_convert_mutex);
+	return stop;
+}
+
+	/** note the first failure, errno telling why */
+static void m5_convert_fail(t_m5Convert *c, const char *why)
+{
+	int err = errno;
+	pthread_mutex_lock(&m5_convert_mutex);
+	if (!c->c_why)
+	{
+		c->c_why = why;
+		c->c_errno = err;
+	}
+	pthread_mutex_unlock(&m5_convert_mutex);
+}
+
+/* ----- thread pool ----- */
+
+	/* threads shared by all conversions, started on first use and kept for
+	   the life of the process. jobs run in the order they were queued, so
+	   files are started in the order they were asked for while the
+	   segments of each spread over the threads. */
+static pthread_mutex_t m5_convertpool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t m5_convertpool_cond = PTHREAD_COND_INITIALIZER;
+static t_m5ConvertJob *m5_convertpool_head = NULL,
+	*m5_convertpool_tail = NULL;
+static int m5_convertpool_nthreads = 0;
+
+static void m5_convert_run(t_m5Convert *c, int segment);
+
+static void *m5_convertpool_main(void *dummy)
+{
+	pthread_mutex_lock(&m5_convertpool_mutex);
+	while (1)
+	{
+		t_m5ConvertJob *j = m5_convertpool_head;
+		if (!j)
+		{
+			pthread_cond_wait(&m5_convertpool_cond, &m5_convertpool_mutex);
+			continue;
+		}
+		if (!(m5_convertpool_head = j->j_next))
+			m5_convertpool_tail = NULL;
+		pthread_mutex_unlock(&m5_convertpool_mutex);
+		m5_convert_run(j->j_convert, j->j_segment);
+		freebytes(j, sizeof(t_m5ConvertJob));
+		pthread_mutex_lock(&m5_convertpool_mutex);
+	}
+	return 0;
+}
+
+	/** start the pool if it isn't running, returns its number of threads */
+static int m5_convertpool_start(void)
+{
+	int n;
+	pthread_mutex_lock(&m5_convertpool_mutex);
+	if (!m5_convertpool_nthreads)
+	{
+#ifdef _SC_NPROCESSORS_ONLN
+		long want = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+#else
+		long want = 1;
+#endif
+		if (want < 1)
+			want = 1;
+		if (want > M5_CONVERT_MAXTHREADS)
+			want = M5_CONVERT_MAXTHREADS;
+		while (want--)
+		{
+			pthread_t thread;
+			if (!pthread_create(&thread, 0, m5_convertpool_main, 0))
+			{
+				pthread_detach(thread);
+				m5_convertpool_nthreads++;
+			}
+		}
+	}
+	n = m5_convertpool_nthreads;
+	pthread_mutex_unlock(&m5_convertpool_mutex);
+	return n;
+}
+
+	/** queue a job, returns 0 if there is no thread to run it */
+static int m5_convertpool_queue(t_m5Convert *c, int segment)
+{
+	t_m5ConvertJob *j;
+	if (!m5_convertpool_start())
+		return 0;
+	j = (t_m5ConvertJob *)getbytes(sizeof(t_m5ConvertJob));
+	j->j_convert = c;
+	j->j_segment = segment;
+	j->j_next = NULL;
+	pthread_mutex_lock(&m5_convertpool_mutex);
+	if (m5_convertpool_tail)
+		m5_convertpool_tail->j_next = j;
+	else m5_convertpool_head = j;
+	m5_convertpool_tail = j;
+	pthread_cond_signal(&m5_convertpool_cond);
+	pthread_mutex_unlock(&m5_convertpool_mutex);
+	return 1;
+}
+
+/* ----- resampling ----- */
+
+	/** tabulate the kernel for converting inrate to outrate: row p holds
+		the weights of the 2 * half input frames around an output frame
+		p / CONVERTPHASES of a frame after the first of the right half,
+		each row normalized to unity gain */
+static void m5_convert_makekernel(t_m5Convert *c, int inrate, int outrate)
+{
+	double cutoff = CONVERTROLLOFF *
+		(outrate < inrate ? (double)outrate / inrate : 1.);
+	int half = (int)ceil(CONVERTHALF / cutoff), taps, p, t;
+		/* an even half width keeps the rows a multiple of 4 long */
+	half += (half & 1);
+	if (half > CONVERTMAXHALF)
+		half = CONVERTMAXHALF;
+	taps = 2 * half;
+	c->c_half = half;
+	c->c_kernel = (float *)getbytes((CONVERTPHASES + 1) * taps *
+		sizeof(float));
+	for (p = 0; p <= CONVERTPHASES; p++)
+	{
+		float *row = c->c_kernel + p * taps;
+		double sum = 0;
+		for (t = 0; t < taps; t++)
+		{
+			double x = t - half + 1 - (double)p / CONVERTPHASES,
+				w = x / half, h;
+			if (w <= -1 || w >= 1)
+				h = 0;
+			else
+			{
+				h = (x == 0 ? cutoff :
+					sin(M_PI * cutoff * x) / (M_PI * x));
+					/* Blackman window */
+				h *= 0.42 + 0.5 * cos(M_PI * w) + 0.08 * cos(2 * M_PI * w);
+			}
+			row[t] = h;
+			sum += h;
+		}
+		for (t = 0; t < taps; t++)
+			row[t] /= sum;
+	}
+}
+
+	/** dot product of n weights with n frames, n a multiple of 4, in
+		four sums the compiler can keep in one vector register */
+static t_sample m5_convert_dot(const t_sample *in, const float *w, int n)
+{
+	t_sample s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+	int i;
+	for (i = 0; i < n; i += 4)
+	{
+		s0 += in[i] * w[i];
+		s1 += in[i + 1] * w[i + 1];
+		s2 += in[i + 2] * w[i + 2];
+		s3 += in[i + 3] * w[i + 3];
+	}
+	return (s0 + s1) + (s2 + s3);
+}
+
+	/** nframes output frames from output frame first on of one channel,
+		in holding the input from input frame lo on. each output frame is
+		placed by exact integer arithmetic, so segments join seamlessly */
+static void m5_convert_resample(const t_m5Convert *c, const t_sample *in,
+	int64_t lo, t_sample *out, size_t first, size_t nframes)
+{
+	uint64_t inrate = c->c_in.sf_samplerate, outrate = c->c_out.sf_samplerate;
+	int half = c->c_half, taps = 2 * half;
+	size_t k;
+	for (k = 0; k < nframes; k++)
+	{
+		uint64_t pos = (first + k) * inrate;
+		int64_t at = pos / outrate;
+		double phase = (double)(pos % outrate) * CONVERTPHASES / outrate;
+		int p = (int)phase;
+		const t_sample *src = in + (at - half + 1 - lo);
+		const float *row = c->c_kernel + p * taps;
+		t_sample a = m5_convert_dot(src, row, taps),
+			b = m5_convert_dot(src, row + taps, taps);
+		out[k] = a + (t_sample)(phase - p) * (b - a);
+	}
+}
+
+/* ----- conversion ----- */
+
+	/** the last segment is done: finish the header, close the output and
+		rename it over <out>, or throw it away */
+static void m5_convert_finish(t_m5Convert *c)
+{
+	const char *why;
+	pthread_mutex_lock(&m5_convert_mutex);
+	why = (c->c_why ? c->c_why : (c->c_cancel ? "cancelled" : NULL));
+	pthread_mutex_unlock(&m5_convert_mutex);
+	if (!why && c->c_out.sf_fd >= 0 &&
+		!c->c_out.sf_type->t_updateheaderfn(&c->c_out, c->c_outframes))
+			m5_convert_fail(c, (why = "can't write the header"));
+	m5_soundfile_close(&c->c_out);
+	if (!why)
+	{
+			// rename() won't replace an existing file everywhere
+		if (rename(c->c_tmppath, c->c_outpath) < 0)
+		{
+			remove(c->c_outpath);
+			if (rename(c->c_tmppath, c->c_outpath) < 0)
+				m5_convert_fail(c, (why = "can't replace"));
+		}
+	}
+	if (why)
+		remove(c->c_tmppath);
+	pthread_mutex_lock(&m5_convert_mutex);
+	if (why && !c->c_why)
+	{
+		c->c_why = why;
+		c->c_errno = 0;
+	}
+	c->c_result = (why ? CONVERT_FAILED : CONVERT_OK);
+	pthread_mutex_unlock(&m5_convert_mutex);
+}
+
+	/** open the input, create "<out>~" with the header for the whole
+		length, and queue the segments. returns the number queued */
+static int m5_convert_prepare(t_m5Convert *c)
+{
+	t_soundfile *in = &c->c_in, *out = &c->c_out;
+	int fd, nthreads, n, i;
+	ssize_t headersize;
+
+	m5_soundfile_clear(in);
+	m5_soundfile_clear(out);
+	in->sf_headersize = -1;
+	if ((fd = sys_open(c->c_inpath, O_RDONLY)) < 0 ||
+		m5_open_soundfile_via_fd(fd, in, 0) < 0)
+	{
+		m5_convert_fail(c, "can't open");
+		return 0;
+	}
+	if (!m5_soundfile_isseekable(in))
+	{
+		m5_soundfile_close(in);
+		errno = 0;
+		m5_convert_fail(c, "can't convert a stream");
+		return 0;
+	}
+	m5_soundfile_close(in);
+	if (in->sf_nchannels > CONVERTMAXCHANS)
+	{
+		errno = 0;
+		m5_convert_fail(c, "too many channels");
+		return 0;
+	}
+	c->c_inframes = in->sf_bytelimit / in->sf_bytesperframe;
+
+	m5_soundfile_copy(out, in);
+	out->sf_fd = -1;
+	out->sf_headersize = -1;
+	out->sf_type = c->c_type;
+	if (c->c_bytespersample)
+		out->sf_bytespersample = c->c_bytespersample;
+	if (c->c_samplerate)
+		out->sf_samplerate = c->c_samplerate;
+	out->sf_bigendian = out->sf_type->t_endiannessfn(c->c_endianness,
+		out->sf_bytespersample);
+	out->sf_bytesperframe = out->sf_nchannels * out->sf_bytespersample;
+	if (out->sf_samplerate == in->sf_samplerate)
+		c->c_outframes = c->c_inframes;
+	else
+	{
+		uint64_t inrate = in->sf_samplerate, outrate = out->sf_samplerate;
+		c->c_outframes = ((uint64_t)c->c_inframes * outrate + inrate - 1) /
+			inrate;
+		m5_convert_makekernel(c, in->sf_samplerate, out->sf_samplerate);
+	}
+	out->sf_bytelimit = c->c_outframes * out->sf_bytesperframe;
+	if (!strcmp(out->sf_type->t_name, "wave") &&
+		(double)c->c_outframes * out->sf_bytesperframe > CONVERTMAXBYTES)
+	{
+		errno = EFBIG;
+		m5_convert_fail(c, "too long for a .wav file");
+		return 0;
+	}
+	if ((out->sf_fd = sys_open(c->c_tmppath,
+		O_RDWR | O_CREAT | O_TRUNC, 0666)) < 0)
+	{
+		m5_convert_fail(c, "can't create");
+		return 0;
+	}
+	if ((headersize = out->sf_type->t_writeheaderfn(out, c->c_outframes)) < 0)
+	{
+		m5_convert_fail(c, "can't write the header");
+		return 0;
+	}
+	out->sf_headersize = headersize;
+
+		/* an encoder takes its frames in order and spreads them over
+		   threads of its own */
+	nthreads = m5_convertpool_start();
+	n = (int)(c->c_outframes / M5_CONVERT_MINSEGMENT);
+	if (n > nthreads)
+		n = nthreads;
+	if (n < 1 || out->sf_encoder)
+		n = 1;
+	pthread_mutex_lock(&m5_convert_mutex);
+	c->c_nsegments = c->c_running = n;
+	c->c_refcount += n;
+	pthread_mutex_unlock(&m5_convert_mutex);
+	for (i = 0; i < n; i++)
+		m5_convertpool_queue(c, i);
+	return n;
+}
+
+	/** convert one segment of the output, reading the input and writing
+		the output through descriptors of its own unless it is the only
+		segment of an encoded file */
+static int m5_convert_segment(t_m5Convert *c, int segment)
+{
+	const t_soundfile *out = &c->c_out;
+	t_soundfile in;
+	int nchannels = out->sf_nchannels, ch, fd, outfd = -1;
+	int raw = (!c->c_kernel &&
+		out->sf_bytespersample == c->c_in.sf_bytespersample &&
+		out->sf_bigendian == c->c_in.sf_bigendian);
+	int half = (c->c_kernel ? c->c_half : 0);
+	uint64_t inrate = c->c_in.sf_samplerate, outrate = out->sf_samplerate;
+	size_t first = (uint64_t)c->c_outframes * segment / c->c_nsegments,
+		end = (uint64_t)c->c_outframes * (segment + 1) / c->c_nsegments,
+		maxin = (c->c_kernel ? (size_t)((uint64_t)M5_CONVERT_CHUNK *
+			inrate / outrate) + 2 * half + 2 : M5_CONVERT_CHUNK), j;
+	size_t inbytes = maxin * c->c_in.sf_bytesperframe,
+		outbytes = (size_t)M5_CONVERT_CHUNK * out->sf_bytesperframe;
+	unsigned char *inbuf = NULL, *outbuf = NULL;
+	t_sample *invecs[CONVERTMAXCHANS], *outvecs[CONVERTMAXCHANS],
+		*at[CONVERTMAXCHANS], *samples = NULL;
+	const char *why = NULL;
+	ssize_t got;
+
+	m5_soundfile_clear(&in);
+	in.sf_headersize = -1;
+	if ((fd = sys_open(c->c_inpath, O_RDONLY)) < 0 ||
+		m5_open_soundfile_via_fd(fd, &in, 0) < 0)
+	{
+		m5_convert_fail(c, "can't open");
+		return 0;
+	}
+	if (!out->sf_encoder &&
+		(outfd = sys_open(c->c_tmppath, O_WRONLY)) < 0)
+	{
+		m5_convert_fail(c, "can't create");
+		m5_soundfile_close(&in);
+		return 0;
+	}
+	inbuf = (unsigned char *)getbytes(inbytes);
+	if (!raw)
+	{
+		outbuf = (unsigned char *)getbytes(outbytes);
+		samples = (t_sample *)getbytes(nchannels *
+			(maxin + M5_CONVERT_CHUNK) * sizeof(t_sample));
+		for (ch = 0; ch < nchannels; ch++)
+		{
+			invecs[ch] = samples + ch * maxin;
+			outvecs[ch] = (c->c_kernel ? samples + nchannels * maxin +
+				ch * M5_CONVERT_CHUNK : invecs[ch]);
+		}
+	}
+	for (j = first; j < end && !why; j += M5_CONVERT_CHUNK)
+	{
+		size_t n = (end - j < M5_CONVERT_CHUNK ? end - j : M5_CONVERT_CHUNK),
+			size = n * out->sf_bytesperframe;
+		const unsigned char *buf = (raw ? inbuf : outbuf);
+		if (m5_convert_stopped(c))
+			break;
+		if (raw)
+		{
+			if ((got = m5_soundfile_read(&in, in.sf_headersize +
+				(off_t)j * in.sf_bytesperframe, inbuf, size)) != (ssize_t)size)
+			{
+					/* the input ended before its header said it would */
+				if (got >= 0)
+					errno = EIO;
+				why = "can't read";
+			}
+		}
+		else
+		{
+				/* the input frames the chunk needs, zero outside the file */
+			int64_t lo = j, hi = j + n, from, to;
+			size_t count;
+			if (c->c_kernel)
+			{
+				lo = (int64_t)(j * inrate / outrate) - half + 1;
+				hi = (int64_t)((j + n - 1) * inrate / outrate) + half + 1;
+			}
+			from = (lo < 0 ? 0 : lo);
+			to = (hi > (int64_t)c->c_inframes ? (int64_t)c->c_inframes : hi);
+			count = (to > from ? to - from : 0);
+			if (count && (got = m5_soundfile_read(&in, in.sf_headersize +
+				(off_t)from * in.sf_bytesperframe, inbuf,
+					count * in.sf_bytesperframe)) !=
+						(ssize_t)(count * in.sf_bytesperframe))
+			{
+				if (got >= 0)
+					errno = EIO;
+				why = "can't read";
+				break;
+			}
+			for (ch = 0; ch < nchannels; ch++)
+			{
+				int64_t k;
+				for (k = lo; k < from && k < hi; k++)
+					invecs[ch][k - lo] = 0;
+				for (k = (to > from ? to : from); k < hi; k++)
+					invecs[ch][k - lo] = 0;
+				at[ch] = invecs[ch] + (from - lo);
+			}
+			m5_soundfile_xferin(&in, nchannels, at, inbuf, count);
+			if (c->c_kernel)
+				for (ch = 0; ch < nchannels; ch++)
+					m5_convert_resample(c, invecs[ch], lo, outvecs[ch], j, n);
+			m5_soundfile_xferout(out, outvecs, outbuf, n);
+		}
+		if (!why && (out->sf_encoder ?
+			m5_soundfile_write(&c->c_out, buf, size) :
+			m5_fd_write(outfd, out->sf_headersize +
+				(off_t)j * out->sf_bytesperframe, buf, size)) != (ssize_t)size)
+					why = "can't write";
+		if (!why)
+		{
+			pthread_mutex_lock(&m5_convert_mutex);
+			c->c_written += n;
+			pthread_mutex_unlock(&m5_convert_mutex);
+		}
+	}
+	if (why)
+		m5_convert_fail(c, why);
+	if (outfd >= 0 && sys_close(outfd) < 0 && !why)
+		m5_convert_fail(c, (why = "can't write"));
+	m5_soundfile_close(&in);
+	freebytes(inbuf, inbytes);
+	if (!raw)
+	{
+		freebytes(outbuf, outbytes);
+		freebytes(samples, nchannels * (maxin + M5_CONVERT_CHUNK) *
+			sizeof(t_sample));
+	}
+	return !why;
+}
+
+	/** pool job: prepare the conversion or convert a segment of it, the
+		last one out finishing it */
+static void m5_convert_run(t_m5Convert *c, int segment)
+{
+	int last;
+	if (segment == CONVERTPREPARE)
+	{
+		if (!m5_convert_prepare(c))
+			m5_convert_finish(c);
+		m5_convert_release(c);
+		return;
+	}
+	m5_convert_segment(c, segment);
+	pthread_mutex_lock(&m5_convert_mutex);
+	last = !--c->c_running;
+	pthread_mutex_unlock(&m5_convert_mutex);
+	if (last)
+		m5_convert_finish(c);
+	m5_convert_release(c);
+}
+
+/* ----- m5_soundfile_convert ----- */
+
+	/** report progress and what has finished, oldest first, and poll again
+		while anything is left */
+static void m5_soundfile_convert_tick(t_m5SoundfileConvert *x)
+{
+	t_m5Convert **cp = &x->x_converts, *c;
+	while ((c = *cp))
+	{
+		int result, err, percent;
+		const char *why;
+		size_t frames;
+		t_m5FrameTimeCode ftc;
+		t_atom at[4];
+		pthread_mutex_lock(&m5_convert_mutex);
+		result = c->c_result;
+		why = c->c_why;
+		err = c->c_errno;
+		frames = c->c_outframes;
+		percent = (frames ? (int)((double)c->c_written * 100 / frames) : -1);
+		pthread_mutex_unlock(&m5_convert_mutex);
+		SETSYMBOL(&at[0], c->c_name);
+		if (result == CONVERT_PENDING)
+		{
+			cp = &c->c_next;
+			if (percent >= 0 && percent != c->c_percent)
+			{
+				c->c_percent = percent;
+				SETFLOAT(&at[1], percent);
+				outlet_anything(x->x_out, gensym("progress"), 2, at);
+			}
+			continue;
+		}
+		*cp = c->c_next;
+		if (result == CONVERT_OK)
+		{
+			m5_frame_time_code_from_frames((long)frames, &ftc);
+			SETFLOAT(&at[1], ftc.sign);
+			SETFLOAT(&at[2], ftc.epoch);
+			SETFLOAT(&at[3], ftc.frames);
+			m5_convert_release(c);
+			outlet_anything(x->x_out, gensym("done"), 4, at);
+		}
+		else
+		{
+			pd_error(x, "[m5_soundfile_convert] %s: %s%s%s",
+				c->c_name->s_name, why, (err ? ": " : ""),
+				(err ? m5_soundfile_strerror(err) : ""));
+			m5_convert_release(c);
+			outlet_anything(x->x_out, gensym("failed"), 1, at);
+		}
+			/* the outlet may have queued more */
+		cp = &x->x_converts;
+	}
+	if (x->x_converts)
+		clock_delay(x->x_clock, CONVERTPOLL);
+}
+
+static void m5_soundfile_convert_usage(t_m5SoundfileConvert *x)
+{
+	pd_error(x, "m5_soundfile_convert: usage: convert [-bytes <n>] [-rate <n>] [-big|-little] [-<type>] <in> <out>");
+}
+
+	/** convert [-bytes <n>] [-rate <n>] [-big|-little] [-<type>] <in> <out> */
+static void m5_soundfile_convert_convert(t_m5SoundfileConvert *x,
+	t_symbol *s, int argc, t_atom *argv)
+{
+	t_soundfile_type *type = NULL;
+	int bytespersample = 0, samplerate = 0, endianness = -1;
+	char name[MAXPDSTRING];
+	t_m5Convert *c, **cp;
+	t_symbol *out;
+
+	while (argc > 0 && argv->a_type == A_SYMBOL &&
+		*argv->a_w.w_symbol->s_name == '-')
+	{
+		const char *flag = argv->a_w.w_symbol->s_name + 1;
+		if (!strcmp(flag, "bytes") || !strcmp(flag, "b"))
+		{
+			if (argc < 2 || argv[1].a_type != A_FLOAT ||
+				((bytespersample = argv[1].a_w.w_float) != 2 &&
+					bytespersample != 3 && bytespersample != 4 &&
+						bytespersample != 8))
+			{
+				m5_soundfile_convert_usage(x);
+				return;
+			}
+			argc -= 2; argv += 2;
+		}
+		else if (!strcmp(flag, "rate") || !strcmp(flag, "r"))
+		{
+			if (argc < 2 || argv[1].a_type != A_FLOAT ||
+				(samplerate = argv[1].a_w.w_float) <= 0)
+			{
+				m5_soundfile_convert_usage(x);
+				return;
+			}
+			argc -= 2; argv += 2;
+		}
+		else if (!strcmp(flag, "big") || !strcmp(flag, "little"))
+		{
+			endianness = (*flag == 'b');
+			argc -= 1; argv += 1;
+		}
+		else if ((type = m5_soundfile_findtype(flag)))
+		{
+			argc -= 1; argv += 1;
+		}
+		else
+		{
+			m5_soundfile_convert_usage(x);
+			return;
+		}
+	}
+	if (argc != 2 || argv[0].a_type != A_SYMBOL ||
+		argv[1].a_type != A_SYMBOL)
+	{
+		m5_soundfile_convert_usage(x);
+		return;
+	}
+	out = argv[1].a_w.w_symbol;
+
+		/* the type from <out>'s extension, or an extension for the type */
+	if (!type && !(type = m5_soundfile_typeforfile(out->s_name)) &&
+		!(type = m5_soundfile_findtype("wave")))
+	{
+		pd_error(x, "m5_soundfile_convert: no type for %s", out->s_name);
+		return;
+	}
+	strncpy(name, out->s_name, MAXPDSTRING - 10);
+	name[MAXPDSTRING - 10] = 0;
+	if (!type->t_hasextensionfn(name, MAXPDSTRING))
+		type->t_addextensionfn(name, MAXPDSTRING - 10);
+
+	c = (t_m5Convert *)getbytes(sizeof(t_m5Convert));
+	c->c_name = out;
+	canvas_makefilename(x->x_canvas, argv[0].a_w.w_symbol->s_name,
+		c->c_inpath, MAXPDSTRING);
+	canvas_makefilename(x->x_canvas, name, c->c_outpath, MAXPDSTRING);
+	if (snprintf(c->c_tmppath, MAXPDSTRING, "%s~", c->c_outpath) >=
+		MAXPDSTRING)
+	{
+		pd_error(x, "m5_soundfile_convert: %s: %s", out->s_name,
+			m5_soundfile_strerror(ENAMETOOLONG));
+		freebytes(c, sizeof(t_m5Convert));
+		return;
+	}
+	c->c_type = type;
+	c->c_bytespersample = bytespersample;
+	c->c_samplerate = samplerate;
+	c->c_endianness = endianness;
+	c->c_out.sf_fd = -1;
+	c->c_refcount = 2;
+	c->c_result = CONVERT_PENDING;
+	c->c_percent = -1;
+	for (cp = &x->x_converts; *cp; cp = &(*cp)->c_next)
+		;
+	*cp = c;
+	if (!m5_convertpool_queue(c, CONVERTPREPARE))
+	{
+		errno = 0;
+		m5_convert_fail(c, "no thread to run it on");
+		c->c_result = CONVERT_FAILED;
+		m5_convert_release(c);
+	}
+	clock_delay(x->x_clock, CONVERTPOLL);
+}
+
+static void *m5_soundfile_convert_new(void)
+{
+	t_m5SoundfileConvert *x =
+		(t_m5SoundfileConvert *)pd_new(m5_soundfile_convert_class);
+	x->x_canvas = canvas_getcurrent();
+	x->x_out = outlet_new(&x->x_obj, &s_anything);
+	x->x_clock = clock_new(x, (t_method)m5_soundfile_convert_tick);
+	x->x_converts = NULL;
+	return x;
+}
+
+	/** conversions still running are cancelled and left to the pool */
+static void m5_soundfile_convert_free(t_m5SoundfileConvert *x)
+{
+	t_m5Convert *c, *next;
+	for (c = x->x_converts; c; c = next)
+	{
+		next = c->c_next;
+		pthread_mutex_lock(&m5_convert_mutex);
+		c->c_cancel = 1;
+		pthread_mutex_unlock(&m5_convert_mutex);
+		m5_convert_release(c);
+	}
+	clock_free(x->x_clock);
+}
+
+void m5_soundfile_convert_setup(void)
+{
+	m5_soundfile_convert_class = class_new(gensym("m5_soundfile_convert"),
+		(t_newmethod)m5_soundfile_convert_new,
+		(t_method)m5_soundfile_convert_free,
+		sizeof(t_m5SoundfileConvert), 0, 0);
+	class_addmethod(m5_soundfile_convert_class,
+		(t_method)m5_soundfile_convert_convert, gensym("convert"),
+		A_GIMME, 0);
+}
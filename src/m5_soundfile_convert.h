@@ -0,0 +1,35 @@
+/* Copyright (c) 2025 Michael Spears.
+* For information on usage and redistribution, and for a DISCLAIMER OF ALL
+* WARRANTIES, see the file, "LICENSE.txt," in this distribution.  */
+
+#pragma once
+
+#include "m_pd.h"
+
+// m5_soundfile_convert: convert sound files to another type, sample format
+// or sample rate in the background, any number at a time.
+//
+//   convert [-bytes <n>] [-rate <n>] [-big|-little] [-<type>] <in> <out>
+//
+// Without a flag the output keeps the input's sample format and rate, and
+// its type comes from the extension of <out> (.wav if it has none). Each
+// file is converted by the object's own pool of threads, one per spare
+// CPU, so converting a show library keeps the m5_worker.h threads free for
+// writesf~. PCM output is cut into segments of at least
+// M5_CONVERT_MINSEGMENT frames which are converted at the same time, each
+// reading and writing its own part of the files in chunks of
+// M5_CONVERT_CHUNK frames; compressed output is one segment, its encoder
+// spreading the work over its own threads. Files only differing in type
+// have their sample data copied as it is. A new rate is made by windowed
+// sinc interpolation, low-passed below the lower of the two Nyquist
+// frequencies.
+//
+// Conversions are written to "<out>~" and renamed over <out> once
+// complete. The outlet sends "progress <out> <percent>" while one runs and
+// "done <out> <FTC frames>" or "failed <out>" when it is finished.
+
+#define M5_CONVERT_CHUNK 65536           /* frames per read and write */
+#define M5_CONVERT_MINSEGMENT 1048576    /* fewest frames per segment */
+#define M5_CONVERT_MAXTHREADS 8          /* most threads in the pool */
+
+void m5_soundfile_convert_setup(void);
@@ -0,0 +1,507 @@
+/* Copyright (c) 2025 Michael Spears.
+* For information on usage and redistribution, and for a DISCLAIMER OF ALL
+* WARRANTIES, see the file, "LICENSE.txt," in this distribution.  */
+
+	/* copy_file_range() is a GNU extension */
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include <m_pd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "m5_soundfile.h"
+#include "m5_soundfile_edit.h"
+#include "m5_timeanchor.h"
+#include "m5_worker.h"
+#include "g_canvas.h"
+#ifdef __linux__
+#include <sys/sendfile.h>
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || \
+	(__GLIBC__ == 2 && __GLIBC_MINOR__ >= 27))
+#define M5_HAVE_COPY_FILE_RANGE
+#endif
+#endif
+
+/*
+
+	cutting and joining .wav files on a background thread
+
+*/
+
+#define EDIT_PENDING -1
+#define EDIT_FAILED 0
+#define EDIT_OK 1
+
+#define EDITPOLL 100 /* msec between looks at the results */
+
+#define EDITMAXBYTES 0xfffffff0 /* sound data a .wav header can count */
+
+	/* how the sound data is copied, each falling back to the next */
+typedef enum _m5EditCopy
+{
+	COPY_RANGE,   /* copy_file_range(): the file system may share blocks */
+	COPY_SENDFILE, /* sendfile(): stays in the kernel */
+	COPY_BUFFER   /* read() and write() */
+} t_m5EditCopy;
+
+typedef struct _m5EditPiece
+{
+	char p_path[MAXPDSTRING];
+	size_t p_start;       /* first frame */
+	size_t p_nframes;     /* SFMAXFRAMES: to the end of the file */
+} t_m5EditPiece;
+
+typedef struct _m5Edit
+{
+	t_symbol *e_name;     /* <out> as given, for reports */
+	char e_path[MAXPDSTRING];
+	t_m5EditPiece *e_pieces;
+	int e_npieces;
+	int e_refcount;       /* the object's and the worker's */
+	int e_cancel;         /* the object is gone */
+	int e_result;         /* EDIT_PENDING until the worker is done */
+	const char *e_why;    /* for EDIT_FAILED */
+	const char *e_file;   /* the piece it failed on, or NULL */
+	int e_errno;          /* or 0 */
+	size_t e_frames;      /* written, for EDIT_OK */
+	struct _m5Edit *e_next;
+} t_m5Edit;
+
+typedef struct _m5SoundfileEdit
+{
+	t_object x_obj;
+	t_canvas *x_canvas;
+	t_outlet *x_out;
+	t_clock *x_clock;     /* polls x_edits */
+	t_m5Edit *x_edits;    /* submitted, oldest first */
+} t_m5SoundfileEdit;
+
+static t_class *m5_soundfile_edit_class;
+
+	/* guards refcounts, cancel flags and results of all edits */
+static pthread_mutex_t m5_edit_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void m5_edit_release(t_m5Edit *e)
+{
+	int last;
+	pthread_mutex_lock(&m5_edit_mutex);
+	last = !--e->e_refcount;
+	pthread_mutex_unlock(&m5_edit_mutex);
+	if (!last)
+		return;
+	freebytes(e->e_pieces, e->e_npieces * sizeof(t_m5EditPiece));
+	freebytes(e, sizeof(t_m5Edit));
+}
+
+static int m5_edit_cancelled(t_m5Edit *e)
+{
+	int cancel;
+	pthread_mutex_lock(&m5_edit_mutex);
+	cancel = e->e_cancel;
+	pthread_mutex_unlock(&m5_edit_mutex);
+	return cancel;
+}
+
+	/** post the result, errno telling why it failed */
+static void m5_edit_finish(t_m5Edit *e, int result, const char *why)
+{
+	int err = errno;
+	pthread_mutex_lock(&m5_edit_mutex);
+	e->e_result = result;
+	e->e_why = why;
+	e->e_errno = (result == EDIT_OK ? 0 : err);
+	pthread_mutex_unlock(&m5_edit_mutex);
+}
+
+	/** copy size bytes at fromoffset in from to tooffset in to, as cheaply
+		as *how allows; the ways that turn out not to work for these files
+		are dropped from *how for the rest of the edit. returns 0 on error */
+static int m5_edit_copy(t_m5Edit *e, int from, off_t fromoffset, int to,
+	off_t tooffset, size_t size, t_m5EditCopy *how)
+{
+	char *buf = NULL;
+	int ok = 1;
+	while (size > 0 && ok)
+	{
+		size_t want = (size < M5_EDIT_CHUNK ? size : M5_EDIT_CHUNK);
+		ssize_t got = -1;
+		if (m5_edit_cancelled(e))
+		{
+			errno = ECANCELED;
+			ok = 0;
+			break;
+		}
+#ifdef M5_HAVE_COPY_FILE_RANGE
+		if (*how == COPY_RANGE)
+		{
+			loff_t in = fromoffset, out = tooffset;
+			got = copy_file_range(from, &in, to, &out, want, 0);
+			if (got < 0 && (errno == EXDEV || errno == ENOSYS ||
+				errno == EINVAL || errno == EOPNOTSUPP))
+			{
+				*how = COPY_SENDFILE;
+				continue;
+			}
+		}
+#else
+		if (*how == COPY_RANGE)
+			*how = COPY_SENDFILE;
+#endif
+#ifdef __linux__
+		if (*how == COPY_SENDFILE)
+		{
+			off_t in = fromoffset;
+			if (lseek(to, tooffset, SEEK_SET) != tooffset)
+				got = -1;
+			else got = sendfile(to, from, &in, want);
+			if (got < 0 && (errno == EINVAL || errno == ENOSYS))
+			{
+				*how = COPY_BUFFER;
+				continue;
+			}
+		}
+#else
+		if (*how == COPY_SENDFILE)
+			*how = COPY_BUFFER;
+#endif
+		if (*how == COPY_BUFFER)
+		{
+			if (!buf)
+				buf = (char *)getbytes(M5_EDIT_CHUNK);
+			if ((got = m5_fd_read(from, fromoffset, buf, want)) > 0 &&
+				m5_fd_write(to, tooffset, buf, got) != got)
+					got = -1;
+		}
+		if (got <= 0)
+		{
+				/* the file ended before its header said it would */
+			if (got == 0)
+				errno = EIO;
+			ok = 0;
+			break;
+		}
+		fromoffset += got;
+		tooffset += got;
+		size -= got;
+	}
+	if (buf)
+		freebytes(buf, M5_EDIT_CHUNK);
+	return ok;
+}
+
+static int m5_edit_sameformat(const t_soundfile *a, const t_soundfile *b)
+{
+	return a->sf_samplerate == b->sf_samplerate &&
+		a->sf_nchannels == b->sf_nchannels &&
+		a->sf_bytespersample == b->sf_bytespersample &&
+		a->sf_bigendian == b->sf_bigendian;
+}
+
+	/** worker job: open every piece, write the header for all of them to
+		"<out>~", copy their sound data after it and rename the result */
+static void m5_edit_run(void *z)
+{
+	t_m5Edit *e = (t_m5Edit *)z;
+	t_soundfile *in = (t_soundfile *)getbytes(e->e_npieces *
+		sizeof(t_soundfile)), out;
+	char tmp[MAXPDSTRING];
+	t_m5EditCopy how = COPY_RANGE;
+	size_t total = 0, i;
+	const char *why = NULL;
+	ssize_t headersize;
+	off_t at;
+	int fd;
+
+	for (i = 0; i < (size_t)e->e_npieces; i++)
+		m5_soundfile_clear(&in[i]);
+	for (i = 0; i < (size_t)e->e_npieces && !why; i++)
+	{
+		t_m5EditPiece *p = &e->e_pieces[i];
+		t_soundfile *sf = &in[i];
+		size_t nframes;
+		sf->sf_headersize = -1;
+		if ((fd = sys_open(p->p_path, O_RDONLY)) < 0 ||
+			m5_open_soundfile_via_fd(fd, sf, 0) < 0)
+				why = "can't open";
+		else if (strcmp(sf->sf_type->t_name, "wave") || sf->sf_decoder ||
+			!m5_soundfile_isseekable(sf))
+				errno = 0, why = "only .wav files can be edited";
+		else if (i > 0 && !m5_edit_sameformat(sf, &in[0]))
+			errno = 0, why = "files differ in format";
+		else if (sf->sf_bytelimit < 0 ||
+			p->p_start > (size_t)sf->sf_bytelimit / sf->sf_bytesperframe)
+				errno = 0, why = "region starts after the end of the file";
+		else
+		{
+				/* a region running past the end stops there */
+			nframes = (size_t)sf->sf_bytelimit / sf->sf_bytesperframe -
+				p->p_start;
+			if (p->p_nframes > nframes)
+				p->p_nframes = nframes;
+			total += p->p_nframes;
+		}
+	}
+	if (why)
+	{
+		e->e_file = e->e_pieces[i - 1].p_path;
+		goto done;
+	}
+	if ((double)total * in[0].sf_bytesperframe > EDITMAXBYTES)
+	{
+		errno = EFBIG, why = "too long for a .wav file";
+		goto done;
+	}
+
+		/* a fresh header for the whole length, written by the type */
+	if (snprintf(tmp, MAXPDSTRING, "%s~", e->e_path) >= MAXPDSTRING)
+	{
+		errno = ENAMETOOLONG, why = "can't create";
+		goto done;
+	}
+	m5_soundfile_copy(&out, &in[0]);
+	out.sf_stream = NULL;
+	if ((out.sf_fd = sys_open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0)
+	{
+		why = "can't create";
+		goto done;
+	}
+	if ((headersize = out.sf_type->t_writeheaderfn(&out, total)) < 0)
+		why = "can't write the header";
+	at = headersize;
+	for (i = 0; i < (size_t)e->e_npieces && !why; i++)
+	{
+		t_m5EditPiece *p = &e->e_pieces[i];
+		size_t size = p->p_nframes * in[i].sf_bytesperframe;
+		if (!m5_edit_copy(e, in[i].sf_fd, in[i].sf_headersize +
+			(off_t)p->p_start * in[i].sf_bytesperframe, out.sf_fd, at,
+				size, &how))
+					why = (errno == ECANCELED ? "cancelled" : "copy failed");
+		at += size;
+	}
+		/* the header counted the pad byte of odd-sized data */
+	if (!why && (at - headersize) & 1 && m5_fd_write(out.sf_fd, at, "", 1) != 1)
+		why = "copy failed";
+	if (sys_close(out.sf_fd) < 0 && !why)
+		why = "copy failed";
+	for (i = 0; i < (size_t)e->e_npieces; i++)
+		m5_soundfile_close(&in[i]);
+	if (!why)
+	{
+			// rename() won't replace an existing file everywhere
+		if (rename(tmp, e->e_path) < 0)
+		{
+			remove(e->e_path);
+			if (rename(tmp, e->e_path) < 0)
+				why = "can't replace";
+		}
+	}
+	if (why)
+		remove(tmp);
+done:
+	for (i = 0; i < (size_t)e->e_npieces; i++)
+		m5_soundfile_close(&in[i]);
+	freebytes(in, e->e_npieces * sizeof(t_soundfile));
+	e->e_frames = total;
+	m5_edit_finish(e, (why ? EDIT_FAILED : EDIT_OK), why);
+	m5_edit_release(e);
+}
+
+	/** report what has finished, oldest first, and poll again while
+		anything is left */
+static void m5_soundfile_edit_tick(t_m5SoundfileEdit *x)
+{
+	t_m5Edit **ep = &x->x_edits, *e;
+	while ((e = *ep))
+	{
+		int result, err;
+		const char *why, *file;
+		size_t frames;
+		t_m5FrameTimeCode ftc;
+		t_atom at[4];
+		pthread_mutex_lock(&m5_edit_mutex);
+		result = e->e_result;
+		why = e->e_why;
+		file = e->e_file;
+		err = e->e_errno;
+		frames = e->e_frames;
+		pthread_mutex_unlock(&m5_edit_mutex);
+		if (result == EDIT_PENDING)
+		{
+			ep = &e->e_next;
+			continue;
+		}
+		*ep = e->e_next;
+		SETSYMBOL(&at[0], e->e_name);
+		if (result == EDIT_OK)
+		{
+			m5_frame_time_code_from_frames((long)frames, &ftc);
+			SETFLOAT(&at[1], ftc.sign);
+			SETFLOAT(&at[2], ftc.epoch);
+			SETFLOAT(&at[3], ftc.frames);
+			m5_edit_release(e);
+			outlet_anything(x->x_out, gensym("done"), 4, at);
+		}
+		else
+		{
+			pd_error(x, "[m5_soundfile_edit] %s: %s%s%s%s%s",
+				e->e_name->s_name, (file ? file : ""), (file ? ": " : ""),
+				why, (err ? ": " : ""), (err ? m5_soundfile_strerror(err) : ""));
+			m5_edit_release(e);
+			outlet_anything(x->x_out, gensym("failed"), 1, at);
+		}
+			/* the outlet may have queued more */
+		ep = &x->x_edits;
+	}
+	if (x->x_edits)
+		clock_delay(x->x_clock, EDITPOLL);
+}
+
+	/** take the pieces and hand the edit to a worker */
+static void m5_soundfile_edit_submit(t_m5SoundfileEdit *x, t_symbol *out,
+	t_m5EditPiece *pieces, int npieces)
+{
+	t_m5Edit *e = (t_m5Edit *)getbytes(sizeof(t_m5Edit)), **ep;
+	e->e_name = out;
+	canvas_makefilename(x->x_canvas, out->s_name, e->e_path, MAXPDSTRING);
+	e->e_pieces = pieces;
+	e->e_npieces = npieces;
+	e->e_refcount = 2;
+	e->e_result = EDIT_PENDING;
+	for (ep = &x->x_edits; *ep; ep = &(*ep)->e_next)
+		;
+	*ep = e;
+	if (!m5_worker_submit(m5_edit_run, e))
+	{
+		errno = 0;
+		m5_edit_finish(e, EDIT_FAILED, "no thread to run it on");
+		m5_edit_release(e);
+	}
+	clock_delay(x->x_clock, EDITPOLL);
+}
+
+	/** one piece: a file, optionally with start and length FTCs at argv */
+static int m5_soundfile_edit_piece(t_m5SoundfileEdit *x, t_m5EditPiece *p,
+	t_symbol *file, int argc, t_atom *argv)
+{
+	t_m5FrameTimeCode ftc;
+	long start = 0, length = -1;
+	canvas_makefilename(x->x_canvas, file->s_name, p->p_path, MAXPDSTRING);
+	if (argc)
+	{
+		if (argc != 6 || m5_frame_time_code_from_atoms(3, argv, &ftc) ||
+			(start = m5_frames_from_time_code(&ftc)) < 0 ||
+			m5_frame_time_code_from_atoms(3, argv + 3, &ftc) ||
+			(length = m5_frames_from_time_code(&ftc)) <= 0)
+		{
+			pd_error(x, "m5_soundfile_edit: a region is a start >= 0 and a length > 0, two frame time codes of three floats... 1|-1, epoch, frames.");
+			return 0;
+		}
+	}
+	p->p_start = start;
+	p->p_nframes = (length < 0 ? SFMAXFRAMES : (size_t)length);
+	return 1;
+}
+
+	/** copy <out> <in> <FTC start> <FTC length> */
+static void m5_soundfile_edit_copy(t_m5SoundfileEdit *x, t_symbol *s,
+	int argc, t_atom *argv)
+{
+	t_m5EditPiece *p;
+	if (argc != 8 || argv[0].a_type != A_SYMBOL || argv[1].a_type != A_SYMBOL)
+	{
+		pd_error(x, "m5_soundfile_edit: usage: copy <out> <in> <FTC start> <FTC length>");
+		return;
+	}
+	p = (t_m5EditPiece *)getbytes(sizeof(t_m5EditPiece));
+	if (!m5_soundfile_edit_piece(x, p, argv[1].a_w.w_symbol, 6, argv + 2))
+	{
+		freebytes(p, sizeof(t_m5EditPiece));
+		return;
+	}
+	m5_soundfile_edit_submit(x, argv[0].a_w.w_symbol, p, 1);
+}
+
+	/** trim <file> <FTC start> <FTC length>: copy onto itself */
+static void m5_soundfile_edit_trim(t_m5SoundfileEdit *x, t_symbol *s,
+	int argc, t_atom *argv)
+{
+	t_m5EditPiece *p;
+	if (argc != 7 || argv[0].a_type != A_SYMBOL)
+	{
+		pd_error(x, "m5_soundfile_edit: usage: trim <file> <FTC start> <FTC length>");
+		return;
+	}
+	p = (t_m5EditPiece *)getbytes(sizeof(t_m5EditPiece));
+	if (!m5_soundfile_edit_piece(x, p, argv[0].a_w.w_symbol, 6, argv + 1))
+	{
+		freebytes(p, sizeof(t_m5EditPiece));
+		return;
+	}
+	m5_soundfile_edit_submit(x, argv[0].a_w.w_symbol, p, 1);
+}
+
+	/** concat <out> <in> <in> ... */
+static void m5_soundfile_edit_concat(t_m5SoundfileEdit *x, t_symbol *s,
+	int argc, t_atom *argv)
+{
+	t_m5EditPiece *p;
+	int i;
+	if (argc < 2)
+	{
+		pd_error(x, "m5_soundfile_edit: usage: concat <out> <in> <in> ...");
+		return;
+	}
+	for (i = 0; i < argc; i++)
+		if (argv[i].a_type != A_SYMBOL)
+	{
+		pd_error(x, "m5_soundfile_edit: concat takes file names only");
+		return;
+	}
+	p = (t_m5EditPiece *)getbytes((argc - 1) * sizeof(t_m5EditPiece));
+	for (i = 1; i < argc; i++)
+		m5_soundfile_edit_piece(x, &p[i - 1], argv[i].a_w.w_symbol, 0, 0);
+	m5_soundfile_edit_submit(x, argv[0].a_w.w_symbol, p, argc - 1);
+}
+
+static void *m5_soundfile_edit_new(void)
+{
+	t_m5SoundfileEdit *x =
+		(t_m5SoundfileEdit *)pd_new(m5_soundfile_edit_class);
+	x->x_canvas = canvas_getcurrent();
+	x->x_out = outlet_new(&x->x_obj, &s_anything);
+	x->x_clock = clock_new(x, (t_method)m5_soundfile_edit_tick);
+	x->x_edits = NULL;
+	return x;
+}
+
+	/** edits still running are cancelled and left to their workers */
+static void m5_soundfile_edit_free(t_m5SoundfileEdit *x)
+{
+	t_m5Edit *e, *next;
+	for (e = x->x_edits; e; e = next)
+	{
+		next = e->e_next;
+		pthread_mutex_lock(&m5_edit_mutex);
+		e->e_cancel = 1;
+		pthread_mutex_unlock(&m5_edit_mutex);
+		m5_edit_release(e);
+	}
+	clock_free(x->x_clock);
+}
+
+void m5_soundfile_edit_setup(void)
+{
+	m5_soundfile_edit_class = class_new(gensym("m5_soundfile_edit"),
+		(t_newmethod)m5_soundfile_edit_new,
+		(t_method)m5_soundfile_edit_free,
+		sizeof(t_m5SoundfileEdit), 0, 0);
+	class_addmethod(m5_soundfile_edit_class,
+		(t_method)m5_soundfile_edit_copy, gensym("copy"), A_GIMME, 0);
+	class_addmethod(m5_soundfile_edit_class,
+		(t_method)m5_soundfile_edit_trim, gensym("trim"), A_GIMME, 0);
+	class_addmethod(m5_soundfile_edit_class,
+		(t_method)m5_soundfile_edit_concat, gensym("concat"), A_GIMME, 0);
+}
@@ -0,0 +1,25 @@
+/* Copyright (c) 2025 Michael Spears.
+* For information on usage and redistribution, and for a DISCLAIMER OF ALL
+* WARRANTIES, see the file, "LICENSE.txt," in this distribution.  */
+
+#pragma once
+
+#include "m_pd.h"
+
+// m5_soundfile_edit: cut and join PCM .wav files without decoding them.
+//
+//   copy <out> <in> <FTC start> <FTC length>   a region of one file
+//   trim <file> <FTC start> <FTC length>       keep only that region
+//   concat <out> <in> <in> ...                 files of the same format
+//
+// Each edit runs on a background worker (m5_worker.h). The sound data is
+// copied between the files by the kernel where it can (copy_file_range(),
+// then sendfile() on Linux), else read and written in chunks, and the new
+// file gets a fresh header from the wave type's header writer. Edits are
+// written to "<out>~" and renamed over <out> once complete, so a file
+// trimmed in place is never left half done. When an edit is finished the
+// outlet sends "done <out> <FTC frames>" or "failed <out>".
+
+#define M5_EDIT_CHUNK (16 * 1024 * 1024) /* bytes per copy call */
+
+void m5_soundfile_edit_setup(void);
@@ -0,0 +1,1640 @@
+/* Copyright (c) 2025 Michael Spears.
+* For information on usage and redistribution, and for a DISCLAIMER OF ALL
+* WARRANTIES, see the file, "LICENSE.txt," in this distribution.  */
+
+/* ref: https://xiph.org/flac/format.html, RFC 9639 */
+
+#include "m5_soundfile.h"
+#include "m5_bitcoder.h"
+#include <stdint.h>
+#include <pthread.h>
+
+/* FLAC (Free Lossless Audio Codec)
+
+  * "fLaC" marker, then metadata blocks, then audio frames
+  * STREAMINFO metadata block is required and comes first
+  * frames hold a block of samples for every channel, each channel coded as
+    a "subframe": constant, verbatim, fixed or LPC prediction with a
+    Rice-coded residual
+  * stereo frames may store left/side, side/right or mid/side channels
+  * all integers are big endian and bit-packed
+  * 1 - 8 channels, 4 - 32 bits per sample
+
+  this implementation:
+
+  * writes 16 or 24 bit files in fixed blocks of 4096 samples, with fixed
+    (not LPC) prediction and stereo decorrelation; blocks are encoded by a
+    pool of worker threads shared by all writers and written in order by
+    the writer's I/O thread, and the header (length, frame sizes and a
+    seek table reserved up front) is rewritten when the file is closed
+  * reserves a PADDING block at the end of the header which writesf~
+    -checksum turns into an APPLICATION block "m5ck" holding a CRC-32C of
+    the sound data
+  * decodes in the thread that calls m5_soundfile_read(), i.e. readsf~'s
+    I/O thread: the file is presented as native-endian 16 bit, 24 bit or
+    (for more than 24 bits) 32 bit float PCM starting at offset 0, so the
+    rest of the code reads it like any other sound file
+  * seeks with the SEEKTABLE block if there is one, and otherwise with an
+    index of the frames it has decoded so far
+  * verifies the frame header CRC-8 and frame CRC-16, and resyncs to the
+    next frame after a damaged one
+  * streamed files (pipes) are decoded as they arrive; if STREAMINFO gives
+    no length they are read until they end
+  * ignores all other metadata blocks (tags, cue sheets, pictures, ...)
+
+*/
+
+#define FLACMARKERSIZE  4 /**< "fLaC" */
+#define FLACBLOCKHDRSIZE 4 /**< metadata block header */
+#define FLACSTREAMINFOSIZE 34
+#define FLACSEEKPOINTSIZE 18
+
+#define FLAC_STREAMINFO 0
+#define FLAC_PADDING    1
+#define FLAC_APPLICATION 2
+#define FLAC_SEEKTABLE  3
+
+#define FLACMAXCHANS 8
+#define FLACMAXLPCORDER 32
+
+    /** skip decoding frame after frame if the seek is further than this
+        many blocks ahead, and use the index instead */
+#define FLACSEEKAHEAD 8
+
+    /** smallest raw read, frames are read in windows at least this large */
+#define FLACMINWINDOW 65536
+
+    /** placeholder seek point */
+#define FLACSEEKPLACEHOLDER 0xffffffffffffffffULL
+
+    /** seek point: stream sample and the file offset of its frame */
+typedef struct _flacpoint
+{
+    uint64_t p_sample;
+    off_t p_offset;
+} t_flacpoint;
+
+    /** decoder state, sf->sf_decoder */
+typedef struct _flacdecoder
+{
+        /* STREAMINFO */
+    int d_minblock;
+    int d_maxblock;
+    int d_samplerate;
+    int d_nchannels;
+    int d_bps;
+    uint64_t d_nsamples;       /**< total samples per channel, 0: unknown */
+    off_t d_firstframe;        /**< file offset of the first frame        */
+        /* seek index, sorted by sample */
+    t_flacpoint *d_index;
+    int d_nindex;
+    int d_indexsize;
+        /* raw file window */
+    unsigned char *d_raw;      /**< d_rawsize + 8 bytes of zero padding   */
+    size_t d_rawsize;
+    off_t d_rawoffset;
+    size_t d_rawbytes;
+    int d_raweof;              /**< window reaches the end of the file    */
+    size_t d_maxframe;         /**< upper bound on a frame's size         */
+        /* current decoded block */
+    int32_t *d_block;          /**< d_maxblock samples per channel        */
+    uint64_t d_blocksample;    /**< stream sample of d_block[0]           */
+    int d_blocklen;            /**< 0 if nothing decoded                  */
+    off_t d_nextframe;         /**< file offset after the decoded frame   */
+    int d_outbytes;            /**< bytes per output sample: 2, 3, or 4   */
+} t_flacdecoder;
+
+/* ----- CRC ----- */
+
+static uint8_t m5_flac_crc8(const unsigned char *buf, size_t size)
+{
+    uint8_t crc = 0;
+    int i;
+    while (size--)
+    {
+        crc ^= *buf++;
+        for (i = 0; i < 8; i++)
+            crc = (crc & 0x80 ? (crc << 1) ^ 0x07 : crc << 1);
+    }
+    return crc;
+}
+
+static uint16_t m5_flac_crc16(const unsigned char *buf, size_t size)
+{
+    static uint16_t table[256];
+    static int init = 0;
+    uint16_t crc = 0;
+    if (!init)
+    {
+        int i, j;
+        for (i = 0; i < 256; i++)
+        {
+            uint16_t c = i << 8;
+            for (j = 0; j < 8; j++)
+                c = (c & 0x8000 ? (c << 1) ^ 0x8005 : c << 1);
+            table[i] = c;
+        }
+        init = 1;
+    }
+    while (size--)
+        crc = (crc << 8) ^ table[(crc >> 8) ^ *buf++];
+    return crc;
+}
+
+/* ----- bit reader ----- */
+
+    /** reads big-endian bit fields out of a byte buffer, which must be
+        followed by 8 readable bytes; overruns set br_err */
+typedef struct _bitreader
+{
+    const unsigned char *br_buf;
+    size_t br_size;            /**< in bytes */
+    size_t br_pos;             /**< in bits  */
+    int br_err;
+} t_bitreader;
+
+static uint64_t m5_br_peek64(const t_bitreader *br)
+{
+    const unsigned char *p = br->br_buf + (br->br_pos >> 3);
+    uint64_t v = ((uint64_t)p[0] << 56) | ((uint64_t)p[1] << 48) |
+                 ((uint64_t)p[2] << 40) | ((uint64_t)p[3] << 32) |
+                 ((uint64_t)p[4] << 24) | ((uint64_t)p[5] << 16) |
+                 ((uint64_t)p[6] << 8) | (uint64_t)p[7];
+    return v << (br->br_pos & 7);
+}
+
+    /** read n <= 32 bits unsigned */
+static uint32_t m5_br_bits(t_bitreader *br, int n)
+{
+    uint32_t v;
+    if (!n)
+        return 0;
+    if (br->br_pos + n > br->br_size * 8)
+    {
+        br->br_err = 1;
+        br->br_pos = br->br_size * 8;
+        return 0;
+    }
+    v = (uint32_t)(m5_br_peek64(br) >> (64 - n));
+    br->br_pos += n;
+    return v;
+}
+
+    /** read n <= 32 bits two's complement */
+static int32_t m5_br_sbits(t_bitreader *br, int n)
+{
+    uint32_t v = m5_br_bits(br, n);
+    if (n && n < 32 && (v & (1u << (n - 1))))
+        v |= ~0u << n;
+    return (int32_t)v;
+}
+
+    /** count zero bits up to the next one bit, and skip them all */
+static uint32_t m5_br_unary(t_bitreader *br)
+{
+    uint32_t n = 0;
+    while (1)
+    {
+        uint64_t v;
+        int avail = 57;
+        if (br->br_pos >= br->br_size * 8)
+        {
+            br->br_err = 1;
+            return n;
+        }
+        v = m5_br_peek64(br) >> 7 << 7; /* 57 bits are always valid */
+        if (v)
+        {
+            int z = __builtin_clzll(v);
+            br->br_pos += z + 1;
+            if (br->br_pos > br->br_size * 8)
+                br->br_err = 1;
+            return n + z;
+        }
+        br->br_pos += avail;
+        n += avail;
+    }
+}
+
+static void m5_br_align(t_bitreader *br)
+{
+    br->br_pos = (br->br_pos + 7) & ~(size_t)7;
+}
+
+/* ----- index ----- */
+
+static void m5_flac_addpoint(t_flacdecoder *d, uint64_t sample, off_t offset)
+{
+    int lo = 0, hi = d->d_nindex;
+        /* find the insertion point, skipping if already known */
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (d->d_index[mid].p_sample < sample)
+            lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo < d->d_nindex && d->d_index[lo].p_sample == sample)
+        return;
+    if (d->d_nindex == d->d_indexsize)
+    {
+        int newsize = (d->d_indexsize ? 2 * d->d_indexsize : 64);
+        t_flacpoint *p = (t_flacpoint *)resizebytes(d->d_index,
+            d->d_indexsize * sizeof(t_flacpoint), newsize * sizeof(t_flacpoint));
+        if (!p)
+            return;
+        d->d_index = p;
+        d->d_indexsize = newsize;
+    }
+    memmove(d->d_index + lo + 1, d->d_index + lo,
+        (d->d_nindex - lo) * sizeof(t_flacpoint));
+    d->d_index[lo].p_sample = sample;
+    d->d_index[lo].p_offset = offset;
+    d->d_nindex++;
+}
+
+    /** last index point at or before sample */
+static const t_flacpoint *m5_flac_findpoint(const t_flacdecoder *d,
+    uint64_t sample)
+{
+    int lo = 0, hi = d->d_nindex;
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (d->d_index[mid].p_sample <= sample)
+            lo = mid + 1;
+        else hi = mid;
+    }
+    return (lo ? &d->d_index[lo - 1] : NULL);
+}
+
+/* ----- raw window ----- */
+
+    /** make sure the window holds d_maxframe bytes from offset (or all of
+        them up to the end of the file), returns 0 on read error */
+static int m5_flac_window(t_soundfile *sf, t_flacdecoder *d, off_t offset)
+{
+    ssize_t got;
+    if (offset >= d->d_rawoffset &&
+        (offset + (off_t)d->d_maxframe <= d->d_rawoffset + (off_t)d->d_rawbytes ||
+            (d->d_raweof && offset <= d->d_rawoffset + (off_t)d->d_rawbytes)))
+        return 1;
+    got = m5_soundfile_readraw(sf, offset, d->d_raw, d->d_rawsize);
+    if (got < 0)
+        return 0;
+    d->d_rawoffset = offset;
+    d->d_rawbytes = got;
+    d->d_raweof = ((size_t)got < d->d_rawsize);
+    memset(d->d_raw + got, 0, 8);
+    return 1;
+}
+
+/* ----- frame decoding ----- */
+
+static const int m5_flac_blocksizes[16] = {
+    0, 192, 576, 1152, 2304, 4608, 0, 0,
+    256, 512, 1024, 2048, 4096, 8192, 16384, 32768
+};
+
+static const int m5_flac_samplesizes[8] = {0, 8, 12, 0, 16, 20, 24, 32};
+
+    /** parsed frame header */
+typedef struct _flacframe
+{
+    int f_blocksize;
+    int f_bps;
+    int f_assignment;          /**< 0-7: independent, 8-10: stereo modes */
+    int f_nchannels;
+    uint64_t f_sample;         /**< stream sample of the first sample     */
+    size_t f_headersize;       /**< bytes, including the CRC-8            */
+} t_flacframe;
+
+    /** parse a frame header at buf, returns 0 if it isn't one */
+static int m5_flac_readframeheader(const t_flacdecoder *d,
+    const unsigned char *buf, size_t size, t_flacframe *f)
+{
+    t_bitreader br = {buf, size, 0, 0};
+    int variable, bscode, srcode, sscode, i, n;
+    uint64_t num;
+    uint32_t c;
+
+    if (size < 6 || buf[0] != 0xff || (buf[1] & 0xfe) != 0xf8)
+        return 0;
+    br.br_pos = 15;
+    variable = m5_br_bits(&br, 1);
+    bscode = m5_br_bits(&br, 4);
+    srcode = m5_br_bits(&br, 4);
+    f->f_assignment = m5_br_bits(&br, 4);
+    sscode = m5_br_bits(&br, 3);
+    if (m5_br_bits(&br, 1) || !bscode || srcode == 15 ||
+        f->f_assignment > 10 || sscode == 3)
+            return 0;
+
+        /* "UTF-8" coded frame or sample number */
+    c = m5_br_bits(&br, 8);
+    if (!(c & 0x80))
+        num = c, n = 0;
+    else if ((c & 0xe0) == 0xc0)
+        num = c & 0x1f, n = 1;
+    else if ((c & 0xf0) == 0xe0)
+        num = c & 0x0f, n = 2;
+    else if ((c & 0xf8) == 0xf0)
+        num = c & 0x07, n = 3;
+    else if ((c & 0xfc) == 0xf8)
+        num = c & 0x03, n = 4;
+    else if ((c & 0xfe) == 0xfc)
+        num = c & 0x01, n = 5;
+    else if (c == 0xfe)
+        num = 0, n = 6;
+    else return 0;
+    for (i = 0; i < n; i++)
+    {
+        c = m5_br_bits(&br, 8);
+        if ((c & 0xc0) != 0x80)
+            return 0;
+        num = (num << 6) | (c & 0x3f);
+    }
+
+    if (bscode == 6)
+        f->f_blocksize = m5_br_bits(&br, 8) + 1;
+    else if (bscode == 7)
+        f->f_blocksize = m5_br_bits(&br, 16) + 1;
+    else f->f_blocksize = m5_flac_blocksizes[bscode];
+    if (srcode == 12)
+        m5_br_bits(&br, 8);
+    else if (srcode == 13 || srcode == 14)
+        m5_br_bits(&br, 16);
+    if (br.br_err)
+        return 0;
+    if (m5_flac_crc8(buf, br.br_pos / 8) != m5_br_bits(&br, 8) || br.br_err)
+        return 0;
+
+    f->f_bps = (sscode ? m5_flac_samplesizes[sscode] : d->d_bps);
+    f->f_nchannels = (f->f_assignment < 8 ? f->f_assignment + 1 : 2);
+    if (f->f_nchannels != d->d_nchannels || f->f_blocksize > d->d_maxblock ||
+        f->f_bps != d->d_bps)
+            return 0;
+    f->f_sample = (variable ? num : num * d->d_maxblock);
+    f->f_headersize = br.br_pos / 8;
+    return 1;
+}
+
+    /** decode a partitioned Rice residual into out[order .. blocksize) */
+static int m5_flac_residual(t_bitreader *br, int32_t *out, int blocksize,
+    int order)
+{
+    int method = m5_br_bits(br, 2), parambits, escape, porder, nparts, p, i;
+    if (method > 1)
+        return 0;
+    parambits = (method ? 5 : 4);
+    escape = (1 << parambits) - 1;
+    porder = m5_br_bits(br, 4);
+    nparts = 1 << porder;
+    if ((blocksize >> porder) < order || (blocksize & (nparts - 1)))
+        return 0;
+    i = order;
+    for (p = 0; p < nparts; p++)
+    {
+        int param = m5_br_bits(br, parambits),
+            end = (p + 1) * (blocksize >> porder);
+        if (param == escape)
+        {
+            int nbits = m5_br_bits(br, 5);
+            for (; i < end; i++)
+                out[i] = m5_br_sbits(br, nbits);
+        }
+        else for (; i < end; i++)
+        {
+            uint32_t q = m5_br_unary(br), v = (q << param) | m5_br_bits(br, param);
+            out[i] = (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+        }
+        if (br->br_err)
+            return 0;
+    }
+    return 1;
+}
+
+    /** decode one subframe of blocksize samples at bps bits into out */
+static int m5_flac_subframe(t_bitreader *br, int32_t *out, int blocksize,
+    int bps)
+{
+    int type, wasted = 0, i, j;
+    if (m5_br_bits(br, 1) || bps > 32)
+        return 0;
+    type = m5_br_bits(br, 6);
+    if (m5_br_bits(br, 1))
+    {
+        wasted = m5_br_unary(br) + 1;
+        bps -= wasted;
+        if (bps < 1)
+            return 0;
+    }
+
+    if (type == 0) /* constant */
+    {
+        int32_t v = m5_br_sbits(br, bps);
+        for (i = 0; i < blocksize; i++)
+            out[i] = v;
+    }
+    else if (type == 1) /* verbatim */
+    {
+        for (i = 0; i < blocksize; i++)
+            out[i] = m5_br_sbits(br, bps);
+    }
+    else if (type >= 8 && type <= 12) /* fixed predictor */
+    {
+        int order = type & 7;
+        if (order > blocksize)
+            return 0;
+        for (i = 0; i < order; i++)
+            out[i] = m5_br_sbits(br, bps);
+        if (!m5_flac_residual(br, out, blocksize, order))
+            return 0;
+            /* 64 bit: 32 bit streams may overflow, damaged ones too */
+        switch (order)
+        {
+        case 1:
+            for (i = 1; i < blocksize; i++)
+                out[i] = (int32_t)((int64_t)out[i] + out[i-1]);
+            break;
+        case 2:
+            for (i = 2; i < blocksize; i++)
+                out[i] = (int32_t)((int64_t)out[i] + 2 * (int64_t)out[i-1] -
+                    out[i-2]);
+            break;
+        case 3:
+            for (i = 3; i < blocksize; i++)
+                out[i] = (int32_t)((int64_t)out[i] + 3 * (int64_t)out[i-1] -
+                    3 * (int64_t)out[i-2] + out[i-3]);
+            break;
+        case 4:
+            for (i = 4; i < blocksize; i++)
+                out[i] = (int32_t)((int64_t)out[i] + 4 * (int64_t)out[i-1] -
+                    6 * (int64_t)out[i-2] + 4 * (int64_t)out[i-3] - out[i-4]);
+            break;
+        }
+    }
+    else if (type >= 32) /* LPC */
+    {
+        int order = (type & 31) + 1, precision, shift;
+        int32_t coefs[FLACMAXLPCORDER];
+        if (order > blocksize)
+            return 0;
+        for (i = 0; i < order; i++)
+            out[i] = m5_br_sbits(br, bps);
+        precision = m5_br_bits(br, 4) + 1;
+        shift = m5_br_sbits(br, 5);
+        if (precision == 16 || shift < 0)
+            return 0;
+        for (i = 0; i < order; i++)
+            coefs[i] = m5_br_sbits(br, precision);
+        if (!m5_flac_residual(br, out, blocksize, order))
+            return 0;
+        for (i = order; i < blocksize; i++)
+        {
+            int64_t sum = 0;
+            for (j = 0; j < order; j++)
+                sum += (int64_t)coefs[j] * out[i - j - 1];
+            out[i] = (int32_t)((int64_t)out[i] + (sum >> shift));
+        }
+    }
+    else return 0; /* reserved */
+
+    if (wasted)
+        for (i = 0; i < blocksize; i++)
+            out[i] = (int32_t)((uint32_t)out[i] << wasted);
+    return !br->br_err;
+}
+
+    /** decode the frame at offset into d_block, returns 1 on success,
+        0 if there's no valid frame there, or -1 on a read error */
+static int m5_flac_decodeframe(t_soundfile *sf, t_flacdecoder *d,
+    off_t offset)
+{
+    t_flacframe f;
+    t_bitreader br;
+    const unsigned char *buf;
+    size_t size;
+    int ch, i;
+
+    if (!m5_flac_window(sf, d, offset))
+        return -1;
+    buf = d->d_raw + (offset - d->d_rawoffset);
+    size = d->d_rawbytes - (offset - d->d_rawoffset);
+    if (!m5_flac_readframeheader(d, buf, size, &f))
+        return 0;
+
+    br.br_buf = buf;
+    br.br_size = size;
+    br.br_pos = f.f_headersize * 8;
+    br.br_err = 0;
+    for (ch = 0; ch < f.f_nchannels; ch++)
+    {
+        int bps = f.f_bps;
+            /* the side channel has one more bit */
+        if ((f.f_assignment == 8 && ch == 1) ||
+            (f.f_assignment == 9 && ch == 0) ||
+            (f.f_assignment == 10 && ch == 1))
+                bps++;
+        if (!m5_flac_subframe(&br, d->d_block + ch * d->d_maxblock,
+            f.f_blocksize, bps))
+                return 0;
+    }
+    m5_br_align(&br);
+    if (br.br_pos / 8 + 2 > size ||
+        m5_flac_crc16(buf, br.br_pos / 8) != m5_br_bits(&br, 16))
+            return 0;
+
+    if (f.f_assignment >= 8)
+    {
+        int32_t *a = d->d_block, *b = d->d_block + d->d_maxblock;
+        for (i = 0; i < f.f_blocksize; i++)
+        {
+            if (f.f_assignment == 8)       /* left, side */
+                b[i] = (int32_t)((int64_t)a[i] - b[i]);
+            else if (f.f_assignment == 9)  /* side, right */
+                a[i] = (int32_t)((int64_t)a[i] + b[i]);
+            else                           /* mid, side */
+            {
+                int64_t mid = (int64_t)a[i] * 2 + (b[i] & 1), side = b[i];
+                a[i] = (int32_t)((mid + side) >> 1);
+                b[i] = (int32_t)((mid - side) >> 1);
+            }
+        }
+    }
+
+    d->d_blocksample = f.f_sample;
+    d->d_blocklen = f.f_blocksize;
+    d->d_nextframe = offset + br.br_pos / 8;
+    m5_flac_addpoint(d, f.f_sample, offset);
+    return 1;
+}
+
+    /** decode the next frame at or after offset, skipping damaged data,
+        returns 1 on success, 0 at the end of the file, or -1 on error */
+static int m5_flac_decodenext(t_soundfile *sf, t_flacdecoder *d, off_t offset)
+{
+    while (1)
+    {
+        int ret = m5_flac_decodeframe(sf, d, offset);
+        const unsigned char *p, *end;
+        if (ret)
+            return ret;
+            /* resync: look for the next frame sync code */
+        p = d->d_raw + (offset - d->d_rawoffset) + 1;
+        end = d->d_raw + d->d_rawbytes;
+        while (p + 1 < end && !(p[0] == 0xff && (p[1] & 0xfe) == 0xf8))
+            p++;
+        offset = d->d_rawoffset + (p - d->d_raw);
+        if (p + 1 >= end)
+        {
+            if (d->d_raweof)
+                return 0;
+                /* keep looking in the next window */
+            if (!m5_flac_window(sf, d, offset))
+                return -1;
+            if (d->d_rawbytes < 2)
+                return 0;
+        }
+    }
+}
+
+    /** make d_block hold the given sample, returns 1 on success, 2 if
+        damaged frames were skipped and d_block starts after it, 0 if it's
+        past the end of the file, or -1 on error */
+static int m5_flac_seek(t_soundfile *sf, t_flacdecoder *d, uint64_t sample)
+{
+    const t_flacpoint *p;
+    off_t offset;
+    int ret;
+
+    if (d->d_blocklen && sample >= d->d_blocksample &&
+        sample < d->d_blocksample + d->d_blocklen)
+            return 1;
+
+        /* start from the index, unless reading on from where we are is
+        quicker */
+    p = m5_flac_findpoint(d, sample);
+    if (d->d_blocklen && sample >= d->d_blocksample + d->d_blocklen &&
+        (!p || p->p_sample <= d->d_blocksample ||
+            sample < d->d_blocksample + FLACSEEKAHEAD * (uint64_t)d->d_maxblock))
+                offset = d->d_nextframe;
+    else offset = (p ? p->p_offset : d->d_firstframe);
+
+    while (1)
+    {
+        if ((ret = m5_flac_decodenext(sf, d, offset)) <= 0)
+        {
+            d->d_blocklen = 0;
+            return ret;
+        }
+        if (sample < d->d_blocksample + d->d_blocklen)
+            return (sample >= d->d_blocksample ? 1 : 2);
+        offset = d->d_nextframe;
+    }
+}
+
+    /** write nframes interleaved frames from d_block, starting at block
+        frame pos, as native-endian PCM */
+static void m5_flac_pack(const t_flacdecoder *d, unsigned char *dst,
+    int pos, int nframes)
+{
+    int ch, i, nch = d->d_nchannels, bps = d->d_bps, big = m5_sys_isbigendian();
+    for (i = pos; i < pos + nframes; i++)
+        for (ch = 0; ch < nch; ch++)
+    {
+        int32_t v = d->d_block[ch * d->d_maxblock + i];
+        if (d->d_outbytes == 2)
+        {
+            int16_t s = (int16_t)((uint32_t)v << (16 - bps));
+            memcpy(dst, &s, 2);
+            dst += 2;
+        }
+        else if (d->d_outbytes == 3)
+        {
+            int32_t s = (int32_t)((uint32_t)v << (24 - bps));
+            if (big)
+                dst[0] = s >> 16, dst[1] = s >> 8, dst[2] = s;
+            else dst[0] = s, dst[1] = s >> 8, dst[2] = s >> 16;
+            dst += 3;
+        }
+        else
+        {
+            float s = (float)((double)v / (double)(1ULL << (bps - 1)));
+            memcpy(dst, &s, 4);
+            dst += 4;
+        }
+    }
+}
+
+static ssize_t m5_flac_decode(t_soundfile *sf, off_t offset, void *dst,
+    size_t size)
+{
+    t_flacdecoder *d = (t_flacdecoder *)sf->sf_decoder;
+    int bpf = sf->sf_bytesperframe;
+    unsigned char *out = (unsigned char *)dst;
+    size_t done = 0;
+
+    offset -= sf->sf_headersize;
+    if (offset < 0)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    while (done < size)
+    {
+        uint64_t sample = (offset + done) / bpf;
+        size_t skip = (offset + done) % bpf;
+        int pos, n, ret;
+        if (d->d_nsamples && sample >= d->d_nsamples)
+            break;
+        if ((ret = m5_flac_seek(sf, d, sample)) < 0)
+            return (done ? (ssize_t)done : -1);
+        if (!ret)
+            break;
+        if (ret == 2)
+        {
+                /* silence in place of what couldn't be decoded */
+            size_t nbytes = (d->d_blocksample - sample) * bpf - skip;
+            if (nbytes > size - done)
+                nbytes = size - done;
+            memset(out + done, 0, nbytes);
+            done += nbytes;
+            continue;
+        }
+        pos = sample - d->d_blocksample;
+        if (skip || size - done < (size_t)bpf)
+        {
+                /* a partial frame */
+            unsigned char frame[FLACMAXCHANS * 4];
+            size_t nbytes = bpf - skip;
+            if (nbytes > size - done)
+                nbytes = size - done;
+            m5_flac_pack(d, frame, pos, 1);
+            memcpy(out + done, frame + skip, nbytes);
+            done += nbytes;
+            continue;
+        }
+        n = d->d_blocklen - pos;
+        if ((size_t)n > (size - done) / bpf)
+            n = (size - done) / bpf;
+        if (d->d_nsamples && sample + n > d->d_nsamples)
+            n = d->d_nsamples - sample;
+        m5_flac_pack(d, out + done, pos, n);
+        done += n * bpf;
+    }
+    return done;
+}
+
+static void m5_flac_freedecoder(t_soundfile *sf)
+{
+    t_flacdecoder *d = (t_flacdecoder *)sf->sf_decoder;
+    if (!d)
+        return;
+    if (d->d_index)
+        freebytes(d->d_index, d->d_indexsize * sizeof(t_flacpoint));
+    if (d->d_raw)
+        freebytes(d->d_raw, d->d_rawsize + 8);
+    if (d->d_block)
+        freebytes(d->d_block, d->d_nchannels * d->d_maxblock * sizeof(int32_t));
+    freebytes(d, sizeof(t_flacdecoder));
+    sf->sf_decoder = NULL;
+}
+
+/* ------------------------- encoder ------------------------- */
+
+    /** samples per channel in each written frame */
+#define FLACENCBLOCK 4096
+
+    /** frames one encoder can have in flight: filling, queued, being
+        encoded or waiting to be written in order */
+#define FLACENCJOBS 16
+
+    /** most threads in the shared encoding pool */
+#define FLACENCMAXTHREADS 8
+
+    /** seek points reserved in the header of a written file */
+#define FLACENCSEEKPOINTS 512
+
+    /** highest residual partition order tried */
+#define FLACENCMAXPORDER 8
+
+    /** "m5ck" APPLICATION block: id, version, flags, CRC-32C, data bytes */
+#define FLACCHECKSIZE (4 + 2 + 2 + 4 + 8)
+
+    /** header of a written file: marker, STREAMINFO, SEEKTABLE and room
+        for the checksum block */
+#define FLACENCHEADERSIZE (FLACMARKERSIZE + \
+    FLACBLOCKHDRSIZE + FLACSTREAMINFOSIZE + \
+    FLACBLOCKHDRSIZE + FLACENCSEEKPOINTS * FLACSEEKPOINTSIZE + \
+    FLACBLOCKHDRSIZE + FLACCHECKSIZE)
+
+#define FLACJOB_FREE   0 /**< can be filled by the writer thread  */
+#define FLACJOB_QUEUED 1 /**< with the pool: waiting or encoding  */
+#define FLACJOB_DONE   2 /**< encoded, waiting to be written      */
+
+struct _flacencoder;
+
+    /** one block of samples and, once encoded, its frame */
+typedef struct _flacjob
+{
+    struct _flacencoder *j_encoder;
+    struct _flacjob *j_next;   /**< pool queue                            */
+    int j_state;               /**< guarded by the pool mutex once queued */
+    uint64_t j_frame;          /**< frame number                          */
+    int j_blocksize;
+    int32_t *j_in;             /**< FLACENCBLOCK samples per channel      */
+    int32_t *j_scratch;        /**< 3 * FLACENCBLOCK                      */
+    unsigned char *j_out;
+    size_t j_outsize;
+    size_t j_outbytes;
+} t_flacjob;
+
+    /** encoder state, sf->sf_encoder */
+typedef struct _flacencoder
+{
+    int e_nchannels;
+    int e_bps;                 /**< 16 or 24                              */
+    int e_samplerate;
+    t_flacjob e_jobs[FLACENCJOBS]; /**< ring, by frame number             */
+    uint64_t e_nextfill;       /**< frame being filled                    */
+    uint64_t e_nextwrite;      /**< frame to write next                   */
+    int e_fill;                /**< samples in the frame being filled     */
+    int e_pending;             /**< jobs with the pool, pool mutex        */
+    pthread_cond_t e_donecond; /**< signaled when a job is done           */
+    uint64_t e_nsamples;       /**< samples per channel queued            */
+    int e_lastblock;           /**< size of the last block queued         */
+    uint64_t e_written;        /**< bytes of frames written               */
+    size_t e_minframe;
+    size_t e_maxframe;
+        /* frame offsets for the seek table, every e_pointstride'th frame */
+    uint64_t *e_points;
+    int e_npoints;
+    int e_pointstride;
+} t_flacencoder;
+
+/* ----- encoding pool ----- */
+
+    /* worker threads shared by all encoders, started on first use and
+       kept for the life of the process. jobs are encoded in the order
+       they were queued and written by their own encoder's thread. */
+static pthread_mutex_t m5_flacpool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t m5_flacpool_cond = PTHREAD_COND_INITIALIZER;
+static t_flacjob *m5_flacpool_head = NULL, *m5_flacpool_tail = NULL;
+static int m5_flacpool_nthreads = 0;
+
+static void m5_flac_encodeframe(const t_flacencoder *e, t_flacjob *j);
+
+static void *m5_flacpool_main(void *dummy)
+{
+    pthread_mutex_lock(&m5_flacpool_mutex);
+    while (1)
+    {
+        t_flacjob *j = m5_flacpool_head;
+        if (!j)
+        {
+            pthread_cond_wait(&m5_flacpool_cond, &m5_flacpool_mutex);
+            continue;
+        }
+        if (!(m5_flacpool_head = j->j_next))
+            m5_flacpool_tail = NULL;
+        pthread_mutex_unlock(&m5_flacpool_mutex);
+        m5_flac_encodeframe(j->j_encoder, j);
+        pthread_mutex_lock(&m5_flacpool_mutex);
+        j->j_state = FLACJOB_DONE;
+        j->j_encoder->e_pending--;
+        pthread_cond_broadcast(&j->j_encoder->e_donecond);
+    }
+    return 0;
+}
+
+    /** start the pool if it isn't running, returns 1 on success */
+static int m5_flacpool_start(void)
+{
+    int ok;
+    pthread_mutex_lock(&m5_flacpool_mutex);
+    if (!m5_flacpool_nthreads)
+    {
+#ifdef _SC_NPROCESSORS_ONLN
+        long n = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+#else
+        long n = 1;
+#endif
+        if (n < 1)
+            n = 1;
+        if (n > FLACENCMAXTHREADS)
+            n = FLACENCMAXTHREADS;
+        while (n--)
+        {
+            pthread_t thread;
+            if (!pthread_create(&thread, 0, m5_flacpool_main, 0))
+            {
+                pthread_detach(thread);
+                m5_flacpool_nthreads++;
+            }
+        }
+    }
+    ok = (m5_flacpool_nthreads > 0);
+    pthread_mutex_unlock(&m5_flacpool_mutex);
+    return ok;
+}
+
+static void m5_flacpool_queue(t_flacencoder *e, t_flacjob *j)
+{
+    j->j_state = FLACJOB_QUEUED;
+    j->j_next = NULL;
+    pthread_mutex_lock(&m5_flacpool_mutex);
+    if (m5_flacpool_tail)
+        m5_flacpool_tail->j_next = j;
+    else m5_flacpool_head = j;
+    m5_flacpool_tail = j;
+    e->e_pending++;
+    pthread_cond_signal(&m5_flacpool_cond);
+    pthread_mutex_unlock(&m5_flacpool_mutex);
+}
+
+/* ----- frame encoding ----- */
+
+#define FLACSUB_CONSTANT 0
+#define FLACSUB_VERBATIM 1
+#define FLACSUB_FIXED    8 /**< + order */
+
+    /** how a subframe will be coded and its size in bits */
+typedef struct _flacsubframe
+{
+    int s_type;
+    int s_order;
+    int s_porder;
+    int s_rice2;               /**< 5 bit Rice parameters                 */
+    uint8_t s_k[1 << FLACENCMAXPORDER];
+    uint64_t s_bits;
+} t_flacsubframe;
+
+    /** choose the coding for one channel of n samples of bps bits,
+        res is scratch for n samples */
+static void m5_flac_plansubframe(const int32_t *x, int n, int bps,
+    int32_t *res, t_flacsubframe *s)
+{
+    int i, order, p;
+
+    s->s_type = FLACSUB_VERBATIM;
+    s->s_bits = 8 + (uint64_t)n * bps;
+    for (i = 1; i < n && x[i] == x[0]; i++)
+        ;
+    if (i == n)
+    {
+        s->s_type = FLACSUB_CONSTANT;
+        s->s_bits = 8 + bps;
+        return;
+    }
+    if (n <= 4)
+        return;
+
+        /* pick the fixed order with the smallest residual */
+    order = m5_fixed_order(x, n, M5_FIXEDMAXORDER);
+    m5_fixed_residual(x, n, order, res);
+
+        /* and the partition order and Rice parameters that code it in the
+           fewest bits */
+    for (p = 0; p <= FLACENCMAXPORDER; p++)
+    {
+        int np = 1 << p, part, len = n >> p, rice2 = 0, start = order;
+        uint8_t ks[1 << FLACENCMAXPORDER];
+        uint64_t bits = 8 + (uint64_t)order * bps + 2 + 4;
+        if ((n & (np - 1)) || len <= order)
+            break;
+        for (part = 0; part < np; part++)
+        {
+            int end = (part + 1) * len;
+            uint64_t best;
+            ks[part] = m5_rice_param(res, start, end, &best);
+            if (ks[part] > 14)
+                rice2 = 1;
+            bits += best;
+            start = end;
+        }
+        bits += (uint64_t)np * (rice2 ? 5 : 4);
+        if (bits < s->s_bits)
+        {
+            s->s_type = FLACSUB_FIXED + order;
+            s->s_order = order;
+            s->s_porder = p;
+            s->s_rice2 = rice2;
+            memcpy(s->s_k, ks, np);
+            s->s_bits = bits;
+        }
+    }
+}
+
+static void m5_flac_writesubframe(t_m5BitWriter *bw, const int32_t *x, int n,
+    int bps, int32_t *res, const t_flacsubframe *s)
+{
+    int i, part, np, len, start;
+    m5_bitwriter_put(bw, (s->s_type == FLACSUB_CONSTANT ? 0 :
+        (s->s_type == FLACSUB_VERBATIM ? 1 : s->s_type)) << 1, 8);
+    if (s->s_type == FLACSUB_CONSTANT)
+    {
+        m5_bitwriter_put(bw, x[0], bps);
+        return;
+    }
+    if (s->s_type == FLACSUB_VERBATIM)
+    {
+        for (i = 0; i < n; i++)
+            m5_bitwriter_put(bw, x[i], bps);
+        return;
+    }
+    for (i = 0; i < s->s_order; i++)
+        m5_bitwriter_put(bw, x[i], bps);
+    m5_fixed_residual(x, n, s->s_order, res);
+    m5_bitwriter_put(bw, s->s_rice2, 2);
+    m5_bitwriter_put(bw, s->s_porder, 4);
+    np = 1 << s->s_porder;
+    len = n >> s->s_porder;
+    for (part = 0, start = s->s_order; part < np; part++)
+    {
+        int k = s->s_k[part], end = (part + 1) * len;
+        m5_bitwriter_put(bw, k, (s->s_rice2 ? 5 : 4));
+        for (i = start; i < end; i++)
+            m5_bitwriter_rice(bw, res[i], k);
+        start = end;
+    }
+}
+
+    /** the "UTF-8" coding of a frame number */
+static void m5_bw_utf8(t_m5BitWriter *bw, uint64_t v)
+{
+    int n, i;
+    if (v < 0x80)
+    {
+        m5_bitwriter_put(bw, (uint32_t)v, 8);
+        return;
+    }
+    for (n = 2; n < 7 && v >= (1ULL << (5 * n + 1)); n++)
+        ;
+    m5_bitwriter_put(bw, (0xff00 >> n) | (uint32_t)(v >> (6 * (n - 1))), 8);
+    for (i = n - 2; i >= 0; i--)
+        m5_bitwriter_put(bw, 0x80 | (uint32_t)((v >> (6 * i)) & 0x3f), 8);
+}
+
+static int m5_flac_sampleratecode(int sr, int *extra, int *extrabits)
+{
+    static const int rates[12] = {0, 88200, 176400, 192000, 8000, 16000,
+        22050, 24000, 32000, 44100, 48000, 96000};
+    int i;
+    *extrabits = 0;
+    for (i = 1; i < 12; i++)
+        if (rates[i] == sr)
+            return i;
+    if (sr % 1000 == 0 && sr / 1000 < 256)
+        return (*extra = sr / 1000, *extrabits = 8, 12);
+    if (sr < 65536)
+        return (*extra = sr, *extrabits = 16, 13);
+    if (sr % 10 == 0 && sr / 10 < 65536)
+        return (*extra = sr / 10, *extrabits = 16, 14);
+    return 0; /* from STREAMINFO */
+}
+
+    /** encode job j into j_out, run by a pool thread */
+static void m5_flac_encodeframe(const t_flacencoder *e, t_flacjob *j)
+{
+    t_m5BitWriter bw;
+    t_flacsubframe plan[FLACMAXCHANS], subs[2], *sub[FLACMAXCHANS];
+    const int32_t *chan[FLACMAXCHANS];
+    int32_t *mid = j->j_scratch, *side = mid + FLACENCBLOCK,
+        *res = side + FLACENCBLOCK;
+    int n = j->j_blocksize, nch = e->e_nchannels, bps = e->e_bps;
+    int assignment = nch - 1, sidech, srcode, sr = 0, srbits, ch, i;
+    uint16_t crc;
+
+    m5_bitwriter_init(&bw, j->j_out, j->j_outsize);
+    for (ch = 0; ch < nch; ch++)
+    {
+        chan[ch] = j->j_in + ch * FLACENCBLOCK;
+        sub[ch] = plan + ch;
+        m5_flac_plansubframe(chan[ch], n, bps, res, sub[ch]);
+    }
+    if (nch == 2)
+    {
+            /* try left/side, side/right and mid/side as well */
+        uint64_t best = plan[0].s_bits + plan[1].s_bits;
+        for (i = 0; i < n; i++)
+        {
+            int64_t l = chan[0][i], r = chan[1][i];
+            side[i] = (int32_t)(l - r);
+            mid[i] = (int32_t)((l + r) >> 1);
+        }
+        m5_flac_plansubframe(side, n, bps + 1, res, &subs[0]);
+        m5_flac_plansubframe(mid, n, bps, res, &subs[1]);
+        if (plan[0].s_bits + subs[0].s_bits < best)
+        {
+            best = plan[0].s_bits + subs[0].s_bits;
+            assignment = 8;
+        }
+        if (subs[0].s_bits + plan[1].s_bits < best)
+        {
+            best = subs[0].s_bits + plan[1].s_bits;
+            assignment = 9;
+        }
+        if (subs[1].s_bits + subs[0].s_bits < best)
+            assignment = 10;
+        if (assignment == 8)
+            chan[1] = side, sub[1] = &subs[0];
+        else if (assignment == 9)
+            chan[0] = side, sub[0] = &subs[0];
+        else if (assignment == 10)
+        {
+            chan[0] = mid, sub[0] = &subs[1];
+            chan[1] = side, sub[1] = &subs[0];
+        }
+    }
+
+        /* header */
+    srcode = m5_flac_sampleratecode(e->e_samplerate, &sr, &srbits);
+    m5_bitwriter_put(&bw, 0xfff8, 16); /* sync, fixed block size */
+    m5_bitwriter_put(&bw, (n == FLACENCBLOCK ? 12 : (n <= 256 ? 6 : 7)), 4);
+    m5_bitwriter_put(&bw, srcode, 4);
+    m5_bitwriter_put(&bw, assignment, 4);
+    m5_bitwriter_put(&bw, (bps == 16 ? 4 : 6), 3);
+    m5_bitwriter_put(&bw, 0, 1);
+    m5_bw_utf8(&bw, j->j_frame);
+    if (n != FLACENCBLOCK)
+        m5_bitwriter_put(&bw, n - 1, (n <= 256 ? 8 : 16));
+    m5_bitwriter_put(&bw, sr, srbits);
+    m5_bitwriter_put(&bw, m5_flac_crc8(bw.w_buf, bw.w_pos), 8);
+
+        /* subframes, the side channel has one more bit */
+    sidech = (assignment == 9 ? 0 : (assignment >= 8 ? 1 : -1));
+    for (ch = 0; ch < nch; ch++)
+        m5_flac_writesubframe(&bw, chan[ch], n, bps + (ch == sidech),
+            res, sub[ch]);
+    m5_bitwriter_align(&bw);
+    crc = m5_flac_crc16(bw.w_buf, bw.w_pos);
+    m5_bitwriter_put(&bw, crc, 16);
+    j->j_outbytes = bw.w_pos;
+}
+
+/* ----- writing ----- */
+
+    /** queue the block being filled with n samples */
+static void m5_flac_submit(t_flacencoder *e, int n)
+{
+    t_flacjob *j = &e->e_jobs[e->e_nextfill % FLACENCJOBS];
+    j->j_frame = e->e_nextfill++;
+    j->j_blocksize = n;
+    e->e_nsamples += n;
+    e->e_lastblock = n;
+    e->e_fill = 0;
+    m5_flacpool_queue(e, j);
+}
+
+    /** write encoded frames to the file in order, waiting until frame
+        number "until" has been written, returns 0 or -1 on error */
+static int m5_flac_writeframes(t_soundfile *sf, t_flacencoder *e,
+    uint64_t until)
+{
+    while (e->e_nextwrite < e->e_nextfill)
+    {
+        t_flacjob *j = &e->e_jobs[e->e_nextwrite % FLACENCJOBS];
+        ssize_t byteswritten;
+        int state;
+        pthread_mutex_lock(&m5_flacpool_mutex);
+        while (e->e_nextwrite < until && j->j_state != FLACJOB_DONE)
+            pthread_cond_wait(&e->e_donecond, &m5_flacpool_mutex);
+        state = j->j_state;
+        pthread_mutex_unlock(&m5_flacpool_mutex);
+        if (state != FLACJOB_DONE)
+            break;
+        byteswritten = write(sf->sf_fd, j->j_out, j->j_outbytes);
+        if (byteswritten < 0 || (size_t)byteswritten < j->j_outbytes)
+            return -1;
+
+            /* note every e_pointstride'th frame for the seek table,
+               thinning them out when there are too many */
+        if (j->j_frame % e->e_pointstride == 0)
+        {
+            if (e->e_npoints == 2 * FLACENCSEEKPOINTS)
+            {
+                int i;
+                for (i = 0; i < FLACENCSEEKPOINTS; i++)
+                    e->e_points[i] = e->e_points[2 * i];
+                e->e_npoints = FLACENCSEEKPOINTS;
+                e->e_pointstride *= 2;
+            }
+            if (j->j_frame % e->e_pointstride == 0)
+                e->e_points[e->e_npoints++] = e->e_written;
+        }
+        if (!e->e_minframe || j->j_outbytes < e->e_minframe)
+            e->e_minframe = j->j_outbytes;
+        if (j->j_outbytes > e->e_maxframe)
+            e->e_maxframe = j->j_outbytes;
+        e->e_written += j->j_outbytes;
+        j->j_state = FLACJOB_FREE;
+        e->e_nextwrite++;
+    }
+    return 0;
+}
+
+static int32_t m5_flac_unpack(const unsigned char *src, int bytes, int big)
+{
+    if (bytes == 2)
+        return (int16_t)(big ? (src[0] << 8) | src[1] : (src[1] << 8) | src[0]);
+    return (int32_t)(big ?
+        ((uint32_t)src[0] << 24) | (src[1] << 16) | (src[2] << 8) :
+        ((uint32_t)src[2] << 24) | (src[1] << 16) | (src[0] << 8)) >> 8;
+}
+
+    /** copy interleaved PCM into blocks and queue each one as it fills;
+        the writer thread only waits for the pool when all FLACENCJOBS
+        are in flight */
+static ssize_t m5_flac_encode(t_soundfile *sf, const void *src, size_t size)
+{
+    t_flacencoder *e = (t_flacencoder *)sf->sf_encoder;
+    const unsigned char *in = (const unsigned char *)src;
+    int bytes = sf->sf_bytespersample, big = sf->sf_bigendian;
+    size_t nframes = size / sf->sf_bytesperframe;
+    while (nframes)
+    {
+        t_flacjob *j;
+        int n, i, ch;
+        if (e->e_nextfill - e->e_nextwrite >= FLACENCJOBS &&
+            m5_flac_writeframes(sf, e, e->e_nextwrite + 1) < 0)
+                return -1;
+        j = &e->e_jobs[e->e_nextfill % FLACENCJOBS];
+        n = FLACENCBLOCK - e->e_fill;
+        if ((size_t)n > nframes)
+            n = nframes;
+        for (i = e->e_fill; i < e->e_fill + n; i++)
+            for (ch = 0; ch < e->e_nchannels; ch++, in += bytes)
+                j->j_in[ch * FLACENCBLOCK + i] = m5_flac_unpack(in, bytes, big);
+        e->e_fill += n;
+        nframes -= n;
+        if (e->e_fill == FLACENCBLOCK)
+            m5_flac_submit(e, FLACENCBLOCK);
+    }
+    if (m5_flac_writeframes(sf, e, e->e_nextwrite) < 0)
+        return -1;
+    return size;
+}
+
+    /** build the file header from what has been written so far */
+static void m5_flac_makeheader(const t_soundfile *sf, const t_flacencoder *e,
+    unsigned char *buf)
+{
+    t_m5BitWriter bw;
+    uint64_t nsamples = (e ? e->e_nsamples : 0);
+    int i, npoints = 0, step = 1;
+
+    m5_bitwriter_init(&bw, buf, FLACENCHEADERSIZE);
+    memcpy(buf, "fLaC", 4);
+    bw.w_pos = 4;
+    m5_bitwriter_put(&bw, FLAC_STREAMINFO, 8);
+    m5_bitwriter_put(&bw, FLACSTREAMINFOSIZE, 24);
+    m5_bitwriter_put(&bw, FLACENCBLOCK, 16);
+    m5_bitwriter_put(&bw, FLACENCBLOCK, 16);
+    m5_bitwriter_put(&bw, (e ? e->e_minframe : 0), 24);
+    m5_bitwriter_put(&bw, (e ? e->e_maxframe : 0), 24);
+    m5_bitwriter_put(&bw, sf->sf_samplerate, 20);
+    m5_bitwriter_put(&bw, sf->sf_nchannels - 1, 3);
+    m5_bitwriter_put(&bw, sf->sf_bytespersample * 8 - 1, 5);
+    m5_bitwriter_put(&bw, (uint32_t)(nsamples >> 32), 4);
+    m5_bitwriter_put(&bw, (uint32_t)nsamples, 32);
+    for (i = 0; i < 4; i++)
+        m5_bitwriter_put(&bw, 0, 32); /* no MD5 */
+
+    m5_bitwriter_put(&bw, FLAC_SEEKTABLE, 8);
+    m5_bitwriter_put(&bw, FLACENCSEEKPOINTS * FLACSEEKPOINTSIZE, 24);
+    if (e && e->e_npoints)
+    {
+        step = (e->e_npoints + FLACENCSEEKPOINTS - 1) / FLACENCSEEKPOINTS;
+        npoints = (e->e_npoints + step - 1) / step;
+    }
+    for (i = 0; i < FLACENCSEEKPOINTS; i++)
+    {
+        uint64_t sample = FLACSEEKPLACEHOLDER, offset = 0, frame;
+        int n = 0;
+        if (i < npoints)
+        {
+            frame = (uint64_t)i * step * e->e_pointstride;
+            sample = frame * FLACENCBLOCK;
+            offset = e->e_points[i * step];
+            n = (frame + 1 == e->e_nextwrite ? e->e_lastblock : FLACENCBLOCK);
+        }
+        m5_bitwriter_put(&bw, (uint32_t)(sample >> 32), 32);
+        m5_bitwriter_put(&bw, (uint32_t)sample, 32);
+        m5_bitwriter_put(&bw, (uint32_t)(offset >> 32), 32);
+        m5_bitwriter_put(&bw, (uint32_t)offset, 32);
+        m5_bitwriter_put(&bw, n, 16);
+    }
+
+        /* last metadata block, until a checksum is written over it */
+    m5_bitwriter_put(&bw, 0x80 | FLAC_PADDING, 8);
+    m5_bitwriter_put(&bw, FLACCHECKSIZE, 24);
+    memset(buf + bw.w_pos, 0, FLACCHECKSIZE);
+}
+
+static void m5_flac_freeencoder(t_soundfile *sf)
+{
+    t_flacencoder *e = (t_flacencoder *)sf->sf_encoder;
+    int i;
+    if (!e)
+        return;
+        /* the pool may still be working on our jobs */
+    pthread_mutex_lock(&m5_flacpool_mutex);
+    while (e->e_pending)
+        pthread_cond_wait(&e->e_donecond, &m5_flacpool_mutex);
+    pthread_mutex_unlock(&m5_flacpool_mutex);
+    for (i = 0; i < FLACENCJOBS; i++)
+    {
+        t_flacjob *j = &e->e_jobs[i];
+        if (j->j_in)
+            freebytes(j->j_in, e->e_nchannels * FLACENCBLOCK * sizeof(int32_t));
+        if (j->j_scratch)
+            freebytes(j->j_scratch, 3 * FLACENCBLOCK * sizeof(int32_t));
+        if (j->j_out)
+            freebytes(j->j_out, j->j_outsize);
+    }
+    if (e->e_points)
+        freebytes(e->e_points, 2 * FLACENCSEEKPOINTS * sizeof(uint64_t));
+    pthread_cond_destroy(&e->e_donecond);
+    freebytes(e, sizeof(t_flacencoder));
+    sf->sf_encoder = NULL;
+}
+
+/* ------------------------- FLAC ------------------------- */
+
+static int m5_flac_isheader(const char *buf, size_t size)
+{
+    return (size >= FLACMARKERSIZE + FLACBLOCKHDRSIZE &&
+        !strncmp(buf, "fLaC", 4) && (buf[4] & 0x7f) == FLAC_STREAMINFO);
+}
+
+    /** find the length of a seekable file whose STREAMINFO doesn't give
+        it, from the last frame that decodes */
+static uint64_t m5_flac_findlength(t_soundfile *sf, t_flacdecoder *d)
+{
+    off_t end = lseek(sf->sf_fd, 0, SEEK_END), offset;
+    if (end <= d->d_firstframe)
+        return 0;
+    offset = end - (off_t)d->d_maxframe;
+    if (offset < d->d_firstframe)
+        offset = d->d_firstframe;
+    for (; offset < end - 1; offset++)
+    {
+        int ret;
+        if (!m5_flac_window(sf, d, offset))
+            return 0;
+        if (d->d_raw[offset - d->d_rawoffset] != 0xff)
+            continue;
+        if ((ret = m5_flac_decodeframe(sf, d, offset)) < 0)
+            return 0;
+        if (ret && d->d_nextframe >= end - 2)
+            return d->d_blocksample + d->d_blocklen;
+    }
+    return 0;
+}
+
+static int m5_flac_readheader(t_soundfile *sf)
+{
+    unsigned char buf[FLACSTREAMINFOSIZE], hdr[FLACBLOCKHDRSIZE];
+    t_flacdecoder *d = NULL;
+    off_t offset = FLACMARKERSIZE;
+    int last = 0, type, nchannels, i;
+    size_t blocksize;
+
+    d = (t_flacdecoder *)getbytes(sizeof(t_flacdecoder));
+    if (!d)
+        return 0;
+    while (!last)
+    {
+        if (m5_soundfile_readraw(sf, offset, hdr, FLACBLOCKHDRSIZE) <
+            FLACBLOCKHDRSIZE)
+                goto badheader;
+        last = hdr[0] & 0x80;
+        type = hdr[0] & 0x7f;
+        blocksize = ((size_t)hdr[1] << 16) | (hdr[2] << 8) | hdr[3];
+        offset += FLACBLOCKHDRSIZE;
+        if (type == FLAC_STREAMINFO)
+        {
+            if (blocksize < FLACSTREAMINFOSIZE ||
+                m5_soundfile_readraw(sf, offset, buf, FLACSTREAMINFOSIZE) <
+                    FLACSTREAMINFOSIZE)
+                        goto badheader;
+            d->d_minblock = (buf[0] << 8) | buf[1];
+            d->d_maxblock = (buf[2] << 8) | buf[3];
+            d->d_samplerate = (buf[10] << 12) | (buf[11] << 4) | (buf[12] >> 4);
+            d->d_nchannels = ((buf[12] >> 1) & 7) + 1;
+            d->d_bps = (((buf[12] & 1) << 4) | (buf[13] >> 4)) + 1;
+            d->d_nsamples = ((uint64_t)(buf[13] & 0x0f) << 32) |
+                ((uint64_t)buf[14] << 24) | ((uint64_t)buf[15] << 16) |
+                ((uint64_t)buf[16] << 8) | buf[17];
+        }
+        else if (type == FLAC_SEEKTABLE && d->d_maxblock)
+        {
+            size_t pos;
+            for (pos = 0; pos + FLACSEEKPOINTSIZE <= blocksize;
+                pos += FLACSEEKPOINTSIZE)
+            {
+                unsigned char p[FLACSEEKPOINTSIZE];
+                uint64_t sample = 0, poff = 0;
+                int j;
+                if (m5_soundfile_readraw(sf, offset + pos, p, FLACSEEKPOINTSIZE) <
+                    FLACSEEKPOINTSIZE)
+                        goto badheader;
+                for (j = 0; j < 8; j++)
+                {
+                    sample = (sample << 8) | p[j];
+                    poff = (poff << 8) | p[8 + j];
+                }
+                    /* offsets are relative to the first frame, which we
+                    don't know yet: fix them up below */
+                if (sample != FLACSEEKPLACEHOLDER)
+                    m5_flac_addpoint(d, sample, (off_t)poff);
+            }
+        }
+        else if (!d->d_maxblock)
+            goto badheader; /* STREAMINFO must come first */
+        offset += blocksize;
+    }
+    d->d_firstframe = offset;
+    if (d->d_maxblock < 16 || d->d_minblock > d->d_maxblock ||
+        d->d_nchannels > FLACMAXCHANS || d->d_bps < 4)
+    {
+        errno = SOUNDFILE_ERRSAMPLEFMT;
+        goto badheader;
+    }
+    for (i = 0; i < d->d_nindex; i++)
+        d->d_index[i].p_offset += d->d_firstframe;
+    m5_flac_addpoint(d, 0, d->d_firstframe);
+
+        /* an uncompressed frame is the worst case */
+    nchannels = d->d_nchannels;
+    d->d_maxframe = (size_t)d->d_maxblock * nchannels * (d->d_bps + 1) / 8 +
+        nchannels * 8 + 32;
+    d->d_rawsize = 2 * d->d_maxframe;
+    if (d->d_rawsize < FLACMINWINDOW)
+        d->d_rawsize = FLACMINWINDOW;
+    d->d_rawoffset = -1;
+    if (!(d->d_raw = (unsigned char *)getbytes(d->d_rawsize + 8)) ||
+        !(d->d_block = (int32_t *)getbytes(nchannels * d->d_maxblock *
+            sizeof(int32_t))))
+                goto badheader;
+    d->d_outbytes = (d->d_bps <= 16 ? 2 : (d->d_bps <= 24 ? 3 : 4));
+
+        /* the length is needed for looping, get it if STREAMINFO didn't */
+    if (!d->d_nsamples && m5_soundfile_isseekable(sf))
+        d->d_nsamples = m5_flac_findlength(sf, d);
+    d->d_blocklen = 0;
+
+    sf->sf_samplerate = d->d_samplerate;
+    sf->sf_nchannels = nchannels;
+    sf->sf_bytespersample = d->d_outbytes;
+    sf->sf_bytesperframe = nchannels * d->d_outbytes;
+    sf->sf_bigendian = m5_sys_isbigendian();
+    sf->sf_headersize = 0;
+    if (d->d_nsamples)
+    {
+        uint64_t bytes = d->d_nsamples * sf->sf_bytesperframe;
+        sf->sf_bytelimit = (bytes > SFMAXBYTES ? SFMAXBYTES : (ssize_t)bytes);
+    }
+    else sf->sf_bytelimit = SFMAXBYTES - 1; /* a stream, read until it ends */
+    sf->sf_decoder = d;
+
+#ifdef DEBUG_SOUNDFILE
+    post("fLaC %d Hz, %d channels, %d bits, %ld samples, %d seek points",
+        d->d_samplerate, nchannels, d->d_bps, (long)d->d_nsamples,
+        d->d_nindex);
+#endif
+
+    return 1;
+
+badheader:
+    if (!errno)
+        errno = SOUNDFILE_ERRMALFORMED;
+    sf->sf_decoder = d;
+    m5_flac_freedecoder(sf);
+    return 0;
+}
+
+    /** write a header for the file's final layout, with no frames, and
+        start an encoder */
+static int m5_flac_writeheader(t_soundfile *sf, size_t nframes)
+{
+    t_flacencoder *e;
+    unsigned char *buf;
+    ssize_t byteswritten;
+    int i;
+
+    if ((sf->sf_bytespersample != 2 && sf->sf_bytespersample != 3) ||
+        sf->sf_nchannels < 1 || sf->sf_nchannels > FLACMAXCHANS ||
+        sf->sf_samplerate < 1 || sf->sf_samplerate >= (1 << 20))
+    {
+        errno = SOUNDFILE_ERRSAMPLEFMT;
+        return -1;
+    }
+    if (!m5_flacpool_start())
+    {
+        errno = EAGAIN;
+        return -1;
+    }
+    buf = (unsigned char *)getbytes(FLACENCHEADERSIZE);
+    m5_flac_makeheader(sf, NULL, buf);
+    byteswritten = m5_fd_write(sf->sf_fd, 0, buf, FLACENCHEADERSIZE);
+    freebytes(buf, FLACENCHEADERSIZE);
+    if (byteswritten < FLACENCHEADERSIZE)
+        return -1;
+
+    e = (t_flacencoder *)getbytes(sizeof(t_flacencoder));
+    e->e_nchannels = sf->sf_nchannels;
+    e->e_bps = sf->sf_bytespersample * 8;
+    e->e_samplerate = sf->sf_samplerate;
+    pthread_cond_init(&e->e_donecond, 0);
+    e->e_points = (uint64_t *)getbytes(2 * FLACENCSEEKPOINTS *
+        sizeof(uint64_t));
+    e->e_pointstride = 1;
+    for (i = 0; i < FLACENCJOBS; i++)
+    {
+        t_flacjob *j = &e->e_jobs[i];
+        j->j_encoder = e;
+        j->j_in = (int32_t *)getbytes(e->e_nchannels * FLACENCBLOCK *
+            sizeof(int32_t));
+        j->j_scratch = (int32_t *)getbytes(3 * FLACENCBLOCK *
+            sizeof(int32_t));
+            /* header, a verbatim subframe per channel with room for a
+               side channel, CRC-16 */
+        j->j_outsize = 32 + e->e_nchannels *
+            (1 + (size_t)(e->e_bps + 1) * FLACENCBLOCK / 8 + 1);
+        j->j_out = (unsigned char *)getbytes(j->j_outsize);
+    }
+    sf->sf_encoder = e;
+    return FLACENCHEADERSIZE;
+}
+
+    /** encode and write what is left, then rewrite the header with the
+        length, frame sizes and seek table */
+static int m5_flac_updateheader(t_soundfile *sf, size_t nframes)
+{
+    t_flacencoder *e = (t_flacencoder *)sf->sf_encoder;
+    unsigned char *buf;
+    ssize_t byteswritten;
+
+    if (!e)
+    {
+        errno = EINVAL;
+        return 0;
+    }
+    if (e->e_fill)
+        m5_flac_submit(e, e->e_fill);
+    if (m5_flac_writeframes(sf, e, e->e_nextfill) < 0)
+        return 0;
+    buf = (unsigned char *)getbytes(FLACENCHEADERSIZE);
+    m5_flac_makeheader(sf, e, buf);
+    byteswritten = m5_fd_write(sf->sf_fd, 0, buf, FLACENCHEADERSIZE);
+    freebytes(buf, FLACENCHEADERSIZE);
+    m5_flac_freeencoder(sf);
+    return (byteswritten == FLACENCHEADERSIZE);
+}
+
+    /** turn the reserved PADDING block into the checksum block */
+static int m5_flac_writechecksum(t_soundfile *sf,
+    const t_soundfile_checksum *ck)
+{
+    unsigned char buf[FLACBLOCKHDRSIZE + FLACCHECKSIZE];
+    t_m5BitWriter bw;
+    m5_bitwriter_init(&bw, buf, sizeof(buf));
+    m5_bitwriter_put(&bw, 0x80 | FLAC_APPLICATION, 8);
+    m5_bitwriter_put(&bw, FLACCHECKSIZE, 24);
+    memcpy(buf + bw.w_pos, "m5ck", 4);
+    bw.w_pos += 4;
+    m5_bitwriter_put(&bw, 1, 16);
+    m5_bitwriter_put(&bw, (ck->sc_bigendian ? 1 : 0), 16);
+    m5_bitwriter_put(&bw, ck->sc_crc32c, 32);
+    m5_bitwriter_put(&bw, (uint32_t)(ck->sc_databytes >> 32), 32);
+    m5_bitwriter_put(&bw, (uint32_t)ck->sc_databytes, 32);
+    return (m5_fd_write(sf->sf_fd, FLACENCHEADERSIZE - sizeof(buf), buf,
+        sizeof(buf)) == sizeof(buf));
+}
+
+    /** look for an "m5ck" APPLICATION block among the metadata blocks */
+static int m5_flac_readchecksum(t_soundfile *sf, t_soundfile_checksum *ck)
+{
+    unsigned char hdr[FLACBLOCKHDRSIZE], buf[FLACCHECKSIZE];
+    off_t offset = FLACMARKERSIZE;
+    int last = 0;
+    while (!last)
+    {
+        size_t blocksize;
+        if (m5_soundfile_readraw(sf, offset, hdr, FLACBLOCKHDRSIZE) <
+            FLACBLOCKHDRSIZE)
+                return 0;
+        last = hdr[0] & 0x80;
+        blocksize = ((size_t)hdr[1] << 16) | (hdr[2] << 8) | hdr[3];
+        offset += FLACBLOCKHDRSIZE;
+        if ((hdr[0] & 0x7f) == FLAC_APPLICATION &&
+            blocksize >= FLACCHECKSIZE &&
+            m5_soundfile_readraw(sf, offset, buf, FLACCHECKSIZE) ==
+                FLACCHECKSIZE &&
+            !memcmp(buf, "m5ck", 4) && ((buf[4] << 8) | buf[5]) == 1)
+        {
+            ck->sc_bigendian = buf[7] & 1;
+            ck->sc_crc32c = ((uint32_t)buf[8] << 24) | (buf[9] << 16) |
+                (buf[10] << 8) | buf[11];
+            ck->sc_databytes = ((uint64_t)buf[12] << 56) |
+                ((uint64_t)buf[13] << 48) | ((uint64_t)buf[14] << 40) |
+                ((uint64_t)buf[15] << 32) | ((uint64_t)buf[16] << 24) |
+                (buf[17] << 16) | (buf[18] << 8) | buf[19];
+            return 1;
+        }
+        offset += blocksize;
+    }
+    return 0;
+}
+
+static int m5_flac_hasextension(const char *filename, size_t size)
+{
+    size_t len = strnlen(filename, size);
+    if (len >= 6 &&
+        (!strncmp(filename + (len - 5), ".flac", 5) ||
+         !strncmp(filename + (len - 5), ".FLAC", 5)))
+        return 1;
+    return 0;
+}
+
+static int m5_flac_addextension(char *filename, size_t size)
+{
+    size_t len = strnlen(filename, size);
+    if (len + 5 >= size)
+        return 0;
+    strcpy(filename + len, ".flac");
+    return 1;
+}
+
+    /* decoded samples are always native endian */
+static int m5_flac_endianness(int endianness, int bytespersample)
+{
+    return m5_sys_isbigendian();
+}
+
+/* ------------------------- setup routine ------------------------ */
+
+t_soundfile_type flac = {
+    "flac",
+    FLACMARKERSIZE + FLACBLOCKHDRSIZE,
+    m5_flac_isheader,
+    m5_flac_readheader,
+    m5_flac_writeheader,
+    m5_flac_updateheader,
+    m5_flac_hasextension,
+    m5_flac_addextension,
+    m5_flac_endianness,
+    m5_flac_decode,
+    m5_flac_freedecoder,
+    m5_flac_encode,
+    m5_flac_freeencoder,
+    m5_flac_writechecksum,
+    m5_flac_readchecksum
+};
+
+void m5_soundfile_flac_setup( void)
+{
+    m5_soundfile_addtype(&flac);
+}
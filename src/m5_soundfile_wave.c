@@ -31,11 +31,13 @@
 
   * supports basic and extended format chunks (WAVE Rev. 3)
   * implicitly writes extended format for 32 or 64 bit float (see below)
-  * implements chunks: format, fact, sound data
+  * implements chunks: format, fact, sound data, and an "m5ck" chunk after
+    the sound data holding a CRC-32C of it (writesf~ -checksum)
   * ignores chunks: info, cset, cue, playlist, associated data, instrument,
                     sample, display, junk, pad, time code, digitization time
   * assumes format chunk is always before sound data chunk
   * assumes there is only 1 sound data chunk
+  * streamed files (pipes) with an unset data size are read until they end
   * does not support 64-bit size variants or BWF file-splitting
   * sample format: 16 and 24 bit lpcm, 32 and 64 bit float, no 32 bit lpcm
 
@@ -54,6 +56,7 @@
 #define WAVEHEADSIZE   12 /**< chunk header and file format only */
 #define WAVEFORMATSIZE 24 /**< chunk header and data */
 #define WAVEFACTSIZE   12 /**< chunk header and data */
+#define WAVECHECKSIZE  24 /**< chunk header and data */
 
 #define WAVEMAXBYTES 0xffffffff /**< max unsigned 32 bit size */
 
@@ -108,6 +111,17 @@ typedef struct _factchunk
     uint32_t fc_samplelength;        /**< number of samples per channel */
 } t_factchunk;
 
+    /** checksum chunk, 24 bytes */
+typedef struct _checkchunk
+{
+    char cc_id[4];                   /**< chunk id "m5ck"               */
+    uint32_t cc_size;                /**< chunk data length             */
+    uint16_t cc_version;             /**< 1                             */
+    uint16_t cc_flags;               /**< bit 0: data was big endian    */
+    uint32_t cc_crc32c;              /**< CRC-32C of the sound data     */
+    uint32_t cc_databytes[2];        /**< bytes covered, low word first */
+} t_checkchunk;
+
 /* ----- helpers ----- */
 
     /** returns 1 if format requires extended format and fact chunk */
@@ -117,9 +131,9 @@ static int m5_wave_isextended(const t_soundfile *sf)
 }
 
     /** read first chunk, returns filled chunk and offset on success or -1 */
-static off_t m5_wave_firstchunk(const t_soundfile *sf, t_chunk *chunk)
+static off_t m5_wave_firstchunk(t_soundfile *sf, t_chunk *chunk)
 {
-    if (m5_fd_read(sf->sf_fd, WAVEHEADSIZE, (char *)chunk,
+    if (m5_soundfile_read(sf, WAVEHEADSIZE, (char *)chunk,
         WAVECHUNKSIZE) < WAVECHUNKSIZE)
         return -1;
     return WAVEHEADSIZE;
@@ -127,13 +141,13 @@ static off_t m5_wave_firstchunk(const t_soundfile *sf, t_chunk *chunk)
 
     /** read next chunk, chunk should be filled when calling
         returns filled chunk offset on success or -1 */
-static off_t m5_wave_nextchunk(const t_soundfile *sf, off_t offset, t_chunk *chunk)
+static off_t m5_wave_nextchunk(t_soundfile *sf, off_t offset, t_chunk *chunk)
 {
     uint32_t chunksize = m5_swap4(chunk->c_size, m5_sys_isbigendian());
     off_t seekto = offset + WAVECHUNKSIZE + chunksize;
     if (seekto & 1) /* pad up to even number of bytes */
         seekto++;
-    if (m5_fd_read(sf->sf_fd, seekto, (char *)chunk,
+    if (m5_soundfile_read(sf, seekto, (char *)chunk,
         WAVECHUNKSIZE) < WAVECHUNKSIZE)
         return -1;
     return seekto;
@@ -235,7 +249,7 @@ static int m5_wave_readheader(t_soundfile *sf)
     t_chunk *chunk = &buf.b_chunk;
 
         /* file header */
-    if (m5_fd_read(sf->sf_fd, 0, buf.b_c, headersize) < headersize)
+    if (m5_soundfile_read(sf, 0, buf.b_c, headersize) < headersize)
         return 0;
     if (strncmp(buf.b_c + 8, "WAVE", 4))
         return 0;
@@ -255,7 +269,7 @@ static int m5_wave_readheader(t_soundfile *sf)
                 /* format chunk */
             int formattag;
             t_formatchunk *format = &buf.b_formatchunk;
-            if (m5_fd_read(sf->sf_fd, headersize + 8,
+            if (m5_soundfile_read(sf, headersize + 8,
                     buf.b_c + 8, chunksize) < chunksize)
                 return 0;
 #ifdef DEBUG_SOUNDFILE
@@ -329,7 +343,14 @@ static int m5_wave_readheader(t_soundfile *sf)
     }
 
         /* interpret data size from file size? */
-    if (bytelimit == WAVEMAXBYTES)
+    if (!m5_soundfile_isseekable(sf))
+    {
+            /* streaming writers can't go back to fill in the size and
+            leave it as 0 or max, either way read until the stream ends */
+        if (bytelimit == 0)
+            bytelimit = WAVEMAXBYTES;
+    }
+    else if (bytelimit == WAVEMAXBYTES)
     {
         bytelimit = lseek(sf->sf_fd, 0, SEEK_END) - headersize;
         if (bytelimit > WAVEMAXBYTES || bytelimit < 0)
@@ -479,6 +500,60 @@ static int m5_wave_updateheader(t_soundfile *sf, size_t nframes)
     return 1;
 }
 
+    /** append the checksum chunk after the sound data and its pad byte,
+        then grow the file header chunk to include it */
+static int m5_wave_writechecksum(t_soundfile *sf,
+    const t_soundfile_checksum *ck)
+{
+    int swap = m5_sys_isbigendian();
+    off_t offset = sf->sf_headersize + ck->sc_databytes +
+        (ck->sc_databytes & 1);
+    t_checkchunk check = {
+        "m5ck", m5_swap4(WAVECHECKSIZE - WAVECHUNKSIZE, swap),
+        m5_swap2(1, swap), m5_swap2(ck->sc_bigendian ? 1 : 0, swap),
+        m5_swap4(ck->sc_crc32c, swap),
+        {m5_swap4((uint32_t)ck->sc_databytes, swap),
+         m5_swap4((uint32_t)(ck->sc_databytes >> 32), swap)}
+    };
+    uint32_t uinttmp;
+
+    if (offset + WAVECHECKSIZE - 8 > WAVEMAXBYTES)
+    {
+        errno = EFBIG;
+        return 0;
+    }
+    if (m5_fd_write(sf->sf_fd, offset, &check, WAVECHECKSIZE) < WAVECHECKSIZE)
+        return 0;
+    uinttmp = m5_swap4((uint32_t)(offset + WAVECHECKSIZE - 8), swap);
+    return (m5_fd_write(sf->sf_fd, 4, &uinttmp, 4) == 4);
+}
+
+    /** look for a checksum chunk anywhere after the header */
+static int m5_wave_readchecksum(t_soundfile *sf, t_soundfile_checksum *ck)
+{
+    int swap = m5_sys_isbigendian();
+    t_chunk chunk;
+    t_checkchunk check;
+    off_t offset = m5_wave_firstchunk(sf, &chunk);
+
+    while (offset >= 0)
+    {
+        if (!strncmp(chunk.c_id, "m5ck", 4))
+        {
+            if (m5_soundfile_readraw(sf, offset, &check, WAVECHECKSIZE) <
+                WAVECHECKSIZE || m5_swap2(check.cc_version, swap) != 1)
+                    return 0;
+            ck->sc_crc32c = m5_swap4(check.cc_crc32c, swap);
+            ck->sc_databytes = m5_swap4(check.cc_databytes[0], swap) |
+                ((uint64_t)m5_swap4(check.cc_databytes[1], swap) << 32);
+            ck->sc_bigendian = (m5_swap2(check.cc_flags, swap) & 1);
+            return 1;
+        }
+        offset = m5_wave_nextchunk(sf, offset, &chunk);
+    }
+    return 0;
+}
+
 static int m5_wave_hasextension(const char *filename, size_t size)
 {
     int len = strnlen(filename, size);
@@ -519,7 +594,10 @@ t_soundfile_type wave = {
     m5_wave_updateheader,
     m5_wave_hasextension,
     m5_wave_addextension,
-    m5_wave_endianness
+    m5_wave_endianness,
+    NULL, NULL, NULL, NULL, /* PCM */
+    m5_wave_writechecksum,
+    m5_wave_readchecksum
 };
 
 void m5_soundfile_wave_setup( void)
@@ -25,6 +25,21 @@ static t_class *m5_ftc_compare_class;
 	m5_ftc_anchor, and utility functions
 	
 */
+
+#ifndef M5_VIRTUAL_CLOCK
+
+double m5_clock_logicaltime(void)
+{
+	return clock_getlogicaltime();
+}
+
+double m5_clock_framessince(double logicaltime)
+{
+	return clock_gettimesincewithunits(logicaltime, 1, 1);
+}
+
+#endif /* M5_VIRTUAL_CLOCK */
+
 static void *m5_time_anchor_new(t_symbol *s)
 {
 	t_m5TimeAnchor *x = (t_m5TimeAnchor *)pd_new(m5_time_anchor_class);
@@ -53,7 +68,7 @@ static void m5_time_anchor_free(t_m5TimeAnchor *x)
 }
 
 static void m5_time_anchor_mark(t_m5TimeAnchor *x) {
-	x->x_starttime = clock_getlogicaltime();
+	x->x_starttime = m5_clock_logicaltime();
 }
 
 static void m5_time_anchor_bang(t_m5TimeAnchor *x) 
@@ -67,7 +82,7 @@ static void m5_time_anchor_bang(t_m5TimeAnchor *x)
 double m5_time_anchor_get_starttime(t_m5TimeAnchor *x) {
 	if (x->x_starttime == MARK_TIME_ANCHOR) {
 		// get current time on first  access
-		x->x_starttime = clock_getlogicaltime();
+		x->x_starttime = m5_clock_logicaltime();
 	}
 	return x->x_starttime;
 }
@@ -75,7 +90,7 @@ double m5_time_anchor_get_starttime(t_m5TimeAnchor *x) {
 unsigned long m5_time_anchor_get_time_since_start(t_m5TimeAnchor *x) {
 	double start = m5_time_anchor_get_starttime(x);
 	
-	double r = ceil(clock_gettimesincewithunits(start, 1, 1));
+	double r = ceil(m5_clock_framessince(start));
 
 	return (unsigned long) r;
 }
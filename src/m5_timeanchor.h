@@ -81,6 +81,13 @@ void m5_ftc_mult_setup(void);
 void m5_ftc_cycles_setup(void);
 void m5_ftc_compare_setup(void);
 
+// The clock behind every frame time in the library: Pd's logical time.
+// Built with -DM5_VIRTUAL_CLOCK these two are left undefined, for the
+// program linking the library to supply (e.g. a test harness that steps
+// time by hand and checks renders sample by sample).
+double m5_clock_logicaltime(void);
+double m5_clock_framessince(double logicaltime);
+
 // Useful functions for working with FTCs and FTC time anchors...
 
 void m5_time_anchor_usedindsp(t_m5TimeAnchor *x);
@@ -0,0 +1,76 @@
+/* Copyright (c) 2025 Michael Spears.
+* For information on usage and redistribution, and for a DISCLAIMER OF ALL
+* WARRANTIES, see the file, "LICENSE.txt," in this distribution.  */
+
+#include <m_pd.h>
+#include <pthread.h>
+#include "m5_worker.h"
+
+/*
+
+	background job pool
+
+*/
+
+typedef struct _m5WorkerJob
+{
+	t_m5WorkerFn j_fn;
+	void *j_data;
+	struct _m5WorkerJob *j_next;
+} t_m5WorkerJob;
+
+static pthread_mutex_t m5_worker_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t m5_worker_cond = PTHREAD_COND_INITIALIZER;
+static t_m5WorkerJob *m5_worker_head = NULL, *m5_worker_tail = NULL;
+static int m5_worker_nthreads = 0;
+
+static void *m5_worker_main(void *dummy)
+{
+	pthread_mutex_lock(&m5_worker_mutex);
+	while (1)
+	{
+		t_m5WorkerJob *j = m5_worker_head;
+		if (!j)
+		{
+			pthread_cond_wait(&m5_worker_cond, &m5_worker_mutex);
+			continue;
+		}
+		if (!(m5_worker_head = j->j_next))
+			m5_worker_tail = NULL;
+		pthread_mutex_unlock(&m5_worker_mutex);
+		j->j_fn(j->j_data);
+		freebytes(j, sizeof(t_m5WorkerJob));
+		pthread_mutex_lock(&m5_worker_mutex);
+	}
+	return 0;
+}
+
+int m5_worker_submit(t_m5WorkerFn fn, void *data)
+{
+	t_m5WorkerJob *j = (t_m5WorkerJob *)getbytes(sizeof(t_m5WorkerJob));
+	j->j_fn = fn;
+	j->j_data = data;
+	j->j_next = NULL;
+	pthread_mutex_lock(&m5_worker_mutex);
+	while (m5_worker_nthreads < M5_WORKER_NTHREADS)
+	{
+		pthread_t thread;
+		if (pthread_create(&thread, 0, m5_worker_main, 0))
+			break;
+		pthread_detach(thread);
+		m5_worker_nthreads++;
+	}
+	if (!m5_worker_nthreads)
+	{
+		pthread_mutex_unlock(&m5_worker_mutex);
+		freebytes(j, sizeof(t_m5WorkerJob));
+		return 0;
+	}
+	if (m5_worker_tail)
+		m5_worker_tail->j_next = j;
+	else m5_worker_head = j;
+	m5_worker_tail = j;
+	pthread_cond_signal(&m5_worker_cond);
+	pthread_mutex_unlock(&m5_worker_mutex);
+	return 1;
+}
@@ -0,0 +1,21 @@
+/* Copyright (c) 2025 Michael Spears.
+* For information on usage and redistribution, and for a DISCLAIMER OF ALL
+* WARRANTIES, see the file, "LICENSE.txt," in this distribution.  */
+
+#pragma once
+
+// Background threads for slow jobs that neither the audio thread nor an
+// object's own I/O thread should wait for, such as verifying a file's
+// checksum. Jobs run one at a time per thread, in the order they were
+// submitted, on a small pool that is started on first use and kept for
+// the life of the process.
+//
+// A job owns whatever it is handed; the submitter must not free data
+// that a running job still uses (refcount it if both sides need it).
+
+#define M5_WORKER_NTHREADS 2
+
+typedef void (*t_m5WorkerFn)(void *data);
+
+// queue fn(data), returns 0 if no thread could be started
+int m5_worker_submit(t_m5WorkerFn fn, void *data);
@@ -0,0 +1,698 @@
+/* Copyright (c) 2025 Michael Spears.
+* For information on usage and redistribution, and for a DISCLAIMER OF ALL
+* WARRANTIES, see the file, "LICENSE.txt," in this distribution.  */
+
+#include "m5_fakepd.h"
+#include "g_canvas.h"
+#include "s_stuff.h"
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+/*
+
+	a stand-in for the parts of Pd the library calls, see m5_fakepd.h
+
+*/
+
+t_symbol s_bang = {"bang", 0, 0}, s_list = {"list", 0, 0},
+	s_anything = {"anything", 0, 0}, s_signal = {"signal", 0, 0};
+int sys_verbose = 0;
+
+double m5_fakepd_time = 0;
+char m5_fakepd_dir[MAXPDSTRING] = ".";
+int m5_fakepd_quiet = 0;
+
+	/* ------------------------- symbols and memory ------------------------- */
+
+typedef struct _fakesymbol
+{
+	t_symbol s_sym;
+	struct _fakesymbol *s_next;
+} t_fakesymbol;
+
+static t_fakesymbol *m5_fakepd_symbols = NULL;
+
+t_symbol *gensym(const char *s)
+{
+	t_fakesymbol *f;
+	for (f = m5_fakepd_symbols; f; f = f->s_next)
+		if (!strcmp(f->s_sym.s_name, s))
+			return &f->s_sym;
+	f = (t_fakesymbol *)calloc(1, sizeof(*f));
+	f->s_sym.s_name = strdup(s);
+	f->s_next = m5_fakepd_symbols;
+	m5_fakepd_symbols = f;
+	return &f->s_sym;
+}
+
+void *getbytes(size_t nbytes)
+{
+	return calloc(1, nbytes ? nbytes : 1);
+}
+
+void *resizebytes(void *x, size_t oldsize, size_t newsize)
+{
+	char *y = (char *)realloc(x, newsize ? newsize : 1);
+	if (y && newsize > oldsize)
+		memset(y + oldsize, 0, newsize - oldsize);
+	return y;
+}
+
+void freebytes(void *x, size_t nbytes)
+{
+	free(x);
+}
+
+	/* ------------------------------- classes ------------------------------ */
+
+#define MAXMETHODS 64
+#define MAXCLASSES 32
+
+struct _class
+{
+	t_symbol *c_name;
+	t_newmethod c_new;
+	t_method c_free;
+	size_t c_size;
+	t_atomtype c_arg;          /* the first argument type, A_NULL if none */
+	int c_nmethods;
+	t_symbol *c_methodname[MAXMETHODS];
+	t_method c_method[MAXMETHODS];
+	t_atomtype c_methodarg[MAXMETHODS];
+	t_method c_bang, c_float, c_list;
+};
+
+static t_class *m5_fakepd_classes[MAXCLASSES];
+static int m5_fakepd_nclasses = 0;
+
+t_class *class_new(t_symbol *name, t_newmethod newmethod, t_method freemethod,
+	size_t size, int flags, t_atomtype arg1, ...)
+{
+	t_class *c = (t_class *)calloc(1, sizeof(*c));
+	c->c_name = name;
+	c->c_new = newmethod;
+	c->c_free = freemethod;
+	c->c_size = size;
+	c->c_arg = arg1;
+	if (m5_fakepd_nclasses < MAXCLASSES)
+		m5_fakepd_classes[m5_fakepd_nclasses++] = c;
+	return c;
+}
+
+void class_addmethod(t_class *c, t_method fn, t_symbol *sel,
+	t_atomtype arg1, ...)
+{
+	if (c->c_nmethods == MAXMETHODS)
+		return;
+	c->c_methodname[c->c_nmethods] = sel;
+	c->c_method[c->c_nmethods] = fn;
+	c->c_methodarg[c->c_nmethods++] = arg1;
+}
+
+	/* the parentheses keep m_pd.h's casting macros off these names */
+void (class_addbang)(t_class *c, t_method fn)
+{
+	c->c_bang = fn;
+}
+
+void class_doaddfloat(t_class *c, t_method fn)
+{
+	c->c_float = fn;
+}
+
+void (class_addlist)(t_class *c, t_method fn)
+{
+	c->c_list = fn;
+}
+
+void class_domainsignalin(t_class *c, int onset)
+{
+}
+
+t_pd *pd_new(t_class *cls)
+{
+	t_pd *x = (t_pd *)calloc(1, cls->c_size);
+	*x = cls;
+	return x;
+}
+
+	/** parse "a 1 b" into at most max atoms, symbols and floats */
+static int m5_fakepd_parse(const char *s, t_atom *av, int max, char *buf,
+	size_t size)
+{
+	char *tok, *save;
+	int ac = 0;
+	snprintf(buf, size, "%s", s ? s : "");
+	for (tok = strtok_r(buf, " ", &save); tok && ac < max;
+		tok = strtok_r(NULL, " ", &save))
+	{
+		char *end;
+		double f = strtod(tok, &end);
+		if (!*end)
+			SETFLOAT(&av[ac], f);
+		else SETSYMBOL(&av[ac], gensym(tok));
+		ac++;
+	}
+	return ac;
+}
+
+void *m5_fakepd_new(const char *name, const char *args)
+{
+	t_symbol *s = gensym(name);
+	char buf[MAXPDSTRING];
+	t_atom av[MAXPDARG * 4];
+	int ac = m5_fakepd_parse(args, av, MAXPDARG * 4, buf, sizeof(buf)), i;
+	for (i = 0; i < m5_fakepd_nclasses; i++)
+	{
+		t_class *c = m5_fakepd_classes[i];
+		if (c->c_name != s)
+			continue;
+		switch (c->c_arg)
+		{
+			case A_GIMME:
+				return ((void *(*)(t_symbol *, int, t_atom *))c->c_new)(s,
+					ac, av);
+			case A_DEFFLOAT:
+			case A_FLOAT:
+				return ((void *(*)(t_floatarg))c->c_new)(
+					atom_getfloatarg(0, ac, av));
+			case A_DEFSYM:
+			case A_SYMBOL:
+				return ((void *(*)(t_symbol *))c->c_new)(
+					atom_getsymbolarg(0, ac, av));
+			default:
+				return ((void *(*)(void))c->c_new)();
+		}
+	}
+	fprintf(stderr, "m5_fakepd: no class %s\n", name);
+	return NULL;
+}
+
+void m5_fakepd_free(void *x)
+{
+	t_class *c = *(t_pd *)x;
+	if (c->c_free)
+		((void (*)(void *))c->c_free)(x);
+	free(x);
+}
+
+void m5_fakepd_send(void *x, const char *msg)
+{
+	t_class *c = *(t_pd *)x;
+	char buf[MAXPDSTRING];
+	t_atom av[MAXPDARG * 4];
+	int ac = m5_fakepd_parse(msg, av, MAXPDARG * 4, buf, sizeof(buf)), i;
+	t_symbol *sel;
+	if (!ac)
+		return;
+	if (av[0].a_type == A_FLOAT)
+	{
+		if (ac == 1 && c->c_float)
+			((void (*)(void *, t_floatarg))c->c_float)(x,
+				av[0].a_w.w_float);
+		else if (c->c_list)
+			((void (*)(void *, t_symbol *, int, t_atom *))c->c_list)(x,
+				&s_list, ac, av);
+		return;
+	}
+	sel = av[0].a_w.w_symbol;
+	if (sel == &s_bang && c->c_bang)
+	{
+		((void (*)(void *))c->c_bang)(x);
+		return;
+	}
+	for (i = 0; i < c->c_nmethods; i++)
+	{
+		if (c->c_methodname[i] != sel)
+			continue;
+		switch (c->c_methodarg[i])
+		{
+			case A_GIMME:
+				((void (*)(void *, t_symbol *, int, t_atom *))c->c_method[i])(
+					x, sel, ac - 1, av + 1);
+				break;
+			case A_DEFFLOAT:
+			case A_FLOAT:
+				((void (*)(void *, t_floatarg))c->c_method[i])(x,
+					atom_getfloatarg(1, ac, av));
+				break;
+			case A_DEFSYM:
+			case A_SYMBOL:
+				((void (*)(void *, t_symbol *))c->c_method[i])(x,
+					atom_getsymbolarg(1, ac, av));
+				break;
+			default:
+				((void (*)(void *))c->c_method[i])(x);
+		}
+		return;
+	}
+	fprintf(stderr, "m5_fakepd: %s: no method for '%s'\n",
+		c->c_name->s_name, sel->s_name);
+}
+
+	/* -------------------------------- atoms ------------------------------- */
+
+t_float atom_getfloat(const t_atom *a)
+{
+	return (a->a_type == A_FLOAT ? a->a_w.w_float : 0);
+}
+
+t_float atom_getfloatarg(int which, int argc, const t_atom *argv)
+{
+	return (which < argc ? atom_getfloat(argv + which) : 0);
+}
+
+t_symbol *atom_getsymbolarg(int which, int argc, const t_atom *argv)
+{
+	return (which < argc && argv[which].a_type == A_SYMBOL ?
+		argv[which].a_w.w_symbol : gensym(""));
+}
+
+	/* ------------------------- inlets and outlets ------------------------- */
+
+struct _inlet
+{
+	int i_dummy;
+};
+
+struct _outlet
+{
+	int o_index;
+};
+
+static char m5_fakepd_log[M5_FAKEPD_NLOG][MAXPDSTRING];
+static int m5_fakepd_nlog = 0;
+
+	/* outlets are numbered per object; te_outlet isn't used otherwise */
+t_outlet *outlet_new(t_object *owner, t_symbol *s)
+{
+	t_outlet *o = (t_outlet *)calloc(1, sizeof(*o));
+	o->o_index = (int)(intptr_t)owner->te_outlet;
+	owner->te_outlet = (t_outlet *)(intptr_t)(o->o_index + 1);
+	return o;
+}
+
+t_inlet *inlet_new(t_object *owner, t_pd *dest, t_symbol *s1, t_symbol *s2)
+{
+	return (t_inlet *)calloc(1, sizeof(t_inlet));
+}
+
+t_inlet *floatinlet_new(t_object *owner, t_float *fp)
+{
+	return (t_inlet *)calloc(1, sizeof(t_inlet));
+}
+
+static void m5_fakepd_out(t_outlet *x, const char *sel, int argc,
+	const t_atom *argv)
+{
+	char *line = m5_fakepd_log[m5_fakepd_nlog++ % M5_FAKEPD_NLOG];
+	size_t n;
+	int i;
+	n = snprintf(line, MAXPDSTRING, "%d %s", x->o_index, sel);
+	for (i = 0; i < argc && n < MAXPDSTRING; i++)
+	{
+		if (argv[i].a_type == A_FLOAT)
+			n += snprintf(line + n, MAXPDSTRING - n, " %g",
+				argv[i].a_w.w_float);
+		else if (argv[i].a_type == A_SYMBOL)
+			n += snprintf(line + n, MAXPDSTRING - n, " %s",
+				argv[i].a_w.w_symbol->s_name);
+	}
+	if (!m5_fakepd_quiet)
+		fprintf(stderr, "[%.0f] %s\n", m5_fakepd_time, line);
+}
+
+void outlet_bang(t_outlet *x)
+{
+	m5_fakepd_out(x, "bang", 0, NULL);
+}
+
+void outlet_float(t_outlet *x, t_float f)
+{
+	t_atom a;
+	SETFLOAT(&a, f);
+	m5_fakepd_out(x, "float", 1, &a);
+}
+
+void outlet_list(t_outlet *x, t_symbol *s, int argc, t_atom *argv)
+{
+	m5_fakepd_out(x, "list", argc, argv);
+}
+
+void outlet_anything(t_outlet *x, t_symbol *s, int argc, t_atom *argv)
+{
+	m5_fakepd_out(x, s->s_name, argc, argv);
+}
+
+const char *m5_fakepd_lastout(const char *prefix)
+{
+	int i, n = (m5_fakepd_nlog < M5_FAKEPD_NLOG ?
+		m5_fakepd_nlog : M5_FAKEPD_NLOG);
+	for (i = 1; i <= n; i++)
+	{
+		const char *line =
+			m5_fakepd_log[(m5_fakepd_nlog - i) % M5_FAKEPD_NLOG];
+		if (!strncmp(line, prefix, strlen(prefix)))
+			return line;
+	}
+	return NULL;
+}
+
+void m5_fakepd_clearlog(void)
+{
+	m5_fakepd_nlog = 0;
+}
+
+	/* ------------------------------- binding ------------------------------ */
+
+typedef struct _fakebinding
+{
+	t_symbol *b_sym;
+	t_pd *b_pd;
+	struct _fakebinding *b_next;
+} t_fakebinding;
+
+static t_fakebinding *m5_fakepd_bindings = NULL;
+
+void pd_bind(t_pd *x, t_symbol *s)
+{
+	t_fakebinding *b = (t_fakebinding *)calloc(1, sizeof(*b));
+	b->b_sym = s;
+	b->b_pd = x;
+	b->b_next = m5_fakepd_bindings;
+	m5_fakepd_bindings = b;
+}
+
+void pd_unbind(t_pd *x, t_symbol *s)
+{
+	t_fakebinding **b;
+	for (b = &m5_fakepd_bindings; *b; b = &(*b)->b_next)
+		if ((*b)->b_pd == x && (*b)->b_sym == s)
+		{
+			t_fakebinding *gone = *b;
+			*b = gone->b_next;
+			free(gone);
+			return;
+		}
+}
+
+t_pd *pd_findbyclass(t_symbol *s, const t_class *c)
+{
+	t_fakebinding *b;
+	for (b = m5_fakepd_bindings; b; b = b->b_next)
+		if (b->b_sym == s && *b->b_pd == c)
+			return b->b_pd;
+	return NULL;
+}
+
+	/* -------------------------------- clocks ------------------------------ */
+
+#define MAXCLOCKS 256
+
+struct _clock
+{
+	void *c_owner;
+	t_method c_fn;
+	double c_time;             /* frames, < 0 when unset */
+};
+
+static t_clock *m5_fakepd_clocklist[MAXCLOCKS];
+
+t_clock *clock_new(void *owner, t_method fn)
+{
+	t_clock *c = (t_clock *)calloc(1, sizeof(*c));
+	int i;
+	c->c_owner = owner;
+	c->c_fn = fn;
+	c->c_time = -1;
+	for (i = 0; i < MAXCLOCKS; i++)
+		if (!m5_fakepd_clocklist[i])
+		{
+			m5_fakepd_clocklist[i] = c;
+			break;
+		}
+	return c;
+}
+
+void clock_delay(t_clock *x, double delaytime)
+{
+	x->c_time = m5_fakepd_time + delaytime * M5_FAKEPD_SR / 1000.;
+}
+
+void clock_unset(t_clock *x)
+{
+	x->c_time = -1;
+}
+
+void clock_free(t_clock *x)
+{
+	int i;
+	for (i = 0; i < MAXCLOCKS; i++)
+		if (m5_fakepd_clocklist[i] == x)
+			m5_fakepd_clocklist[i] = NULL;
+	free(x);
+}
+
+void m5_fakepd_clocks(void)
+{
+	int i, fired;
+	do
+	{
+		fired = 0;
+		for (i = 0; i < MAXCLOCKS; i++)
+		{
+			t_clock *c = m5_fakepd_clocklist[i];
+			if (c && c->c_time >= 0 && c->c_time <= m5_fakepd_time)
+			{
+				c->c_time = -1;
+				((void (*)(void *))c->c_fn)(c->c_owner);
+				fired = 1;
+			}
+		}
+	} while (fired);
+}
+
+	/* --------------------------------- DSP -------------------------------- */
+
+#define MAXDSP 64
+#define MAXDSPARGS 8
+
+static t_perfroutine m5_fakepd_perform[MAXDSP];
+static t_int m5_fakepd_args[MAXDSP][MAXDSPARGS + 1];
+static int m5_fakepd_ndsp = 0;
+
+void dsp_add(t_perfroutine f, int n, ...)
+{
+	va_list ap;
+	int i;
+	if (m5_fakepd_ndsp == MAXDSP || n > MAXDSPARGS)
+		return;
+	m5_fakepd_perform[m5_fakepd_ndsp] = f;
+	va_start(ap, n);
+	for (i = 0; i < n; i++)
+		m5_fakepd_args[m5_fakepd_ndsp][i + 1] = va_arg(ap, t_int);
+	va_end(ap);
+	m5_fakepd_ndsp++;
+}
+
+void m5_fakepd_dsp(void *x, t_signal **sp)
+{
+	t_class *c = *(t_pd *)x;
+	t_symbol *dsp = gensym("dsp");
+	int i;
+	m5_fakepd_ndsp = 0;
+	for (i = 0; i < c->c_nmethods; i++)
+		if (c->c_methodname[i] == dsp)
+			((void (*)(void *, t_signal **))c->c_method[i])(x, sp);
+}
+
+void m5_fakepd_tick(void)
+{
+	int i;
+	for (i = 0; i < m5_fakepd_ndsp; i++)
+		(*m5_fakepd_perform[i])(m5_fakepd_args[i]);
+}
+
+t_signal *m5_fakepd_signal(int n, int overlap)
+{
+	t_signal *s = (t_signal *)calloc(1, sizeof(*s));
+	s->s_n = n;
+	s->s_nchans = 1;
+	s->s_overlap = overlap;
+	s->s_sr = (t_float)M5_FAKEPD_SR * overlap;
+	s->s_vec = (t_sample *)calloc(n, sizeof(t_sample));
+	return s;
+}
+
+void m5_fakepd_signal_free(t_signal *s)
+{
+	free(s->s_vec);
+	free(s);
+}
+
+	/* a multichannel outlet gets a signal of its own */
+void signal_setmultiout(t_signal **sig, int nchans)
+{
+	t_signal *s = *sig;
+	if (!s)
+		*sig = s = m5_fakepd_signal(64, 1);
+	if (s->s_nchans != nchans)
+	{
+		free(s->s_vec);
+		s->s_nchans = nchans;
+		s->s_vec = (t_sample *)calloc((size_t)s->s_n * nchans,
+			sizeof(t_sample));
+	}
+}
+
+t_float sys_getsr(void)
+{
+	return M5_FAKEPD_SR;
+}
+
+void canvas_update_dsp(void)
+{
+}
+
+	/* ------------------------------- printing ----------------------------- */
+
+void post(const char *fmt, ...)
+{
+	va_list ap;
+	if (m5_fakepd_quiet)
+		return;
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fputc('\n', stderr);
+}
+
+void pd_error(const void *object, const char *fmt, ...)
+{
+	va_list ap;
+	fputs("error: ", stderr);
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fputc('\n', stderr);
+}
+
+	/* -------------------------------- files ------------------------------- */
+
+t_glist *canvas_getcurrent(void)
+{
+	return NULL;
+}
+
+t_symbol *canvas_getdir(const t_glist *x)
+{
+	return gensym(m5_fakepd_dir);
+}
+
+void canvas_makefilename(const t_glist *c, const char *file, char *result,
+	int resultsize)
+{
+	if (sys_isabsolutepath(file))
+		snprintf(result, resultsize, "%s", file);
+	else snprintf(result, resultsize, "%s/%s", m5_fakepd_dir, file);
+}
+
+int sys_isabsolutepath(const char *dir)
+{
+	return (dir[0] == '/');
+}
+
+int canvas_path_iterate(const t_canvas *x, t_canvas_path_iterator fun,
+	void *user_data)
+{
+	return ((*fun)(m5_fakepd_dir, user_data) ? 1 : 0);
+}
+
+int open_via_path(const char *dir, const char *name, const char *ext,
+	char *dirresult, char **nameresult, unsigned int size, int bin)
+{
+	char *slash;
+	int fd;
+	if (sys_isabsolutepath(name))
+		snprintf(dirresult, size, "%s%s", name, ext);
+	else snprintf(dirresult, size, "%s/%s%s", dir, name, ext);
+	if ((fd = open(dirresult, O_RDONLY)) < 0)
+		return -1;
+	slash = strrchr(dirresult, '/');
+	*slash = 0;
+	*nameresult = slash + 1;
+	return fd;
+}
+
+int canvas_open(const t_canvas *x, const char *name, const char *ext,
+	char *dirresult, char **nameresult, unsigned int size, int bin)
+{
+	return open_via_path(m5_fakepd_dir, name, ext, dirresult, nameresult,
+		size, bin);
+}
+
+int sys_open(const char *path, int oflag, ...)
+{
+	va_list ap;
+	int mode = 0;
+	if (oflag & O_CREAT)
+	{
+		va_start(ap, oflag);
+		mode = va_arg(ap, int);
+		va_end(ap);
+	}
+	return open(path, oflag, mode);
+}
+
+int sys_close(int fd)
+{
+	return close(fd);
+}
+
+FILE *sys_fopen(const char *filename, const char *mode)
+{
+	return fopen(filename, mode);
+}
+
+int sys_fclose(FILE *stream)
+{
+	return fclose(stream);
+}
+
+t_namelist *namelist_append(t_namelist *listwas, const char *s, int allowdup)
+{
+	t_namelist *nl = (t_namelist *)calloc(1, sizeof(*nl)), *last;
+	nl->nl_string = strdup(s);
+	if (!listwas)
+		return nl;
+	for (last = listwas; last->nl_next; last = last->nl_next)
+		;
+	last->nl_next = nl;
+	return listwas;
+}
+
+void namelist_free(t_namelist *listwas)
+{
+	while (listwas)
+	{
+		t_namelist *next = listwas->nl_next;
+		free(listwas->nl_string);
+		free(listwas);
+		listwas = next;
+	}
+}
+
+double sys_getrealtime(void)
+{
+	static struct timeval then;
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	if (!then.tv_sec)
+		then = now;
+	return (now.tv_sec - then.tv_sec) + 1e-6 * (now.tv_usec - then.tv_usec);
+}
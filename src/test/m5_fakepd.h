@@ -0,0 +1,52 @@
+/* Copyright (c) 2025 Michael Spears.
+* For information on usage and redistribution, and for a DISCLAIMER OF ALL
+* WARRANTIES, see the file, "LICENSE.txt," in this distribution.  */
+
+#pragma once
+
+#include "m_pd.h"
+
+// m5_fakepd: just enough of Pd, single-threaded, to run the library's
+// objects from a test program. Objects are made and sent messages by name,
+// their perform routines run when the program says so, and logical time is
+// whatever the program sets m5_fakepd_time to (in frames, M5_FAKEPD_SR of
+// them a second). Clocks fire from m5_fakepd_clocks() once that time has
+// reached them. Messages sent to outlets are kept, the newest
+// M5_FAKEPD_NLOG of them, as "<outlet> <selector> <args...>".
+//
+// Files are looked up in m5_fakepd_dir, which also stands in for the
+// directory of the patch.
+
+#define M5_FAKEPD_SR 48000
+#define M5_FAKEPD_UNITS 100.     /* logical time units per frame */
+#define M5_FAKEPD_NLOG 64
+
+extern double m5_fakepd_time;
+extern char m5_fakepd_dir[MAXPDSTRING];
+extern int m5_fakepd_quiet;      /* don't print posts and outlet messages */
+
+// make an object of a class set up earlier, with arguments as in a box
+void *m5_fakepd_new(const char *name, const char *args);
+void m5_fakepd_free(void *x);
+
+// send a message as typed in a message box, e.g. "open -bytes 4 a.wav"
+void m5_fakepd_send(void *x, const char *msg);
+
+// a signal of n frames per block in a subpatch overlapping that much
+t_signal *m5_fakepd_signal(int n, int overlap);
+void m5_fakepd_signal_free(t_signal *s);
+
+// call the object's "dsp" method with sp, dropping any earlier DSP chain
+void m5_fakepd_dsp(void *x, t_signal **sp);
+
+// run the DSP chain once
+void m5_fakepd_tick(void);
+
+// fire the clocks that are due
+void m5_fakepd_clocks(void);
+
+// the newest outlet message starting with prefix, or NULL
+const char *m5_fakepd_lastout(const char *prefix);
+
+// forget the outlet messages so far
+void m5_fakepd_clearlog(void);
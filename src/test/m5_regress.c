@@ -0,0 +1,497 @@
+/* Copyright (c) 2025 Michael Spears.
+* For information on usage and redistribution, and for a DISCLAIMER OF ALL
+* WARRANTIES, see the file, "LICENSE.txt," in this distribution.  */
+
+	/* built in, for the objects' fifos and states */
+#include "../m5_soundfile.c"
+#include "m5_fakepd.h"
+#include <stdlib.h>
+#include <unistd.h>
+
+/*
+
+	sample-by-sample regression test of m5_readsf~ and m5_writesf~, run by
+	"make check". At every block size from 1 to 8192 frames, overlapping 1,
+	2 and 4 times, readsf~ plays a ramp and writesf~ records one, started
+	in each of the ways listed in m5_regress_reads[] and m5_regress_writes[],
+	and every sample is compared with what the timeline says it should be.
+	So is the start each object reports: readsf~'s "latency" must match
+	where sound actually began, and be 0 for a start sent a block ahead;
+	writesf~'s start time must be the file's first frame. Time is virtual
+	(built with -DM5_VIRTUAL_CLOCK), frames count from an m5_ftc_anchor
+	marked as each case begins, and the test waits for the objects' file
+	threads before each block, so a run comes out the same on any machine.
+
+*/
+
+#define RAMPFRAMES 20000        /* the ramp loops after this */
+#define RUNFRAMES 60000         /* timeline frames each case covers */
+#define STOPFRAME 50001         /* where writesf~ stops */
+#define LATEFRAME 16384         /* when a late start is sent, a multiple of
+                                   every hop and of Pd's 64-frame tick */
+#define SETTLEWAIT 10.          /* seconds a file thread may keep us waiting */
+#define MAXREPORTS 3            /* mismatches printed per case */
+#define ANCHOR "m5_regress"     /* the m5_ftc_anchor every case runs on */
+
+	/* how readsf~ is started: "start" with the frame r_ahead + r_blocks
+	blocks after r_sendat, sent at r_sendat, or a plain "start" if
+	r_now. A start sent at least a block ahead must play every frame;
+	one that isn't may begin late, but only with the frames due then */
+typedef struct _m5RegressRead
+{
+	const char *r_name;
+	long r_sendat;
+	long r_ahead;
+	int r_blocks;
+	int r_now;
+	long r_loopstart;           /* with r_looplength, a loop; 0 for none */
+	long r_looplength;
+} t_m5RegressRead;
+
+static const t_m5RegressRead m5_regress_reads[] =
+{
+	{"a block ahead", 0, 777, 1, 0, 0, 0},
+	{"a loop", 0, 777, 1, 0, 3000, 7000},
+	{"a loop past the end", 0, 777, 1, 0, 15000, 9000},
+	{"in the first block", 0, 777, 0, 0, 0, 0},
+	{"in the past", LATEFRAME, -5000, 0, 0, 0, 0},
+	{"now", LATEFRAME, 0, 0, 1, 0, 0},
+};
+
+	/* how writesf~ is started, the same way, or with a threshold */
+typedef struct _m5RegressWrite
+{
+	const char *w_name;
+	long w_sendat;
+	long w_ahead;
+	int w_blocks;
+	long w_threshold;           /* "start <w_threshold>" if non-zero */
+} t_m5RegressWrite;
+
+static const t_m5RegressWrite m5_regress_writes[] =
+{
+	{"a block ahead", 0, 777, 1, 0},
+	{"in the first block", 0, 777, 0, 0},
+	{"in the past", LATEFRAME, -5000, 0, 0},
+	{"at a threshold", 0, 0, 0, 30001},
+};
+
+#define NREADS (int)(sizeof(m5_regress_reads) / sizeof(*m5_regress_reads))
+#define NWRITES (int)(sizeof(m5_regress_writes) / sizeof(*m5_regress_writes))
+
+static char m5_regress_dir[] = "/tmp/m5_regress.XXXXXX";
+
+	/* the clock the objects read, see m5_timeanchor.h */
+double m5_clock_logicaltime(void)
+{
+	return m5_fakepd_time * M5_FAKEPD_UNITS;
+}
+
+double m5_clock_framessince(double logicaltime)
+{
+	return m5_fakepd_time - logicaltime / M5_FAKEPD_UNITS;
+}
+
+static void m5_regress_put32(FILE *fp, uint32_t v)
+{
+	unsigned char b[4] = {v & 0xff, (v >> 8) & 0xff, (v >> 16) & 0xff, v >> 24};
+	fwrite(b, 1, 4, fp);
+}
+
+static void m5_regress_put16(FILE *fp, uint16_t v)
+{
+	unsigned char b[2] = {v & 0xff, v >> 8};
+	fwrite(b, 1, 2, fp);
+}
+
+	/** a 32-bit float stereo wave file whose frame f is f, f + 0.5 */
+static int m5_regress_ramp(const char *path)
+{
+	FILE *fp = fopen(path, "wb");
+	uint32_t datasize = RAMPFRAMES * 8;
+	int f;
+	if (!fp)
+		return 0;
+	fwrite("RIFF", 1, 4, fp);
+	m5_regress_put32(fp, 36 + datasize);
+	fwrite("WAVEfmt ", 1, 8, fp);
+	m5_regress_put32(fp, 16);
+	m5_regress_put16(fp, 3);
+	m5_regress_put16(fp, 2);
+	m5_regress_put32(fp, M5_FAKEPD_SR);
+	m5_regress_put32(fp, M5_FAKEPD_SR * 8);
+	m5_regress_put16(fp, 8);
+	m5_regress_put16(fp, 32);
+	fwrite("data", 1, 4, fp);
+	m5_regress_put32(fp, datasize);
+	for (f = 0; f < RAMPFRAMES; f++)
+	{
+		float v[2] = {(float)f, f + 0.5f};
+		fwrite(v, sizeof(float), 2, fp);
+	}
+	return (fclose(fp) == 0);
+}
+
+	/** the timeline frame the call'th call of a block of n overlapping
+		that much starts at, and Pd's logical time then: the 64-frame tick
+		it falls in */
+static size_t m5_regress_settime(double t0, int call, int hop)
+{
+	size_t at = (size_t)call * hop;
+	m5_fakepd_time = t0 + (at / 64) * 64;
+	return at;
+}
+
+typedef int (*t_m5RegressWaiting)(t_readsf *x, size_t arg);
+
+	/** wait for the file thread while waiting(x, arg) holds, looking with
+		the mutex locked, and if "run" let Pd run on meanwhile. Returns 1 if
+		it took longer than SETTLEWAIT */
+static int m5_regress_settle(t_readsf *x, t_m5RegressWaiting waiting,
+	size_t arg, int run)
+{
+	double since = sys_getrealtime();
+	while (1)
+	{
+		int stillwaiting;
+		pthread_mutex_lock(x->x_mutex);
+		stillwaiting = (*waiting)(x, arg);
+		pthread_mutex_unlock(x->x_mutex);
+		if (!stillwaiting)
+			return 0;
+		if (sys_getrealtime() - since > SETTLEWAIT)
+		{
+			fprintf(stderr, "  file thread stalled\n");
+			return 1;
+		}
+		if (run)
+		{
+			m5_fakepd_time += 64;
+			m5_fakepd_tick();
+			m5_fakepd_clocks();
+		}
+		usleep(100);
+	}
+}
+
+	/** until an "open" has found the file's length */
+static int m5_regress_opening(t_readsf *x, size_t dummy)
+{
+	return (x->x_state == STATE_STARTUP && !x->x_fileerror);
+}
+
+	/** until the block starting at frame "next" is in the fifo */
+static int m5_regress_reading(t_readsf *x, size_t next)
+{
+	int bpf = x->x_sf.sf_bytesperframe;
+	ssize_t need;
+	if (x->x_state != STATE_STREAM || x->x_eof || x->x_fileerror)
+		return 0;
+	if (x->x_m5Refilling && x->x_fifohead == x->x_fifotail)
+		return 1;
+	need = ((ssize_t)next - (ssize_t)x->x_m5TailTime + x->x_vecsize) * bpf;
+	if (need > x->x_fifosize / 2)
+		need = x->x_fifosize / 2;
+	return (m5_readsf_fifoavailable(x) < need);
+}
+
+	/** what frame t of the timeline should play on channel c, for a case
+		started at frame "start" */
+static t_sample m5_regress_want(const t_m5RegressRead *r, long start, long t,
+	int c)
+{
+	long f;
+	if (t < start)
+		return 0;
+	f = t - start;
+	if (r->r_looplength)
+		f = r->r_loopstart + f % r->r_looplength;
+	else f %= RAMPFRAMES;
+	return (f < RAMPFRAMES ? f + 0.5f * c : 0);
+}
+
+	/** mark the anchor that frames count from, as a case begins */
+static void m5_regress_mark(void *anchor, void *x)
+{
+	m5_fakepd_send(anchor, "mark");
+	m5_fakepd_send(x, "time " ANCHOR);
+	m5_fakepd_clearlog();
+}
+
+	/** play the ramp as case r asks, blocks of n overlapping that much.
+		A start a block ahead must play from its frame on and report a
+		latency of 0; a later one must play silence until it begins, the
+		right frames after that, and report how late it began, which may
+		not be more than a block and a hop */
+static int m5_regress_read(void *anchor, const t_m5RegressRead *r, int n,
+	int overlap)
+{
+	int hop = n / overlap, call, k, c, errors = 0;
+	t_signal *sig[2];
+	t_readsf *x = (t_readsf *)m5_fakepd_new("m5_readsf~", "2");
+	char msg[MAXPDSTRING];
+	long start = (r->r_now ? r->r_sendat :
+		r->r_sendat + r->r_ahead + (long)r->r_blocks * n),
+		due = (start > r->r_sendat ? start : r->r_sendat), first = -1;
+	int ahead = (!r->r_now && start >= r->r_sendat + n);
+	const char *report;
+	double t0, latency;
+	if (!x)
+		return 1;
+	for (c = 0; c < 2; c++)
+		sig[c] = m5_fakepd_signal(n, overlap);
+	m5_fakepd_dsp(x, sig);
+	m5_fakepd_send(x, "open ramp.wav");
+		/* perform picks up the length */
+	errors += m5_regress_settle(x, m5_regress_opening, 0, 1);
+	m5_fakepd_send(x, "stop never");
+	if (r->r_looplength)
+	{
+		snprintf(msg, MAXPDSTRING, "loopstart 1 0 %ld", r->r_loopstart);
+		m5_fakepd_send(x, msg);
+		snprintf(msg, MAXPDSTRING, "looplength 1 0 %ld", r->r_looplength);
+		m5_fakepd_send(x, msg);
+	}
+		/* a tick after the settling ones, or perform takes the first call
+		for a later one in the same tick */
+	m5_fakepd_time += 64;
+	t0 = m5_fakepd_time;
+	m5_regress_mark(anchor, x);
+	for (call = 0; (size_t)call * hop < RUNFRAMES; call++)
+	{
+		size_t at = m5_regress_settime(t0, call, hop);
+		if ((long)at == r->r_sendat)
+		{
+			if (r->r_now)
+				m5_fakepd_send(x, "start");
+			else
+			{
+				snprintf(msg, MAXPDSTRING, "start 1 0 %ld", start);
+				m5_fakepd_send(x, msg);
+			}
+		}
+		m5_fakepd_tick();
+		m5_fakepd_clocks();
+		for (k = 0; k < n; k++)
+		{
+			long t = (long)at + k;
+				/* channel 1 is never 0 once sound has begun */
+			if (!ahead && first < 0 && sig[1]->s_vec[k] != 0)
+				first = t;
+			for (c = 0; c < 2; c++)
+			{
+				t_sample got = sig[c]->s_vec[k], want =
+					(!ahead && (first < 0 || t < first) ? 0 :
+						m5_regress_want(r, start, t, c));
+				if (got != want && errors++ < MAXREPORTS)
+					fprintf(stderr, "  readsf~ %s: channel %d frame %ld: "
+						"%g, not %g\n", r->r_name, c, t, got, want);
+			}
+		}
+		errors += m5_regress_settle(x, m5_regress_reading,
+			(size_t)(call + 1) * hop, 0);
+	}
+	if (ahead)
+		first = due;
+	if (first < due || first - due > n + hop)
+	{
+		fprintf(stderr, "  readsf~ %s: began at frame %ld, due at %ld\n",
+			r->r_name, first, due);
+		errors++;
+	}
+	if (!(report = m5_fakepd_lastout("3 latency ")) ||
+		sscanf(report, "3 latency %lf", &latency) != 1 ||
+		latency != first - due)
+	{
+		fprintf(stderr, "  readsf~ %s: reported \"%s\", began %ld late\n",
+			r->r_name, (report ? report : "nothing"), first - due);
+		errors++;
+	}
+	m5_fakepd_free(x);
+	for (c = 0; c < 2; c++)
+		m5_fakepd_signal_free(sig[c]);
+	return errors;
+}
+
+	/** until the child has created the file "open" asked for */
+static int m5_regress_creating(t_writesf *x, size_t dummy)
+{
+	return (x->x_requestcode == REQUEST_OPEN);
+}
+
+	/** until the fifo is no more than half full */
+static int m5_regress_writing(t_writesf *x, size_t dummy)
+{
+	return (x->x_fifosize && (x->x_fifohead - x->x_fifotail +
+		x->x_fifosize) % x->x_fifosize > x->x_fifosize / 2);
+}
+
+	/** until the file has been finished and handed back */
+static int m5_regress_finishing(t_writesf *x, size_t dummy)
+{
+	return (x->x_state != STATE_IDLE || x->x_m5Takes ||
+		x->x_requestcode != REQUEST_NOTHING);
+}
+
+	/** the frames of a 32-bit float stereo wave file, or -1 */
+static long m5_regress_readwave(const char *path, float **data)
+{
+	FILE *fp = fopen(path, "rb");
+	unsigned char h[8];
+	long frames = -1;
+	if (!fp)
+		return -1;
+	if (fseek(fp, 12, SEEK_SET) == 0)
+		while (fread(h, 1, 8, fp) == 8)
+	{
+		long size = h[4] | (h[5] << 8) | (h[6] << 16) | ((long)h[7] << 24);
+		if (memcmp(h, "data", 4))
+		{
+			fseek(fp, size + (size & 1), SEEK_CUR);
+			continue;
+		}
+		*data = (float *)malloc(size ? size : 1);
+		frames = (long)fread(*data, 8, size / 8, fp);
+		break;
+	}
+	fclose(fp);
+	return frames;
+}
+
+	/** record a timeline whose frame f is f, -f, started as case w asks
+		and stopped at STOPFRAME, in blocks of n overlapping that much. The
+		start writesf~ reports must be where w asked for, or for a start
+		in the past, no earlier than that and no later than it was sent;
+		the file must hold the timeline from there on */
+static int m5_regress_write(void *anchor, const t_m5RegressWrite *w, int n,
+	int overlap)
+{
+	int hop = n / overlap, call, k, c, errors = 0;
+	t_signal *sig[2];
+	t_writesf *x = (t_writesf *)m5_fakepd_new("m5_writesf~", "2");
+	char path[MAXPDSTRING], msg[MAXPDSTRING + 32];
+	long start = (w->w_threshold ? w->w_threshold :
+		w->w_sendat + w->w_ahead + (long)w->w_blocks * n), began = -1;
+	float *data = NULL, sign, epoch, frames;
+	const char *report;
+	long nframes, f;
+	double t0;
+	if (!x)
+		return 1;
+	for (c = 0; c < 2; c++)
+		sig[c] = m5_fakepd_signal(n, overlap);
+	m5_fakepd_dsp(x, sig);
+	snprintf(path, MAXPDSTRING, "%s/take.wav", m5_regress_dir);
+	snprintf(msg, sizeof(msg), "open -bytes 4 %s", path);
+	m5_fakepd_send(x, msg);
+		/* with nothing to write yet, nothing else waits for the child */
+	errors += m5_regress_settle(x, m5_regress_creating, 0, 0);
+	t0 = m5_fakepd_time;
+	m5_regress_mark(anchor, x);
+	for (call = 0; (size_t)call * hop < RUNFRAMES; call++)
+	{
+		size_t at = m5_regress_settime(t0, call, hop);
+		if ((long)at == w->w_sendat)
+		{
+			if (w->w_threshold)
+				snprintf(msg, MAXPDSTRING, "start %ld", w->w_threshold);
+			else snprintf(msg, MAXPDSTRING, "start 1 0 %ld", start);
+			m5_fakepd_send(x, msg);
+			snprintf(msg, MAXPDSTRING, "stop 1 0 %d", STOPFRAME);
+			m5_fakepd_send(x, msg);
+		}
+			/* the newest hop is the last one in the block */
+		for (k = 0; k < n; k++)
+		{
+			long t = (long)at + hop - n + k;
+			sig[0]->s_vec[k] = t;
+			sig[1]->s_vec[k] = -t;
+		}
+		m5_fakepd_tick();
+		m5_fakepd_clocks();
+		errors += m5_regress_settle(x, m5_regress_writing, 0, 0);
+	}
+	errors += m5_regress_settle(x, m5_regress_finishing, 0, 1);
+	if ((report = m5_fakepd_lastout("0 list ")) &&
+		sscanf(report, "0 list %f %f %f", &sign, &epoch, &frames) == 3)
+	{
+		t_m5FrameTimeCode ftc;
+		ftc.sign = sign;
+		ftc.epoch = epoch;
+		ftc.frames = frames;
+		began = m5_frames_from_time_code(&ftc);
+	}
+	if (start < w->w_sendat ? (began < start || began > w->w_sendat) :
+		began != start)
+	{
+		fprintf(stderr, "  writesf~ %s: reported a start at %ld, "
+			"asked for %ld\n", w->w_name, began, start);
+		errors++;
+	}
+	m5_fakepd_free(x);
+	for (c = 0; c < 2; c++)
+		m5_fakepd_signal_free(sig[c]);
+	if (began < 0)
+		began = start;
+	if ((nframes = m5_regress_readwave(path, &data)) != STOPFRAME - began)
+	{
+		fprintf(stderr, "  writesf~ %s: %ld frames, not %ld\n", w->w_name,
+			nframes, STOPFRAME - began);
+		errors++;
+	}
+	for (f = 0; f < nframes; f++)
+		for (c = 0; c < 2; c++)
+	{
+		float got = data[2 * f + c],
+			want = (c ? -1 : 1) * (float)(began + f);
+		if (got != want && errors++ < MAXREPORTS)
+			fprintf(stderr, "  writesf~ %s: channel %d frame %ld: %g, "
+				"not %g\n", w->w_name, c, began + f, got, want);
+	}
+	free(data);
+	remove(path);
+	return errors;
+}
+
+int main(void)
+{
+	int n, overlap, i, failed = 0, cases = 0;
+	char path[MAXPDSTRING];
+	void *anchor;
+	if (!mkdtemp(m5_regress_dir))
+	{
+		perror("m5_regress");
+		return 1;
+	}
+	snprintf(m5_fakepd_dir, MAXPDSTRING, "%s", m5_regress_dir);
+	snprintf(path, MAXPDSTRING, "%s/ramp.wav", m5_regress_dir);
+	if (!m5_regress_ramp(path))
+	{
+		perror(path);
+		return 1;
+	}
+	m5_fakepd_quiet = 1;
+	m5_soundfile_setup();
+	anchor = m5_fakepd_new("m5_ftc_anchor", ANCHOR);
+	for (n = 1; n <= 8192; n *= 2)
+		for (overlap = 1; overlap <= 4 && overlap <= n; overlap *= 2)
+	{
+		int rfailed = 0, wfailed = 0;
+		for (i = 0; i < NREADS; i++)
+			rfailed += (m5_regress_read(anchor, &m5_regress_reads[i], n,
+				overlap) != 0);
+		for (i = 0; i < NWRITES; i++)
+			wfailed += (m5_regress_write(anchor, &m5_regress_writes[i], n,
+				overlap) != 0);
+		printf("block %4d overlap %d: readsf~ %s, writesf~ %s\n", n, overlap,
+			(rfailed ? "FAILED" : "ok"), (wfailed ? "FAILED" : "ok"));
+		failed += rfailed + wfailed;
+		cases += NREADS + NWRITES;
+	}
+	m5_fakepd_free(anchor);
+	remove(path);
+	rmdir(m5_regress_dir);
+	if (failed)
+		printf("%d of the %d cases failed\n", failed, cases);
+	return (failed != 0);
+}
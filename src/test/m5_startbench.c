@@ -0,0 +1,192 @@
+/* Copyright (c) 2025 Michael Spears.
+* For information on usage and redistribution, and for a DISCLAIMER OF ALL
+* WARRANTIES, see the file, "LICENSE.txt," in this distribution.  */
+
+	/* built in, for the objects' states */
+#include "../m5_soundfile.c"
+#include "m5_fakepd.h"
+#include <stdlib.h>
+#include <unistd.h>
+
+/*
+
+	start-up benchmark of m5_readsf~, run by "make bench": how long an
+	"open" followed by "start" takes until the file's length is known
+	("ready") and until the first non-zero sample plays ("first sound"), in
+	wall-clock msec and DSP blocks. Blocks are paced in real time, as an
+	audio interface would call them, so the file thread competes with the
+	DSP clock the way it does in Pd. Each block size is tried with the file
+	kept open from earlier (warm) and with "open -cold", at several
+	"iodelay" settings standing in for slower storage.
+
+*/
+
+#define BENCHFRAMES 48000       /* a second of sound */
+#define REPEATS 5               /* opens averaged per case */
+#define GIVEUP 5.               /* seconds to wait for the first sound */
+
+static char m5_startbench_dir[] = "/tmp/m5_startbench.XXXXXX";
+
+	/* the clock the objects read, see m5_timeanchor.h */
+double m5_clock_logicaltime(void)
+{
+	return m5_fakepd_time * M5_FAKEPD_UNITS;
+}
+
+double m5_clock_framessince(double logicaltime)
+{
+	return m5_fakepd_time - logicaltime / M5_FAKEPD_UNITS;
+}
+
+static void m5_startbench_put32(FILE *fp, uint32_t v)
+{
+	unsigned char b[4] = {v & 0xff, (v >> 8) & 0xff, (v >> 16) & 0xff, v >> 24};
+	fwrite(b, 1, 4, fp);
+}
+
+static void m5_startbench_put16(FILE *fp, uint16_t v)
+{
+	unsigned char b[2] = {v & 0xff, v >> 8};
+	fwrite(b, 1, 2, fp);
+}
+
+	/** a 16-bit stereo wave file with no silence at its head */
+static int m5_startbench_file(const char *path)
+{
+	FILE *fp = fopen(path, "wb");
+	uint32_t datasize = BENCHFRAMES * 4;
+	int f;
+	if (!fp)
+		return 0;
+	fwrite("RIFF", 1, 4, fp);
+	m5_startbench_put32(fp, 36 + datasize);
+	fwrite("WAVEfmt ", 1, 8, fp);
+	m5_startbench_put32(fp, 16);
+	m5_startbench_put16(fp, 1);
+	m5_startbench_put16(fp, 2);
+	m5_startbench_put32(fp, M5_FAKEPD_SR);
+	m5_startbench_put32(fp, M5_FAKEPD_SR * 4);
+	m5_startbench_put16(fp, 4);
+	m5_startbench_put16(fp, 16);
+	fwrite("data", 1, 4, fp);
+	m5_startbench_put32(fp, datasize);
+	for (f = 0; f < BENCHFRAMES; f++)
+	{
+		m5_startbench_put16(fp, (uint16_t)(1000 + f % 1000));
+		m5_startbench_put16(fp, (uint16_t)(-1000 - f % 1000));
+	}
+	return (fclose(fp) == 0);
+}
+
+	/** open and start, then run blocks of n in real time until the first
+		non-zero sample. The msec and blocks until ready and until the
+		first sound go to readyms[]/readyblocks[] and soundms[]/
+		soundblocks[]; returns 0 if the sound never came */
+static int m5_startbench_once(t_readsf *x, t_signal **sig, int n,
+	const char *openmsg, double *readyms, int *readyblocks, double *soundms,
+	int *soundblocks)
+{
+	useconds_t blockus = (useconds_t)(1e6 * n / M5_FAKEPD_SR);
+	double since;
+	int blocks = 0, k, c;
+	*readyms = -1;
+	since = sys_getrealtime();
+	m5_fakepd_send(x, openmsg);
+	m5_fakepd_send(x, "stop end");
+	m5_fakepd_send(x, "start");
+	while (sys_getrealtime() - since < GIVEUP)
+	{
+		usleep(blockus);
+		m5_fakepd_time += n;
+		m5_fakepd_tick();
+		m5_fakepd_clocks();
+		blocks++;
+		if (*readyms < 0 && x->x_m5SoundFileFramesAvailableFromOnset > 0)
+		{
+			*readyms = (sys_getrealtime() - since) * 1000.;
+			*readyblocks = blocks;
+		}
+		for (c = 0; c < 2; c++)
+			for (k = 0; k < n; k++)
+				if (sig[c]->s_vec[k] != 0)
+		{
+			*soundms = (sys_getrealtime() - since) * 1000.;
+			*soundblocks = blocks;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+	/** time REPEATS opens at block size n and print their means */
+static int m5_startbench_case(int n, int cold, int iodelay)
+{
+	t_signal *sig[2];
+	t_readsf *x = (t_readsf *)m5_fakepd_new("m5_readsf~", "2");
+	char msg[MAXPDSTRING];
+	double readyms, soundms, readysum = 0, soundsum = 0;
+	int readyblocks = 0, soundblocks = 0, readyblocksum = 0,
+		soundblocksum = 0, r, c;
+	if (!x)
+		return 1;
+	for (c = 0; c < 2; c++)
+		sig[c] = m5_fakepd_signal(n, 1);
+	m5_fakepd_dsp(x, sig);
+	snprintf(msg, MAXPDSTRING, "iodelay %d", iodelay);
+	m5_fakepd_send(x, msg);
+	snprintf(msg, MAXPDSTRING, "open%s bench.wav", (cold ? " -cold" : ""));
+	for (r = 0; r < REPEATS; r++)
+	{
+		if (!m5_startbench_once(x, sig, n, msg, &readyms, &readyblocks,
+			&soundms, &soundblocks))
+		{
+			printf("block %4d %s iodelay %2d: no sound after %g sec\n", n,
+				(cold ? "cold" : "warm"), iodelay, GIVEUP);
+			break;
+		}
+		readysum += readyms;
+		readyblocksum += readyblocks;
+		soundsum += soundms;
+		soundblocksum += soundblocks;
+	}
+	if (r == REPEATS)
+		printf("block %4d %s iodelay %2d: ready %6.2f msec (%4.1f blocks), "
+			"first sound %6.2f msec (%4.1f blocks)\n", n,
+			(cold ? "cold" : "warm"), iodelay, readysum / REPEATS,
+			(double)readyblocksum / REPEATS, soundsum / REPEATS,
+			(double)soundblocksum / REPEATS);
+	m5_fakepd_free(x);
+	for (c = 0; c < 2; c++)
+		m5_fakepd_signal_free(sig[c]);
+	return (r != REPEATS);
+}
+
+int main(void)
+{
+	static const int blocksizes[] = {64, 1024}, iodelays[] = {0, 1, 5, 20};
+	int b, cold, d, failed = 0;
+	char path[MAXPDSTRING];
+	if (!mkdtemp(m5_startbench_dir))
+	{
+		perror("m5_startbench");
+		return 1;
+	}
+	snprintf(m5_fakepd_dir, MAXPDSTRING, "%s", m5_startbench_dir);
+	snprintf(path, MAXPDSTRING, "%s/bench.wav", m5_startbench_dir);
+	if (!m5_startbench_file(path))
+	{
+		perror(path);
+		return 1;
+	}
+	m5_fakepd_quiet = 1;
+	m5_soundfile_setup();
+	printf("open, then start, until ready and first sound (mean of %d)\n",
+		REPEATS);
+	for (b = 0; b < (int)(sizeof(blocksizes) / sizeof(*blocksizes)); b++)
+		for (cold = 0; cold < 2; cold++)
+			for (d = 0; d < (int)(sizeof(iodelays) / sizeof(*iodelays)); d++)
+				failed += m5_startbench_case(blocksizes[b], cold, iodelays[d]);
+	remove(path);
+	rmdir(m5_startbench_dir);
+	return (failed != 0);
+}